@@ -12,7 +12,6 @@
 #include "verify.h"
 #include "laplace_spherical_cpu.h"
 using namespace exafmm;
-vec3 KernelBase::Xperiodic = 0;
 real_t KernelBase::eps2 = 0.0;
 
 template<typename Kernel>
@@ -8,7 +8,6 @@
 #include "up_down_pass.h"
 #include "verify.h"
 using namespace exafmm;
-vec3 KernelBase::Xperiodic = 0;
 real_t KernelBase::eps2 = 0.0;
 complex_t KernelBase::wavek = complex_t(10.,1.) / real_t(2 * M_PI);
 
@@ -24,6 +23,7 @@ void fmm(Args args) {
   BoundBox<Kernel> boundBox(args.nspawn);
   Bounds bounds;
   BuildTree<Kernel> buildTree(args.ncrit, args.nspawn);
+  CostModel<Kernel> costModel(args.theta);
   Cells cells, jcells;
   Dataset<Kernel> data;
   Kernel kernel;
@@ -38,6 +38,12 @@ void fmm(Args args) {
   logger::path = args.path;
   logger::printTitle("FMM Parameters");
   args.print(logger::stringLength);
+  if (args.costModel) {
+    costModel.calibrate();
+    costModel.printCostModel();
+    buildTree.setCostModel(&costModel);
+    traversal.setCostModel(&costModel);
+  }
   bodies = data.initBodies(args.numBodies, args.distribution, 0);
   buffer.reserve(bodies.size());
   if (args.IneJ) {
@@ -11,7 +11,6 @@
 #include "up_down_pass.h"
 #include "verify.h"
 using namespace exafmm;
-vec3 KernelBase::Xperiodic = 0;
 real_t KernelBase::eps2 = 0.0;
 complex_t KernelBase::wavek = complex_t(10.,1.) / real_t(2 * M_PI);
 
@@ -29,10 +28,12 @@ void fmm(Args args) {
   Bounds localBounds, globalBounds;
   BuildTree<Kernel> localTree(args.ncrit, args.nspawn);
   BuildTree<Kernel> globalTree(1, args.nspawn);
+  CostModel<Kernel> costModel(args.theta);
   Cells cells, jcells, gcells;
   Dataset<Kernel> data;
   Partition<Kernel> partition(baseMPI.mpirank, baseMPI.mpisize);
   TreeMPI<Kernel> treeMPI(baseMPI.mpirank, baseMPI.mpisize, args.images);
+  NodeMPI nodeMPI(args.nodeSize);
   Traversal<Kernel> traversal(args.nspawn, args.images, args.path);
   UpDownPass<Kernel> upDownPass(args.theta, args.useRmax, args.useRopt);
   Verify<Kernel> verify(args.path);
@@ -46,6 +47,24 @@ void fmm(Args args) {
   logger::path = args.path;
   logger::printTitle("FMM Parameters");
   args.print(logger::stringLength);
+  if (args.rma && (!args.dual || args.graft || args.costModel)) {
+    fprintf(stderr,"--rma needs --dual, and neither --graft nor --costModel\n");
+    abort();
+  }
+  if (nodeMPI.enabled()) {
+    partition.setNodeMPI(&nodeMPI);
+    treeMPI.setNodeMPI(&nodeMPI);
+  }
+  if (args.costModel) {
+    costModel.calibrate();
+    double times[CostModel<Kernel>::numOperators];
+    costModel.getTimes(times);
+    MPI_Allreduce(MPI_IN_PLACE, times, CostModel<Kernel>::numOperators, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    costModel.setTimes(times);
+    costModel.printCostModel();
+    localTree.setCostModel(&costModel);
+    traversal.setCostModel(&costModel);
+  }
   bodies = data.initBodies(args.numBodies, args.distribution, baseMPI.mpirank, baseMPI.mpisize);
   buffer.reserve(bodies.size());
   if (args.IneJ) {
@@ -82,10 +101,12 @@ void fmm(Args args) {
         localBounds = boundBox.getBounds(jbodies, localBounds);
       }
       globalBounds = baseMPI.allreduceBounds(localBounds);
-      partition.bisection(bodies, globalBounds);
+      if (args.curve) partition.curve(bodies, globalBounds);
+      else partition.bisection(bodies, globalBounds);
       bodies = treeMPI.commBodies(bodies);
       if (args.IneJ) {
-        partition.bisection(jbodies, globalBounds);
+        if (args.curve) partition.curve(jbodies, globalBounds);
+        else partition.bisection(jbodies, globalBounds);
         jbodies = treeMPI.commBodies(jbodies);
       }
       localBounds = boundBox.getBounds(bodies);
@@ -101,44 +122,70 @@ void fmm(Args args) {
 
 #if 1 // Set to 0 for debugging by shifting bodies and reconstructing tree
       treeMPI.allgatherBounds(localBounds);
-      if (args.IneJ) {
-        treeMPI.setLET(jcells, cycle);
+      if (args.rma) {
+        treeMPI.exposeLET(args.IneJ ? jcells : cells);
       } else {
-        treeMPI.setLET(cells, cycle);
+        if (args.IneJ) {
+          treeMPI.setLET(jcells, cycle);
+        } else {
+          treeMPI.setLET(cells, cycle);
+        }
+        if (!args.graft) {
+          treeMPI.startLET();
+        }
       }
+      traversal.initListCount(cells);
+      traversal.initWeight(cells);
+      if (args.graft) {
 #pragma omp parallel sections
-      {
-#pragma omp section
         {
-          treeMPI.commBodies();
-          treeMPI.commCells();
-        }
 #pragma omp section
-        {
-          traversal.initListCount(cells);
-          traversal.initWeight(cells);
-          if (args.IneJ) {
-            traversal.traverse(cells, jcells, cycle, args.dual, false);
-          } else {
-            traversal.traverse(cells, cells, cycle, args.dual, args.mutual);
-            jbodies = bodies;
+          {
+            treeMPI.commBodies();
+            treeMPI.commCells();
           }
+#pragma omp section
+          {
+            if (args.IneJ) {
+              traversal.traverse(cells, jcells, cycle, args.dual, false);
+            } else {
+              traversal.traverse(cells, cells, cycle, args.dual, args.mutual);
+            }
+          }
+        }
+      } else {
+        if (!args.rma) traversal.setProgress(&treeMPI);
+        if (args.IneJ) {
+          traversal.traverse(cells, jcells, cycle, args.dual, false);
+        } else {
+          traversal.traverse(cells, cells, cycle, args.dual, args.mutual);
         }
       }
+      if (!args.IneJ) jbodies = bodies;
       if (baseMPI.mpisize > 1) {
-        if (args.graft) {
+        if (args.rma) {
+          for (int irank=0; irank<baseMPI.mpisize; irank++) {
+            if (irank == baseMPI.mpirank) continue;
+            treeMPI.pullLET(cells, jcells, irank, cycle, args.nspawn);
+            traversal.traverse(cells, jcells, cycle, args.dual, false);
+          }
+        } else if (args.graft) {
           treeMPI.linkLET();
           gbodies = treeMPI.root2body();
           jcells = globalTree.buildTree(gbodies, buffer, globalBounds);
           treeMPI.attachRoot(jcells);
           traversal.traverse(cells, jcells, cycle, args.dual, false);
         } else {
-          for (int irank=0; irank<baseMPI.mpisize; irank++) {
-            treeMPI.getLET(jcells, (baseMPI.mpirank+irank)%baseMPI.mpisize);
+          while (treeMPI.waitLET(jcells) >= 0) {
             traversal.traverse(cells, jcells, cycle, args.dual, false);
           }
         }
       }
+      traversal.setProgress(NULL);
+      if (args.rma) {
+        treeMPI.printPullData();
+        treeMPI.closeLET();
+      }
 #else
       if (!args.IneJ) jbodies = bodies;
       for (int irank=0; irank<baseMPI.mpisize; irank++) {
@@ -4,7 +4,6 @@
 #include <vector>
 #include "verify.h"
 using namespace exafmm;
-vec3 KernelBase::Xperiodic = 0;
 real_t KernelBase::eps2 = 0.0;
 complex_t KernelBase::wavek = complex_t(10.,1.) / real_t(2 * M_PI);
 
@@ -32,6 +31,7 @@ void fmm(Args args) {
   logger::verbose = true;
 
   const int NTERM = Kernel::NTERM;
+  const vec3 Xperiodic = 0;
   Cells cells(4);
   Verify<Kernel> verify;
   jbodies[0].X = 2;
@@ -61,7 +61,7 @@ void fmm(Args args) {
   if (args.mass) {
     for (int i=1; i<NTERM; i++) CJ->M[i] /= CJ->M[0];
   }
-  Kernel::M2L(CI, CJ, false);
+  Kernel::M2L(CI, CJ, Xperiodic, false);
 
   C_iter Ci = cells.begin()+3;
   Ci->X = 1;
@@ -79,7 +79,7 @@ void fmm(Args args) {
   if (args.mass) {
     for (int i=1; i<NTERM; i++) Cj->M[i] /= Cj->M[0];
   }
-  Kernel::M2L(Ci, Cj, false);
+  Kernel::M2L(Ci, Cj, Xperiodic, false);
 #endif
 
   bodies[0].X = 2;
@@ -97,7 +97,7 @@ void fmm(Args args) {
   Cj->NBODY = jbodies.size();
   Ci->NBODY = bodies2.size();
   Ci->BODY = bodies2.begin();
-  Kernel::P2P(Ci, Cj, false);
+  Kernel::P2P(Ci, Cj, Xperiodic, false);
   for (B_iter B=bodies2.begin(); B!=bodies2.end(); B++) {
     B->TRG /= B->SRC;
   }
@@ -0,0 +1,93 @@
+#include "base_mpi.h"
+#include "args.h"
+#include "bound_box.h"
+#include "build_tree_radix.h"
+#include "dataset.h"
+#include "keys.h"
+#include "logger.h"
+#include "partition.h"
+#include "traversal.h"
+#include "tree_mpi.h"
+#include "up_down_pass.h"
+using namespace exafmm;
+#include "laplace_cartesian_cpu.h"
+real_t KernelBase::eps2 = 0.0;
+complex_t KernelBase::wavek = complex_t(10.,1.) / real_t(2 * M_PI);
+
+typedef LaplaceCartesianCPU<4,0> Kernel;
+typedef Kernel::Bodies Bodies;                                  //!< Vector of bodies
+typedef Kernel::Cells Cells;                                    //!< Vector of cells
+
+//! Partition, build, exchange LET and traverse with keys along a given curve
+template<typename Key>
+void run(Args args, BaseMPI & baseMPI, Bodies bodies, const char * name,
+	 double & timeP2P, double & bytesLET) {
+  const vec3 cycle = 2 * M_PI;
+  Bodies buffer;
+  BoundBox<Kernel> boundBox(args.nspawn);
+  Bounds localBounds, globalBounds;
+  BuildTreeRadix<Kernel,Key> localTree(args.ncrit, args.nspawn);
+  Cells cells, jcells;
+  Partition<Kernel,Key> partition(baseMPI.mpirank, baseMPI.mpisize);
+  TreeMPI<Kernel> treeMPI(baseMPI.mpirank, baseMPI.mpisize, args.images);
+  Traversal<Kernel,Key> traversal(args.nspawn, args.images, args.path);
+  UpDownPass<Kernel> upDownPass(args.theta, args.useRmax, args.useRopt);
+
+  logger::printTitle(name);
+  localBounds = boundBox.getBounds(bodies);
+  globalBounds = baseMPI.allreduceBounds(localBounds);
+  partition.curve(bodies, globalBounds);
+  bodies = treeMPI.commBodies(bodies);
+  localBounds = boundBox.getBounds(bodies);
+  cells = localTree.buildTree(bodies, buffer, localBounds);
+  localBounds = boundBox.getBounds(cells, localBounds);
+  upDownPass.upwardPass(cells);
+  treeMPI.allgatherBounds(localBounds);
+  treeMPI.setLET(cells, cycle);
+  treeMPI.commBodies();
+  treeMPI.commCells();
+  logger::resetTimer("Traverse P2P");
+  traversal.traverse(cells, cells, cycle, false, false);
+  double localP2P = logger::timer["Traverse P2P"];
+  for (int irank=0; irank<baseMPI.mpisize; irank++) {
+    if (irank == baseMPI.mpirank) continue;
+    treeMPI.getLET(jcells, irank);
+    traversal.traverse(cells, jcells, cycle, true, false);
+  }
+  upDownPass.downwardPass(cells);
+  MPI_Allreduce(&localP2P, &timeP2P, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  bytesLET = treeMPI.printLETData();
+  localTree.printTreeData(cells);
+}
+
+int main(int argc, char ** argv) {
+  Args args(argc, argv);
+  BaseMPI baseMPI;
+  Dataset<Kernel> data;
+  num_threads(args.threads);
+
+  Kernel::init();
+  args.verbose &= baseMPI.mpirank == 0;
+  logger::verbose = args.verbose;
+  logger::path = args.path;
+  logger::printTitle("Key Parameters");
+  args.print(logger::stringLength);
+  Bodies bodies = data.initBodies(args.numBodies, args.distribution, baseMPI.mpirank, baseMPI.mpisize);
+  data.initTarget(bodies);
+  double timeMorton, bytesMorton, timeHilbert, bytesHilbert;
+  run<MortonKey>(args, baseMPI, bodies, "Morton", timeMorton, bytesMorton);
+  run<HilbertKey>(args, baseMPI, bodies, "Hilbert", timeHilbert, bytesHilbert);
+  if (args.verbose) {
+    logger::printTitle("Morton vs. Hilbert");
+    std::cout << std::setw(logger::stringLength) << std::left
+	      << "P2P time (Morton)" << " : " << std::setprecision(7) << std::fixed << timeMorton << " s" << std::endl
+	      << std::setw(logger::stringLength) << std::left
+	      << "P2P time (Hilbert)" << " : " << std::setprecision(7) << std::fixed << timeHilbert << " s" << std::endl
+	      << std::setw(logger::stringLength) << std::left
+	      << "LET bytes (Morton)" << " : " << std::setprecision(0) << std::fixed << bytesMorton << std::endl
+	      << std::setw(logger::stringLength) << std::left
+	      << "LET bytes (Hilbert)" << " : " << std::setprecision(0) << std::fixed << bytesHilbert << std::endl;
+  }
+  Kernel::finalize();
+  return 0;
+}
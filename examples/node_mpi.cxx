@@ -0,0 +1,150 @@
+#include "base_mpi.h"
+#include "args.h"
+#include "bound_box.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "logger.h"
+#include "node_mpi.h"
+#include "partition.h"
+#include "tree_mpi.h"
+#include "up_down_pass.h"
+using namespace exafmm;
+#include "laplace_cartesian_cpu.h"
+real_t KernelBase::eps2 = 0.0;
+complex_t KernelBase::wavek = complex_t(10.,1.) / real_t(2 * M_PI);
+
+typedef LaplaceCartesianCPU<4,0> Kernel;
+typedef Kernel::Bodies Bodies;                                  //!< Vector of bodies
+typedef Kernel::Cells Cells;                                    //!< Vector of cells
+typedef Kernel::B_iter B_iter;                                  //!< Iterator of body vector
+typedef Kernel::C_iter C_iter;                                  //!< Iterator of cell vector
+
+//! Print time of flat and two-level communication, and relative difference of checksums
+void print(const char * name, double timeFlat, double timeNode, double checksumFlat, double checksumNode) {
+  std::string flat = std::string(name) + " (flat)";
+  std::string node = std::string(name) + " (node)";
+  std::cout << std::setw(logger::stringLength) << std::left
+	    << flat << " : " << std::setprecision(7) << std::fixed << timeFlat << " s" << std::endl
+	    << std::setw(logger::stringLength) << std::left
+	    << node << " : " << std::setprecision(7) << std::fixed << timeNode << " s" << std::endl
+	    << std::setw(logger::stringLength) << std::left
+	    << "Checksum difference" << " : " << std::setprecision(7) << std::scientific
+	    << std::abs(checksumFlat - checksumNode) / std::abs(checksumFlat) << std::endl;
+}
+
+//! Partition bodies repeatedly, and return the time per partition and a checksum of the local bodies
+double partitionBodies(Args args, Bodies & bodies, Bounds globalBounds, Partition<Kernel> & partition,
+		       TreeMPI<Kernel> & treeMPI, double & checksum) {
+  Bodies local;
+  bool verbose = logger::verbose;
+  logger::verbose = false;
+  MPI_Barrier(MPI_COMM_WORLD);
+  double begin = logger::get_time();
+  for (int t=0; t<args.repeat; t++) {
+    local = bodies;
+    partition.bisection(local, globalBounds);
+    local = treeMPI.commBodies(local);
+  }
+  double result[2] = {(logger::get_time() - begin) / args.repeat, 0};
+  for (B_iter B=local.begin(); B!=local.end(); B++) {
+    result[1] += B->IBODY + B->SRC + B->X[0] + B->X[1] + B->X[2];
+  }
+  logger::verbose = verbose;
+  double time;
+  MPI_Allreduce(&result[0], &time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(&result[1], &checksum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  bodies = local;
+  return time;
+}
+
+//! Exchange the LET repeatedly, and return the time per exchange and a checksum of the received LETs
+double exchangeLET(Args args, BaseMPI & baseMPI, TreeMPI<Kernel> & treeMPI, double & checksum) {
+  Cells jcells;
+  bool verbose = logger::verbose;
+  logger::verbose = false;
+  MPI_Barrier(MPI_COMM_WORLD);
+  double begin = logger::get_time();
+  for (int t=0; t<args.repeat; t++) {
+    treeMPI.commBodies();
+    treeMPI.commCells();
+  }
+  double local[2] = {(logger::get_time() - begin) / args.repeat, 0};
+  for (int irank=0; irank<baseMPI.mpisize; irank++) {
+    treeMPI.getLET(jcells, irank);
+    for (C_iter C=jcells.begin(); C!=jcells.end(); C++) {
+      local[1] += C->NCHILD + C->NBODY + C->M[0] + C->X[0] + C->X[1] + C->X[2];
+      for (B_iter B=C->BODY; B!=C->BODY+C->NBODY; B++) {
+	local[1] += B->SRC + B->X[0] + B->X[1] + B->X[2];
+      }
+    }
+  }
+  logger::verbose = verbose;
+  double time;
+  MPI_Allreduce(&local[0], &time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(&local[1], &checksum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  return time;
+}
+
+int main(int argc, char ** argv) {
+  Args args(argc, argv);
+  BaseMPI baseMPI;
+  const vec3 cycle = 2 * M_PI;
+  Bodies bodies, buffer;
+  BoundBox<Kernel> boundBox(args.nspawn);
+  Bounds localBounds, globalBounds;
+  BuildTree<Kernel> localTree(args.ncrit, args.nspawn);
+  Cells cells;
+  Dataset<Kernel> data;
+  Partition<Kernel> partition(baseMPI.mpirank, baseMPI.mpisize);
+  TreeMPI<Kernel> treeMPI(baseMPI.mpirank, baseMPI.mpisize, args.images);
+  UpDownPass<Kernel> upDownPass(args.theta, args.useRmax, args.useRopt);
+  if (args.nodeSize <= 0) args.nodeSize = 4;
+  NodeMPI nodeMPI(args.nodeSize);
+  num_threads(args.threads);
+
+  Kernel::init();
+  args.verbose &= baseMPI.mpirank == 0;
+  logger::verbose = args.verbose;
+  logger::path = args.path;
+  logger::printTitle("Node Parameters");
+  args.print(logger::stringLength);
+  if (args.verbose) {
+    std::cout << std::setw(logger::stringLength) << std::left
+	      << "numNodes" << " : " << nodeMPI.numNodes << std::endl;
+  }
+  treeMPI.setNeighborSize(baseMPI.mpisize+1);
+  bodies = data.initBodies(args.numBodies, args.distribution, baseMPI.mpirank, baseMPI.mpisize);
+  localBounds = boundBox.getBounds(bodies);
+  globalBounds = baseMPI.allreduceBounds(localBounds);
+
+  logger::printTitle("Partition");
+  Bodies flatBodies = bodies;
+  double checksumFlat, checksumNode;
+  double timeFlat = partitionBodies(args, flatBodies, globalBounds, partition, treeMPI, checksumFlat);
+  partition.setNodeMPI(&nodeMPI);
+  treeMPI.setNodeMPI(&nodeMPI);
+  double timeNode = partitionBodies(args, bodies, globalBounds, partition, treeMPI, checksumNode);
+  if (args.verbose) print("Partition", timeFlat, timeNode, checksumFlat, checksumNode);
+
+  localBounds = boundBox.getBounds(bodies);
+  cells = localTree.buildTree(bodies, buffer, localBounds);
+  localBounds = boundBox.getBounds(cells, localBounds);
+  upDownPass.upwardPass(cells);
+  treeMPI.allgatherBounds(localBounds);
+
+  const char * names[2] = {"FMM LET", "Cutoff LET"};
+  real_t cutoffs[2] = {0, real_t(args.cutoff)};
+  for (int i=0; i<2; i++) {
+    if (i == 1 && args.cutoff == 0) break;
+    logger::printTitle(names[i]);
+    treeMPI.setLET(cells, cycle, cutoffs[i]);
+    treeMPI.printLETData();
+    treeMPI.setNodeMPI(NULL);
+    timeFlat = exchangeLET(args, baseMPI, treeMPI, checksumFlat);
+    treeMPI.setNodeMPI(&nodeMPI);
+    timeNode = exchangeLET(args, baseMPI, treeMPI, checksumNode);
+    if (args.verbose) print("Exchange", timeFlat, timeNode, checksumFlat, checksumNode);
+  }
+  Kernel::finalize();
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "args.h"
+#include "bound_box.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "logger.h"
+#include "traversal.h"
+#include "up_down_pass.h"
+using namespace exafmm;
+real_t KernelBase::eps2 = 0.0;
+complex_t KernelBase::wavek = complex_t(10.,1.) / real_t(2 * M_PI);
+#include "laplace_spherical_cpu.h"
+
+// Task runtime selected by configure
+#if EXAFMM_WITH_TBB
+#define EXAFMM_RUNTIME "tbb"
+#elif EXAFMM_WITH_MTHREAD
+#define EXAFMM_RUNTIME "mthread"
+#elif EXAFMM_WITH_CILK
+#define EXAFMM_RUNTIME "cilk"
+#elif EXAFMM_WITH_WSTEAL
+#define EXAFMM_RUNTIME "wsteal"
+#elif EXAFMM_WITH_OPENMP
+#define EXAFMM_RUNTIME "openmp"
+#define EXAFMM_OMP_TASKS 1
+#else
+#define EXAFMM_RUNTIME "serial"
+#endif
+
+int main(int argc, char ** argv) {
+  Args args(argc, argv);
+  typedef LaplaceSphericalCPU<4> Kernel;
+  typedef Kernel::Bodies Bodies;                                //!< Vector of bodies
+  typedef Kernel::Cells Cells;                                  //!< Vector of cells
+
+  const vec3 cycle = 2 * M_PI;
+  Bodies bodies, buffer;
+  BoundBox<Kernel> boundBox(args.nspawn);
+  Bounds bounds;
+  BuildTree<Kernel> buildTree(args.ncrit, args.nspawn);
+  Cells cells;
+  Dataset<Kernel> data;
+  Traversal<Kernel> traversal(args.nspawn, args.images, args.path);
+  UpDownPass<Kernel> upDownPass(args.theta, args.useRmax, args.useRopt);
+  num_threads(args.threads);
+
+  Kernel::init();
+  logger::verbose = args.verbose;
+  logger::printTitle("Traversal Parameters");
+  args.print(logger::stringLength);
+  std::cout << std::setw(logger::stringLength) << std::left
+	    << "runtime" << " : " << EXAFMM_RUNTIME << std::endl;
+  bodies = data.initBodies(args.numBodies, args.distribution, 0);
+  buffer.reserve(bodies.size());
+  bounds = boundBox.getBounds(bodies);
+  cells = buildTree.buildTree(bodies, buffer, bounds);
+  upDownPass.upwardPass(cells);
+  double * traverse = new double [args.repeat+1];
+  for (int t=0; t<args.repeat+1; t++) {
+    logger::resetTimer();
+#if EXAFMM_OMP_TASKS
+#pragma omp parallel
+#pragma omp single
+#endif
+    traversal.traverse(cells, cells, cycle, true, args.mutual);
+    traverse[t] = logger::timer["Traverse"];
+  }
+  double traverseAve = 0;
+  for (int t=0; t<args.repeat; t++) {
+    traverseAve += traverse[t+1];
+  }
+  traverseAve /= args.repeat;
+  double traverseStd = 0;
+  for (int t=0; t<args.repeat; t++) {
+    traverseStd += (traverse[t+1] - traverseAve) * (traverse[t+1] - traverseAve);
+  }
+  traverseStd /= args.repeat;
+  std::cout << "Traverse: " << traverseAve << "+-" << std::sqrt(traverseStd)
+	    << " (" << EXAFMM_RUNTIME << ", first " << traverse[0] << ")" << std::endl;
+  std::ofstream fid("time.dat", std::ios::app);
+  fid << args.numBodies << " " << args.threads << " " << args.nspawn << " "
+      << EXAFMM_RUNTIME << " " << traverseAve << std::endl;
+  delete[] traverse;
+  fid.close();
+  Kernel::finalize();
+  return 0;
+}
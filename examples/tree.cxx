@@ -1,6 +1,7 @@
 #include "args.h"
 #include "bound_box.h"
 #include "build_tree.h"
+#include "build_tree_radix.h"
 #include "dataset.h"
 #include "logger.h"
 using namespace exafmm;
@@ -18,6 +19,7 @@ int main(int argc, char ** argv) {
   BoundBox<Kernel> boundBox(args.nspawn);
   Bounds bounds;
   BuildTree<Kernel> buildTree(args.ncrit, args.nspawn);
+  BuildTreeRadix<Kernel> buildTreeRadix(args.ncrit, args.nspawn);
   Cells cells, jcells;
   Dataset<Kernel> data;
   num_threads(args.threads);
@@ -30,6 +32,8 @@ int main(int argc, char ** argv) {
   double * link1 = new double [args.repeat+1];
   double * grow2 = new double [args.repeat+1];
   double * link2 = new double [args.repeat+1];
+  double * grow3 = new double [args.repeat+1];
+  double * link3 = new double [args.repeat+1];
   for (int t=0; t<args.repeat+1; t++) {
     std::cout << t << std::endl;
     bodies = data.initBodies(args.numBodies, args.distribution, 0);
@@ -42,39 +46,60 @@ int main(int argc, char ** argv) {
     grow2[t] = logger::timer["Grow tree"];
     link2[t] = logger::timer["Link tree"];
     logger::resetTimer();
+    bodies = data.initBodies(args.numBodies, args.distribution, 0);
+    cells = buildTreeRadix.buildTree(bodies, buffer, bounds);
+    grow3[t] = logger::timer["Grow tree"];
+    link3[t] = logger::timer["Link tree"];
+    logger::resetTimer();
   }
-  double grow1ave = 0, link1ave = 0, grow2ave = 0, link2ave = 0;
+  double grow1ave = 0, link1ave = 0, grow2ave = 0, link2ave = 0, grow3ave = 0, link3ave = 0;
   for (int t=0; t<args.repeat; t++) {
     grow1ave += grow1[t+1];
     link1ave += link1[t+1];
     grow2ave += grow2[t+1];
     link2ave += link2[t+1];
+    grow3ave += grow3[t+1];
+    link3ave += link3[t+1];
   }
   grow1ave /= args.repeat;
   link1ave /= args.repeat;
   grow2ave /= args.repeat;
   link2ave /= args.repeat;
-  double grow1std = 0, link1std = 0, grow2std = 0, link2std = 0;
+  grow3ave /= args.repeat;
+  link3ave /= args.repeat;
+  double grow1std = 0, link1std = 0, grow2std = 0, link2std = 0, grow3std = 0, link3std = 0;
   for (int t=0; t<args.repeat; t++) {
     grow1std += (grow1[t+1] - grow1ave) * (grow1[t+1] - grow1ave);
     link1std += (link1[t+1] - link1ave) * (link1[t+1] - link1ave);
     grow2std += (grow2[t+1] - grow2ave) * (grow2[t+1] - grow2ave);
     link2std += (link2[t+1] - link2ave) * (link2[t+1] - link2ave);
+    grow3std += (grow3[t+1] - grow3ave) * (grow3[t+1] - grow3ave);
+    link3std += (link3[t+1] - link3ave) * (link3[t+1] - link3ave);
   }
   grow1std /= args.repeat;
   link1std /= args.repeat;
   grow2std /= args.repeat;
   link2std /= args.repeat;
+  grow3std /= args.repeat;
+  link3std /= args.repeat;
   std::cout << "Grow1: " << grow1ave << "+-" << std::sqrt(grow1std)
 	    << " Link1: " << link1ave << "+-" << link1std << std::endl;
   std::cout << "Grow2: " << grow2ave << "+-" << std::sqrt(grow2std)
 	    << " Link2: " << link2ave << "+-" << link2std << std::endl;
+  std::cout << "Grow3: " << grow3ave << "+-" << std::sqrt(grow3std)
+	    << " Link3: " << link3ave << "+-" << link3std << " (radix)" << std::endl;
+#if EXAFMM_WITH_TBB
+  std::cout << "Cold1: " << grow1[0] + link1[0] << " (empty node pool)"
+	    << " Warm1: " << grow1ave + link1ave << " (reused node pool)" << std::endl;
+#endif
   std::ofstream fid("time.dat", std::ios::app);
-  fid << args.numBodies << " " << args.threads << " " << grow1ave << " " << grow2ave << std::endl;
+  fid << args.numBodies << " " << args.threads << " " << grow1ave << " " << grow2ave << " " << grow3ave << std::endl;
   delete[] grow1;
   delete[] link1;
   delete[] grow2;
   delete[] link2;
+  delete[] grow3;
+  delete[] link3;
   fid.close();
   return 0;
 }
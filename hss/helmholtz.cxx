@@ -12,7 +12,6 @@
 #include "StrumpackDensePackage.hpp"
 using namespace exafmm;
 #include "helmholtz_spherical_cpu.h"
-vec3 KernelBase::Xperiodic = 0;
 real_t KernelBase::eps2 = 0.0;
 complex_t KernelBase::wavek = complex_t(10.,1.) / real_t(2 * M_PI);
 
@@ -499,7 +498,7 @@ int main(int argc, char ** argv) {
 	    int locri=r+i+1;
 	    int globri=indxl2g_(&locri,&nb,&myrow,&IZERO,&nprow);
 	    B_iter Bi=bodies.begin()+globri-1;
-	    vec3 dX=Bi->X-Bj->X-Kernel::Xperiodic;
+	    vec3 dX=Bi->X-Bj->X;
 	    real_t R2=norm(dX)+Kernel::eps2;
 	    real_t R=sqrt(R2);
 	    A[i+nrows*j]=R2==0?0.0:exp(I1*(Kernel::wavek)*R)/R;
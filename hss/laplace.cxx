@@ -12,7 +12,6 @@
 #include "StrumpackDensePackage.hpp"
 using namespace exafmm;
 #include "laplace_cartesian_cpu.h"
-vec3 KernelBase::Xperiodic = 0;
 real_t KernelBase::eps2 = 0.0;
 
 /* Laplace, cartesian coordinates example, 3D geometry.
@@ -27,14 +27,18 @@ namespace exafmm {
     {"help",         no_argument,       0, 'h'},
     {"images",       required_argument, 0, 'i'},
     {"IneJ",         no_argument,       0, 'j'},
+    {"costModel",    no_argument,       0, 'k'},
     {"mutual",       no_argument,       0, 'm'},
     {"mass",         no_argument,       0, 'M'},
     {"numBodies",    required_argument, 0, 'n'},
+    {"nodeSize",     required_argument, 0, 'N'},
     {"useRopt",      no_argument,       0, 'o'},
     {"path",         required_argument, 0, 'p'},
     {"P",            required_argument, 0, 'P'},
     {"repeat",       required_argument, 0, 'r'},
+    {"rma",          no_argument,       0, 'R'},
     {"nspawn",       required_argument, 0, 's'},
+    {"curve",        no_argument,       0, 'S'},
     {"theta",        required_argument, 0, 't'},
     {"threads",      required_argument, 0, 'T'},
     {"verbose",      no_argument,       0, 'v'},
@@ -57,14 +61,18 @@ namespace exafmm {
     int getMatrix;
     int images;
     int IneJ;
+    int costModel;
     int mutual;
     int mass;
     int numBodies;
+    int nodeSize;
     int useRopt;
     const char * path;
     int P;
     int repeat;
+    int rma;
     int nspawn;
+    int curve;
     double theta;
     int threads;
     int verbose;
@@ -88,14 +96,18 @@ namespace exafmm {
 	      " --help (-h)                     : Show this help document\n"
 	      " --images (-i)                   : Number of periodic image levels (%d)\n"
 	      " --IneJ (-j)                     : Use different sources & targets (%d)\n"
+	      " --costModel (-k)                : Split cells and select far field kernels by calibrated cost model, ncrit is upper bound (%d)\n"
 	      " --mutual (-m)                   : Use mutual interaction (%d)\n"
 	      " --mass (-M)                     : Use mass (all positive charges) (%d)\n"
 	      " --numBodies (-n)                : Number of bodies (%d)\n"
+	      " --nodeSize (-N)                 : Ranks per node of two-level communication, 0 for flat (%d)\n"
 	      " --useRopt (-o)                  : Use error optimized theta for MAC (%d)\n"
 	      " --path (-p)                     : Path to save files (%s)\n"
 	      " --P (-P) not working            : Order of expansion (%d)\n"
 	      " --repeat (-r)                   : Number of iteration loops (%d)\n"
+	      " --rma (-R)                      : Pull LET with one-sided communication (%d)\n"
 	      " --nspawn (-s)                   : Threshold for stopping task creation during recursion (%d)\n"
+	      " --curve (-S)                    : Partition by weighted splitting of the space filling curve (%d)\n"
 	      " --theta (-t)                    : Multipole acceptance criterion (%f)\n"
 	      " --threads (-T)                  : Number of threads (%d)\n"
 	      " --verbose (-v)                  : Print information to screen (%d)\n"
@@ -113,14 +125,18 @@ namespace exafmm {
 	      getMatrix,
 	      images,
 	      IneJ,
+	      costModel,
 	      mutual,
 	      mass,
 	      numBodies,
+	      nodeSize,
 	      useRopt,
               path,
 	      P,
 	      repeat,
+	      rma,
 	      nspawn,
+	      curve,
 	      theta,
 	      threads,
 	      verbose,
@@ -266,14 +282,18 @@ namespace exafmm {
       getMatrix(0),
       images(0),
       IneJ(0),
+      costModel(0),
       mutual(0),
       mass(0),
       numBodies(1000000),
+      nodeSize(0),
       useRopt(0),
       path("./"),
       P(Pmax),
       repeat(1),
+      rma(0),
       nspawn(5000),
+      curve(0),
       theta(.4),
       threads(16),
       verbose(0),
@@ -282,10 +302,10 @@ namespace exafmm {
       while (1) {
 #if _SX
 #warning SX does not have getopt_long
-	int c = getopt(argc, argv, "ab:c:d:De:gGhi:jmMn:op:P:r:s:t:T:vwx");
+	int c = getopt(argc, argv, "ab:c:d:De:gGhi:jkmMn:N:op:P:r:Rs:St:T:vwx");
 #else
 	int option_index;
-	int c = getopt_long(argc, argv, "ab:c:d:De:gGhi:jmMn:op:P:r:s:t:T:vwx", long_options, &option_index);
+	int c = getopt_long(argc, argv, "ab:c:d:De:gGhi:jkmMn:N:op:P:r:Rs:St:T:vwx", long_options, &option_index);
 #endif
 	if (c == -1) break;
 	switch (c) {
@@ -325,6 +345,9 @@ namespace exafmm {
 	case 'j':
 	  IneJ = 1;
 	  break;
+	case 'k':
+	  costModel = 1;
+	  break;
 	case 'm':
 	  mutual = 1;
 	  break;
@@ -334,6 +357,9 @@ namespace exafmm {
 	case 'n':
 	  numBodies = atoi(optarg);
 	  break;
+	case 'N':
+	  nodeSize = atoi(optarg);
+	  break;
 	case 'o':
 	  useRopt = 1;
 	  break;
@@ -346,9 +372,15 @@ namespace exafmm {
 	case 'r':
 	  repeat = atoi(optarg);
 	  break;
+	case 'R':
+	  rma = 1;
+	  break;
 	case 's':
 	  nspawn = atoi(optarg);
 	  break;
+	case 'S':
+	  curve = 1;
+	  break;
 	case 't':
 	  theta = atof(optarg);
 	  break;
@@ -420,12 +452,16 @@ namespace exafmm {
 		  << std::setw(stringLength)
 		  << "IneJ" << " : " << IneJ << std::endl
 		  << std::setw(stringLength)
+		  << "costModel" << " : " << costModel << std::endl
+		  << std::setw(stringLength)
 		  << "mutual" << " : " << mutual << std::endl
 		  << std::setw(stringLength)
 		  << "mass" << " : " << mass << std::endl
 		  << std::setw(stringLength)
 		  << "numBodies" << " : " << numBodies << std::endl
 		  << std::setw(stringLength)
+		  << "nodeSize" << " : " << nodeSize << std::endl
+		  << std::setw(stringLength)
 		  << "useRopt" << " : " << useRopt << std::endl
 		  << std::setw(stringLength)
 		  << "path" << " : " << path << std::endl
@@ -434,8 +470,12 @@ namespace exafmm {
 		  << std::setw(stringLength)
 		  << "repeat" << " : " << repeat << std::endl
 		  << std::setw(stringLength)
+		  << "rma" << " : " << rma << std::endl
+		  << std::setw(stringLength)
 		  << "nspawn" << " : " << nspawn << std::endl
 		  << std::setw(stringLength)
+		  << "curve" << " : " << curve << std::endl
+		  << std::setw(stringLength)
 		  << "theta" << " : " << theta << std::endl
 		  << std::setw(stringLength)
 		  << "threads" << " : " << threads << std::endl
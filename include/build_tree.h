@@ -11,9 +11,20 @@
 #include "build_tree_tbb.h"
 #endif
 
-#elif defined EXAFMM_WITH_TBB || defined EXAFMM_WITH_MTHREAD
+#elif defined EXAFMM_WITH_TBB || defined EXAFMM_WITH_MTHREAD || defined EXAFMM_WITH_WSTEAL
 #include "build_tree_tbb.h"
 
+#elif defined EXAFMM_RADIX_TREE
+#include "build_tree_radix.h"
+namespace exafmm {
+  //! Select radix sort based tree construction
+  template<typename Kernel, typename Key=DefaultKey>
+  class BuildTree : public BuildTreeRadix<Kernel, Key> {
+  public:
+    BuildTree(int _ncrit, int _nspawn) : BuildTreeRadix<Kernel, Key>(_ncrit, _nspawn) {}
+  };
+}
+
 #else
 #include "build_tree_omp.h"
 
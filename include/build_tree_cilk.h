@@ -1,7 +1,9 @@
 #ifndef build_tree_cilk_h
 #define build_tree_cilk_h
 #include <algorithm>
+#include "cost_model.h"
 #include "logger.h"
+#include "rebuild_tree.h"
 #include "thread.h"
 #include "types.h"
 
@@ -290,7 +292,7 @@ namespace exafmm {
   }
 
   template<typename Kernel>
-  class BuildTree {
+  class BuildTree : public RebuildTree<BuildTree<Kernel>,Kernel> {
     typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
     typedef typename Kernel::Cells Cells;                       //!< Vector of cells
     typedef typename Kernel::B_iter B_iter;                     //!< Iterator of body vector
@@ -387,6 +389,9 @@ namespace exafmm {
   public:
     BuildTree(int _ncrit, int) : numLevels(0), ncrit(_ncrit) {}
 
+    //! Cost model splitting is not supported by the uniform tree of this builder, cells are split by ncrit only
+    void setCostModel(const CostModel<Kernel> *) {}
+
     Cells buildTree(Bodies & bodies, Bodies & buffer, Bounds bounds) {
       const int numBodies = bodies.size();
       const int level = numBodies >= ncrit ? 1 + int(log2(numBodies / ncrit)/3) : 0;
@@ -1,24 +1,38 @@
 #ifndef build_tree_omp2_h
 #define build_tree_omp2_h
+#include "cost_model.h"
+#include "keys.h"
 #include "logger.h"
 #include "thread.h"
 #include "types.h"
 
 namespace exafmm {
-  template<typename Kernel>
+  template<typename Kernel, typename Key=DefaultKey>
   class BuildTree {
     typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
     typedef typename Kernel::Cells Cells;                       //!< Vector of cells
     typedef typename Kernel::B_iter B_iter;                     //!< Iterator of body vector
     typedef typename Kernel::C_iter C_iter;                     //!< Iterator of cell vecto
+    typedef typename Bodies::value_type Body;                   //!< Body structure
 
   private:
     const int ncrit;                                            //!< Number of bodies per leaf cell
+    const CostModel<Kernel> * costModel;                        //!< Cost model for splitting cells, NULL for ncrit only
     int numLevels;                                              //!< Number of levels
+    Box treeBox;                                                //!< Bounding box of last full build in updateTree
+    std::vector<int> nodeArena;                                 //!< Nodes array reused across builds
+    std::vector<int> permutationArena;                          //!< Permutation array reused across builds
+    std::vector<int> iworkArena;                                //!< Work array reused across builds
+    std::vector<vec3> XjArena;                                  //!< Coordinate array reused across builds
+    std::vector<char> dirtyArena;                               //!< Flags for cells to rebuild reused across updates
+    std::vector<int> ownerArena;                                //!< Cell index of each body reused across updates
+    std::vector<int> offsetArena;                               //!< Offset of bodies in each cell reused across updates
+    std::vector<int> previousArena;                             //!< Copy of permutation reused across updates
+    Bodies subArena;                                            //!< Bodies of regrown subtree reused across updates
 
   private:
     //! Get permutation index for reordering bodies
-    void reorder(Box box, int level, int * iX, vec3 * Xj,
+    void reorder(Box box, int level, int * iX, vec3 * Xj, int * rank,
 		 int * permutation, int ibody, int n, int * iwork, int * nbody) {
       int offset[9];                                            // Offset of bodies per octant
       vec3 X;                                                   // Declare temporary coordinates
@@ -30,6 +44,7 @@ namespace exafmm {
       for (int i=0; i<n; i++) {                                 // Loop over bodies
 	int j = permutation[i];                                 //  Current body index
 	int octant = (Xj[j][2] > X[2]) * 4 + (Xj[j][1] > X[1]) * 2 + (Xj[j][0] > X[0]);// Octant of current body
+	octant = rank[octant];                                  //  Position of octant along the curve
 	nbody[octant]++;                                        //  Increment nbody counter for current octant
       }                                                         // End loop over bodies
       offset[0] = 0;                                            // Initialize offset array
@@ -40,6 +55,7 @@ namespace exafmm {
       for (int i=0; i<n; i++) {                                 // Loop over bodies
 	int j = permutation[i];                                 //  Current body index
 	int octant = (Xj[j][2] > X[2]) * 4 + (Xj[j][1] > X[1]) * 2 + (Xj[j][0] > X[0]);// Octant of current body
+	octant = rank[octant];                                  //  Position of octant along the curve
 	iwork[offset[octant]+nbody[octant]] = permutation[i];   //  Put permutation index into temporary buffer
 	nbody[octant]++;                                        //  Increment nbody counter for current octant
       }                                                         // End loop over bodies
@@ -48,26 +64,48 @@ namespace exafmm {
       }                                                         // End loop over bodies
     }
 
-    //! Get Morton key
-    uint64_t getKey(ivec3 iX, int level) {
-      uint64_t index = ((1 << 3 * level) - 1) / 7;              // Level offset
-      for (int l=0; l<level; l++) {                             // Loop over levels
-	for (int d=0; d<3; d++) {                               //  Loop over dimensions
-	  index += (iX[d] & 1) << (3 * l + d);                  //   Interleave bits for each dimension
-	  iX[d] >>= 1;                                          //   Shift bits for each dimension
-	}                                                       //  End loop over dimensions
-      }                                                         // End loop over levels
-      return index;                                             // Return Morton key
+    //! Get order of child octants along the space filling curve
+    void getOctantOrder(int * iX, int level, int * rank, int * octants) {
+      uint64_t keys[8];                                         // Keys of child octants
+      for (int i=0; i<8; i++) {                                 // Loop over octants
+	octants[i] = i;                                         //  Initialize octant order
+	if (level < maxKeyLevel) {                              //  If child level fits in key
+	  ivec3 jX;                                             //   3-D index of child octant
+	  for (int d=0; d<3; d++) jX[d] = iX[d] * 2 + ((i >> d) & 1);// Child index for each dimension
+	  keys[i] = Key::interleave(jX, level + 1);             //   Key of child octant
+	} else {                                                //  Else keep Morton order
+	  keys[i] = i;                                          //   Octant as key
+	}                                                       //  End if for child level
+      }                                                         // End loop over octants
+      for (int i=1; i<8; i++) {                                 // Insertion sort of octants by key
+	int octant = octants[i];                                //  Current octant
+	int j = i - 1;                                          //  Index of previous octant
+	for (; j>=0 && keys[octants[j]] > keys[octant]; j--) {  //  Loop while previous key is larger
+	  octants[j+1] = octants[j];                            //   Shift octant
+	}                                                       //  End loop over previous octants
+	octants[j+1] = octant;                                  //  Insert octant
+      }                                                         // End insertion sort of octants by key
+      for (int i=0; i<8; i++) rank[octants[i]] = i;             // Position of each octant along the curve
     }
 
-    //! Get level from Morton key
-    int getLevel(uint64_t key) {
-      int level = -1;                                           // Initialize level
-      while( int(key) >= 0 ) {                                  // Loop while key has level offsets to subtract
-	level++;                                                //  Increment level
-	key -= 1 << 3*level;                                    //  Subtract level offset from key
-      }                                                         // End while loop for level offsets to subtract
-      return level;                                             // Return level
+    //! Grow arenas to fit a build of numBodies bodies, and return nodes array
+    int (* reserveArena(int numBodies))[10] {
+      int numNodes = 2 * numBodies / ncrit + 16;                // Initial guess of number of nodes
+      if (int(nodeArena.size()) < 10 * numNodes) nodeArena.resize(10 * numNodes);// Grow nodes array
+      if (int(permutationArena.size()) < numBodies) permutationArena.resize(numBodies);// Grow permutation array
+      if (int(iworkArena.size()) < numBodies) iworkArena.resize(numBodies);// Grow work array
+      if (int(XjArena.size()) < numBodies) XjArena.resize(numBodies);// Grow coordinate array
+      return reinterpret_cast<int (*)[10]>(&nodeArena[0]);      // Return nodes array
+    }
+
+    //! Grow arenas of updateTree to fit numBodies bodies and numCells cells, and clear dirty flags
+    void reserveUpdate(int numBodies, int numCells) {
+      int size = std::max(numBodies, numCells) + 1;             // Owner array is reused as subtree index of cells
+      if (int(dirtyArena.size()) < numCells + 1) dirtyArena.resize(numCells + 1);// Grow dirty flags
+      if (int(ownerArena.size()) < size) ownerArena.resize(size);// Grow owner array
+      if (int(offsetArena.size()) < numCells + 1) offsetArena.resize(numCells + 1);// Grow offset array
+      if (int(previousArena.size()) < numBodies + 1) previousArena.resize(numBodies + 1);// Grow permutation copy
+      std::fill(dirtyArena.begin(), dirtyArena.begin() + numCells, 0);// Clear dirty flags
     }
 
     //! Transform Xmin & Xmax to X (center) & R (radius)
@@ -86,19 +124,20 @@ namespace exafmm {
     }
 
     //! Grow tree as link between node structures
-    void growTree(Bodies & bodies, int (* nodes)[10], int & numCells,
-		  int * permutation, Box box) {
+    void growTree(Bodies & bodies, int (* & nodes)[10], int & numCells,
+		  int * permutation, Box box, int rootLevel, ivec3 rootIndex) {
       logger::startTimer("Grow tree");                          // Start timer
       const int maxLevel = 30;                                  // Maximum levels in tree
       const int numBodies = bodies.size();                      // Number of bodies
       int nbody8[8];                                            // Number of bodies per octant
-      int * iwork = new int [numBodies];                        // Allocate temporary work array of integers
-      int * levelOffset = new int [maxLevel];                   // Allocate level offset array
-      vec3 * Xj = new vec3 [numBodies];                         // Allocate temporary coordinate array
-      nodes[0][0] = 0;                                          // Initialize level
-      nodes[0][1] = 0;                                          // Initialize ix
-      nodes[0][2] = 0;                                          // Initialize iy
-      nodes[0][3] = 0;                                          // Initialize iz
+      int rank[8], octants[8];                                  // Order of octants along the curve
+      int * iwork = &iworkArena[0];                             // Temporary work array of integers
+      int levelOffset[maxLevel+2];                              // Level offset array
+      vec3 * Xj = &XjArena[0];                                  // Temporary coordinate array
+      nodes[0][0] = rootLevel;                                  // Initialize level
+      nodes[0][1] = rootIndex[0];                               // Initialize ix
+      nodes[0][2] = rootIndex[1];                               // Initialize iy
+      nodes[0][3] = rootIndex[2];                               // Initialize iz
       nodes[0][4] = 0;                                          // Initialize iparent
       nodes[0][5] = 0;                                          // Initialize ichild
       nodes[0][6] = 0;                                          // Initialize nchild
@@ -111,18 +150,26 @@ namespace exafmm {
 	Xj[i] = bodies[i].X;                                    //  Copy coordinates
       }                                                         // End loop over bodies
       numCells = 1;                                             // Initialize number of cells
-      numLevels = 0;                                            // Initialize number of levels
-      for (int level=0; level<maxLevel; level++) {              // Loop over levels
-	for (int iparent=levelOffset[level]; iparent<levelOffset[level+1]; iparent++) {// Loop over cells in level
+      numLevels = rootLevel;                                    // Initialize number of levels
+      for (int level=rootLevel; level<maxLevel; level++) {      // Loop over levels
+	int l = level - rootLevel;                              //  Level relative to root node
+	for (int iparent=levelOffset[l]; iparent<levelOffset[l+1]; iparent++) {// Loop over cells in level
 	  int nbody = nodes[iparent][8];                        //   Number of bodies in current cell
-	  if (nbody > ncrit) {                                  //   If number of bodies is larger than threshold
+	  if (nbody > ncrit || (costModel != NULL && nbody > 1)) {//   If cell may be split
+	    if (10 * (numCells + 8) > int(nodeArena.size())) {  //    If nodes array can overflow
+	      nodeArena.resize(2 * nodeArena.size());           //     Double size of nodes array
+	      nodes = reinterpret_cast<int (*)[10]>(&nodeArena[0]);//  Update nodes array
+	    }                                                   //    End if for nodes array overflow
 	    int ibody = nodes[iparent][7];                      //    Index of first body in cell
-	    reorder(box, level, &nodes[iparent][1], Xj, &permutation[ibody], ibody, nbody, iwork, nbody8);// Sort bodies
+	    getOctantOrder(&nodes[iparent][1], level, rank, octants);// Order of child octants
+	    reorder(box, level, &nodes[iparent][1], Xj, rank, &permutation[ibody], ibody, nbody, iwork, nbody8);// Sort bodies
+	    if (nbody <= ncrit && !costModel->split(nbody, nbody8)) continue;// Keep leaf if cost model does not split
 	    int nchild = 0;                                     //    Initialize number of child cells
 	    int offset = ibody;                                 //    Initialize offset
 	    nodes[iparent][5] = numCells;                       //    Store cell counter as ichild
-	    for (int i=0; i<8; i++) {                           //    Loop over octants
-              if (nbody8[i] != 0) {                             //     If octant is not empty
+	    for (int j=0; j<8; j++) {                           //    Loop over octants along the curve
+	      int i = octants[j];                               //     Octant index
+              if (nbody8[j] != 0) {                             //     If octant is not empty
                 nodes[numCells][0] = level + 1;                 //     Store level
                 nodes[numCells][1] = nodes[iparent][1] * 2 + i % 2;//    Store ix
                 nodes[numCells][2] = nodes[iparent][2] * 2 + (i / 2) % 2;// Store iy
@@ -131,27 +178,24 @@ namespace exafmm {
                 nodes[numCells][5] = 0;                         //     Initialize ichild
                 nodes[numCells][6] = 0;                         //     Initialize nchild
                 nodes[numCells][7] = offset;                    //     Store ibody
-                nodes[numCells][8] = nbody8[i];                 //     Store nbody
+                nodes[numCells][8] = nbody8[j];                 //     Store nbody
                 nchild++;                                       //     Increment number of child cells
-                offset += nbody8[i];                            //     Increment octant offset
+                offset += nbody8[j];                            //     Increment octant offset
                 numCells++;                                     //     Increment number of cells
                 numLevels=level + 1;                            //     Update number of levels
               }                                                 //     End if for non-empty octant
 	    }                                                   //    End loop over octants
 	    nodes[iparent][6] = nchild;                         //    Store nchild
-	  }                                                     //   End if for number of bodies threshold
+	  }                                                     //   End if for cell to split
 	}                                                       //  End loop over cells in level
-	levelOffset[level+2] = numCells;                        //  Update level offset
-	if (levelOffset[level+1] == levelOffset[level+2]) break;//  If no cells were added then exit loop
+	levelOffset[l+2] = numCells;                            //  Update level offset
+	if (levelOffset[l+1] == levelOffset[l+2]) break;        //  If no cells were added then exit loop
       }                                                         // End loop over levels
-      delete[] Xj;                                              // Deallocate temporary coordinate array
-      delete[] levelOffset;                                     // Deallocate level offset array 
-      delete[] iwork;                                           // Deallocate temporary work array of integers
       logger::stopTimer("Grow tree");                           // Stop timer
     }
 
     //! Convert nodes to cells
-    Cells linkTree(Bodies & bodies, Bodies & buffer, int (* nodes)[10], int numCells,
+    Cells linkTree(Bodies & bodies, int (* nodes)[10], int numCells,
 		   int * permutation, Box box) {
       logger::startTimer("Link tree");                          // Start timer
       int numBodies = bodies.size();                            // Number of bodies
@@ -163,7 +207,7 @@ namespace exafmm {
 	iX[0]      = nodes[i][1];                               //  3-D index x component
 	iX[1]      = nodes[i][2];                               //  3-D index y component
 	iX[2]      = nodes[i][3];                               //  3-D index z component
-	C->ICELL   = getKey(iX, level);                         //  Copy Morton key as icell
+	C->ICELL   = Key::getKey(iX, level);                    //  Copy key as icell
 	C->IPARENT = nodes[i][4];                               //  Copy iparent
 	C->ICHILD  = nodes[i][5];                               //  Copy ichild
 	C->NCHILD  = nodes[i][6];                               //  Copy nchild
@@ -175,11 +219,24 @@ namespace exafmm {
 	  C->X[d] = box.X[d] - box.R + iX[d] * R * 2 + R;       //   Center of cell
 	}                                                       //  End loop over dimensions
       }                                                         // End loop over cells
-      buffer.resize(numBodies);                                 // Resize buffer
       for (int i=0; i<numBodies; i++) {                         // Loop over bodies
-	buffer[i] = bodies[permutation[i]];                     //  Copy permuted bodies to buffer
+	if (permutation[i] < 0 || permutation[i] == i) continue;//  Skip bodies that are in place or already moved
+	Body body = bodies[i];                                  //  Save first body of cycle
+	int j = i;                                              //  Current position in cycle
+	while (true) {                                          //  Loop over cycle of permutation
+	  int k = permutation[j];                               //   Position to gather from
+	  permutation[j] = ~k;                                  //   Mark position as moved
+	  if (k == i) {                                         //   If cycle is closed
+	    bodies[j] = body;                                   //    Put saved body
+	    break;                                              //    Exit loop
+	  }                                                     //   End if for closed cycle
+	  bodies[j] = bodies[k];                                //   Move body in place
+	  j = k;                                                //   Advance in cycle
+	}                                                       //  End loop over cycle of permutation
+      }                                                         // End loop over bodies
+      for (int i=0; i<numBodies; i++) {                         // Loop over bodies
+	if (permutation[i] < 0) permutation[i] = ~permutation[i];//  Restore permutation
       }                                                         // End loop over bodies
-      bodies = buffer;                                          // Copy back to bodies
       B_iter B = bodies.begin();                                // Iterator of first body
       for (C=cells.begin(); C!=cells.end(); C++) {              // Loop over cells
 	C->BODY = B + C->IBODY;                                 //  Store iterator of first body in cell
@@ -188,26 +245,244 @@ namespace exafmm {
       return cells;                                             // Return cells
     }
 
+    //! Rebuild whole tree and compose permutation with the new body order
+    void rebuildTree(Bodies & bodies, Cells & cells,
+		     std::vector<int> & permutation, Box box) {
+      int numCells;                                             // Number of cells
+      int numBodies = bodies.size();                            // Number of bodies
+      int (* nodes)[10] = reserveArena(numBodies);              // Nodes array
+      int * iperm = &permutationArena[0];                       // Permutation array of this build
+      growTree(bodies, nodes, numCells, iperm, box, 0, ivec3(0));// Grow tree as link between node structures
+      cells = linkTree(bodies, nodes, numCells, iperm, box);    // Convert nodes to cells
+      previousArena.assign(permutation.begin(), permutation.end());// Copy previous permutation
+      for (int i=0; i<numBodies; i++) {                         // Loop over bodies
+	permutation[i] = previousArena[iperm[i]];               //  Compose permutations
+      }                                                         // End loop over bodies
+      treeBox = box;                                            // Store bounding box of this build
+    }
+
+    //! Find cell that contains a body by descending from the root, -1 if outside of root
+    int findCell(Cells & cells, vec3 X, char * dirty) {
+      C_iter C = cells.begin();                                 // Start from root cell
+      for (int d=0; d<3; d++) {                                 // Loop over dimensions
+	if (std::abs(X[d] - C->X[d]) > C->R) return -1;         //  Return if body is outside of root
+      }                                                         // End loop over dimensions
+      while (C->NCHILD != 0) {                                  // While cell is not a leaf
+	int octant = (X[2] > C->X[2]) * 4 + (X[1] > C->X[1]) * 2 + (X[0] > C->X[0]);// Octant of body
+	C_iter Cj = cells.begin() + C->ICHILD;                  //  First child cell
+	C_iter Cend = Cj + C->NCHILD;                           //  End of child cells
+	for (; Cj!=Cend; Cj++) {                                //  Loop over child cells
+	  int octantj = (Cj->X[2] > C->X[2]) * 4 + (Cj->X[1] > C->X[1]) * 2 + (Cj->X[0] > C->X[0]);// Octant of child
+	  if (octantj == octant) break;                         //   Exit loop if octant matches
+	}                                                       //  End loop over child cells
+	if (Cj == Cend) {                                       //  If octant has no child cell
+	  dirty[C-cells.begin()] = 1;                           //   Mark cell for rebuild
+	  break;                                                //   Keep body in this cell
+	}                                                       //  End if for missing child
+	C = Cj;                                                 //  Descend to child cell
+      }                                                         // End while loop for leaf
+      return C - cells.begin();                                 // Return index of cell
+    }
+
+    //! Reassemble cells in breadth first order after replacing dirty subtrees
+    Cells mergeTree(Cells & cells, std::vector<Cells> & subtrees, int * subtree) {
+      Cells merged;                                             // Merged cell vector
+      merged.reserve(cells.size());                             // Reserve for old number of cells
+      std::vector<int> queueTree(1, subtree[0]), queueCell(1, 0), queueParent(1, 0);// Queue of cells to copy
+      for (size_t q=0; q<queueCell.size(); q++) {               // Loop over queue
+	int s = queueTree[q];                                   //  Index of subtree, -1 for old tree
+	Cells & source = s < 0 ? cells : subtrees[s];           //  Cells to copy from
+	merged.push_back(source[queueCell[q]]);                 //  Copy cell
+	C_iter C = merged.end() - 1;                            //  Copied cell
+	C->IPARENT = queueParent[q];                            //  Parent in merged tree
+	int ichild = C->ICHILD;                                 //  First child in source
+	C->ICHILD = C->NCHILD ? queueCell.size() : 0;           //  First child in merged tree
+	for (int i=ichild; i<ichild+C->NCHILD; i++) {           //  Loop over child cells
+	  int t = s < 0 ? subtree[i] : s;                       //   Subtree of child
+	  queueTree.push_back(t);                               //   Push subtree to queue
+	  queueCell.push_back(s < 0 && t >= 0 ? 0 : i);         //   Push cell to queue
+	  queueParent.push_back(q);                             //   Push parent to queue
+	}                                                       //  End loop over child cells
+      }                                                         // End loop over queue
+      return merged;                                            // Return merged cells
+    }
+
   public:
-    BuildTree(int _ncrit, int ) : ncrit(_ncrit) {}              // Constructor
+    //! Constructor
+    BuildTree(int _ncrit, int ) : ncrit(_ncrit), costModel(NULL) {
+      treeBox.X = 0;                                            // Initialize center of last full build
+      treeBox.R = 0;                                            // Initialize radius of last full build
+    }
+
+    //! Split cells by cost model, ncrit becomes an upper bound of bodies per leaf
+    void setCostModel(const CostModel<Kernel> * _costModel) {
+      costModel = _costModel;                                   // Set cost model
+    }
 
     //! Build tree structure
-    Cells buildTree(Bodies & bodies, Bodies & buffer, Bounds bounds) {
+    /*!
+      The buffer argument is not used by this builder, which permutes bodies in place.
+      It is kept so that all builders share the same interface.
+    */
+    Cells buildTree(Bodies & bodies, Bodies &, Bounds bounds) {
       int numCells;                                             // Number of cells
       int numBodies = bodies.size();                            // Number of bodies
       Cells cells;                                              // Cell vector
       if (numBodies == 0) return cells;                         // Return if bodies array is empty
-      int (* nodes)[10] = new int [2*numBodies+10][10]();       // Allocate nodes array
-      int * permutation = new int [numBodies];                  // Allocate permutation array
+      int (* nodes)[10] = reserveArena(numBodies);              // Nodes array
+      int * permutation = &permutationArena[0];                 // Permutation array
       Box box = bounds2box(bounds);                             // Bounding box
-      growTree(bodies, nodes, numCells, permutation, box);      // Grow tree as link between node structures
-      assert(numCells <= 2*numBodies+10);
-      cells = linkTree(bodies, buffer, nodes, numCells, permutation, box);// Convert nodes to cells
-      delete[] permutation;                                     // Deallocate permutation array
-      delete[] nodes;                                           // Deallocate nodes array
+      growTree(bodies, nodes, numCells, permutation, box, 0, ivec3(0));// Grow tree as link between node structures
+      cells = linkTree(bodies, nodes, numCells, permutation, box);// Convert nodes to cells
       return cells;                                             // Return cells
     }
 
+    //! Update tree of previous step, rebuilding only subtrees whose split decision has changed
+    /*!
+      bodies are given in the caller's order and are returned in tree order.
+      permutation[i] is the caller's index of the i-th body in tree order; it is
+      kept together with cells between calls. Bodies that left their leaf are moved
+      to the deepest existing cell that contains them, and the body ranges are
+      refit bottom-up. Cells that then violate the split rule of growTree are
+      regrown in place, so the result has the same structure as a full build with
+      the same bounds. The whole tree is rebuilt if the bounds change, if a body
+      leaves the root cell, or if more than a quarter of the bodies are in dirty cells.
+    */
+    void updateTree(Bodies & bodies, Bodies & buffer, Cells & cells,
+		    std::vector<int> & permutation, Bounds bounds) {
+      logger::startTimer("Update tree");                        // Start timer
+      int numBodies = bodies.size();                            // Number of bodies
+      int numCells = cells.size();                              // Number of cells
+      Box box = bounds2box(bounds);                             // Bounding box
+      bool rebuild = numCells == 0 || int(permutation.size()) != numBodies || box.R != treeBox.R;// Rebuild if tree does not match
+      for (int d=0; d<3; d++) rebuild |= box.X[d] != treeBox.X[d];// Rebuild if bounds have moved
+      reserveUpdate(numBodies, numCells);                       // Grow arenas of update
+      char * dirty = &dirtyArena[0];                            // Flags for cells to rebuild
+      int * owner = &ownerArena[0];                             // Cell index of each body
+      if (!rebuild) {                                           // If previous tree can be reused
+	for (C_iter C=cells.begin(); C!=cells.end(); C++) {     //  Loop over cells
+	  int level = getLevel(C->ICELL);                       //   Level of cell
+	  ivec3 iX = Key::getIndex(C->ICELL);                   //   3-D index of cell
+	  C->R = box.R / (1 << level);                          //   Reset cell radius from geometry
+	  for (int d=0; d<3; d++) {                             //   Loop over dimensions
+	    C->X[d] = box.X[d] - box.R + iX[d] * C->R * 2 + C->R;//   Reset center of cell from geometry
+	  }                                                     //   End loop over dimensions
+	}                                                       //  End loop over cells
+	buffer.resize(numBodies);                               //  Resize buffer
+	for (int i=0; i<numBodies; i++) {                       //  Loop over bodies
+	  buffer[i] = bodies[permutation[i]];                   //   Gather bodies in previous tree order
+	}                                                       //  End loop over bodies
+	for (C_iter C=cells.begin(); C!=cells.end() && !rebuild; C++) {// Loop over cells
+	  if (C->NCHILD != 0) continue;                         //   Skip cells that are not leafs
+	  for (int i=C->IBODY; i<C->IBODY+C->NBODY; i++) {      //   Loop over bodies in leaf
+	    bool inside = true;                                 //    Flag for body inside of leaf
+	    for (int d=0; d<3; d++) {                           //    Loop over dimensions
+	      inside &= buffer[i].X[d] > C->X[d] - C->R && buffer[i].X[d] <= C->X[d] + C->R;// Check bounds of leaf
+	    }                                                   //    End loop over dimensions
+	    owner[i] = inside ? C - cells.begin() : findCell(cells, buffer[i].X, dirty);// Cell that contains body
+	    if (owner[i] < 0) {                                 //    If body left the root cell
+	      rebuild = true;                                   //     Rebuild whole tree
+	      break;                                            //     Exit loop
+	    }                                                   //    End if for body outside of root
+	  }                                                     //   End loop over bodies in leaf
+	}                                                       //  End loop over cells
+      }                                                         // End if for reusable tree
+      if (rebuild) {                                            // If whole tree has to be rebuilt
+	permutation.resize(numBodies);                          //  Resize permutation
+	for (int i=0; i<numBodies; i++) permutation[i] = i;     //  Bodies are in the caller's order
+	if (numBodies == 0) cells.clear();                      //  Empty tree for empty bodies
+	else rebuildTree(bodies, cells, permutation, box);      // Rebuild whole tree
+	logger::stopTimer("Update tree");                       //  Stop timer
+	return;                                                 //  Return
+      }                                                         // End if for rebuild
+      int * offset = &offsetArena[0];                           // Offset of bodies kept in each cell
+      for (C_iter C=cells.begin(); C!=cells.end(); C++) C->NBODY = 0;// Initialize nbody
+      for (int i=0; i<numBodies; i++) cells[owner[i]].NBODY++;  // Count bodies kept in each cell
+      for (int i=0; i<numCells; i++) offset[i] = cells[i].NBODY;// Store count of bodies kept in each cell
+      for (int i=numCells-1; i>0; i--) {                        // Loop over cells bottom-up
+	cells[cells[i].IPARENT].NBODY += cells[i].NBODY;        //  Refit nbody of parent
+      }                                                         // End loop over cells
+      cells[0].IBODY = 0;                                       // Root starts from first body
+      for (C_iter C=cells.begin(); C!=cells.end(); C++) {       // Loop over cells top-down
+	int ibody = C->IBODY + offset[C-cells.begin()];         //  Children follow bodies kept in cell
+	offset[C-cells.begin()] = C->IBODY;                     //  Store offset of bodies kept in cell
+	for (C_iter Cj=cells.begin()+C->ICHILD; Cj!=cells.begin()+C->ICHILD+C->NCHILD; Cj++) {// Loop over child cells
+	  Cj->IBODY = ibody;                                    //   Refit ibody of child
+	  ibody += Cj->NBODY;                                   //   Increment offset
+	}                                                       //  End loop over child cells
+      }                                                         // End loop over cells
+      int * previous = &previousArena[0];                       // Copy of previous permutation
+      std::copy(permutation.begin(), permutation.end(), previous);// Copy previous permutation
+      bodies.resize(numBodies);                                 // Resize bodies
+      for (int i=0; i<numBodies; i++) {                         // Loop over bodies in previous tree order
+	int j = offset[owner[i]]++;                             //  New index of body
+	bodies[j] = buffer[i];                                  //  Stable sort of bodies by cell
+	permutation[j] = previous[i];                           //  Permute caller's index
+      }                                                         // End loop over bodies
+      int numDirty = 0;                                         // Number of bodies in dirty cells
+      for (C_iter C=cells.begin(); C!=cells.end(); C++) {       // Loop over cells
+	int i = C - cells.begin();                              //  Index of cell
+	int nbody8[8] = {0, 0, 0, 0, 0, 0, 0, 0};               //  Number of bodies per octant
+	if (costModel != NULL && C->NBODY <= ncrit) {           //  If cost model decides split
+	  for (int j=C->IBODY; j<C->IBODY+C->NBODY; j++) {      //   Loop over bodies in cell
+	    vec3 X = bodies[j].X;                               //    Coordinates of body
+	    nbody8[(X[2] > C->X[2]) * 4 + (X[1] > C->X[1]) * 2 + (X[0] > C->X[0])]++;// Count bodies per octant
+	  }                                                     //   End loop over bodies in cell
+	}                                                       //  End if for cost model
+	bool split = C->NBODY > ncrit || (costModel != NULL && C->NBODY > 1 && costModel->split(C->NBODY, nbody8));// Split decision of growTree
+	if (split != (C->NCHILD != 0)) dirty[i] = 1;            //  Leaf overflows or cell underflows
+	if (C->NBODY == 0) dirty[C->IPARENT] = 1;               //  Empty cell is removed by parent
+      }                                                         // End loop over cells
+      int * subtree = owner;                                    // Reuse owner array as subtree index of cells
+      for (int i=0; i<numCells; i++) {                          // Loop over cells top-down
+	subtree[i] = -1;                                        //  Initialize subtree index
+	bool parentDirty = i > 0 && subtree[cells[i].IPARENT] != -1;// Parent is part of a regrown subtree
+	if (parentDirty) subtree[i] = -2;                       //  Cell is dropped with its ancestor
+	else if (dirty[i]) {                                    //  Else if cell is the top of a dirty subtree
+	  subtree[i] = 0;                                       //   Mark as subtree
+	  numDirty += cells[i].NBODY;                           //   Count bodies in dirty subtree
+	}                                                       //  End if for dirty cell
+      }                                                         // End loop over cells
+      if (subtree[0] != -1 || 4 * numDirty > numBodies) {       // If most of the tree is dirty
+	rebuildTree(bodies, cells, permutation, box);   //  Rebuild whole tree
+      } else if (numDirty > 0) {                                // Else if some subtrees are dirty
+	std::vector<Cells> subtrees;                            //  Regrown subtrees
+	for (int i=0; i<numCells; i++) {                        //  Loop over cells
+	  if (subtree[i] < 0) continue;                         //   Skip cells that are not tops of dirty subtrees
+	  C_iter C = cells.begin() + i;                         //   Top of dirty subtree
+	  int level = getLevel(C->ICELL);                       //   Level of subtree root
+	  ivec3 iX = Key::getIndex(C->ICELL);                   //   3-D index of subtree root
+	  Bodies & sub = subArena;                              //   Bodies in subtree
+	  sub.assign(bodies.begin()+C->IBODY, bodies.begin()+C->IBODY+C->NBODY);// Copy bodies of subtree
+	  int (* nodes)[10] = reserveArena(C->NBODY);           //   Nodes array
+	  int * iperm = &permutationArena[0];                   //   Permutation array
+	  int numSubCells;                                      //   Number of cells in subtree
+	  growTree(sub, nodes, numSubCells, iperm, box, level, iX);// Grow subtree
+	  Cells subCells = linkTree(sub, nodes, numSubCells, iperm, box);// Convert nodes to cells
+	  for (int j=0; j<C->NBODY; j++) {                      //   Loop over bodies in subtree
+	    bodies[C->IBODY+j] = sub[j];                        //    Copy back sorted bodies
+	    previous[j] = permutation[C->IBODY+iperm[j]];       //    Permute caller's index
+	  }                                                     //   End loop over bodies in subtree
+	  for (int j=0; j<C->NBODY; j++) {                      //   Loop over bodies in subtree
+	    permutation[C->IBODY+j] = previous[j];              //    Copy back permutation
+	  }                                                     //   End loop over bodies in subtree
+	  for (C_iter Cj=subCells.begin(); Cj!=subCells.end(); Cj++) {// Loop over cells in subtree
+	    Cj->IBODY += C->IBODY;                              //    Offset ibody of subtree
+	  }                                                     //   End loop over cells in subtree
+	  subtree[i] = subtrees.size();                         //   Store subtree index
+	  subtrees.push_back(subCells);                         //   Store subtree
+	}                                                       //  End loop over cells
+	cells = mergeTree(cells, subtrees, subtree);            //  Reassemble cells
+      }                                                         // End if for dirty subtrees
+      numLevels = 0;                                            // Initialize number of levels
+      B_iter B = bodies.begin();                                // Iterator of first body
+      for (C_iter C=cells.begin(); C!=cells.end(); C++) {       // Loop over cells
+	C->BODY = B + C->IBODY;                                 //  Store iterator of first body in cell
+	numLevels = std::max(numLevels, getLevel(C->ICELL));    //  Update number of levels
+      }                                                         // End loop over cells
+      logger::stopTimer("Update tree");                         // Stop timer
+    }
+
     void printTreeData(Cells & cells) {
       if (logger::verbose && !cells.empty()) {                  // If verbose flag is true
 	logger::printTitle("Tree stats");                       //  Print title
@@ -0,0 +1,239 @@
+#ifndef build_tree_radix_h
+#define build_tree_radix_h
+#include <algorithm>
+#include "cost_model.h"
+#include "keys.h"
+#include "logger.h"
+#include "rebuild_tree.h"
+#include "sort.h"
+#include "thread.h"
+#include "types.h"
+
+namespace exafmm {
+  //! Parallel tree construction from radix sorted space filling curve keys
+  template<typename Kernel, typename Key=DefaultKey>
+  class BuildTreeRadix : public RebuildTree<BuildTreeRadix<Kernel,Key>,Kernel> {
+    typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
+    typedef typename Kernel::Cells Cells;                       //!< Vector of cells
+    typedef typename Kernel::B_iter B_iter;                     //!< Iterator of body vector
+    typedef typename Kernel::C_iter C_iter;                     //!< Iterator of cell vecto
+
+  private:
+    //! Node of the level-wise tree before conversion to cells
+    struct Node {
+      int      LEVEL;                                           //!< Level of node
+      int      IPARENT;                                         //!< Index of parent node
+      int      ICHILD;                                          //!< Index of first child node
+      int      NCHILD;                                          //!< Number of child nodes
+      int      IBODY;                                           //!< Index of first body
+      int      NBODY;                                           //!< Number of descendant bodies
+      uint64_t KEY;                                             //!< Key without level offset
+    };
+    typedef std::vector<Node> Nodes;                            //!< Vector of nodes
+
+    static const int maxLevel = maxKeyLevel;                    //!< Maximum levels in tree (3*21 bits of key)
+    const int ncrit;                                            //!< Number of bodies per leaf cell
+    const CostModel<Kernel> * costModel;                        //!< Cost model for splitting cells, NULL for ncrit only
+    int numLevels;                                              //!< Number of levels
+    std::vector<uint64_t> keys;                                 //!< Keys of bodies
+    std::vector<int> permutation;                               //!< Permutation index of bodies
+    Sort<Kernel> sort;                                          //!< Radix sort with buffers reused across builds
+    Nodes nodes;                                                //!< Nodes of tree
+
+  private:
+    //! Transform Xmin & Xmax to X (center) & R (radius)
+    Box bounds2box(Bounds bounds) {
+      vec3 Xmin = bounds.Xmin;                                  // Set local Xmin
+      vec3 Xmax = bounds.Xmax;                                  // Set local Xmax
+      Box box;                                                  // Bounding box
+      for (int d=0; d<3; d++) box.X[d] = (Xmax[d] + Xmin[d]) / 2;// Calculate center of domain
+      box.R = 0;                                                // Initialize cell radius
+      for (int d=0; d<3; d++) {                                 // Loop over dimensions
+	box.R = std::max(box.X[d] - Xmin[d], box.R);            //  Calculate min distance from center
+	box.R = std::max(Xmax[d] - box.X[d], box.R);            //  Calculate max distance from center
+      }                                                         // End loop over dimensions
+      box.R *= 1.00001;                                         // Add some leeway to radius
+      return box;                                               // Return box.X and box.R
+    }
+
+    //! Get keys of all bodies at the finest level
+    void getKeys(Bodies & bodies, Box box) {
+      const int numBodies = bodies.size();                      // Number of bodies
+      const int maxIndex = (1 << maxLevel) - 1;                 // Maximum 3-D index at finest level
+      const double scale = (1 << maxLevel) / (2 * double(box.R));// Inverse of finest cell diameter
+      keys.resize(numBodies);                                   // Resize key array
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int i=0; i<numBodies; i++) {                         // Loop over bodies
+	ivec3 iX;                                               //  3-D index at finest level
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  iX[d] = int((bodies[i].X[d] - box.X[d] + box.R) * scale);// 3-D index at finest level
+	  iX[d] = std::min(std::max(iX[d], 0), maxIndex);       //   Clamp to domain
+	}                                                       //  End loop over dimensions
+	keys[i] = Key::interleave(iX, maxLevel);                //  Store key
+      }                                                         // End loop over bodies
+    }
+
+    //! Find the body range of each octant of a node from sorted keys
+    void getOctantRange(const Node & node, int * octantOffset) {
+      const uint64_t * first = &keys[0] + node.IBODY;           // First key in node
+      const uint64_t * last = first + node.NBODY;               // Last key in node
+      const int shift = 3 * (maxLevel - node.LEVEL - 1);        // Bit shift of child level
+      octantOffset[0] = node.IBODY;                             // Offset of first octant
+      for (int i=1; i<8; i++) {                                 // Loop over octants
+	uint64_t key = (node.KEY * 8 + i) << shift;             //  First key of octant
+	first = std::lower_bound(first, last, key);             //  Binary search for key
+	octantOffset[i] = first - &keys[0];                     //  Offset of octant
+      }                                                         // End loop over octants
+      octantOffset[8] = node.IBODY + node.NBODY;                // Offset of end of last octant
+    }
+
+    //! Grow tree level by level from sorted keys
+    void growTree(Bodies & bodies, Box box) {
+      logger::startTimer("Grow tree");                          // Start timer
+      const int numBodies = bodies.size();                      // Number of bodies
+      getKeys(bodies, box);                                     // Get keys of bodies
+      sort.sortKeys(keys, permutation);                         // Sort bodies according to keys
+      nodes.resize(1);                                          // Initialize nodes with root
+      Node & root = nodes[0];                                   // Root node
+      root.LEVEL = root.IPARENT = root.ICHILD = root.NCHILD = 0;// Initialize root node
+      root.IBODY = 0;                                           // Index of first body
+      root.NBODY = numBodies;                                   // Number of bodies
+      root.KEY = 0;                                             // Key of root
+      int levelBegin = 0, levelEnd = 1;                         // Range of nodes in current level
+      std::vector<int> octantOffset, childOffset;               // Octant body ranges and child offsets
+      numLevels = 0;                                            // Initialize number of levels
+      for (int level=0; level<maxLevel; level++) {              // Loop over levels
+	const int numParents = levelEnd - levelBegin;           //  Number of nodes in this level
+	octantOffset.resize(9 * numParents);                    //  Resize octant body ranges
+	childOffset.resize(numParents + 1);                     //  Resize child offsets
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+	for (int i=0; i<numParents; i++) {                      //  Loop over nodes in this level
+	  const Node & node = nodes[levelBegin+i];              //   Current node
+	  int nchild = 0;                                       //   Initialize number of child nodes
+	  if (node.NBODY > ncrit || (costModel != NULL && node.NBODY > 1)) {// If node may be split
+	    int nbody8[8];                                      //    Number of bodies per octant
+	    getOctantRange(node, &octantOffset[9*i]);           //    Body range of each octant
+	    for (int j=0; j<8; j++) {                           //    Loop over octants
+	      nbody8[j] = octantOffset[9*i+j+1] - octantOffset[9*i+j];// Number of bodies in octant
+	      if (nbody8[j] != 0) nchild++;                     //     Count non-empty octants
+	    }                                                   //    End loop over octants
+	    if (node.NBODY <= ncrit && !costModel->split(node.NBODY, nbody8)) nchild = 0;// Keep leaf if cost model does not split
+	  }                                                     //   End if for node to split
+	  childOffset[i] = nchild;                              //   Store number of child nodes
+	}                                                       //  End loop over nodes in this level
+	int numChilds = 0;                                      //  Exclusive scan of child counts
+	for (int i=0; i<numParents; i++) {                      //  Loop over nodes in this level
+	  int nchild = childOffset[i];                          //   Number of child nodes
+	  childOffset[i] = levelEnd + numChilds;                //   Index of first child node
+	  numChilds += nchild;                                  //   Increment number of child nodes
+	}                                                       //  End loop over nodes in this level
+	childOffset[numParents] = levelEnd + numChilds;         //  End of child nodes
+	if (numChilds == 0) break;                              //  If no nodes were added then exit loop
+	nodes.resize(levelEnd + numChilds);                     //  Allocate nodes of next level
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+	for (int i=0; i<numParents; i++) {                      //  Loop over nodes in this level
+	  Node & node = nodes[levelBegin+i];                    //   Current node
+	  node.NCHILD = childOffset[i+1] - childOffset[i];      //   Number of child nodes
+	  node.ICHILD = node.NCHILD ? childOffset[i] : 0;       //   Index of first child node
+	  int ichild = childOffset[i];                          //   Index of current child node
+	  for (int j=0; j<8 && node.NCHILD; j++) {              //   Loop over octants
+	    int ibody = octantOffset[9*i+j];                    //    Index of first body in octant
+	    int nbody = octantOffset[9*i+j+1] - ibody;          //    Number of bodies in octant
+	    if (nbody != 0) {                                   //    If octant is not empty
+	      Node & child = nodes[ichild];                     //     Child node
+	      child.LEVEL = level + 1;                          //     Store level
+	      child.IPARENT = levelBegin + i;                   //     Store iparent
+	      child.ICHILD = 0;                                 //     Initialize ichild
+	      child.NCHILD = 0;                                 //     Initialize nchild
+	      child.IBODY = ibody;                              //     Store ibody
+	      child.NBODY = nbody;                              //     Store nbody
+	      child.KEY = node.KEY * 8 + j;                     //     Store key
+	      ichild++;                                         //     Increment child node index
+	    }                                                   //    End if for non-empty octant
+	  }                                                     //   End loop over octants
+	}                                                       //  End loop over nodes in this level
+	levelBegin = levelEnd;                                  //  Begin of next level
+	levelEnd += numChilds;                                  //  End of next level
+	numLevels = level + 1;                                  //  Update number of levels
+      }                                                         // End loop over levels
+      logger::stopTimer("Grow tree");                           // Stop timer
+    }
+
+    //! Convert nodes to cells and permute bodies
+    Cells linkTree(Bodies & bodies, Bodies & buffer, Box box) {
+      logger::startTimer("Link tree");                          // Start timer
+      const int numBodies = bodies.size();                      // Number of bodies
+      const int numCells = nodes.size();                        // Number of cells
+      Cells cells(numCells);                                    // Instantiate cells vector
+      buffer.resize(numBodies);                                 // Resize buffer
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int i=0; i<numBodies; i++) {                         // Loop over bodies
+	buffer[i] = bodies[permutation[i]];                     //  Copy permuted bodies to buffer
+      }                                                         // End loop over bodies
+      bodies.swap(buffer);                                      // Swap sorted bodies into place
+      B_iter B0 = bodies.begin();                               // Iterator of first body
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int i=0; i<numCells; i++) {                          // Loop over cells
+	const Node & node = nodes[i];                           //  Current node
+	C_iter C = cells.begin() + i;                           //  Current cell
+	ivec3 iX = Key::deinterleave(node.KEY, node.LEVEL);     //  3-D index
+	C->ICELL   = levelOffset(node.LEVEL) + node.KEY;        //  Key with level offset
+	C->IPARENT = node.IPARENT;                              //  Copy iparent
+	C->ICHILD  = node.ICHILD;                               //  Copy ichild
+	C->NCHILD  = node.NCHILD;                               //  Copy nchild
+	C->IBODY   = node.IBODY;                                //  Copy ibody
+	C->NBODY   = node.NBODY;                                //  Copy nbody
+	C->BODY    = B0 + node.IBODY;                           //  Iterator of first body in cell
+	real_t R = box.R / (1 << node.LEVEL);                   //  Cell radius
+	C->R = R;                                               //  Store cell radius
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  C->X[d] = box.X[d] - box.R + iX[d] * R * 2 + R;       //   Center of cell
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over cells
+      logger::stopTimer("Link tree");                           // Stop timer
+      return cells;                                             // Return cells
+    }
+
+  public:
+    BuildTreeRadix(int _ncrit, int ) : ncrit(_ncrit), costModel(NULL), numLevels(0) {}// Constructor
+
+    //! Split cells by cost model, ncrit becomes an upper bound of bodies per leaf
+    void setCostModel(const CostModel<Kernel> * _costModel) {
+      costModel = _costModel;                                   // Set cost model
+    }
+
+    //! Build tree structure
+    Cells buildTree(Bodies & bodies, Bodies & buffer, Bounds bounds) {
+      Cells cells;                                              // Cell vector
+      if (bodies.empty()) return cells;                         // Return if bodies array is empty
+      Box box = bounds2box(bounds);                             // Bounding box
+      growTree(bodies, box);                                    // Grow tree from sorted keys
+      cells = linkTree(bodies, buffer, box);                    // Convert nodes to cells
+      return cells;                                             // Return cells
+    }
+
+    //! Print tree structure statistics
+    void printTreeData(Cells & cells) {
+      if (logger::verbose && !cells.empty()) {                  // If verbose flag is true
+	logger::printTitle("Tree stats");                       //  Print title
+	std::cout  << std::setw(logger::stringLength) << std::left// Set format
+		   << "Bodies"     << " : " << cells.front().NBODY << std::endl// Print number of bodies
+		   << std::setw(logger::stringLength) << std::left// Set format
+		   << "Cells"      << " : " << cells.size() << std::endl// Print number of cells
+		   << std::setw(logger::stringLength) << std::left// Set format
+		   << "Tree depth" << " : " << numLevels << std::endl;//  Print number of levels
+      }                                                         // End if for verbose flag
+    }
+  };
+}
+#endif
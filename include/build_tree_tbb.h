@@ -1,12 +1,15 @@
 #ifndef build_tree_tbb_h
 #define build_tree_tbb_h
+#include "cost_model.h"
+#include "keys.h"
 #include "logger.h"
+#include "rebuild_tree.h"
 #include "thread.h"
 #include "types.h"
 
 namespace exafmm {
-  template<typename Kernel>
-  class BuildTree {
+  template<typename Kernel, typename Key=DefaultKey>
+  class BuildTree : public RebuildTree<BuildTree<Kernel,Key>,Kernel> {
     typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
     typedef typename Kernel::Cells Cells;                       //!< Vector of cells
     typedef typename Kernel::B_iter B_iter;                     //!< Iterator of body vector
@@ -32,11 +35,74 @@ namespace exafmm {
       vec3         X;                                           //!< Coordinate at center
     };
 
+    //! Pool of octree nodes, handed out in slabs per thread and released in bulk after linkTree
+    class NodePool {
+    private:
+      //! Slab of the calling thread
+      struct Cursor {
+	int          generation;                                //!< Generation of pool when slab was taken
+	OctreeNode * next;                                      //!< Next free node in slab
+	OctreeNode * end;                                       //!< End of slab
+      };
+      static const int slabSize = 1024;                         //!< Number of nodes per slab
+      std::vector<OctreeNode*> slabs;                           //!< Slabs owned by the pool
+      int numUsed;                                              //!< Number of slabs handed out since last release
+      int generation;                                           //!< Unique among pools, renewed at every release
+      volatile int lock;                                        //!< Spin lock for taking slabs
+
+      NodePool(const NodePool &);                               // Not copyable
+      NodePool & operator=(const NodePool &);                   // Not assignable
+      //! Get new generation that is unique among all pools
+      static int newGeneration() {
+	static volatile int counter = 0;                        // Global generation counter
+	return __sync_add_and_fetch(&counter, 1);               // Increment atomically
+      }
+      //! Get slab of the calling thread
+      static Cursor & getCursor() {
+	static __thread Cursor cursor = {0, NULL, NULL};        // Thread local cursor
+	return cursor;                                          // Return cursor
+      }
+      //! Take a slab for the calling thread
+      OctreeNode * takeSlab() {
+	while (__sync_lock_test_and_set(&lock, 1));             // Acquire lock
+	if (numUsed == int(slabs.size())) {                     // If all slabs are in use
+	  slabs.push_back(new OctreeNode [slabSize]);           //  Allocate new slab
+	}                                                       // End if for slabs in use
+	OctreeNode * slab = slabs[numUsed++];                   // Take next slab
+	__sync_lock_release(&lock);                             // Release lock
+	return slab;                                            // Return slab
+      }
+
+    public:
+      NodePool() : numUsed(0), generation(newGeneration()), lock(0) {}// Constructor
+      ~NodePool() {                                             // Destructor
+	for (size_t i=0; i<slabs.size(); i++) delete[] slabs[i];// Deallocate slabs
+      }
+      //! Allocate a node from the slab of the calling thread
+      OctreeNode * allocate() {
+	Cursor & cursor = getCursor();                          // Slab of the calling thread
+	if (cursor.generation != generation || cursor.next == cursor.end) {// If slab is stale or full
+	  cursor.generation = generation;                       //  Mark slab as taken from this pool
+	  cursor.next = takeSlab();                             //  Take new slab
+	  cursor.end = cursor.next + slabSize;                  //  End of new slab
+	}                                                       // End if for stale or full slab
+	return cursor.next++;                                   // Return next free node
+      }
+      //! Release all nodes at once, slabs are kept for the next build
+      void release() {
+	numUsed = 0;                                            // All slabs are free
+	generation = newGeneration();                           // Invalidate cursors of all threads
+      }
+    };
+
     const int    ncrit;                                         //!< Number of bodies per leaf cell
     const int    nspawn;                                        //!< Threshold of NBODY for spawning new threads
+    const CostModel<Kernel> * costModel;                        //!< Cost model for splitting cells, NULL for ncrit only
     int          numLevels;                                     //!< Number of levels in tree
     B_iter       B0;                                            //!< Iterator of first body
     OctreeNode * N0;                                            //!< Pointer to octree root node
+    NodePool     nodePool;                                      //!< Pool of octree nodes reused across builds
+    std::vector<BinaryTreeNode> binNodeArena;                   //!< Binary tree nodes reused across builds
 
   private:
     //! Recursive functor for counting bodies in each octant using binary tree
@@ -140,19 +206,22 @@ namespace exafmm {
       real_t R0;                                                //!< Radius of root cell
       int ncrit;                                                //!< Number of bodies per leaf cell
       int nspawn;                                               //!< Threshold of NBODY for spawning new threads
+      const CostModel<Kernel> * costModel;                      //!< Cost model for splitting cells, NULL for ncrit only
       logger::Timer & timer;
+      NodePool & nodePool;                                      //!< Pool of octree nodes
       int level;                                                //!< Current tree level
       bool direction;                                           //!< Direction of buffer copying
       //! Constructor
       BuildNodes(OctreeNode *& _octNode, Bodies & _bodies,
 		 Bodies & _buffer, int _begin, int _end, BinaryTreeNode * _binNode,
-		 vec3 _X, real_t _R0, int _ncrit, int _nspawn, logger::Timer & _timer, int _level=0, bool _direction=false) :
+		 vec3 _X, real_t _R0, int _ncrit, int _nspawn, const CostModel<Kernel> * _costModel,
+		 logger::Timer & _timer, NodePool & _nodePool, int _level=0, bool _direction=false) :
 	octNode(_octNode), bodies(_bodies), buffer(_buffer),    // Initialize variables
 	begin(_begin), end(_end), binNode(_binNode), X(_X), R0(_R0),
-	ncrit(_ncrit), nspawn(_nspawn), timer(_timer), level(_level), direction(_direction) {}
+	ncrit(_ncrit), nspawn(_nspawn), costModel(_costModel), timer(_timer), nodePool(_nodePool), level(_level), direction(_direction) {}
       //! Create an octree node
       OctreeNode * makeOctNode(bool nochild) const {
-	octNode = new OctreeNode();                             // Allocate memory for single node
+	octNode = nodePool.allocate();                          // Allocate single node from pool
 	octNode->IBODY = begin;                                 // Index of first body in node
 	octNode->NBODY = end - begin;                           // Number of bodies in node
 	octNode->NNODE = 1;                                     // Initialize counter for decendant nodes
@@ -162,6 +231,11 @@ namespace exafmm {
 	}                                                       // End if for node children
 	return octNode;                                         // Return node
       }
+      //! Copy bodies of a leaf to buffer if the sort left them in the other vector
+      void copyLeaf() const {
+	if (direction)                                          // If direction of data is from bodies to buffer
+	  for (int i=begin; i<end; i++) buffer[i] = bodies[i];  //  Copy bodies to buffer
+      }
       //! Exclusive scan with offset
       inline ivec8 exclusiveScan(ivec8 input, int offset) const {
 	ivec8 output;                                           // Output vector
@@ -182,9 +256,8 @@ namespace exafmm {
 	  octNode = NULL;                                       //   Assign null pointer
 	  return;                                               //   End buildNodes()
 	}                                                       //  End if for no bodies
-	if (end - begin <= ncrit) {                             //  If number of bodies is less than threshold
-	  if (direction)                                        //   If direction of data is from bodies to buffer
-	    for (int i=begin; i<end; i++) buffer[i] = bodies[i];//    Copy bodies to buffer
+	if (end - begin <= ncrit && (costModel == NULL || end - begin <= 1)) {// If number of bodies is less than threshold
+	  copyLeaf();                                           //   Bodies of leaf end up in bodies
 	  octNode = makeOctNode(true);                          //   Create an octree node and assign it's pointer
 	  return;                                               //   End buildNodes()
 	}                                                       //  End if for number of bodies
@@ -195,6 +268,15 @@ namespace exafmm {
 	countBodies();                                          //  Count bodies in each octant using binary recursion
 	tic = logger::get_time();
 	timer["Count bodies"] += tic - toc;
+	if (end - begin <= ncrit) {                             //  If cost model decides split
+	  int nbody8[8];                                        //   Number of bodies in each octant
+	  for (int i=0; i<8; i++) nbody8[i] = binNode->NBODY[i];//   Copy octant counts
+	  if (!costModel->split(end - begin, nbody8)) {         //   If splitting does not reduce cost
+	    copyLeaf();                                         //    Bodies of leaf end up in bodies
+	    for (int i=0; i<8; i++) octNode->CHILD[i] = NULL;   //    Keep node as a leaf
+	    return;                                             //    End buildNodes()
+	  }                                                     //   End if for splitting
+	}                                                       //  End if for cost model
 	ivec8 octantOffset = exclusiveScan(binNode->NBODY, begin);//  Exclusive scan to obtain offset from octant count
 	toc = logger::get_time();
 	timer["Exclusive scan"] += toc - tic; 
@@ -220,7 +302,7 @@ namespace exafmm {
 	  timer["Get node range"] += tic - toc;
 	  BuildNodes buildNodes(octNode->CHILD[i], buffer, bodies,//    Instantiate recursive functor
 				octantOffset[i], octantOffset[i] + binNode->NBODY[i],
-				&binNodeChild[i], Xchild, R0, ncrit, nspawn, timer, level+1, !direction);
+				&binNodeChild[i], Xchild, R0, ncrit, nspawn, costModel, timer, nodePool, level+1, !direction);
 	  create_taskc(buildNodes);                             //    Create new task for recursive call
 	  binNodeOffset += maxBinNode;                          //   Increment offset for binNode memory address
 	}                                                       //  End loop over children
@@ -251,14 +333,9 @@ namespace exafmm {
 	X0(_X0), R0(_R0), nspawn(_nspawn), numLevels(_numLevels), level(_level), iparent(_iparent) {}
       //! Get cell index
       uint64_t getKey(vec3 X, vec3 Xmin, real_t diameter) const {
-	int iX[3] = {0, 0, 0};                                  // Initialize 3-D index
+	ivec3 iX;                                               // Initialize 3-D index
 	for (int d=0; d<3; d++) iX[d] = int((X[d] - Xmin[d]) / diameter);// 3-D index
-	uint64_t index = ((1 << 3 * level) - 1) / 7;            // Levelwise offset
-	for (int l=0; l<level; l++) {                           // Loop over levels
-	  for (int d=0; d<3; d++) index += (iX[d] & 1) << (3 * l + d); // Interleave bits into Morton key
-	  for (int d=0; d<3; d++) iX[d] >>= 1;                  //  Bitshift 3-D index
-	}                                                       // End loop over levels
-	return index;                                           // Return Morton key
+	return Key::getKey(iX, level);                          // Return key with level offset
       }
       void operator() () const {                                // Overload operator()
 	C->IPARENT = iparent;                                   //  Index of parent cell
@@ -267,7 +344,7 @@ namespace exafmm {
 	C->NBODY   = octNode->NBODY;                            //  Number of decendant bodies
 	C->IBODY   = octNode->IBODY;                            //  Index of first body in cell
 	C->BODY    = B0 + C->IBODY;                             //  Iterator of first body in cell
-	C->ICELL   = getKey(C->X, X0-R0, 2*C->R);               //  Get Morton key
+	C->ICELL   = getKey(C->X, X0-R0, 2*C->R);               //  Get key
 	if (octNode->NNODE == 1) {                              //  If node has no children
 	  C->ICHILD = 0;                                        //   Set index of first child cell to zero
 	  C->NCHILD = 0;                                        //   Number of child cells
@@ -298,10 +375,6 @@ namespace exafmm {
 	    CN += octNode->CHILD[octant]->NNODE - 1;            //    Increment next free memory address
 	  }                                                     //   End loop over children
 	  wait_tasks;                                           //   Synchronize tasks
-	  for (int i=0; i<nchild; i++) {                        //   Loop over children
-	    int octant = octants[i];                            //    Get octant from child index
-	    delete octNode->CHILD[octant];                      //    Free child pointer to avoid memory leak
-	  }                                                     //   End loop over children
 	  numLevels = std::max(numLevels, level+1);             //   Update maximum level of tree
 	}                                                       //  End if for child existance
       }                                                         // End overload operator()
@@ -329,13 +402,13 @@ namespace exafmm {
       B0 = bodies.begin();                                      // Bodies iterator
       BinaryTreeNode binNode[1];                                // Allocate root node of binary tree
       int maxBinNode = (4 * bodies.size()) / nspawn;            // Get maximum size of binary tree
-      binNode->BEGIN = new BinaryTreeNode[maxBinNode];          // Allocate array for binary tree nodes
+      if (int(binNodeArena.size()) < maxBinNode + 1) binNodeArena.resize(maxBinNode + 1);// Grow binary tree array
+      binNode->BEGIN = &binNodeArena[0];                        // Reuse array for binary tree nodes
       binNode->END = binNode->BEGIN + maxBinNode;               // Set end pointer
       logger::Timer timer;
       BuildNodes buildNodes(N0, bodies, buffer, 0, bodies.size(),
-			    binNode, box.X, box.R, ncrit, nspawn, timer);// Instantiate recursive functor
+			    binNode, box.X, box.R, ncrit, nspawn, costModel, timer, nodePool);// Instantiate recursive functor
       buildNodes();                                             // Recursively build octree nodes
-      delete[] binNode->BEGIN;                                  // Deallocate binary tree array
 #if 0
       logger::printTitle("Grow tree");
       std::cout << std::setw(logger::stringLength) << std::left
@@ -365,14 +438,20 @@ namespace exafmm {
 	C_iter C0 = cells.begin();                              //  Cell begin iterator
 	Nodes2cells nodes2cells(N0, B0, C0, C0, C0+1, box.X, box.R, nspawn, numLevels);// Instantiate recursive functor
 	nodes2cells();                                          //  Convert nodes to cells recursively
-	delete N0;                                              //  Deallocate nodes
+	nodePool.release();                                     //  Release all nodes at once
+	N0 = NULL;                                              //  Root node is released
       }                                                         // End if for empty node tree
       logger::stopTimer("Link tree");                           // Stop timer
       return cells;                                             // Return cells array
     }
 
   public:
-    BuildTree(int _ncrit, int _nspawn) : ncrit(_ncrit), nspawn(_nspawn), numLevels(0) {}
+    BuildTree(int _ncrit, int _nspawn) : ncrit(_ncrit), nspawn(_nspawn), costModel(NULL), numLevels(0) {}
+
+    //! Split cells by cost model, ncrit becomes an upper bound of bodies per leaf
+    void setCostModel(const CostModel<Kernel> * _costModel) {
+      costModel = _costModel;                                   // Set cost model
+    }
 
     //! Build tree structure top down
     Cells buildTree(Bodies & bodies, Bodies & buffer, Bounds bounds) {
@@ -0,0 +1,252 @@
+#ifndef cost_model_h
+#define cost_model_h
+#include <cmath>
+#include "logger.h"
+#include "types.h"
+
+namespace exafmm {
+  //! Cost model for deciding per cell whether splitting it is cheaper than keeping it as a leaf
+  /*!
+    The cost of each kernel is measured once by a microbenchmark of the selected
+    Kernel at its P. A leaf with n bodies costs numNear * n^2 pairs of P2P. Splitting
+    it into children with n_i bodies reduces this to numNear * sum(n_i^2) pairs, but
+    adds numFar M2L calls and one M2M/L2L per child, and nchild-1 more calls of P2M
+    and L2P over the same bodies. numNear and numFar are the sizes of the near and
+    far lists of a uniform tree for the given theta.
+    The same timings select the cheapest of M2L, M2P, P2L and P2P for a pair of
+    cells that already satisfies the MAC, which is Teng's cost-aware BH MAC.
+    Splitting by cost is honoured by the OpenMP, radix and TBB tree builders. The
+    Cilk builder builds a uniform tree of fixed depth and splits by ncrit only.
+    Timings differ between ranks, so MPI codes should reduce them with getTimes()
+    and setTimes() to build the same kind of tree everywhere.
+  */
+  template<typename Kernel>
+  class CostModel {
+    typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
+    typedef typename Kernel::Cells Cells;                       //!< Vector of cells
+    typedef typename Kernel::B_iter B_iter;                     //!< Iterator of body vector
+    typedef typename Kernel::C_iter C_iter;                     //!< Iterator of cell vecto
+
+  public:
+    //! Kernels timed by the cost model
+    enum Operator {
+      P2P,                                                      //!< Particle to particle
+      M2L,                                                      //!< Multipole to local
+      M2M,                                                      //!< Multipole to multipole
+      L2L,                                                      //!< Local to local
+      M2P,                                                      //!< Multipole to particle
+      P2L,                                                      //!< Particle to local
+      P2M,                                                      //!< Particle to multipole
+      L2P,                                                      //!< Local to particle
+      numOperators                                              //!< Number of timed kernels
+    };
+
+  private:
+    int numNear;                                                //!< Number of cells in near list
+    int numFar;                                                 //!< Number of cells in far list
+    double timeP2P;                                             //!< Time of P2P per pair of bodies
+    double timeM2L;                                             //!< Time of M2L per call
+    double timeM2M;                                             //!< Time of M2M per call
+    double timeL2L;                                             //!< Time of L2L per call
+    double timeM2P;                                             //!< Time of M2P per target body
+    double timeP2L;                                             //!< Time of P2L per source body
+    double timeP2M;                                             //!< Time of P2M per call for one body
+    double timeL2P;                                             //!< Time of L2P per call for one body
+
+    //! Time per call of a kernel, repeated until minimum time has passed
+    double timeKernel(Operator kernel, C_iter C0) {
+      const double minTime = 2e-3;                              // Minimum time of measurement
+      C_iter Ci = C0, Cj = C0 + 1, CJ = C0 + 2;                 // Target, source and parent of source cells
+      const vec3 Xperiodic = 0;                                 // Periodic coordinate offset
+      int numCalls = 0;                                         // Number of kernel calls
+      double tic = logger::get_time(), toc = tic;               // Start time
+      while (toc - tic < minTime) {                             // Loop until minimum time has passed
+	for (int i=0; i<8; i++) {                               //  Loop over batch of calls
+	  switch (kernel) {                                     //   Case switch for kernel
+	  case P2P:                                             //   P2P kernel
+	    Kernel::P2P(Ci, Cj, Xperiodic, false);              //    P2P between target and source cells
+	    break;                                              //   Break P2P kernel
+	  case M2L:                                             //   M2L kernel
+	    Kernel::M2L(Ci, Cj, Xperiodic, false);              //    M2L between target and source cells
+	    break;                                              //   Break M2L kernel
+	  case M2M:                                             //   M2M kernel
+	    Kernel::M2M(CJ, C0);                                //    M2M from source cell to its parent
+	    break;                                              //   Break M2M kernel
+	  case L2L:                                             //   L2L kernel
+	    Kernel::L2L(Cj, C0);                                //    L2L from parent to source cell
+	    break;                                              //   Break L2L kernel
+	  case M2P:                                             //   M2P kernel
+	    Kernel::M2P(Ci, Cj, Xperiodic);                     //    M2P from source cell to target bodies
+	    break;                                              //   Break M2P kernel
+	  case P2L:                                             //   P2L kernel
+	    Kernel::P2L(Ci, Cj, Xperiodic);                     //    P2L from source bodies to target cell
+	    break;                                              //   Break P2L kernel
+	  case P2M:                                             //   P2M kernel
+	    Kernel::P2M(Cj);                                    //    P2M from source bodies to source cell
+	    break;                                              //   Break P2M kernel
+	  default:                                              //   L2P kernel
+	    Kernel::L2P(Ci);                                    //    L2P from target cell to target bodies
+	  }                                                     //   End case switch for kernel
+	}                                                       //  End loop over batch of calls
+	numCalls += 8;                                          //  Increment number of calls
+	toc = logger::get_time();                               //  Stop time
+      }                                                         // End loop for minimum time
+      return (toc - tic) / numCalls;                            // Return time per call
+    }
+
+  public:
+    //! Constructor
+    CostModel(real_t theta) : timeP2P(0), timeM2L(0), timeM2M(0), timeL2L(0), timeM2P(0), timeP2L(0),
+			      timeP2M(0), timeL2P(0) {
+      int r = std::max(int(1 / theta), 1);                      // Near cells per direction for MAC of equal cells
+      numNear = (2 * r + 1) * (2 * r + 1) * (2 * r + 1);        // Near cells of a uniform tree
+      numFar = 8 * numNear - numNear;                           // Children of parent's near cells that are far
+    }
+
+    //! Measure cost of kernels for two cells of nbody bodies
+    void calibrate(int nbody=64) {
+      logger::startTimer("Calibrate cost");                     // Start timer
+      Bodies bodies(2 * nbody);                                 // Bodies of target and source cells
+      for (B_iter B=bodies.begin(); B!=bodies.end(); B++) {     // Loop over bodies
+	int i = B - bodies.begin();                             //  Index of body
+	B->X[0] = i * 0.618034 - int(i * 0.618034);             //  Quasi-random x coordinate in unit cube
+	B->X[1] = i * 0.754878 - int(i * 0.754878);             //  Quasi-random y coordinate in unit cube
+	B->X[2] = i * 0.569840 - int(i * 0.569840);             //  Quasi-random z coordinate in unit cube
+	if (i >= nbody) B->X[0] += 3;                           //  Separate source cell from target cell
+	B->SRC = 1;                                             //  Initialize source values
+	B->TRG = 0;                                             //  Initialize target values
+      }                                                         // End loop over bodies
+      Cells cells(3);                                           // Target, source and parent of source cells
+      for (C_iter C=cells.begin(); C!=cells.end(); C++) {       // Loop over cells
+	C->X = .5;                                              //  Center of cell
+	C->R = .5;                                              //  Radius of cell
+	C->SCALE = 1;                                           //  Scale of cell
+	C->IPARENT = C->ICHILD = C->NCHILD = 0;                 //  Initialize links
+	C->BODY = bodies.begin();                               //  Bodies of target cell
+	C->NBODY = nbody;                                       //  Number of bodies
+	C->M = 0;                                               //  Initialize multipole expansion coefficients
+	C->L = 0;                                               //  Initialize local expansion coefficients
+      }                                                         // End loop over cells
+      C_iter Ci = cells.begin();                                // Target cell
+      C_iter Cj = cells.begin() + 1;                            // Source cell
+      Cj->X[0] += 3;                                            // Separate source cell from target cell
+      Cj->BODY = bodies.begin() + nbody;                        // Bodies of source cell
+      Cj->IPARENT = 2;                                          // Parent of source cell
+      C_iter CJ = cells.begin() + 2;                            // Parent of source cell
+      CJ->X[0] += 3.5;                                          // Center of parent cell
+      CJ->R = CJ->SCALE = 1;                                    // Radius and scale of parent cell
+      CJ->ICHILD = 1;                                           // First child of parent cell
+      CJ->NCHILD = 1;                                           // Number of children of parent cell
+      Kernel::P2M(Cj);                                          // Multipole expansion of source cell
+      timeP2P = timeKernel(P2P, cells.begin()) / (double(nbody) * nbody);// Time of P2P per pair
+      timeM2L = timeKernel(M2L, cells.begin());                 // Time of M2L per call
+      timeM2M = timeKernel(M2M, cells.begin());                 // Time of M2M per call
+      timeL2L = timeKernel(L2L, cells.begin());                 // Time of L2L per call
+      timeM2P = timeKernel(M2P, cells.begin()) / nbody;         // Time of M2P per target body
+      timeP2L = timeKernel(P2L, cells.begin()) / nbody;         // Time of P2L per source body
+      Ci->NBODY = Cj->NBODY = 1;                                // Single body, per body cost cancels when splitting
+      timeP2M = timeKernel(P2M, cells.begin());                 // Time of P2M per call
+      timeL2P = timeKernel(L2P, cells.begin());                 // Time of L2P per call
+      logger::stopTimer("Calibrate cost");                      // Stop timer
+    }
+
+    //! Check if splitting a cell of nbody bodies into octants of nbody8 bodies reduces cost
+    bool split(int nbody, const int * nbody8) const {
+      double sum = 0;                                           // Sum of squared bodies in octants
+      int nchild = 0;                                           // Number of non-empty octants
+      for (int i=0; i<8; i++) {                                 // Loop over octants
+	sum += double(nbody8[i]) * nbody8[i];                   //  Add squared bodies in octant
+	if (nbody8[i] != 0) nchild++;                           //  Count non-empty octants
+      }                                                         // End loop over octants
+      double saveP2P = numNear * timeP2P * (double(nbody) * nbody - sum);// Time of P2P saved by splitting
+      double costFar = nchild * (numFar * timeM2L + timeM2M + timeL2L)// Time of far field added by splitting
+	+ (nchild - 1) * (timeP2M + timeL2P);                   // Bodies are expanded by nchild cells instead of one
+      return saveP2P > costFar;                                 // Split if it saves time
+    }
+
+    //! Get times of kernels in the order of Operator, e.g. to reduce them across ranks
+    void getTimes(double * times) const {
+      times[P2P] = timeP2P;                                     // Time of P2P per pair of bodies
+      times[M2L] = timeM2L;                                     // Time of M2L per call
+      times[M2M] = timeM2M;                                     // Time of M2M per call
+      times[L2L] = timeL2L;                                     // Time of L2L per call
+      times[M2P] = timeM2P;                                     // Time of M2P per target body
+      times[P2L] = timeP2L;                                     // Time of P2L per source body
+      times[P2M] = timeP2M;                                     // Time of P2M per call
+      times[L2P] = timeL2P;                                     // Time of L2P per call
+    }
+
+    //! Set times of kernels in the order of Operator, instead of calibrating them
+    void setTimes(const double * times) {
+      timeP2P = times[P2P];                                     // Time of P2P per pair of bodies
+      timeM2L = times[M2L];                                     // Time of M2L per call
+      timeM2M = times[M2M];                                     // Time of M2M per call
+      timeL2L = times[L2L];                                     // Time of L2L per call
+      timeM2P = times[M2P];                                     // Time of M2P per target body
+      timeP2L = times[P2L];                                     // Time of P2L per source body
+      timeP2M = times[P2M];                                     // Time of P2M per call
+      timeL2P = times[L2P];                                     // Time of L2P per call
+    }
+
+    //! Select the cheapest kernel for a pair of cells that satisfies the MAC
+    /*!
+      Returns P2P, M2L, M2P or P2L. Pass 0 for nbodyi (nbodyj) if the target (source)
+      bodies cannot be used, which leaves M2L and P2L (M2P) as the only choices.
+    */
+    Operator select(int nbodyi, int nbodyj) const {
+      Operator kernel = M2L;                                    // Default to M2L kernel
+      double cost = timeM2L;                                    // Time of M2L per call
+      if (nbodyi * timeM2P < cost && nbodyi > 0) {              // If M2P is cheaper
+	kernel = M2P;                                           //  Select M2P kernel
+	cost = nbodyi * timeM2P;                                //  Time of M2P
+      }                                                         // End if for M2P
+      if (nbodyj * timeP2L < cost && nbodyj > 0) {              // If P2L is cheaper
+	kernel = P2L;                                           //  Select P2L kernel
+	cost = nbodyj * timeP2L;                                //  Time of P2L
+      }                                                         // End if for P2L
+      if (double(nbodyi) * nbodyj * timeP2P < cost && nbodyi > 0 && nbodyj > 0) {// If P2P is cheaper
+	kernel = P2P;                                           //  Select P2P kernel
+      }                                                         // End if for P2P
+      return kernel;                                            // Return selected kernel
+    }
+
+    //! Print calibrated cost of kernels
+    void printCostModel() {
+      if (logger::verbose) {                                    // If verbose flag is true
+	double leafCost = (64 * (numFar * timeM2L + timeM2M + timeL2L) + 56 * (timeP2M + timeL2P))// n^2 at uniform break-even
+	  / (7 * numNear * timeP2P);
+	logger::printTitle("Cost model");                       //  Print title
+	std::cout << std::setw(logger::stringLength) << std::left //  Set format
+		  << "P2P per pair" << " : "                    //  Print title
+		  << std::setprecision(logger::decimal) << std::scientific // Set format
+		  << timeP2P << " s" << std::endl               //  Print time of P2P per pair
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "M2L per call" << " : "                    //  Print title
+		  << timeM2L << " s" << std::endl               //  Print time of M2L per call
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "M2M per call" << " : "                    //  Print title
+		  << timeM2M << " s" << std::endl               //  Print time of M2M per call
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "L2L per call" << " : "                    //  Print title
+		  << timeL2L << " s" << std::endl               //  Print time of L2L per call
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "M2P per body" << " : "                    //  Print title
+		  << timeM2P << " s" << std::endl               //  Print time of M2P per target body
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "P2L per body" << " : "                    //  Print title
+		  << timeP2L << " s" << std::endl               //  Print time of P2L per source body
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "P2M per call" << " : "                    //  Print title
+		  << timeP2M << " s" << std::endl               //  Print time of P2M per call
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "L2P per call" << " : "                    //  Print title
+		  << timeL2P << " s" << std::endl               //  Print time of L2P per call
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "Uniform leaf size" << " : "               //  Print title
+		  << std::setprecision(0) << std::fixed         //  Set format
+		  << std::sqrt(leafCost) << std::endl;          //  Print break-even leaf size of uniform tree
+      }                                                         // End if for verbose flag
+    }
+  };
+}
+#endif
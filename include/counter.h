@@ -0,0 +1,165 @@
+#ifndef counter_h
+#define counter_h
+#include <iomanip>
+#include <iostream>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+#include "logger.h"
+#include "types.h"
+
+namespace exafmm {
+  //! Per-thread counters of kernel calls, interactions and cycles
+  /*!
+    Each thread accumulates into its own counters, which are registered on first use and
+    merged by print(). Counting is compiled in with EXAFMM_COUNT_KERNEL; otherwise start()
+    and stop() are empty, so the calls in the kernels' callers cost nothing.
+  */
+  namespace counter {
+    //! Operators that are counted
+    enum Operator {
+      P2P,                                                      //!< Particle to particle
+      P2M,                                                      //!< Particle to multipole
+      M2M,                                                      //!< Multipole to multipole
+      M2L,                                                      //!< Multipole to local
+      M2P,                                                      //!< Multipole to particle
+      P2L,                                                      //!< Particle to local
+      L2L,                                                      //!< Local to local
+      L2P,                                                      //!< Local to particle
+      numOperators                                              //!< Number of operators
+    };
+
+    //! Counters of one thread
+    struct Counts {
+      double calls[numOperators];                               //!< Number of kernel calls
+      double interactions[numOperators];                        //!< Number of interactions
+      double cycles[numOperators];                              //!< Cycles spent in kernel
+      Counts() {                                                //!< Constructor
+	for (int i=0; i<numOperators; i++) {                    //  Loop over operators
+	  calls[i] = interactions[i] = cycles[i] = 0;           //   Initialize counters
+	}                                                       //  End loop over operators
+      }
+    };
+
+#if EXAFMM_COUNT_KERNEL
+    std::vector<Counts*> threadCounts;                          //!< Counters of all threads
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;          //!< Mutex for registering counters
+    __thread Counts * localCounts = NULL;                       //!< Counters of this thread
+
+    //! Counters of this thread, registered on first use
+    inline Counts & local() {
+      if (localCounts == NULL) {                                // If this thread has no counters yet
+	localCounts = new Counts;                               //  Allocate counters
+	pthread_mutex_lock(&mutex);                             //  Lock mutex
+	threadCounts.push_back(localCounts);                    //  Register counters
+	pthread_mutex_unlock(&mutex);                           //  Unlock mutex
+      }                                                         // End if for first use
+      return *localCounts;                                      // Return counters of this thread
+    }
+
+    //! Start counting cycles of a kernel call
+    inline uint64_t start() {
+      return logger::get_cycle();                               // Cycle counter
+    }
+
+    //! Count a kernel call with its interactions, and the cycles since begin
+    inline void stop(Operator op, uint64_t begin, double interactions) {
+      uint64_t end = logger::get_cycle();                       // Cycle counter
+      Counts & counts = local();                                // Counters of this thread
+      counts.calls[op]++;                                       // Increment kernel calls
+      counts.interactions[op] += interactions;                  // Accumulate interactions
+      counts.cycles[op] += double(end - begin);                 // Accumulate cycles
+    }
+
+    //! Reset counters of all threads
+    inline void reset() {
+      pthread_mutex_lock(&mutex);                               // Lock mutex
+      for (size_t i=0; i<threadCounts.size(); i++) {            // Loop over threads
+	*threadCounts[i] = Counts();                            //  Reset counters
+      }                                                         // End loop over threads
+      pthread_mutex_unlock(&mutex);                             // Unlock mutex
+    }
+
+    //! Merge counters of all threads
+    inline Counts merge() {
+      Counts total;                                             // Sum of counters
+      pthread_mutex_lock(&mutex);                               // Lock mutex
+      for (size_t i=0; i<threadCounts.size(); i++) {            // Loop over threads
+	for (int op=0; op<numOperators; op++) {                 //  Loop over operators
+	  total.calls[op] += threadCounts[i]->calls[op];        //   Sum kernel calls
+	  total.interactions[op] += threadCounts[i]->interactions[op];// Sum interactions
+	  total.cycles[op] += threadCounts[i]->cycles[op];      //   Sum cycles
+	}                                                       //  End loop over operators
+      }                                                         // End loop over threads
+      pthread_mutex_unlock(&mutex);                             // Unlock mutex
+      return total;                                             // Return sum of counters
+    }
+
+    //! Cycles per second, measured against the wall clock
+    inline double getFrequency() {
+      double time = logger::get_time();                         // Wall clock at start
+      uint64_t begin = logger::get_cycle();                     // Cycle counter at start
+      while (logger::get_time() - time < 0.01);                 // Busy wait for 10 ms
+      uint64_t end = logger::get_cycle();                       // Cycle counter at end
+      return double(end - begin) / (logger::get_time() - time); // Return cycles per second
+    }
+#else
+    inline uint64_t start() { return 0; }
+    inline void stop(Operator, uint64_t, double) {}
+    inline void reset() {}
+#endif
+
+    //! Nominal floating point operations per interaction of each operator of Kernel
+    /*!
+      P2P interactions are pairs of bodies, P2M, M2P, P2L and L2P interactions are bodies,
+      and translations are calls. Translations are counted as dense complex (Spherical) or
+      real (Cartesian) products of NTERM coefficients with P^2 or NTERM terms, and the body
+      operators as one evaluation of the NTERM harmonics or monomials.
+    */
+    template<typename Kernel>
+    void getFlops(double * flops) {
+      const double NTERM = Kernel::NTERM;                       // Number of expansion terms
+      const double P2 = Kernel::P * Kernel::P;                  // Number of source terms of a spherical translation
+      bool spherical = Kernel::basis == Spherical;              // Complex spherical harmonics or real monomials
+      double translation = spherical ? 8 * NTERM * P2 : 2 * NTERM * NTERM;// Flops per translation
+      double body = spherical ? 16 * NTERM : 4 * NTERM;         // Flops per body of P2M, M2P, P2L and L2P
+      flops[P2P] = Kernel::equation == Laplace ? 20 : Kernel::equation == Helmholtz ? 40 : 30;// Flops per pair
+      flops[P2M] = flops[M2P] = flops[P2L] = flops[L2P] = body; // Flops per body
+      flops[M2M] = flops[M2L] = flops[L2L] = translation;       // Flops per translation
+    }
+
+#if EXAFMM_COUNT_KERNEL
+    //! Print calls, interactions, cycles per interaction and GFLOP/s of each operator
+    template<typename Kernel>
+    void print() {
+      if (!logger::verbose) return;                             // Print only if verbose
+      const char * names[numOperators] = {"P2P", "P2M", "M2M", "M2L", "M2P", "P2L", "L2L", "L2P"};// Operator names
+      double flops[numOperators];                               // Flops per interaction
+      getFlops<Kernel>(flops);                                  // Nominal flops of Kernel
+      Counts total = merge();                                   // Sum of counters of all threads
+      double frequency = getFrequency();                        // Cycles per second
+      std::cout << "--- Kernel stats -----------------" << std::endl// Print title
+		<< std::setw(8) << std::left << "Kernel"        //  Column of operator
+		<< std::setw(12) << std::right << "calls"       //  Column of calls
+		<< std::setw(14) << "interactions"              //  Column of interactions
+		<< std::setw(12) << "cycles/int"                //  Column of cycles per interaction
+		<< std::setw(10) << "GFLOP/s" << std::endl;     //  Column of flop rate
+      for (int op=0; op<numOperators; op++) {                   // Loop over operators
+	if (total.calls[op] == 0) continue;                     //  Skip operators that were not called
+	double cycles = total.cycles[op] / total.interactions[op];// Cycles per interaction
+	double gflops = flops[op] * frequency / cycles / 1e9;   //  Flop rate of one thread
+	std::cout << std::setw(8) << std::left << names[op]     //  Print operator name
+		  << std::setw(12) << std::right << std::setprecision(0) << std::fixed
+		  << total.calls[op]                            //  Print calls
+		  << std::setw(14) << total.interactions[op]    //  Print interactions
+		  << std::setw(12) << std::setprecision(1) << cycles// Print cycles per interaction
+		  << std::setw(10) << std::setprecision(2) << gflops << std::endl;// Print flop rate
+      }                                                         // End loop over operators
+    }
+#else
+    template<typename Kernel>
+    void print() {}
+#endif
+  }
+}
+#endif
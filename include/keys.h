@@ -0,0 +1,143 @@
+#ifndef keys_h
+#define keys_h
+#include "config.h"
+#include "types.h"
+
+namespace exafmm {
+  const int maxKeyLevel = 21;                                   //!< Finest level representable in 64-bit keys
+
+  //! Offset of keys in a given level (number of cells in coarser levels)
+  inline uint64_t levelOffset(int level) {
+    return ((uint64_t(1) << 3 * level) - 1) / 7;                // Sum of 8^l for l<level
+  }
+
+  //! Get level from key with level offset
+  inline int getLevel(uint64_t key) {
+    int level = 0;                                              // Initialize level
+    while (level < maxKeyLevel && key >= levelOffset(level+1)) level++;// Increment level while key exceeds offset
+    return level;                                               // Return level
+  }
+
+  //! Morton (Z-order) keys
+  struct MortonKey {
+    //! Interleave 3-D index into key without level offset
+    static uint64_t interleave(ivec3 iX, int level) {
+      uint64_t key = 0;                                         // Initialize key
+      for (int l=0; l<level; l++) {                             // Loop over levels
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  key |= uint64_t((iX[d] >> l) & 1) << (3 * l + d);     //   Interleave bits for each dimension
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over levels
+      return key;                                               // Return Morton key
+    }
+
+    //! Deinterleave key without level offset into 3-D index
+    static ivec3 deinterleave(uint64_t key, int level) {
+      ivec3 iX = 0;                                             // Initialize 3-D index
+      for (int l=0; l<level; l++) {                             // Loop over levels
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  iX[d] |= int((key >> (3 * l + d)) & 1) << l;          //   Deinterleave bits for each dimension
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over levels
+      return iX;                                                // Return 3-D index
+    }
+
+    //! Get key with level offset
+    static uint64_t getKey(ivec3 iX, int level) {
+      return levelOffset(level) + interleave(iX, level);        // Add level offset to Morton key
+    }
+
+    //! Get 3-D index from key with level offset
+    static ivec3 getIndex(uint64_t key) {
+      int level = getLevel(key);                                // Level of key
+      return deinterleave(key - levelOffset(level), level);     // Deinterleave key without offset
+    }
+  };
+
+  //! Hilbert keys (Skilling, AIP Conf. Proc. 707, 2004)
+  /*!
+    Keys of level l are the leading 3*l bits of the key at maxKeyLevel, so that
+    cells of every level occupy contiguous ranges of the finest curve.
+  */
+  struct HilbertKey {
+    //! Interleave 3-D index into key without level offset
+    static uint64_t interleave(ivec3 iX, int level) {
+      const int shift = maxKeyLevel - level;                    // Number of levels below this level
+      int X[3];                                                 // Transposed Hilbert index
+      for (int d=0; d<3; d++) X[d] = iX[d] << shift;            // Coordinates at finest level
+      for (int Q=1<<(maxKeyLevel-1); Q>1; Q>>=1) {              // Loop over bits (inverse undo)
+	int P = Q - 1;                                          //  Mask of lower bits
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  if (X[d] & Q) {                                       //   If bit is set
+	    X[0] ^= P;                                          //    Invert lower bits of first dimension
+	  } else {                                              //   Else if bit is not set
+	    int t = (X[0] ^ X[d]) & P;                          //    Exchange lower bits with first dimension
+	    X[0] ^= t;                                          //    Swap first dimension
+	    X[d] ^= t;                                          //    Swap current dimension
+	  }                                                     //   End if for bit
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over bits
+      for (int d=1; d<3; d++) X[d] ^= X[d-1];                   // Gray encode
+      int t = 0;                                                // Initialize Gray mask
+      for (int Q=1<<(maxKeyLevel-1); Q>1; Q>>=1) {              // Loop over bits
+	if (X[2] & Q) t ^= Q - 1;                               //  Accumulate Gray mask
+      }                                                         // End loop over bits
+      for (int d=0; d<3; d++) X[d] ^= t;                        // Apply Gray mask
+      uint64_t key = 0;                                         // Initialize key
+      for (int l=0; l<maxKeyLevel; l++) {                       // Loop over levels
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  key |= uint64_t((X[d] >> l) & 1) << (3 * l + 2 - d);  //   Interleave transposed bits
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over levels
+      return key >> 3 * shift;                                  // Truncate to current level
+    }
+
+    //! Deinterleave key without level offset into 3-D index
+    static ivec3 deinterleave(uint64_t key, int level) {
+      const int shift = maxKeyLevel - level;                    // Number of levels below this level
+      key <<= 3 * shift;                                        // Key at finest level
+      int X[3] = {0, 0, 0};                                     // Transposed Hilbert index
+      for (int l=0; l<maxKeyLevel; l++) {                       // Loop over levels
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  X[d] |= int((key >> (3 * l + 2 - d)) & 1) << l;       //   Deinterleave transposed bits
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over levels
+      int t = X[2] >> 1;                                        // Gray decode
+      for (int d=2; d>0; d--) X[d] ^= X[d-1];                   // Gray decode by H ^ (H/2)
+      X[0] ^= t;                                                // Gray decode first dimension
+      for (int Q=2; Q!=(1<<maxKeyLevel); Q<<=1) {               // Loop over bits (undo excess work)
+	int P = Q - 1;                                          //  Mask of lower bits
+	for (int d=2; d>=0; d--) {                              //  Loop over dimensions
+	  if (X[d] & Q) {                                       //   If bit is set
+	    X[0] ^= P;                                          //    Invert lower bits of first dimension
+	  } else {                                              //   Else if bit is not set
+	    int t = (X[0] ^ X[d]) & P;                          //    Exchange lower bits with first dimension
+	    X[0] ^= t;                                          //    Swap first dimension
+	    X[d] ^= t;                                          //    Swap current dimension
+	  }                                                     //   End if for bit
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over bits
+      ivec3 iX;                                                 // 3-D index
+      for (int d=0; d<3; d++) iX[d] = X[d] >> shift;            // Coordinates at current level
+      return iX;                                                // Return 3-D index
+    }
+
+    //! Get key with level offset
+    static uint64_t getKey(ivec3 iX, int level) {
+      return levelOffset(level) + interleave(iX, level);        // Add level offset to Hilbert key
+    }
+
+    //! Get 3-D index from key with level offset
+    static ivec3 getIndex(uint64_t key) {
+      int level = getLevel(key);                                // Level of key
+      return deinterleave(key - levelOffset(level), level);     // Deinterleave key without offset
+    }
+  };
+
+#ifdef EXAFMM_HILBERT
+  typedef HilbertKey DefaultKey;                                //!< Space filling curve used for keys
+#else
+  typedef MortonKey DefaultKey;                                 //!< Space filling curve used for keys
+#endif
+}
+#endif
@@ -0,0 +1,60 @@
+#ifndef mac_h
+#define mac_h
+#include <cmath>
+#include "types.h"
+
+namespace exafmm {
+  //! What the dual tree traversal does with a pair of cells for one periodic image
+  enum PairType {
+    PairSkip,                                                   //!< Beyond the cutoff, nothing is evaluated
+    PairFar,                                                    //!< Far enough for the far field kernels
+    PairNear,                                                   //!< Pair of leafs for P2P
+    PairSplit                                                   //!< Too close, one or both cells are split
+  };
+
+  //! Which cells of a pair are split
+  enum SplitType {
+    SplitTarget,                                                //!< Children of Ci with Cj
+    SplitSource,                                                //!< Ci with children of Cj
+    SplitBoth                                                   //!< Children of Ci with children of Cj
+  };
+
+  //! Multipole acceptance criterion of the dual tree traversal for Cj shifted by Xperiodic
+  /*!
+    With cutoff > 0, pairs beyond the cutoff are skipped and the far field is not
+    evaluated. inside is set for pairs of leafs whose bodies are all within the cutoff.
+    Traversal and TreeMPI::pullLET() both decide with this, so that the pulled tree
+    holds exactly the cells that the traversal reads.
+  */
+  template<typename C_iter>
+  PairType getPairType(C_iter Ci, C_iter Cj, const vec3 & Xperiodic, real_t cutoff, bool & inside) {
+    vec3 dX = Ci->X - Cj->X - Xperiodic;                        // Distance vector from source to target
+    real_t R2 = norm(dX);                                       // Scalar distance squared
+    bool leafs = Ci->NCHILD == 0 && Cj->NCHILD == 0;            // Flag for pair of leafs
+    inside = false;                                             // Not known to be within cutoff
+    if (cutoff > 0) {                                           // If cutoff traversal
+      real_t R = std::sqrt(R2);                                 //  Distance between cell centers
+      real_t Rsum = (Ci->R + Cj->R) * std::sqrt(real_t(3));     //  Radii of spheres around cubic cells
+      if (R - Rsum >= cutoff) return PairSkip;                  //  Pair is beyond the cutoff
+      inside = R + Rsum < cutoff;                               //  All pairs of bodies are within cutoff
+      return leafs ? PairNear : PairSplit;                      //  P2P for leafs, split otherwise
+    }                                                           // End if for cutoff traversal
+    if (R2 > (Ci->R+Cj->R) * (Ci->R+Cj->R) * (1 - 1e-3)) return PairFar;// Distance is far enough
+    return leafs ? PairNear : PairSplit;                        // P2P for leafs, split otherwise
+  }
+
+  //! Splitting rule of the dual tree traversal for a pair that is not a pair of leafs
+  /*!
+    Leafs are never split. Large pairs (and Ci == Cj for mutual traversal) split both
+    cells, so that their children can be traversed concurrently, and otherwise the
+    larger cell is split.
+  */
+  template<typename C_iter>
+  SplitType getSplitType(C_iter Ci, C_iter Cj, int nspawn, bool mutual) {
+    if (Cj->NCHILD == 0) return SplitTarget;                    // Cj is leaf
+    if (Ci->NCHILD == 0) return SplitSource;                    // Ci is leaf
+    if (Ci->NBODY + Cj->NBODY >= nspawn || (mutual && Ci == Cj)) return SplitBoth;// Cells are still large
+    return Ci->R >= Cj->R ? SplitTarget : SplitSource;          // Split the larger cell
+  }
+}
+#endif
@@ -0,0 +1,247 @@
+#ifndef node_mpi_h
+#define node_mpi_h
+#include <mpi.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace exafmm {
+  //! Two-level communication through node communicators and node leaders
+  /*!
+    Ranks that share memory (MPI_COMM_TYPE_SHARED) form a node, which is split further
+    into groups of at most nodeSize ranks, so that several nodes can be emulated on one
+    machine. Within a node, data is copied directly out of MPI shared memory windows, and
+    only the node leaders (rank 0 of each node) communicate between nodes.
+  */
+  class NodeMPI {
+  private:
+    int mpirank;                                                //!< Rank of MPI communicator
+    int mpisize;                                                //!< Size of MPI communicator
+    std::vector<std::vector<int> > nodeRanks;                   //!< Ranks of each node in ascending order
+#if MPI_VERSION >= 3
+    MPI_Win countWin;                                           //!< Shared window of counts and displacements
+    std::vector<int*> counts;                                   //!< Counts and displacements of each rank of this node
+    MPI_Win sendWin;                                            //!< Shared window of send buffers
+    std::vector<int*> sendBase;                                 //!< Send buffers of each rank of this node
+    int sendCapacity;                                           //!< Words of send window on this rank
+    MPI_Win recvWin;                                            //!< Shared window of messages from other nodes
+    std::vector<int*> recvBase;                                 //!< Messages of each rank of this node
+    int recvCapacity;                                           //!< Words of message window on this rank
+#endif
+
+  public:
+    MPI_Comm nodeComm;                                          //!< Communicator of ranks in this node
+    MPI_Comm leaderComm;                                        //!< Communicator of node leaders
+    int noderank;                                               //!< Rank in node communicator
+    int nodesize;                                               //!< Size of node communicator
+    int inode;                                                  //!< Index of this node
+    int numNodes;                                               //!< Number of nodes
+
+  private:
+#if MPI_VERSION >= 3
+    //! Allocate a node shared window with size words on this rank, and get base pointers of all ranks in the node
+    int * allocateWindow(int size, MPI_Win & win, std::vector<int*> & bases) {
+      int * base;                                               // Base pointer of this rank
+      MPI_Win_allocate_shared(MPI_Aint(size)*sizeof(int), sizeof(int), MPI_INFO_NULL, nodeComm, &base, &win);// Allocate window
+      MPI_Win_lock_all(MPI_MODE_NOCHECK, win);                  // Passive target epoch for loads and stores
+      bases.resize(nodesize);                                   // Resize base pointers
+      for (int i=0; i<nodesize; i++) {                          // Loop over ranks in node
+	MPI_Aint bytes;                                         //  Size of window segment
+	int unit;                                               //  Displacement unit of window segment
+	MPI_Win_shared_query(win, i, &bytes, &unit, &bases[i]); //  Get base pointer of rank in node
+      }                                                         // End loop over ranks in node
+      return base;                                              // Return base pointer of this rank
+    }
+
+    //! Free a node shared window
+    void freeWindow(MPI_Win & win) {
+      MPI_Win_unlock_all(win);                                  // End passive target epoch
+      MPI_Win_free(&win);                                       // Free window
+    }
+
+    //! Make sure a persistent node shared window holds size words on this rank, collective over the node
+    /*!
+      The window is reallocated only when some rank of the node needs more than its
+      capacity, and then grows at least twofold, so that repeated calls with similar
+      sizes reuse it.
+    */
+    int * reserveWindow(int size, MPI_Win & win, std::vector<int*> & bases, int & capacity) {
+      int grow = win == MPI_WIN_NULL || size > capacity;        // Flag for reallocating window
+      MPI_Allreduce(MPI_IN_PLACE, &grow, 1, MPI_INT, MPI_LOR, nodeComm);// Reallocate if any rank in node needs to
+      if (grow) {                                               // If window has to grow
+	if (win != MPI_WIN_NULL) freeWindow(win);               //  Free old window
+	capacity = std::max(size, 2 * capacity);                //  Grow capacity
+	allocateWindow(capacity, win, bases);                   //  Allocate new window
+      }                                                         // End if for growing window
+      return bases[noderank];                                   // Return base pointer of this rank
+    }
+
+    //! Make stores to shared windows visible to all ranks in the node
+    void syncWindow(MPI_Win win) {
+      MPI_Win_sync(win);                                        // Complete stores of this rank
+      MPI_Barrier(nodeComm);                                    // Wait for all ranks in node
+      MPI_Win_sync(win);                                        // Observe stores of other ranks
+    }
+#endif
+
+  public:
+    //! Constructor
+    /*!
+      Collective over MPI_COMM_WORLD. With nodeSize <= 0 nothing is set up and enabled() is false.
+    */
+    NodeMPI(int nodeSize) : nodeComm(MPI_COMM_NULL), leaderComm(MPI_COMM_NULL),
+			    noderank(0), nodesize(1), inode(0), numNodes(0) {
+#if MPI_VERSION >= 3
+      sendWin = recvWin = MPI_WIN_NULL;                         // Windows are allocated on first use
+      sendCapacity = recvCapacity = 0;                          // No capacity yet
+#endif
+      MPI_Comm_rank(MPI_COMM_WORLD, &mpirank);                  // Get rank of current MPI process
+      MPI_Comm_size(MPI_COMM_WORLD, &mpisize);                  // Get number of MPI processes
+      if (nodeSize <= 0) return;                                // Two-level communication is not used
+#if MPI_VERSION >= 3
+      MPI_Comm sharedComm;                                      // Communicator of ranks sharing memory
+      MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, mpirank, MPI_INFO_NULL, &sharedComm);// Split by shared memory
+      int sharedrank;                                           // Rank in shared memory communicator
+      MPI_Comm_rank(sharedComm, &sharedrank);                   // Get rank in shared memory communicator
+      MPI_Comm_split(sharedComm, sharedrank / nodeSize, mpirank, &nodeComm);// Split into nodes of at most nodeSize ranks
+      MPI_Comm_free(&sharedComm);                               // Free shared memory communicator
+      MPI_Comm_rank(nodeComm, &noderank);                       // Get rank in node
+      MPI_Comm_size(nodeComm, &nodesize);                       // Get size of node
+      MPI_Comm_split(MPI_COMM_WORLD, noderank == 0 ? 0 : MPI_UNDEFINED, mpirank, &leaderComm);// Communicator of node leaders
+      if (noderank == 0) MPI_Comm_rank(leaderComm, &inode);     // Node index is rank among leaders
+      MPI_Bcast(&inode, 1, MPI_INT, 0, nodeComm);               // Broadcast node index to ranks in node
+      std::vector<int> nodeOf(mpisize);                         // Node of each rank
+      MPI_Allgather(&inode, 1, MPI_INT, &nodeOf[0], 1, MPI_INT, MPI_COMM_WORLD);// Gather node of each rank
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	numNodes = std::max(numNodes, nodeOf[irank] + 1);       //  Count nodes
+      }                                                         // End loop over ranks
+      nodeRanks.resize(numNodes);                               // Resize ranks of each node
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	nodeRanks[nodeOf[irank]].push_back(irank);              //  Ranks are ordered as in node communicator
+      }                                                         // End loop over ranks
+      allocateWindow(3*mpisize, countWin, counts);              // Shared send counts/displacements and receive counts
+#else
+      if (mpirank == 0) std::cerr << "Two-level communication requires MPI-3" << std::endl;
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);                  // Shared memory windows need MPI-3
+#endif
+    }
+
+    //! Destructor
+    ~NodeMPI() {
+      if (!enabled()) return;                                   // Nothing was set up
+      int finalized;                                            // Flag for MPI_Finalize
+      MPI_Finalized(&finalized);                                // Check if MPI_Finalize has been called
+      if (finalized) return;                                    // Handles are gone with MPI
+#if MPI_VERSION >= 3
+      freeWindow(countWin);                                     // Free window of counts
+      if (sendWin != MPI_WIN_NULL) freeWindow(sendWin);         // Free window of send buffers
+      if (recvWin != MPI_WIN_NULL) freeWindow(recvWin);         // Free window of messages
+#endif
+      if (leaderComm != MPI_COMM_NULL) MPI_Comm_free(&leaderComm);// Free communicator of node leaders
+      MPI_Comm_free(&nodeComm);                                 // Free node communicator
+    }
+
+    //! Check if two-level communication is set up
+    bool enabled() const {
+      return nodeComm != MPI_COMM_NULL;                         // Node communicator exists
+    }
+
+    //! Allreduce over all ranks by reducing in the node, allreducing among leaders, and broadcasting in the node
+    void allreduce(void * send, void * recv, int count, MPI_Datatype type, MPI_Op op) {
+      MPI_Reduce(send, recv, count, type, op, 0, nodeComm);     // Reduce to node leader
+      if (noderank == 0) MPI_Allreduce(MPI_IN_PLACE, recv, count, type, op, leaderComm);// Allreduce among leaders
+      MPI_Bcast(recv, count, type, 0, nodeComm);                // Broadcast to ranks in node
+    }
+
+    //! Exchange one int with every rank
+    void alltoall(int * send, int * recv) {
+      std::vector<int> count(mpisize, 1), displ(mpisize);       // One int per rank
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	displ[irank] = irank;                                   //  Displacement is rank
+      }                                                         // End loop over ranks
+      alltoallv(send, &count[0], &displ[0], recv, &count[0], &displ[0]);// Exchange through nodes
+    }
+
+    //! Exchange data in units of int with counts and displacements per rank, as MPI_Alltoallv
+    /*!
+      Each rank stores its send buffer and counts in node shared windows. Ranks copy blocks
+      from the same node directly. The leader gathers the blocks of all ranks in its node
+      for each other node into one message, exchanges the messages with the other leaders
+      into a shared window, from which each rank copies its own blocks.
+    */
+    void alltoallv(int * send, int * sendCount, int * sendDispl,
+		   int * recv, int * recvCount, int * recvDispl) {
+#if MPI_VERSION >= 3
+      int * row = counts[noderank];                             // Counts of this rank in shared window
+      int numSend = 0;                                          // Size of send buffer
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	row[irank] = sendCount[irank];                          //  Share send count
+	row[mpisize+irank] = sendDispl[irank];                  //  Share send displacement
+	row[2*mpisize+irank] = recvCount[irank];                //  Share receive count
+	numSend = std::max(numSend, sendDispl[irank] + sendCount[irank]);// Extent of send buffer
+      }                                                         // End loop over ranks
+      int * data = reserveWindow(numSend, sendWin, sendBase, sendCapacity);// Shared send buffer
+      if (numSend > 0) std::memcpy(data, send, numSend*sizeof(int));// Copy send buffer to shared window
+      MPI_Win_sync(countWin);                                   // Complete stores of counts
+      syncWindow(sendWin);                                      // Send buffers and counts are visible in node
+      MPI_Win_sync(countWin);                                   // Observe counts of other ranks
+      std::vector<int> & ranks = nodeRanks[inode];              // Ranks in this node
+      for (int i=0; i<nodesize; i++) {                          // Loop over ranks in node
+	int irank = ranks[i];                                   //  Source rank
+	int * block = sendBase[i] + counts[i][mpisize+mpirank]; //  Block sent to this rank
+	if (recvCount[irank] > 0) std::memcpy(recv + recvDispl[irank], block, recvCount[irank]*sizeof(int));// Copy block
+      }                                                         // End loop over ranks in node
+      if (numNodes > 1) {                                       // If there are other nodes
+	std::vector<int> stream;                                //  Messages to other nodes
+	std::vector<int> nodeSendCount(numNodes, 0), nodeSendDispl(numNodes, 0);// Send count/displacement per node
+	std::vector<int> nodeRecvCount(numNodes, 0), nodeRecvDispl(numNodes, 0);// Receive count/displacement per node
+	int numRecv = 0;                                        //  Size of messages from other nodes
+	if (noderank == 0) {                                    //  If this rank is the node leader
+	  for (int jnode=0; jnode<numNodes; jnode++) {          //   Loop over nodes
+	    nodeSendDispl[jnode] = stream.size();               //    Send displacement of node
+	    nodeRecvDispl[jnode] = numRecv;                     //    Receive displacement of node
+	    if (jnode == inode) continue;                       //    Skip own node
+	    std::vector<int> & jranks = nodeRanks[jnode];       //    Ranks in other node
+	    for (int i=0; i<nodesize; i++) {                    //    Loop over ranks in this node
+	      for (size_t j=0; j<jranks.size(); j++) {          //     Loop over ranks in other node
+		int * block = sendBase[i] + counts[i][mpisize+jranks[j]];// Block of rank i to rank j
+		stream.insert(stream.end(), block, block + counts[i][jranks[j]]);// Append block to message
+	      }                                                 //     End loop over ranks in other node
+	    }                                                   //    End loop over ranks in this node
+	    nodeSendCount[jnode] = stream.size() - nodeSendDispl[jnode];// Send count of node
+	    for (size_t j=0; j<jranks.size(); j++) {            //    Loop over ranks in other node
+	      for (int i=0; i<nodesize; i++) {                  //     Loop over ranks in this node
+		nodeRecvCount[jnode] += counts[i][2*mpisize+jranks[j]];// Block of rank j to rank i
+	      }                                                 //     End loop over ranks in this node
+	    }                                                   //    End loop over ranks in other node
+	    numRecv += nodeRecvCount[jnode];                    //    Accumulate receive size
+	  }                                                     //   End loop over nodes
+	}                                                       //  End if for node leader
+	int * message = reserveWindow(numRecv, recvWin, recvBase, recvCapacity);// Only the leader holds messages
+	if (noderank == 0) {                                    //  If this rank is the node leader
+	  stream.resize(stream.size() + 1);                     //   Avoid taking address of empty vector
+	  MPI_Alltoallv(&stream[0], &nodeSendCount[0], &nodeSendDispl[0], MPI_INT,// Exchange messages among leaders
+			message, &nodeRecvCount[0], &nodeRecvDispl[0], MPI_INT, leaderComm);
+	}                                                       //  End if for node leader
+	syncWindow(recvWin);                                    //  Messages are visible in node
+	int offset = 0;                                         //  Offset in messages
+	for (int jnode=0; jnode<numNodes; jnode++) {            //  Loop over nodes
+	  if (jnode == inode) continue;                         //   Skip own node
+	  std::vector<int> & jranks = nodeRanks[jnode];         //   Ranks in other node
+	  for (size_t j=0; j<jranks.size(); j++) {              //   Loop over ranks in other node
+	    for (int i=0; i<nodesize; i++) {                    //    Loop over ranks in this node
+	      int count = counts[i][2*mpisize+jranks[j]];       //     Size of block of rank j to rank i
+	      if (i == noderank && count > 0) std::memcpy(recv + recvDispl[jranks[j]], recvBase[0] + offset, count*sizeof(int));// Copy own block
+	      offset += count;                                  //     Advance offset
+	    }                                                   //    End loop over ranks in this node
+	  }                                                     //   End loop over ranks in other node
+	}                                                       //  End loop over nodes
+      }                                                         // End if for other nodes
+      MPI_Barrier(nodeComm);                                    // Windows and counts are no longer read
+#endif
+    }
+  };
+}
+#endif
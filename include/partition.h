@@ -1,12 +1,15 @@
 #ifndef partition_h
 #define partition_h
 #include <mpi.h>
+#include <algorithm>
+#include "keys.h"
 #include "logger.h"
+#include "node_mpi.h"
 #include "sort.h"
 
 namespace exafmm {
   //! Handles all the partitioning of domains
-  template<typename Kernel>
+  template<typename Kernel, typename Key=DefaultKey>
   class Partition {
     typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
     typedef typename Kernel::Cells Cells;                       //!< Vector of cells
@@ -31,10 +34,19 @@ namespace exafmm {
     float * globalHist;                                         //!< Global body weight histogram
     Bounds * rankBounds;                                        //!< Bounds of each rank
     Bodies buffer;                                              //!< MPI communication buffer for bodies
+    Sort<Kernel> sort;                                          //!< Radix sort with buffers reused across calls
+    NodeMPI * node;                                             //!< Two-level communication through node leaders (NULL: flat)
+
+  private:
+    //! Allreduce over all ranks, through node leaders if two-level communication is set
+    void allreduce(void * send, void * recv, int count, MPI_Datatype type, MPI_Op op) {
+      if (node != NULL) node->allreduce(send, recv, count, type, op);// Reduce in node, then among leaders
+      else MPI_Allreduce(send, recv, count, type, op, MPI_COMM_WORLD);// Reduce over all ranks
+    }
 
   public:
     //! Constructor
-    Partition(int _mpirank, int _mpisize) : mpirank(_mpirank), mpisize(_mpisize), numBins(16) {
+    Partition(int _mpirank, int _mpisize) : mpirank(_mpirank), mpisize(_mpisize), numBins(16), node(NULL) {
       rankDispl  = new int [mpisize];                           // Allocate displacement of MPI rank group
       rankCount  = new int [mpisize];                           // Allocate size of MPI rank group
       rankColor  = new int [mpisize];                           // Allocate color of MPI rank group
@@ -71,6 +83,11 @@ namespace exafmm {
       delete[] rankBounds;                                      // Deallocate bounds of each rank
     }
 
+    //! Set two-level communication for the reductions of partitioning (NULL: flat)
+    void setNodeMPI(NodeMPI * _node) {
+      node = _node;                                             // Set two-level communication
+    }
+
     //! Partitioning by orthogonal recursive bisection
     Bounds bisection(Bodies & bodies, Bounds globalBounds) {
       logger::startTimer("Partition");                          // Start timer
@@ -108,7 +125,7 @@ namespace exafmm {
 	    localWeightSum += B[b].WEIGHT;                      //     Add weights of body to local sum
 	  }                                                     //    End loop over bodies in current partition
 	  float globalWeightSum;                                //   Declare global sum of weights in current partition
-	  MPI_Allreduce(&localWeightSum, &globalWeightSum, 1, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);// Reduce sum of weights
+	  allreduce(&localWeightSum, &globalWeightSum, 1, MPI_FLOAT, MPI_SUM);// Reduce sum of weights
 	  float globalSplit = globalWeightSum * rankSplit / oldRankCount;// Global weight splitter index
 	  float globalOffset = 0;                               //   Initialize global weight offset
 	  real_t xmax = bounds.Xmax[direction];                 //   Upper bound of partition
@@ -140,7 +157,7 @@ namespace exafmm {
 	      for (int b=bodyBegin; b<bodyEnd; b++) {           //     Loop over bodies
 		B[b] = buffer[b];                               //      Copy back bodies from buffer
 	      }                                                 //     End loop over bodies
-	      MPI_Allreduce(weightHist, globalHist, numBins, MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);// Reduce weight histogram
+	      allreduce(weightHist, globalHist, numBins, MPI_FLOAT, MPI_SUM);// Reduce weight histogram
 	      int splitBin = 0;                                 //     Initialize bin splitter
 	      while (globalOffset < globalSplit) {              //     While scan of global histogram is less than splitter
 		globalOffset += globalHist[splitBin];           //      Scan global histogram
@@ -200,6 +217,81 @@ namespace exafmm {
       return rankBounds[mpirank];                               // Return local bounds
     }
 
+    //! Partitioning by weighted splitting of the space filling curve
+    Bounds curve(Bodies & bodies, Bounds globalBounds) {
+      logger::startTimer("Partition");                          // Start timer
+      const int numBodies = bodies.size();                      // Number of local bodies
+      const int maxIndex = (1 << maxKeyLevel) - 1;              // Maximum 3-D index at finest level
+      vec3 X0 = (globalBounds.Xmax + globalBounds.Xmin) / 2;    // Center of global domain
+      real_t R0 = 0;                                            // Initialize radius of global domain
+      for (int d=0; d<3; d++) {                                 // Loop over dimensions
+	R0 = std::max(globalBounds.Xmax[d] - X0[d], R0);        //  Calculate max distance from center
+      }                                                         // End loop over dimensions
+      R0 *= 1.00001;                                            // Add some leeway to radius
+      const double scale = (1 << maxKeyLevel) / (2 * double(R0));// Inverse of finest cell diameter
+      std::vector<uint64_t> keys(numBodies);                    // Keys of bodies
+      std::vector<int> index;                                   // Indices of bodies sorted along the curve
+      for (int b=0; b<numBodies; b++) {                         // Loop over bodies
+	int ic = 0;                                             //  Residual index
+	if (bodies[b].ICELL < 0) ic = bodies[b].ICELL;          //  Use first body in group
+	ivec3 iX;                                               //  3-D index at finest level
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  iX[d] = int((bodies[b+ic].X[d] - X0[d] + R0) * scale);//   3-D index at finest level
+	  iX[d] = std::min(std::max(iX[d], 0), maxIndex);       //   Clamp to domain
+	}                                                       //  End loop over dimensions
+	keys[b] = Key::interleave(iX, maxKeyLevel);             //  Key of body
+      }                                                         // End loop over bodies
+      sort.sortKeys(keys, index);                               // Sort bodies along the curve
+      buffer.resize(numBodies);                                 // Resize sort buffer
+      for (int b=0; b<numBodies; b++) {                         // Loop over bodies
+	buffer[b] = bodies[index[b]];                           //  Copy sorted bodies to buffer
+      }                                                         // End loop over bodies
+      bodies.swap(buffer);                                      // Swap sorted bodies into place
+      std::vector<double> weightScan(numBodies+1);              // Inclusive scan of body weights
+      weightScan[0] = 0;                                        // Initialize weight scan
+      for (int b=0; b<numBodies; b++) {                         // Loop over bodies
+	weightScan[b+1] = weightScan[b] + bodies[b].WEIGHT;     //  Scan weights along the curve
+      }                                                         // End loop over bodies
+      const int numSplits = mpisize - 1;                        // Number of splitters
+      double globalWeightSum;                                   // Global sum of weights
+      allreduce(&weightScan[numBodies], &globalWeightSum, 1, MPI_DOUBLE, MPI_SUM);// Reduce sum of weights
+      std::vector<uint64_t> splitKeys(numSplits, 0);            // Keys of splitters
+      std::vector<double> localWeight(numSplits), globalWeight(numSplits);// Weight in front of trial splitters
+      for (int bit=3*maxKeyLevel-1; bit>=0 && numSplits>0; bit--) {// Bisect all splitters bit by bit
+	for (int i=0; i<numSplits; i++) {                       //  Loop over splitters
+	  uint64_t trial = splitKeys[i] | (uint64_t(1) << bit); //   Trial splitter with current bit set
+	  int b = std::lower_bound(keys.begin(), keys.end(), trial) - keys.begin();// Bodies in front of splitter
+	  localWeight[i] = weightScan[b];                       //   Local weight in front of splitter
+	}                                                       //  End loop over splitters
+	allreduce(&localWeight[0], &globalWeight[0], numSplits, MPI_DOUBLE, MPI_SUM);// Reduce weights
+	for (int i=0; i<numSplits; i++) {                       //  Loop over splitters
+	  if (globalWeight[i] <= globalWeightSum * (i + 1) / mpisize) {// If trial splitter is not past target weight
+	    splitKeys[i] |= uint64_t(1) << bit;                 //    Keep current bit
+	  }                                                     //   End if for target weight
+	}                                                       //  End loop over splitters
+      }                                                         // End loop over bits
+      std::vector<float> Xmin(3*mpisize, 1e30), Xmax(3*mpisize, -1e30);// Bounds of bodies per rank
+      std::vector<float> globalXmin(3*mpisize), globalXmax(3*mpisize);// Global bounds per rank
+      for (int b=0; b<numBodies; b++) {                         // Loop over bodies
+	int irank = std::upper_bound(splitKeys.begin(), splitKeys.end(), keys[b]) - splitKeys.begin();// Rank of body
+	bodies[b].IRANK = irank;                                //  Copy MPI rank to body
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  Xmin[3*irank+d] = std::min(Xmin[3*irank+d], float(bodies[b].X[d]));// Update Xmin of rank
+	  Xmax[3*irank+d] = std::max(Xmax[3*irank+d], float(bodies[b].X[d]));// Update Xmax of rank
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over bodies
+      allreduce(&Xmin[0], &globalXmin[0], 3*mpisize, MPI_FLOAT, MPI_MIN);// Reduce Xmin of ranks
+      allreduce(&Xmax[0], &globalXmax[0], 3*mpisize, MPI_FLOAT, MPI_MAX);// Reduce Xmax of ranks
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over MPI ranks
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  rankBounds[irank].Xmin[d] = globalXmin[3*irank+d];    //   Xmin of rank
+	  rankBounds[irank].Xmax[d] = globalXmax[3*irank+d];    //   Xmax of rank
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over MPI ranks
+      logger::stopTimer("Partition");                           // Stop timer
+      return rankBounds[mpirank];                               // Return local bounds
+    }
+
     //! Partition bodies with geometric octsection
     Bounds octsection(Bodies & bodies, Bounds global) {
       logger::startTimer("Partition");                          // Start timer
@@ -235,8 +327,8 @@ namespace exafmm {
       }                                                         // End loop over bodies
       logger::stopTimer("Partition");                           // Stop timer
       logger::startTimer("Sort");                               // Start timer
-      Sort<Kernel> sort;                                        // Instantiate sort class
-      bodies = sort.irank(bodies);                              // Sort bodies according to IRANK
+      sort.irank(bodies, buffer);                               // Sort bodies according to IRANK
+      bodies.swap(buffer);                                      // Swap sorted bodies into place
       logger::stopTimer("Sort");                                // Stop timer
       return local;
     }
@@ -244,8 +336,8 @@ namespace exafmm {
     //! Send bodies back to where they came from
     void unpartition(Bodies & bodies) {
       logger::startTimer("Sort");                               // Start timer
-      Sort<Kernel> sort;                                        // Instantiate sort class
-      bodies = sort.irank(bodies);                              // Sort bodies according to IRANK
+      sort.irank(bodies, buffer);                               // Sort bodies according to IRANK
+      bodies.swap(buffer);                                      // Swap sorted bodies into place
       logger::stopTimer("Sort");                                // Stop timer
     }
   };
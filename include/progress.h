@@ -0,0 +1,15 @@
+#ifndef progress_h
+#define progress_h
+
+namespace exafmm {
+  //! Hook that long computations poll, e.g. to progress non-blocking communication
+  /*!
+    poll() is only called from thread 0, the thread that called the computation, so
+    implementations may call MPI without MPI_THREAD_MULTIPLE. It must not block.
+  */
+  struct Progress {
+    virtual ~Progress() {}                                      //!< Destructor
+    virtual void poll() = 0;                                    //!< Make progress without blocking
+  };
+}
+#endif
@@ -0,0 +1,37 @@
+#ifndef rebuild_tree_h
+#define rebuild_tree_h
+#include <vector>
+#include "types.h"
+
+namespace exafmm {
+  //! updateTree for tree builders without incremental updates
+  /*!
+    Builder derives from RebuildTree<Builder,Kernel> and provides buildTree(). The
+    tree of the previous step is discarded and built from scratch, and the permutation
+    is recovered by tracking the bodies through IBODY.
+  */
+  template<typename Builder, typename Kernel>
+  class RebuildTree {
+    typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
+    typedef typename Kernel::Cells Cells;                       //!< Vector of cells
+
+  public:
+    //! Update tree of previous step by rebuilding the whole tree
+    void updateTree(Bodies & bodies, Bodies & buffer, Cells & cells,
+		    std::vector<int> & permutation, Bounds bounds) {
+      int numBodies = bodies.size();                            // Number of bodies
+      std::vector<int> ibody(numBodies);                        // Caller's IBODY of each body
+      for (int i=0; i<numBodies; i++) {                         // Loop over bodies
+	ibody[i] = bodies[i].IBODY;                             //  Save IBODY
+	bodies[i].IBODY = i;                                    //  Use IBODY to track caller's index
+      }                                                         // End loop over bodies
+      cells = static_cast<Builder*>(this)->buildTree(bodies, buffer, bounds);// Build tree from scratch
+      permutation.resize(numBodies);                            // Resize permutation
+      for (int i=0; i<numBodies; i++) {                         // Loop over bodies in tree order
+	permutation[i] = bodies[i].IBODY;                       //  Caller's index of body
+	bodies[i].IBODY = ibody[permutation[i]];                //  Restore IBODY
+      }                                                         // End loop over bodies
+    }
+  };
+}
+#endif
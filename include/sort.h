@@ -1,5 +1,10 @@
 #ifndef sort_h
 #define sort_h
+#include <stdint.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "types.h"
 
 namespace exafmm {
@@ -12,91 +17,161 @@ namespace exafmm {
     typedef typename Kernel::C_iter C_iter;                     //!< Iterator of cell vecto
 
   private:
-    Bodies output;                                              //!< Output buffer
+    std::vector<uint64_t> keys;                                 //!< Keys of bodies
+    std::vector<uint64_t> keyBuffer;                            //!< Buffer for keys
+    std::vector<int> permutation;                               //!< Permutation index
+    std::vector<int> permutationBuffer;                         //!< Buffer for permutation index
+    std::vector<int> bucket;                                    //!< Per-thread histograms
+    Bodies output;                                              //!< Output buffer for unsort
 
   private:
-    //! Radixsorts the values using the keys
-    void radixsort(int * key, int * value, int size) {
+    //! Get number of threads in the next parallel region
+    int getNumThreads() {
+#ifdef _OPENMP
+      return omp_get_max_threads();                             // Number of OpenMP threads
+#else
+      return 1;                                                 // Serial execution
+#endif
+    }
+
+    //! Parallel LSD radix sort of keys and permutation index with per-thread histograms
+    void radixsort(std::vector<uint64_t> & key, std::vector<int> & index) {
       const int bitStride = 8;                                  // Number of bits in one stride
       const int stride = 1 << bitStride;                        // Size of stride in decimal
       const int mask = stride - 1;                              // Mask the bits in one stride
-      int maxKey = 0;                                           // Maximum value of key
-      int bucket[stride];                                       // Bucket
-      int * buffer = new int [size];                            // Buffer for both key and value
-      int * permutation = new int [size];                       // Permutation index
-      for (int i=0; i<size; i++)                                // Loop over keys
-	if (key[i] > maxKey)                                    //  If key is larger than maxKey
-	  maxKey = key[i];                                      //   Update maxKey per thread
-      while (maxKey > 0) {                                      // While there are bits in maxKey to process
-	for (int i=0; i<stride; i++)                            //   Loop over strides
-	  bucket[i] = 0;                                        //    Initialize bucket
-	for (int i=0; i<size; i++)                              //   Loop over keys
-	  bucket[key[i] & mask]++;                              //    Increment bucket
-	for (int i=1; i<stride; i++)                            //   Loop over strides
-	  bucket[i] += bucket[i-1];                             //    Scan bucket over strides
-	for (int i=size-1; i>=0; i--)                           //   Loop over keys backwards
-	  permutation[i] = --bucket[key[i] & mask];             //    Reverse scan bucket to get permutation
-	for (int i=0; i<size; i++)                              //   Loop over values
-	  buffer[permutation[i]] = value[i];                    //    Sort into buffer
-	for (int i=0; i<size; i++)                              //   Loop over values
-	  value[i] = buffer[i];                                 //    Copy back from buffer
-	for (int i=0; i<size; i++)                              //   Loop over keys
-	  buffer[permutation[i]] = key[i];                      //    Sort into buffer
-	for (int i=0; i<size; i++)                              //   Loop over keys
-	  key[i] = buffer[i] >> bitStride;                      //    Copy back from buffer and bit shift keys
-	maxKey >>= bitStride;                                   //   Bit shift maxKey
-      }                                                         //  End while for bits in maxKey
-      delete[] buffer;                                          // Deallocate buffer
-      delete[] permutation;                                     // Deallocate permutation index
+      const int size = key.size();                              // Number of keys
+      if (size == 0) return;                                    // Nothing to sort
+      uint64_t maxKey = 0;                                      // Bitwise or of all keys
+      for (int i=0; i<size; i++) maxKey |= key[i];              // Collect significant bits of keys
+      int numBits = 0;                                          // Number of significant bits in key
+      while (maxKey >> numBits) numBits++;                      // Count significant bits
+      keyBuffer.resize(size);                                   // Resize key buffer
+      permutationBuffer.resize(size);                           // Resize permutation buffer
+      bucket.resize(getNumThreads() * stride);                  // Resize per-thread histograms
+      uint64_t * key1 = &key[0];                                // Input keys
+      uint64_t * key2 = &keyBuffer[0];                          // Output keys
+      int * index1 = &index[0];                                 // Input permutation
+      int * index2 = &permutationBuffer[0];                     // Output permutation
+      bool skip = false;                                        // Skip pass if all keys share the digit
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+      {
+#ifdef _OPENMP
+	const int numThreads = omp_get_num_threads();           //  Number of threads
+	const int ithread = omp_get_thread_num();               //  Thread index
+#else
+	const int numThreads = 1;                               //  Number of threads
+	const int ithread = 0;                                  //  Thread index
+#endif
+	const int begin = (long(size) * ithread) / numThreads;  //  Begin index for this thread
+	const int end = (long(size) * (ithread + 1)) / numThreads;// End index for this thread
+	int * count = &bucket[ithread * stride];                //  Histogram of this thread
+	for (int shift=0; shift<numBits; shift+=bitStride) {    //  Loop over strides of bits
+	  for (int i=0; i<stride; i++) count[i] = 0;            //   Initialize histogram
+	  for (int i=begin; i<end; i++) {                       //   Loop over keys of this thread
+	    count[(key1[i] >> shift) & mask]++;                 //    Increment histogram
+	  }                                                     //   End loop over keys of this thread
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+	  {
+	    int offset = 0;                                     //    Initialize offset
+	    skip = false;                                       //    Initialize skip flag
+	    for (int i=0; i<stride; i++) {                      //    Loop over digits
+	      int sum = 0;                                      //     Initialize digit count
+	      for (int t=0; t<numThreads; t++) {                //     Loop over threads
+		int c = bucket[t * stride + i];                 //      Count of this digit in thread
+		bucket[t * stride + i] = offset;                //      Replace count with offset
+		offset += c;                                    //      Increment offset
+		sum += c;                                       //      Increment digit count
+	      }                                                 //     End loop over threads
+	      if (sum == size) skip = true;                     //     All keys share this digit
+	    }                                                   //    End loop over digits
+	  }
+	  if (!skip) {                                          //   If keys differ in this digit
+	    for (int i=begin; i<end; i++) {                     //    Loop over keys of this thread
+	      int j = count[(key1[i] >> shift) & mask]++;       //     Destination index
+	      key2[j] = key1[i];                                //     Scatter key
+	      index2[j] = index1[i];                            //     Scatter permutation
+	    }                                                   //    End loop over keys of this thread
+	  }                                                     //   End if for keys differ
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+	  if (!skip) {                                          //   If scattered
+	    std::swap(key1, key2);                              //    Swap key pointers
+	    std::swap(index1, index2);                          //    Swap permutation pointers
+	  }                                                     //   End if for scattered
+	}                                                       //  End loop over strides of bits
+      }
+      if (key1 != &key[0]) {                                    // If result is in buffer
+	key.swap(keyBuffer);                                    //  Swap key vectors
+	index.swap(permutationBuffer);                          //  Swap permutation vectors
+      }                                                         // End if for result in buffer
+    }
+
+    //! Permute input into output according to permutation index
+    void permute(Bodies & input, Bodies & out) {
+      const int size = input.size();                            // Size of bodies vector
+      out.resize(size);                                         // Resize output
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int i=0; i<size; i++) {                              // Loop over output bodies
+	out[i] = input[permutation[i]];                         //  Permute according to index
+      }                                                         // End loop over output bodies
     }
 
   public:
-    //! Sort input accoring to ibody
-    Bodies ibody(Bodies & input) {
+    //! Sort 64-bit keys in place, index[i] is the position of the i-th sorted key before sorting
+    /*!
+      Both vectors may be swapped with internal buffers, which are kept for the next call.
+    */
+    void sortKeys(std::vector<uint64_t> & key, std::vector<int> & index) {
+      const int size = key.size();                              // Number of keys
+      index.resize(size);                                       // Resize permutation index
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int i=0; i<size; i++) index[i] = i;                  // Initialize permutation index
+      radixsort(key, index);                                    // Radix sort index according to key
+    }
+
+    //! Sort input accoring to ibody into output
+    void ibody(Bodies & input, Bodies & out) {
       const int size = input.size();                            // Size of bodies vector
-      int * key = new int [size];                               // Allocate key array
-      int * index = new int [size];                             // Allocate index array
-      for (B_iter B=input.begin(); B!=input.end(); B++) {       // Loop over input bodies
-	int i = B-input.begin();                                //  Body index
-	key[i] = B->IBODY;                                      //  Copy IBODY to key array
-	index[i] = i;                                           //  Initialize index array
+      keys.resize(size);                                        // Resize key array
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int i=0; i<size; i++) {                              // Loop over input bodies
+	keys[i] = uint32_t(input[i].IBODY);                     //  Copy IBODY to key array
       }                                                         // End loop over input bodies
-      radixsort(key,index,size);                                // Radix sort index according to key
-      output.resize(size);                                      // Resize output buffer
-      for (B_iter B=output.begin(); B!=output.end(); B++) {     // Loop over output boides
-	int i = B-output.begin();                               //  Body index
-	*B = input[index[i]];                                   //  Permute according to index
-      }                                                         // End loop over output bodies
-      delete[] key;                                             // Deallocate key array
-      delete[] index;                                           // Deallocate index array
-      return output;                                            // Return output
+      sortKeys(keys, permutation);                              // Radix sort index according to key
+      permute(input, out);                                      // Permute according to index
     }
 
-    //! Sort input accoring to irank
-    Bodies irank(Bodies & input) {
+    //! Sort input accoring to irank into output
+    void irank(Bodies & input, Bodies & out) {
       const int size = input.size();                            // Size of bodies vector
-      int * key = new int [size];                               // Allocate key array
-      int * index = new int [size];                             // Allocate index array
-      for (B_iter B=input.begin(); B!=input.end(); B++) {       // Loop over input bodies
-	int i = B-input.begin();                                //  Body index
-	key[i] = B->IRANK;                                      //  Copy IRANK to key array
-	index[i] = i;                                           //  Initialize index array
+      keys.resize(size);                                        // Resize key array
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for (int i=0; i<size; i++) {                              // Loop over input bodies
+	keys[i] = uint32_t(input[i].IRANK);                     //  Copy IRANK to key array
       }                                                         // End loop over input bodies
-      radixsort(key,index,size);                                // Radix sort index according to key
-      output.resize(size);                                      // Resize output buffer
-      for (B_iter B=output.begin(); B!=output.end(); B++) {     // Loop over output boides
-	int i = B-output.begin();                               //  Body index
-	*B = input[index[i]];                                   //  Permute according to index
-      }                                                         // End loop over output bodies
-      delete[] key;                                             // Deallocate key array
-      delete[] index;                                           // Deallocate index array
-      return output;                                            // Return output
+      sortKeys(keys, permutation);                              // Radix sort index according to key
+      permute(input, out);                                      // Permute according to index
     }
 
     //! Sort bodies back to original order
-    Bodies unsort(Bodies & bodies) {
-      bodies = ibody(bodies);                                   // Sort bodies
-      return bodies;
+    void unsort(Bodies & bodies) {
+      ibody(bodies, output);                                    // Sort bodies into output buffer
+      bodies.swap(output);                                      // Swap sorted bodies into place
     }
   };
 }
@@ -1,5 +1,6 @@
 #ifndef thread_h
 #define thread_h
+#include <algorithm>
 #include "config.h"
 #pragma GCC system_header
 
@@ -10,6 +11,7 @@
 
 #if EXAFMM_WITH_TBB
 #define num_threads(E)                tbb::task_scheduler_init init(E)
+#include <tbb/task_arena.h>
 #if DAG_RECORDER == 2  /* TBB with DAG Recorder */
 #define TO_TBB 1 
 #include <tpswitch/tpswitch.h>
@@ -40,6 +42,20 @@ void call(Call C) { C(); }
 #define create_taskc(E)               cilk_spawn call(E)
 #define create_taskc_if(x, E)         if(x) { create_taskc(E); } else { E(); }
 
+#elif EXAFMM_WITH_WSTEAL
+/* Built-in work stealing runtime (wsteal.h) */
+#include "wsteal.h"
+#if EXAFMM_WITH_OPENMP
+#include <omp.h>
+#define num_threads(E)                omp_set_num_threads(E); exafmm::wsteal::init(E)
+#else
+#define num_threads(E)                exafmm::wsteal::init(E)
+#endif
+#define mk_task_group                 exafmm::wsteal::TaskGroup tg;
+#define wait_tasks                    tg.wait()
+#define create_taskc(E)               tg.run(E)
+#define create_taskc_if(x, E)         if(x) { create_taskc(E); } else { E(); }
+
 #elif EXAFMM_WITH_OPENMP
 #include <omp.h>
 #define num_threads(E)                omp_set_num_threads(E);
@@ -63,4 +79,47 @@ void call(Call C) { C(); }
 
 #endif
 
+namespace exafmm {
+  //! Upper bound of the thread indices of the current task runtime, for sizing per-thread data
+  inline int getMaxThreads() {
+#if EXAFMM_WITH_TBB
+    return tbb::this_task_arena::max_concurrency();             // Threads of current arena
+#elif EXAFMM_WITH_MTHREAD
+    return myth_get_num_workers();                              // MassiveThreads workers
+#elif EXAFMM_WITH_CILK
+    return __cilkrts_get_nworkers();                            // Cilk workers
+#elif EXAFMM_WITH_WSTEAL
+#if EXAFMM_WITH_OPENMP
+    return std::max(wsteal::numWorkers, omp_get_max_threads()); // Workers or threads of parallel loops
+#else
+    return std::max(wsteal::numWorkers, 1);                     // Workers, or the calling thread
+#endif
+#elif EXAFMM_WITH_OPENMP
+    return omp_get_max_threads();                               // OpenMP threads
+#else
+    return 1;                                                   // Serial
+#endif
+  }
+
+  //! Index of the calling thread in [0,getMaxThreads())
+  inline int getThreadIndex() {
+#if EXAFMM_WITH_TBB
+    return tbb::this_task_arena::current_thread_index();        // Slot of thread in current arena
+#elif EXAFMM_WITH_MTHREAD
+    return myth_get_worker_num();                               // MassiveThreads worker
+#elif EXAFMM_WITH_CILK
+    return __cilkrts_get_worker_number();                       // Cilk worker
+#elif EXAFMM_WITH_WSTEAL
+#if EXAFMM_WITH_OPENMP
+    if (omp_in_parallel()) return omp_get_thread_num();         // Thread of parallel loop
+#endif
+    return wsteal::self ? wsteal::self->id : 0;                 // Worker, or the calling thread
+#elif EXAFMM_WITH_OPENMP
+    return omp_get_thread_num();                                // OpenMP thread
+#else
+    return 0;                                                   // Serial
+#endif
+  }
+}
+
 #endif
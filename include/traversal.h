@@ -1,33 +1,53 @@
 #ifndef traversal_h
 #define traversal_h
+#include "cost_model.h"
+#include "counter.h"
+#include "keys.h"
 #include "logger.h"
+#include "mac.h"
+#include "progress.h"
 #include "thread.h"
 #include "types.h"
 
-#if EXAFMM_COUNT_KERNEL
-#define countKernel(N) N++
-#else
-#define countKernel(N)
-#endif
-
 namespace exafmm {
-  template<typename Kernel>
+  template<typename Kernel, typename Key=DefaultKey>
   class Traversal {
     typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
     typedef typename Kernel::Cells Cells;                       //!< Vector of cells
     typedef typename Kernel::B_iter B_iter;                     //!< Iterator of body vector
     typedef typename Kernel::C_iter C_iter;                     //!< Iterator of cell vecto
+    typedef typename Kernel::vecP vecP;                         //!< Vector type of expansion coefficients
+    typedef typename CostModel<Kernel>::Operator Operator;      //!< Far field kernel selected by the cost model
 
   private:
+    //! Scratch for filtering source bodies by the cutoff
+    struct CutoffScratch {
+      Bodies buffer;                                            //!< Source bodies within cutoff
+      Cells cells;                                              //!< Cells of target body and filtered source bodies
+      CutoffScratch() : cells(2) {}                             //!< Constructor
+    };
+
+    static const int directBlock = 64;                          //!< Number of bodies in a block of direct summation
     const int nspawn;                                           //!< Threshold of NBODY for spawning new threads
     const int images;                                           //!< Number of periodic image sublevels
     const char * path;                                          //!< Path to save files
-    int (* listOffset)[3];                                      //!< Offset in interaction lists
-    int (* lists)[3];                                           //!< Interaction lists
-#if EXAFMM_COUNT_KERNEL
-    real_t numP2P;                                              //!< Number of P2P kernel calls
-    real_t numM2L;                                              //!< Number of M2L kernel calls
-#endif
+    const CostModel<Kernel> * costModel;                        //!< Cost model for selecting far field kernels, NULL for M2L only
+    Progress * progress;                                        //!< Hook polled between kernels, NULL for none
+    int numPolls;                                               //!< Calls of pollProgress() on thread 0 since last poll
+    int (* listOffset)[6];                                      //!< Offset in interaction lists of each type
+    std::vector<ivec3> lists;                                   //!< Interaction lists (pointer, cell, periodic key)
+    InteractionList traversalList;                              //!< Flat interaction lists of list based traversal
+    bool recording;                                             //!< Flag for recording pairs instead of evaluating kernels
+    real_t cutoff;                                              //!< Cutoff radius of cutoff traversal, 0 for FMM traversal
+    vec3 Xperiodic[27];                                         //!< Periodic coordinate offset of each periodic key
+    std::vector<CutoffScratch> cutoffScratch;                   //!< Scratch of each thread for filtering by the cutoff
+    std::vector<int> pairsP2P;                                  //!< Recorded P2P (icell,jcell,periodicKey) triplets
+    std::vector<int> pairsM2L;                                  //!< Recorded M2L (icell,jcell,periodicKey) triplets
+    std::vector<int> pairsM2P;                                  //!< Recorded M2P (icell,jcell,periodicKey) triplets
+    std::vector<int> pairsP2L;                                  //!< Recorded P2L (icell,jcell,periodicKey) triplets
+    std::vector<vecP> periodicOperator;                         //!< Far field of periodic images for each unit part of root multipole
+    vec3 periodicCycle;                                         //!< Cycle of periodic operator
+    real_t periodicScale;                                       //!< Scale of source root of periodic operator
     C_iter Ci0;                                                 //!< Iterator of first target cell
     C_iter Cj0;                                                 //!< Iterator of first source cell
 
@@ -56,36 +76,6 @@ namespace exafmm {
     void countWeight(C_iter, C_iter, bool, real_t) {}
 #endif
 
-    //! Get level from key
-    int getLevel(uint64_t key) {
-      int level = -1;                                           // Initialize level
-      while( int(key) >= 0 ) {                                  // While key has level offsets to subtract
-	level++;                                                //  Increment level
-	key -= 1 << 3*level;                                    //  Subtract level offset
-      }                                                         // End while loop for level offsets
-      return level;                                             // Return level
-    }
-
-    //! Get 3-D index from key
-    ivec3 getIndex(uint64_t key) {
-      int level = -1;                                           // Initialize level
-      while( int(key) >= 0 ) {                                  // While key has level offsets to subtract
-	level++;                                                //  Increment level
-	key -= 1 << 3*level;                                    //  Subtract level offset
-      }                                                         // End while loop for level offsets
-      key += 1 << 3*level;                                      // Compensate for over-subtraction
-      level = 0;                                                // Initialize level
-      ivec3 iX = 0;                                             // Initialize 3-D index
-      int d = 0;                                                // Initialize dimension
-      while( key > 0 ) {                                        // While key has bits to shift
-	iX[d] += (key % 2) * (1 << level);                      //  Deinterleave key bits to 3-D bits
-	key >>= 1;                                              //  Shift bits in key
-	d = (d+1) % 3;                                          //  Increment dimension
-	if( d == 0 ) level++;                                   //  Increment level
-      }                                                         // End while loop for key bits to shift
-      return iX;                                                // Return 3-D index
-    }
-
     //! Get 3-D index from periodic key
     ivec3 getPeriodicIndex(int key) {
       ivec3 iX;                                                 // Initialize 3-D periodic index
@@ -96,6 +86,16 @@ namespace exafmm {
       return iX;                                                // Return 3-D periodic index
     }
 
+    //! Set periodic coordinate offset of each periodic key, read only during traversal
+    void setPeriodicOffsets(vec3 cycle) {
+      for (int key=0; key<27; key++) {                          // Loop over periodic keys
+	ivec3 pX = getPeriodicIndex(key);                       //  3-D periodic index of key
+	for (int d=0; d<3; d++) {                               //  Loop over dimensions
+	  Xperiodic[key][d] = pX[d] * cycle[d];                 //   Periodic coordinate offset
+	}                                                       //  End loop over dimensions
+      }                                                         // End loop over periodic keys
+    }
+
     //! Get interaction list
     void getList(int itype, int icell, int * list, int * periodicKey, int & numList) {
       int ilast = listOffset[icell][itype];                     // Initialize list pointer
@@ -112,20 +112,75 @@ namespace exafmm {
 
     //! Set one interaction list
     void setList(int itype, int icell, int list, int periodicKey, int & numLists) {
-      lists[numLists][0] = listOffset[icell][itype];            // Store list pointer
-      lists[numLists][1] = list;                                // Store list
-      lists[numLists][2] = periodicKey;                         // Store periodicKey
+      ivec3 entry;                                              // Entry of linked list
+      entry[0] = listOffset[icell][itype];                      // Store list pointer
+      entry[1] = list;                                          // Store list
+      entry[2] = periodicKey;                                   // Store periodicKey
+      lists.push_back(entry);                                   // Append entry
       listOffset[icell][itype] = numLists;                      // Store list size
       numLists++;                                               // Increment list size
     }
 
+    //! Check if the source cell shifted by its periodic key touches the target cell, for cells of any level
+    bool isNeighbor(C_iter Ci, C_iter Cj, int periodicKey) {
+      int leveli = getLevel(Ci->ICELL);                         // Level of target cell
+      int levelj = getLevel(Cj->ICELL);                         // Level of source cell
+      int level = std::max(leveli, levelj);                     // Finer of the two levels
+      int si = 1 << (level - leveli);                           // Size of target cell at finer level
+      int sj = 1 << (level - levelj);                           // Size of source cell at finer level
+      ivec3 iX = Key::getIndex(Ci->ICELL);                      // 3-D index of target cell
+      ivec3 jX = Key::getIndex(Cj->ICELL);                      // 3-D index of source cell
+      jX += getPeriodicIndex(periodicKey) * (1 << levelj);      // Periodic image shift
+      for (int d=0; d<3; d++) {                                 // Loop over dimensions
+	if (jX[d] * sj > (iX[d] + 1) * si || iX[d] * si > (jX[d] + 1) * sj) return false;// Separated in this dimension
+      }                                                         // End loop over dimensions
+      return true;                                              // Cells touch in all dimensions
+    }
+
+    //! Store a leaf larger than the target cell, as neighbor if it touches and in X list otherwise
+    void setCoarseList(int icell, int jcell, int periodicKey, int & numLists) {
+      C_iter Ci = Ci0 + icell;                                  // Iterator of target cell
+      C_iter Cj = Cj0 + jcell;                                  // Iterator of source leaf
+      if (isNeighbor(Ci, Cj, periodicKey)) {                    // If source leaf touches target cell
+	setList(5, icell, jcell, periodicKey, numLists);        //  Store coarse neighbor list
+      } else if (Cj->NBODY == 0) {                              // Else if source bodies are not available
+	setList(1, icell, jcell, periodicKey, numLists);        //  Store M2L list
+      } else {                                                  // Else source leaf is well separated
+	setList(4, icell, jcell, periodicKey, numLists);        //  Store P2L list (X list)
+      }                                                         // End if for touching source leaf
+    }
+
+    //! Store descendants of a neighbor of leaf icell, in P2P list if they touch and in W list otherwise
+    void setFineList(int icell, int jparent, int periodicKey, int & numLists) {
+      C_iter Ci = Ci0 + icell;                                  // Iterator of target leaf
+      C_iter Cj = Cj0 + jparent;                                // Iterator of source parent
+      for (int jcell=Cj->ICHILD; jcell<Cj->ICHILD+Cj->NCHILD; jcell++) {// Loop over children of source
+	C_iter Cc = Cj0 + jcell;                                //  Iterator of source child
+	if (!isNeighbor(Ci, Cc, periodicKey)) {                 //  If source child is well separated
+	  setList(3, icell, jcell, periodicKey, numLists);      //   Store M2P list (W list)
+	} else if (Cc->NCHILD == 0) {                           //  Else if source child is a touching leaf
+	  setList(Cc->NBODY ? 0 : 1, icell, jcell, periodicKey, numLists);// Store P2P list, M2L if bodies are not available
+	} else {                                                //  Else source child touches and has children
+	  setFineList(icell, jcell, periodicKey, numLists);     //   Recurse into its children
+	}                                                       //  End if for well separated source child
+      }                                                         // End loop over children of source
+    }
+
     //! Set all interaction lists
-    void setLists(Cells & icells) {
-      int numCells = icells.size();                             // Number of cells
-      int childs[216], neighbors[27];                           // Array of parents' neighbors' children and neighbors
-      int childKeys[216], neighborKeys[27];                     // Periodic keys
+    /*!
+      Cells of one level are colleagues if they touch. The M2L list (V list) holds the
+      children of the parent's colleagues that do not touch. On adaptive trees, a leaf
+      colleague of the parent is larger than the cell. It is kept as a coarse neighbor if
+      it touches, and goes to the P2L list (X list) otherwise. A leaf evaluates P2P with
+      touching leafs of all sizes, and M2P with the descendants of its colleagues that do
+      not touch (W list). On uniform trees the P2P and M2L lists are unchanged.
+    */
+    void setLists(int numCells) {
+      int childs[216], neighbors[216];                          // Array of parents' neighbors' children and neighbors
+      int childKeys[216], neighborKeys[216];                    // Periodic keys
+      lists.clear();                                            // Clear linked lists
       for (int i=0; i<numCells; i++) {                          // Loop over number of cells
-	for (int j=0; j<3; j++) {                               //  Loop over list types
+	for (int j=0; j<6; j++) {                               //  Loop over list types
 	  listOffset[i][j] = -1;                                //   Set initial value to -1
 	}                                                       //  End loop over list types
       }                                                         // End loop over number of cells
@@ -142,12 +197,15 @@ namespace exafmm {
 	int iparent = Ci->IPARENT;                              //  Index of parent target cell
 	int numNeighbors;                                       //  Number of neighbor parents
 	getList(2, iparent, neighbors, neighborKeys, numNeighbors);//  Get list of neighbors
-	ivec3 iX = getIndex(Ci->ICELL);                         //  Get 3-D index from key
+	ivec3 iX = Key::getIndex(Ci->ICELL);                    //  Get 3-D index from key
 	int nchilds = 0;                                        //  Initialize number of parents' neighbors' children
 	for (int i=0; i<numNeighbors; i++) {                    //  Loop over parents' neighbors
 	  int jparent = neighbors[i];                           //   Index of parent source cell
 	  int parentKey = neighborKeys[i];                      //   Periodic key of parent source cell
 	  C_iter Cj = Cj0 + jparent;                            //   Iterator of parent source cell
+	  if (Cj->NCHILD == 0) {                                //   If parent's neighbor is a leaf
+	    setCoarseList(icell, jparent, parentKey, numLists); //    Store as coarse neighbor or X list
+	  }                                                     //   End if for leaf
 	  for (int j=0; j<Cj->NCHILD; j++) {                    //   Loop over children of parents' neighbors
 	    int jcell = Cj->ICHILD+j;                           //    Index of source cell
 	    childs[nchilds] = jcell;                            //    Store index of source cell
@@ -159,7 +217,7 @@ namespace exafmm {
 	  int jcell = childs[i];                                //   Index of source cell
 	  int periodicKey = childKeys[i];                       //   Periodic key of source cell
 	  C_iter Cj = Cj0 + jcell;                              //   Iterator of source cell
-	  ivec3 jX = getIndex(Cj->ICELL);                       //   3-D index of source cell
+	  ivec3 jX = Key::getIndex(Cj->ICELL);                  //   3-D index of source cell
 	  ivec3 pX = getPeriodicIndex(periodicKey);             //   3-D periodic index of source cell
 	  int level = getLevel(Cj->ICELL);                      //   Level of source cell
 	  jX += pX * (1 << level);                              //   Periodic image shift
@@ -171,6 +229,10 @@ namespace exafmm {
 	    setList(1, icell, jcell, periodicKey, numLists);    //    Store M2L list
 	  }                                                     //   End if for non-neighbor
 	}                                                       //  End loop over children of parents' neighbors
+	getList(5, iparent, neighbors, neighborKeys, numNeighbors);// Get list of parent's coarse neighbors
+	for (int i=0; i<numNeighbors; i++) {                    //  Loop over parent's coarse neighbors
+	  setCoarseList(icell, neighbors[i], neighborKeys[i], numLists);// Store as coarse neighbor or X list
+	}                                                       //  End loop over parent's coarse neighbors
       }                                                         // End loop over target cells
       for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
 	C_iter Ci = Ci0 + icell;                                //  Iterator of target cell
@@ -182,105 +244,341 @@ namespace exafmm {
 	    int periodicKey = neighborKeys[j];                  //    Periodic key of source cell
 	    C_iter Cj = Cj0 + jcell;                            //    Iterator of source cell
 	    if (Cj->NCHILD == 0) {                              //    If source cell is leaf
-	      setList(0, icell, jcell, periodicKey, numLists);  //     Store P2P list
+	      setList(Cj->NBODY ? 0 : 1, icell, jcell, periodicKey, numLists);// Store P2P list, M2L if bodies are not available
 	    }                                                   //    End if for source cell leaf
 	  }                                                     //   End loop over neighbor cells
+	  for (int j=0; j<numNeighbors; j++) {                  //   Loop over neighbor cells
+	    if (Cj0[neighbors[j]].NCHILD != 0) {                //    If source cell has children
+	      setFineList(icell, neighbors[j], neighborKeys[j], numLists);// Store its descendants in P2P or W list
+	    }                                                   //    End if for source cell children
+	  }                                                     //   End loop over neighbor cells
+	  getList(5, icell, neighbors, neighborKeys, numNeighbors);// Get list of coarse neighbors
+	  for (int j=0; j<numNeighbors; j++) {                  //   Loop over coarse neighbors
+	    setList(Cj0[neighbors[j]].NBODY ? 0 : 1, icell, neighbors[j], neighborKeys[j], numLists);// Store P2P list, M2L if bodies are not available
+	  }                                                     //   End loop over coarse neighbors
 	}                                                       //  End if for target cell leaf
       }                                                         // End loop over target cells
     }
 
+    //! Copy linked interaction list of type itype to compressed sparse row format
+    void copyList(int itype, int numCells, CSRList & list) {
+      list.offset.resize(numCells+1);                           // Resize offsets
+      list.jcell.clear();                                       // Clear source cells
+      list.periodicKey.clear();                                 // Clear periodic keys
+      for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
+	list.offset[icell] = list.jcell.size();                 //  Offset of list of target cell
+	for (int ilast=listOffset[icell][itype]; ilast>=0; ilast=lists[ilast][0]) {// Loop over linked list
+	  if (lists[ilast][1] >= 0) {                           //   If pointer is valid
+	    list.jcell.push_back(lists[ilast][1]);              //    Append source cell
+	    list.periodicKey.push_back(lists[ilast][2]);        //    Append periodic key
+	  }                                                     //   End if for valid pointer
+	}                                                       //  End loop over linked list
+      }                                                         // End loop over target cells
+      list.offset[numCells] = list.jcell.size();                // Offset of end of lists
+    }
+
+    //! Sort recorded (icell,jcell,periodicKey) triplets by target cell into compressed sparse row format
+    void sortPairs(const std::vector<int> & pairs, int numCells, CSRList & list) {
+      int numPairs = pairs.size() / 3;                          // Number of recorded pairs
+      list.offset.assign(numCells+1, 0);                        // Initialize offsets
+      for (int i=0; i<numPairs; i++) {                          // Loop over pairs
+	list.offset[pairs[3*i]+1]++;                            //  Count pairs of target cell
+      }                                                         // End loop over pairs
+      for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
+	list.offset[icell+1] += list.offset[icell];             //  Scan counts to offsets
+      }                                                         // End loop over target cells
+      list.jcell.resize(numPairs);                              // Resize source cells
+      list.periodicKey.resize(numPairs);                        // Resize periodic keys
+      std::vector<int> next(list.offset.begin(), list.offset.end()-1);// Next free slot of each target cell
+      for (int i=0; i<numPairs; i++) {                          // Loop over pairs in recorded order
+	int j = next[pairs[3*i]]++;                             //  Slot of pair
+	list.jcell[j] = pairs[3*i+1];                           //  Store source cell
+	list.periodicKey[j] = pairs[3*i+2];                     //  Store periodic key
+      }                                                         // End loop over pairs
+    }
+
+    //! M2L kernel, or record the pair when setting an interaction list
+    void evalM2L(C_iter Ci, C_iter Cj, int key, bool mutual, real_t remote) {
+      if (recording) {                                          // If recording interaction list
+	pairsM2L.push_back(Ci-Ci0);                             //  Store target cell
+	pairsM2L.push_back(Cj-Cj0);                             //  Store source cell
+	pairsM2L.push_back(key);                                //  Store periodic key
+	return;                                                 //  Skip kernel
+      }                                                         // End if for recording
+      uint64_t begin = counter::start();                        // Start cycle counter
+      Kernel::M2L(Ci, Cj, Xperiodic[key], mutual);              // M2L kernel
+      counter::stop(counter::M2L, begin, 1);                    // Count M2L kernel
+      countList(Ci, Cj, mutual, false);                         // Increment M2L list
+      countWeight(Ci, Cj, mutual, remote);                      // Increment M2L weight
+    }
+
+    //! Batched M2L kernel of a target cell with numCells source cells shifted by Xj
+    void evalM2L(C_iter Ci, const C_iter * Cj, const vec3 * Xj, int numCells, real_t remote) {
+      uint64_t begin = counter::start();                        // Start cycle counter
+      Kernel::M2L(Ci, Cj, Xj, numCells);                        // Batched M2L kernel
+      counter::stop(counter::M2L, begin, numCells);             // Count M2L kernel
+      for (int i=0; i<numCells; i++) {                          // Loop over source cells
+	countList(Ci, Cj[i], false, false);                     //  Increment M2L list
+	countWeight(Ci, Cj[i], false, remote);                  //  Increment M2L weight
+      }                                                         // End loop over source cells
+    }
+
+    //! M2P kernel, or record the pair when setting an interaction list
+    void evalM2P(C_iter Ci, C_iter Cj, int key, real_t remote) {
+      if (recording) {                                          // If recording interaction list
+	pairsM2P.push_back(Ci-Ci0);                             //  Store target cell
+	pairsM2P.push_back(Cj-Cj0);                             //  Store source cell
+	pairsM2P.push_back(key);                                //  Store periodic key
+	return;                                                 //  Skip kernel
+      }                                                         // End if for recording
+      uint64_t begin = counter::start();                        // Start cycle counter
+      Kernel::M2P(Ci, Cj, Xperiodic[key]);                      // M2P kernel
+      counter::stop(counter::M2P, begin, Ci->NBODY);            // Count M2P kernel
+      countList(Ci, Cj, false, false);                          // Increment M2L list
+      countWeight(Ci, Cj, false, remote);                       // Increment M2P weight
+    }
+
+    //! P2L kernel, or record the pair when setting an interaction list
+    void evalP2L(C_iter Ci, C_iter Cj, int key, real_t remote) {
+      if (recording) {                                          // If recording interaction list
+	pairsP2L.push_back(Ci-Ci0);                             //  Store target cell
+	pairsP2L.push_back(Cj-Cj0);                             //  Store source cell
+	pairsP2L.push_back(key);                                //  Store periodic key
+	return;                                                 //  Skip kernel
+      }                                                         // End if for recording
+      uint64_t begin = counter::start();                        // Start cycle counter
+      Kernel::P2L(Ci, Cj, Xperiodic[key]);                      // P2L kernel
+      counter::stop(counter::P2L, begin, Cj->NBODY);            // Count P2L kernel
+      countList(Ci, Cj, false, false);                          // Increment M2L list
+      countWeight(Ci, Cj, false, remote);                       // Increment P2L weight
+    }
+
+    //! Kernel of the cost model for a pair of cells that satisfies the MAC
+    /*!
+      Bodies are only used in leafs, so that P2P and M2P never write to bodies of
+      another target cell in the replayed lists, and remote cells whose bodies were
+      not sent (NBODY == 0) only interact through their multipoles.
+    */
+    Operator selectKernel(C_iter Ci, C_iter Cj) const {
+      int nbodyi = Ci->NCHILD == 0 ? Ci->NBODY : 0;             // Target bodies if Ci is leaf
+      int nbodyj = Cj->NCHILD == 0 ? Cj->NBODY : 0;             // Source bodies if Cj is leaf
+      return costModel->select(nbodyi, nbodyj);                 // Cheapest kernel by cost model
+    }
+
+    //! Far field kernel selected by the cost model
+    void evalFar(Operator kernel, C_iter Ci, C_iter Cj, int key, bool mutual, real_t remote) {
+      switch (kernel) {                                         // Case switch for kernel
+      case CostModel<Kernel>::P2P:                              // P2P kernel
+	evalP2P(Ci, Cj, key, mutual, remote);                   //  P2P kernel
+	break;                                                  // Break P2P kernel
+      case CostModel<Kernel>::M2P:                              // M2P kernel
+	evalM2P(Ci, Cj, key, remote);                           //  M2P kernel
+	break;                                                  // Break M2P kernel
+      case CostModel<Kernel>::P2L:                              // P2L kernel
+	evalP2L(Ci, Cj, key, remote);                           //  P2L kernel
+	break;                                                  // Break P2L kernel
+      default:                                                  // M2L kernel
+	evalM2L(Ci, Cj, key, mutual, remote);                   //  M2L kernel
+      }                                                         // End case switch for kernel
+    }
+
+    //! Cheapest far field kernel of a pair of cells that satisfies the MAC
+    void evalFar(C_iter Ci, C_iter Cj, int key, bool mutual, real_t remote) {
+      Operator kernel = selectKernel(Ci, Cj);                   // Kernel from Cj to Ci
+      if (mutual) {                                             // If mutual interaction
+	Operator kernelj = selectKernel(Cj, Ci);                //  Kernel from Ci to Cj
+	bool symmetric = kernel == CostModel<Kernel>::P2P || kernel == CostModel<Kernel>::M2L;//  P2P and M2L can be mutual
+	if (kernel == kernelj && symmetric) {                   //  If same symmetric kernel in both directions
+	  evalFar(kernel, Ci, Cj, key, true, remote);           //   Mutual P2P or M2L kernel
+	} else {                                                //  Else if kernels differ
+	  evalFar(kernel, Ci, Cj, key, false, remote);          //   Kernel from Cj to Ci
+	  evalFar(kernelj, Cj, Ci, key, false, remote);         //   Kernel from Ci to Cj
+	}                                                       //  End if for same kernel
+      } else {                                                  // Else if not mutual
+	evalFar(kernel, Ci, Cj, key, false, remote);            //  Kernel from Cj to Ci
+      }                                                         // End if for mutual interaction
+    }
+
+    //! P2P kernel, or record the pair when setting an interaction list
+    void evalP2P(C_iter Ci, C_iter Cj, int key, bool mutual, real_t remote) {
+      if (recording) {                                          // If recording interaction list
+	pairsP2P.push_back(Ci-Ci0);                             //  Store target cell
+	pairsP2P.push_back(Cj-Cj0);                             //  Store source cell
+	pairsP2P.push_back(key);                                //  Store periodic key
+	return;                                                 //  Skip kernel
+      }                                                         // End if for recording
+      if (Ci == Cj && key == 13) {                              // If source and target are same
+	evalP2P(Ci, mutual, remote);                            //  P2P kernel for single cell
+	return;                                                 //  Already counted
+      }                                                         // End if for same source and target
+      uint64_t begin = counter::start();                        // Start cycle counter
+      Kernel::P2P(Ci, Cj, Xperiodic[key], mutual);              // P2P kernel for pair of cells
+      counter::stop(counter::P2P, begin, real_t(Ci->NBODY) * Cj->NBODY);// Count P2P kernel
+      countList(Ci, Cj, mutual, true);                          // Increment P2P list
+      countWeight(Ci, Cj, mutual, remote);                      // Increment P2P weight
+    }
+
+    //! P2P kernel of a cell with itself
+    void evalP2P(C_iter Ci, bool mutual, real_t remote) {
+      uint64_t begin = counter::start();                        // Start cycle counter
+      Kernel::P2P(Ci);                                          // P2P kernel for single cell
+      counter::stop(counter::P2P, begin, real_t(Ci->NBODY) * (Ci->NBODY - 1) / 2);// Count P2P kernel
+      countList(Ci, Ci, mutual, true);                          // Increment P2P list
+      countWeight(Ci, Ci, mutual, remote);                      // Increment P2P weight
+    }
+
+    //! Batched P2P kernel of a target cell with numCells source cells shifted by Xj
+    void evalP2P(C_iter Ci, const C_iter * Cj, const vec3 * Xj, int numCells, real_t remote) {
+      uint64_t begin = counter::start();                        // Start cycle counter
+      Kernel::P2P(Ci, Cj, Xj, numCells);                        // Batched P2P kernel
+      real_t numBodies = 0;                                     // Number of source bodies in batch
+      for (int i=0; i<numCells; i++) numBodies += Cj[i]->NBODY; // Count source bodies in batch
+      counter::stop(counter::P2P, begin, Ci->NBODY * numBodies);// Count P2P kernel
+      for (int i=0; i<numCells; i++) {                          // Loop over source cells
+	countList(Ci, Cj[i], false, true);                      //  Increment P2P list
+	countWeight(Ci, Cj[i], false, remote);                  //  Increment P2P weight
+      }                                                         // End loop over source cells
+    }
+
+    //! Poll the progress hook from thread 0, once every interval calls
+    void pollProgress(int interval) {
+      if (progress == NULL || getThreadIndex() != 0) return;    // Only thread 0 polls
+      if (++numPolls < interval) return;                        // Not yet time to poll
+      numPolls = 0;                                             // Reset calls since last poll
+      progress->poll();                                         // Make progress
+    }
+
+    //! Give every thread its own cutoff scratch, before any thread uses it
+    void initCutoffScratch() {
+      int numThreads = getMaxThreads();                         // Number of threads
+      if (int(cutoffScratch.size()) < numThreads) cutoffScratch.resize(numThreads);// Keep scratch of previous calls
+    }
+
+    //! P2P of the target bodies of Ci with the source bodies of Cj that are within the cutoff
+    static void P2PCutoff(C_iter Ci, C_iter Cj, const vec3 & X, real_t cutoff, Bodies & buffer, C_iter C) {
+      const real_t cutoff2 = cutoff * cutoff;                   // Cutoff radius squared
+      if (int(buffer.size()) < Cj->NBODY) buffer.resize(Cj->NBODY);// Buffer has to hold all source bodies
+      C_iter Cb = C + 1;                                        // Cell of filtered source bodies
+      Cb->BODY = buffer.begin();                                // Filtered source bodies are in buffer
+      C->NBODY = 1;                                             // One target body at a time
+      for (B_iter Bi=Ci->BODY; Bi!=Ci->BODY+Ci->NBODY; Bi++) {  // Loop over target bodies
+	int nj = 0;                                             //  Number of source bodies within cutoff
+	for (B_iter Bj=Cj->BODY; Bj!=Cj->BODY+Cj->NBODY; Bj++) {//  Loop over source bodies
+	  if (norm(Bi->X - Bj->X - X) < cutoff2) buffer[nj++] = *Bj;// Keep source body within cutoff
+	}                                                       //  End loop over source bodies
+	if (nj == 0) continue;                                  //  Skip target body without sources
+	C->BODY = Bi;                                           //  Cell of target body
+	Cb->NBODY = nj;                                         //  Number of filtered source bodies
+	Kernel::P2P(C, Cb, X, false);                           //  P2P kernel for target body
+      }                                                         // End loop over target bodies
+    }
+
+    //! P2P kernel of the bodies within the cutoff, or record the pair when setting a Verlet list
+    /*!
+      inside tells if all pairs of bodies are within the cutoff. Only pairs of leafs that
+      straddle the cutoff are filtered body by body, so the cutoff costs little when
+      leafs are small.
+    */
+    void evalP2PCutoff(C_iter Ci, C_iter Cj, int key, bool inside, real_t remote) {
+      if (recording || inside) {                                // If recording or all bodies are within cutoff
+	evalP2P(Ci, Cj, key, false, remote);                    //  P2P kernel for pair of cells
+      } else {                                                  // Else if cells straddle the cutoff
+	CutoffScratch & scratch = cutoffScratch[getThreadIndex()];//  Scratch of this thread
+	uint64_t begin = counter::start();                      //  Start cycle counter
+	P2PCutoff(Ci, Cj, Xperiodic[key], cutoff, scratch.buffer, scratch.cells.begin());// Filter pairs by cutoff
+	counter::stop(counter::P2P, begin, real_t(Ci->NBODY) * Cj->NBODY);// Count P2P kernel
+	countList(Ci, Cj, false, true);                         //  Increment P2P list
+	countWeight(Ci, Cj, false, remote);                     //  Increment P2P weight
+      }                                                         // End if for straddling cells
+    }
+
     //! Split cell and call traverse() recursively for child
-    void splitCell(C_iter Ci, C_iter Cj, bool mutual, real_t remote) {
-      if (Cj->NCHILD == 0) {                                    // If Cj is leaf
-	assert(Ci->NCHILD > 0);                                 //  Make sure Ci is not leaf
-	for (C_iter ci=Ci0+Ci->ICHILD; ci!=Ci0+Ci->ICHILD+Ci->NCHILD; ci++) {// Loop over Ci's children
-	  dualTreeTraversal(ci, Cj, mutual, remote);            //   Traverse a single pair of cells
-	}                                                       //  End loop over Ci's children
-      } else if (Ci->NCHILD == 0) {                             // Else if Ci is leaf
-	assert(Cj->NCHILD > 0);                                 //  Make sure Cj is not leaf
-	for (C_iter cj=Cj0+Cj->ICHILD; cj!=Cj0+Cj->ICHILD+Cj->NCHILD; cj++) {// Loop over Cj's children
-	  dualTreeTraversal(Ci, cj, mutual, remote);            //   Traverse a single pair of cells
-	}                                                       //  End loop over Cj's children
-      } else if (Ci->NBODY + Cj->NBODY >= nspawn || (mutual && Ci == Cj)) {// Else if cells are still large
+    void splitCell(C_iter Ci, C_iter Cj, int mask, bool mutual, real_t remote) {
+      SplitType split = getSplitType(Ci, Cj, nspawn, mutual);   // Which cells are split
+      assert(split == SplitTarget || Cj->ICHILD >= 0);          // Make sure children of Cj were pulled
+      if (split == SplitBoth) {                                 // If both cells are split
 	TraverseRange traverseRange(this, Ci0+Ci->ICHILD, Ci0+Ci->ICHILD+Ci->NCHILD,// Instantiate recursive functor
-				    Cj0+Cj->ICHILD, Cj0+Cj->ICHILD+Cj->NCHILD, mutual, remote);
+				    Cj0+Cj->ICHILD, Cj0+Cj->ICHILD+Cj->NCHILD, mask, mutual, remote);
 	traverseRange();                                        //  Traverse for range of cell pairs
-      } else if (Ci->R >= Cj->R) {                              // Else if Ci is larger than Cj
+      } else if (split == SplitTarget) {                        // Else if Ci is split
 	for (C_iter ci=Ci0+Ci->ICHILD; ci!=Ci0+Ci->ICHILD+Ci->NCHILD; ci++) {// Loop over Ci's children
-	  dualTreeTraversal(ci, Cj, mutual, remote);            //   Traverse a single pair of cells
+	  dualTreeTraversal(ci, Cj, mask, mutual, remote);      //   Traverse a single pair of cells
 	}                                                       //  End loop over Ci's children
-      } else {                                                  // Else if Cj is larger than Ci
+      } else {                                                  // Else if Cj is split
 	for (C_iter cj=Cj0+Cj->ICHILD; cj!=Cj0+Cj->ICHILD+Cj->NCHILD; cj++) {// Loop over Cj's children
-	  dualTreeTraversal(Ci, cj, mutual, remote);            //   Traverse a single pair of cells
+	  dualTreeTraversal(Ci, cj, mask, mutual, remote);      //   Traverse a single pair of cells
 	}                                                       //  End loop over Cj's children
-      }                                                         // End if for leafs and Ci Cj size
-    }
-
-    //! Dual tree traversal for a single pair of cells
-    void dualTreeTraversal(C_iter Ci, C_iter Cj, bool mutual, real_t remote) {
-      vec3 dX = Ci->X - Cj->X - Kernel::Xperiodic;              // Distance vector from source to target
-      real_t R2 = norm(dX);                                     // Scalar distance squared
-      if (R2 > (Ci->R+Cj->R) * (Ci->R+Cj->R) * (1 - 1e-3)) {    // If distance is far enough
-	Kernel::M2L(Ci, Cj, mutual);                            //  M2L kernel
-	countKernel(numM2L);                                    //  Increment M2L counter
-	countList(Ci, Cj, mutual, false);                       //  Increment M2L list
-	countWeight(Ci, Cj, mutual, remote);                    //  Increment M2L weight
-      } else if (Ci->NCHILD == 0 && Cj->NCHILD == 0) {          // Else if both cells are bodies
+      }                                                         // End if for split type
+    }
+
+    //! Dual tree traversal for a single pair of cells and a mask of periodic keys of source images
+    /*!
+      How a pair of cells is split does not depend on the image, so all images that
+      need splitting descend together, and each image sees the same cell pairs as a
+      traversal of its own. The offsets are passed to the kernels explicitly, so
+      tasks of different images only share the read only Xperiodic table.
+    */
+    void dualTreeTraversal(C_iter Ci, C_iter Cj, int mask, bool mutual, real_t remote) {
+      pollProgress(64);                                         // Poll progress hook every 64 pairs
+      int splitMask = 0;                                        // Periodic keys of images that need splitting
+      for (int key=0; (mask >> key) != 0; key++) {              // Loop over periodic keys in mask
+	if ((mask & (1 << key)) == 0) continue;                 //  Skip images that are not in mask
+	bool inside;                                            //  Flag for all bodies within cutoff
+	PairType type = getPairType(Ci, Cj, Xperiodic[key], cutoff, inside);// Multipole acceptance criterion
+	if (type == PairSkip) {                                 //  If pair is beyond the cutoff
+	  continue;                                             //   Skip image
+	} else if (type == PairSplit) {                         //  Else if cells are close but not bodies
+	  splitMask |= 1 << key;                                //   Split cells for this image
+	} else if (cutoff > 0) {                                //  Else if pair of leafs in cutoff traversal
+	  if (Cj->NBODY != 0) evalP2PCutoff(Ci, Cj, key, inside, remote);// P2P kernel within the cutoff
+	} else if (type == PairFar) {                           //  Else if distance is far enough
+	  if (costModel == NULL) evalM2L(Ci, Cj, key, mutual, remote);// M2L kernel
+	  else evalFar(Ci, Cj, key, mutual, remote);            //   Or cheapest kernel by cost model
+	} else {                                                //  Else if both cells are bodies
 #if EXAFMM_NO_P2P
-	int index = Ci->ICELL;
-	int iX[3] = {0, 0, 0};
-	int d = 0, level = 0;
-	while( index != 0 ) {
-	  iX[d] += (index % 2) * (1 << level);
-	  index >>= 1;
-	  d = (d+1) % 3;
-	  if( d == 0 ) level++;
-	}
-	index = Cj->ICELL;
-	int jX[3] = {0, 0, 0};
-	d = 0; level = 0;
-	while( index != 0 ) {
-	  jX[d] += (index % 2) * (1 << level);
-	  index >>= 1;
-	  d = (d+1) % 3;
-	  if( d == 0 ) level++;
-	}
-	int isNeighbor = 1;
-	for (d=0; d<3; d++) {
-	  if (Kernel::Xperiodic[d] > 1e-3) jX[d] += 5;
-	  if (Kernel::Xperiodic[d] < -1e-3) jX[d] -= 5;
-	  isNeighbor &= abs(iX[d] - jX[d]) <= 1;
-	}
+	  int index = Ci->ICELL;
+	  int iX[3] = {0, 0, 0};
+	  int d = 0, level = 0;
+	  while( index != 0 ) {
+	    iX[d] += (index % 2) * (1 << level);
+	    index >>= 1;
+	    d = (d+1) % 3;
+	    if( d == 0 ) level++;
+	  }
+	  index = Cj->ICELL;
+	  int jX[3] = {0, 0, 0};
+	  d = 0; level = 0;
+	  while( index != 0 ) {
+	    jX[d] += (index % 2) * (1 << level);
+	    index >>= 1;
+	    d = (d+1) % 3;
+	    if( d == 0 ) level++;
+	  }
+	  int isNeighbor = 1;
+	  for (d=0; d<3; d++) {
+	    if (Xperiodic[key][d] > 1e-3) jX[d] += 5;
+	    if (Xperiodic[key][d] < -1e-3) jX[d] -= 5;
+	    isNeighbor &= abs(iX[d] - jX[d]) <= 1;
+	  }
 #endif
-	if (Cj->NBODY == 0) {                                   //  If the bodies weren't sent from remote node
-	  //std::cout << "Warning: icell " << Ci->ICELL << " needs bodies from jcell" << Cj->ICELL << std::endl;
-	  Kernel::M2L(Ci, Cj, mutual);                          //   M2L kernel
-	  countKernel(numM2L);                                  //   Increment M2L counter
-	  countList(Ci, Cj, mutual, false);                     //   Increment M2L list
-	  countWeight(Ci, Cj, mutual, remote);                  //   Increment M2L weight
+	  if (Cj->NBODY == 0) {                                 //   If the bodies weren't sent from remote node
+	    //std::cout << "Warning: icell " << Ci->ICELL << " needs bodies from jcell" << Cj->ICELL << std::endl;
+	    evalM2L(Ci, Cj, key, mutual, remote);               //    M2L kernel
 #if EXAFMM_NO_P2P
-	} else if (!isNeighbor) {                               //  If GROAMCS handles neighbors
-	  Kernel::M2L(Ci, Cj, mutual);                          //   M2L kernel
-	  countKernel(numM2L);                                  //   Increment M2L counter
-	  countList(Ci, Cj, mutual, false);                     //   Increment M2L list
-	  countWeight(Ci, Cj, mutual, remote);                  //   Increment M2L weight
-	} else {
-	  countList(Ci, Cj, mutual, true);                      //   Increment P2P list
+	  } else if (!isNeighbor) {                             //   If GROAMCS handles neighbors
+	    evalM2L(Ci, Cj, key, mutual, remote);               //    M2L kernel
+	  } else {
+	    countList(Ci, Cj, mutual, true);                    //    Increment P2P list
 #else
-	} else {
-	  if (R2 == 0 && Ci == Cj) {                            //   If source and target are same
-	    Kernel::P2P(Ci);                                    //    P2P kernel for single cell
-	  } else {                                              //   Else if source and target are different
-	    Kernel::P2P(Ci, Cj, mutual);                        //    P2P kernel for pair of cells
-	  }                                                     //   End if for same source and target
-	  countKernel(numP2P);                                  //   Increment P2P counter
-	  countList(Ci, Cj, mutual, true);                      //   Increment P2P list
-	  countWeight(Ci, Cj, mutual, remote);                  //   Increment P2P weight
+	  } else {
+	    evalP2P(Ci, Cj, key, mutual, remote);               //    P2P kernel
 #endif
-	}                                                       //  End if for bodies
-      } else {                                                  // Else if cells are close but not bodies
-	splitCell(Ci, Cj, mutual, remote);                      //  Split cell and call function recursively for child
-      }                                                         // End if for multipole acceptance
+	  }                                                     //   End if for bodies
+	}                                                       //  End if for multipole acceptance
+      }                                                         // End loop over periodic keys in mask
+      if (splitMask != 0) {                                     // If any image needs splitting
+	splitCell(Ci, Cj, splitMask, mutual, remote);           //  Split cell and call function recursively for child
+      }                                                         // End if for splitting
     }
 
     //! Recursive functor for dual tree traversal of a range of Ci and Cj
@@ -290,24 +588,25 @@ namespace exafmm {
       C_iter CiEnd;                                             //!< End iterator of target cells
       C_iter CjBegin;                                           //!< Begin Iterator of source cells
       C_iter CjEnd;                                             //!< End iterator of source cells
+      int mask;                                                 //!< Mask of periodic keys of source images
       bool mutual;                                              //!< Flag for mutual interaction
       real_t remote;                                            //!< Weight for remote work load
       TraverseRange(Traversal * _traversal, C_iter _CiBegin, C_iter _CiEnd,// Constructor
 		    C_iter _CjBegin, C_iter _CjEnd,
-		    bool _mutual, real_t _remote) :
+		    int _mask, bool _mutual, real_t _remote) :
 	traversal(_traversal), CiBegin(_CiBegin), CiEnd(_CiEnd),// Initialize variables
-	CjBegin(_CjBegin), CjEnd(_CjEnd), mutual(_mutual), remote(_remote) {}
+	CjBegin(_CjBegin), CjEnd(_CjEnd), mask(_mask), mutual(_mutual), remote(_remote) {}
       void operator() () const {                                // Overload operator()
 	Tracer tracer;                                          //  Instantiate tracer
 	logger::startTracer(tracer);                            //  Start tracer
 	if (CiEnd - CiBegin == 1 || CjEnd - CjBegin == 1) {     //  If only one cell in range
 	  if (CiBegin == CjBegin) {                             //   If Ci == Cj
 	    assert(CiEnd == CjEnd);                             //    Check if mutual & self interaction
-	    traversal->dualTreeTraversal(CiBegin, CjBegin, mutual, remote);//   Call traverse for single pair
+	    traversal->dualTreeTraversal(CiBegin, CjBegin, mask, mutual, remote);// Call traverse for single pair
 	  } else {                                              //   If Ci != Cj
 	    for (C_iter Ci=CiBegin; Ci!=CiEnd; Ci++) {          //    Loop over all Ci cells
 	      for (C_iter Cj=CjBegin; Cj!=CjEnd; Cj++) {        //     Loop over all Cj cells
-		traversal->dualTreeTraversal(Ci, Cj, mutual, remote);//   Call traverse for single pair
+		traversal->dualTreeTraversal(Ci, Cj, mask, mutual, remote);// Call traverse for single pair
 	      }                                                 //     End loop over all Cj cells
 	    }                                                   //    End loop over all Ci cells
 	  }                                                     //   End if for Ci == Cj
@@ -317,20 +616,20 @@ namespace exafmm {
 	  mk_task_group;                                        //   Initialize task group
 	  {
 	    TraverseRange leftBranch(traversal, CiBegin, CiMid, //    Instantiate recursive functor
-				     CjBegin, CjMid, mutual, remote);
-	    create_taskc(leftBranch);                           //    Ci:former Cj:former
+				     CjBegin, CjMid, mask, mutual, remote);
+	    create_taskc_if(!traversal->recording, leftBranch); //    Ci:former Cj:former
 	    TraverseRange rightBranch(traversal, CiMid, CiEnd,  //    Instantiate recursive functor
-				      CjMid, CjEnd, mutual, remote);
+				      CjMid, CjEnd, mask, mutual, remote);
 	    rightBranch();                                      //    Ci:latter Cj:latter
 	    wait_tasks;                                         //    Synchronize task group
 	  }
 	  {
 	    TraverseRange leftBranch(traversal, CiBegin, CiMid, //    Instantiate recursive functor
-				     CjMid, CjEnd, mutual, remote);
-	    create_taskc(leftBranch);                           //    Ci:former Cj:latter
+				     CjMid, CjEnd, mask, mutual, remote);
+	    create_taskc_if(!traversal->recording, leftBranch); //    Ci:former Cj:latter
 	    if (!mutual || CiBegin != CjBegin) {                //    Exclude mutual & self interaction
 	      TraverseRange rightBranch(traversal, CiMid, CiEnd,//    Instantiate recursive functor
-					CjBegin, CjMid, mutual, remote);
+					CjBegin, CjMid, mask, mutual, remote);
 	      rightBranch();                                    //    Ci:latter Cj:former
 	    } else {                                            //    If mutual or self interaction
 	      assert(CiEnd == CjEnd);                           //     Check if mutual & self interaction
@@ -342,67 +641,240 @@ namespace exafmm {
       }                                                         // End overload operator()
     };
 
+    //! Dual tree traversal of root cells for all periodic images in one pass
+    void dualTreeTraversalImages(vec3 cycle, bool mutual, real_t remote) {
+      setPeriodicOffsets(cycle);                                // Set periodic coordinate offset of each key
+      if (images == 0) {                                        // If non-periodic boundary condition
+	dualTreeTraversal(Ci0, Cj0, 1 << 13, mutual, remote);   //  Traverse the tree for center image
+      } else {                                                  // If periodic boundary condition
+	dualTreeTraversal(Ci0, Cj0, (1 << 27) - 1, false, remote);//  Traverse the tree for all 27 images
+      }                                                         // End if for periodic boundary condition
+    }
+
+    //! Set P2P and M2L interaction lists of current Ci0 and Cj0 without evaluating kernels
+    void setInteractionList(int numCells, vec3 cycle, bool dual, InteractionList & list) {
+      if (dual) {                                               // If dual tree traversal
+	recording = true;                                       //  Record pairs instead of evaluating kernels
+	pairsP2P.clear();                                       //  Clear recorded P2P pairs
+	pairsM2L.clear();                                       //  Clear recorded M2L pairs
+	pairsM2P.clear();                                       //  Clear recorded M2P pairs
+	pairsP2L.clear();                                       //  Clear recorded P2L pairs
+	dualTreeTraversalImages(cycle, false, 1);               //  Traverse the tree
+	recording = false;                                      //  Evaluate kernels from now on
+	sortPairs(pairsP2P, numCells, list.P2P);                //  Set P2P list from recorded pairs
+	sortPairs(pairsM2L, numCells, list.M2L);                //  Set M2L list from recorded pairs
+	sortPairs(pairsM2P, numCells, list.M2P);                //  Set M2P list from recorded pairs
+	sortPairs(pairsP2L, numCells, list.P2L);                //  Set P2L list from recorded pairs
+      } else {                                                  // If list based traversal
+	listOffset = new int [numCells][6]();                   //  Offset of interaction lists
+	lists.reserve((216+27)*numCells);                       //  Reserve interaction lists of uniform tree
+	setLists(numCells);                                     //  Set U, V, W and X interaction lists
+	copyList(0, numCells, list.P2P);                        //  Copy P2P list
+	copyList(1, numCells, list.M2L);                        //  Copy M2L list
+	copyList(3, numCells, list.M2P);                        //  Copy M2P list
+	copyList(4, numCells, list.P2L);                        //  Copy P2L list
+	delete[] listOffset;                                    //  Deallocate offset of lists
+	std::vector<ivec3>().swap(lists);                       //  Deallocate lists
+      }                                                         // End if for dual tree traversal
+    }
+
+    //! Symmetric P2P of list based traversal, evaluating each pair of neighbor leafs once
+    /*!
+      Leafs are colored by their level and their 3-D index modulo 3 in each dimension. A pair
+      is evaluated by its coarser leaf, so leafs of one color only update bodies within their
+      own neighborhood. They are at least 3 cells apart, the updates do not overlap, and each
+      color runs in parallel. Pairs across a periodic boundary would break this, so they
+      stay one-sided in both directions with explicit periodic offsets.
+    */
+    void listBasedP2PMutual(int numCells, const CSRList & list, real_t remote) {
+      std::vector<int> levels(numCells);                        // Level of each cell
+      int maxLevel = 0;                                         // Deepest level of leafs
+      for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
+	levels[icell] = getLevel((Ci0+icell)->ICELL);           //  Level of cell
+	maxLevel = std::max(maxLevel, levels[icell]);           //  Update deepest level
+      }                                                         // End loop over target cells
+      const int numColors = 27 * (maxLevel + 1);                // Number of colors of leafs, 27 per level
+      std::vector<int> colorOffset(numColors+1, 0);             // Offset of leafs of each color
+      std::vector<int> colors(numCells), leafs(numCells);       // Color of each cell and leafs sorted by color
+      for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
+	ivec3 iX = Key::getIndex((Ci0+icell)->ICELL);           //  3-D index of cell
+	colors[icell] = iX[0] % 3 + 3 * (iX[1] % 3) + 9 * (iX[2] % 3) + 27 * levels[icell];// Color of cell
+	if (list.offset[icell] != list.offset[icell+1]) colorOffset[colors[icell]+1]++;// Count leafs of color
+      }                                                         // End loop over target cells
+      for (int color=0; color<numColors; color++) {             // Loop over colors
+	colorOffset[color+1] += colorOffset[color];             //  Scan counts to offsets
+      }                                                         // End loop over colors
+      std::vector<int> next(colorOffset.begin(), colorOffset.end()-1);// Next free slot of each color
+      for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
+	if (list.offset[icell] != list.offset[icell+1]) leafs[next[colors[icell]]++] = icell;// Store leaf in its color
+      }                                                         // End loop over target cells
+      for (int color=0; color<numColors; color++) {             // Loop over colors
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int l=colorOffset[color]; l<colorOffset[color+1]; l++) {// Loop over leafs of this color
+	  const int maxBatch = 64;                              //   Maximum number of source cells in one batch
+	  int icell = leafs[l];                                 //   Index of target cell
+	  pollProgress(1);                                      //   Poll progress hook
+	  C_iter Ci = Ci0 + icell;                              //   Iterator of target cell
+	  C_iter Cj[maxBatch];                                  //   Batch of periodic source cells
+	  vec3 Xj[maxBatch];                                    //   Periodic offsets of source cells
+	  int numBatch = 0;                                     //   Number of source cells in batch
+	  for (int i=list.offset[icell]; i<list.offset[icell+1]; i++) {// Loop over P2P interaction list
+	    int jcell = list.jcell[i];                          //    Index of source cell
+	    if (list.periodicKey[i] != 13) {                    //    If source cell is a periodic image
+	      Xj[numBatch] = Xperiodic[list.periodicKey[i]];    //     Periodic coordinate offset
+	      Cj[numBatch] = Cj0 + jcell;                       //     Iterator of source cell
+	      if (++numBatch == maxBatch) {                     //     If batch is full
+		evalP2P(Ci, Cj, Xj, numBatch, remote);          //      Batched P2P kernel
+		numBatch = 0;                                   //      Start new batch
+	      }                                                 //     End if for full batch
+	    } else if (jcell == icell) {                        //    Else if source and target are same
+	      evalP2P(Ci, false, remote);                       //     P2P kernel for single cell
+	    } else if (levels[jcell] > levels[icell] ||         //    Else if source is finer, or
+		       (levels[jcell] == levels[icell] && jcell > icell)) {// same level with larger index
+	      evalP2P(Ci, Cj0+jcell, 13, true, remote);         //     Mutual P2P kernel
+	    }                                                   //    End if for periodic image
+	  }                                                     //   End loop over P2P interaction list
+	  if (numBatch > 0) evalP2P(Ci, Cj, Xj, numBatch, remote);// Batched P2P kernel for rest of list
+	}                                                       //  End loop over leafs of this color
+      }                                                         // End loop over colors
+    }
+
     //! List based traversal
-    void listBasedTraversal(int numCells, vec3 cycle, bool mutual, real_t remote) {
-      int list[189], periodicKeys[189];                         // Current interaction list
+    void listBasedTraversal(int numCells, const InteractionList & list, vec3 cycle, bool mutual, real_t remote) {
+      setPeriodicOffsets(cycle);                                // Set periodic coordinate offset of each key
 #ifdef _OPENMP
-#pragma omp parallel for private(list, periodicKeys) schedule(dynamic)
+#pragma omp parallel for schedule(dynamic)
 #endif
       for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
+	const int maxBatch = 64;                                //  Maximum number of source cells in one batch
 	C_iter Ci = Ci0 + icell;                                //  Iterator of target cell
-	int nlist;                                              //  Interaction list size
-	getList(1, icell, list, periodicKeys, nlist);           //  Get M2L interaction list
-	for (int ilist=0; ilist<nlist; ilist++) {               //  Loop over M2L interaction list
-	  int jcell = list[ilist];                              //   Index of source cell
-	  int periodicKey = periodicKeys[ilist];                //   Periodic key
-	  C_iter Cj = Cj0 + jcell;                              //   Iterator of source cell
-	  ivec3 pX = getPeriodicIndex(periodicKey);             //   3-D periodic index of source cell
-	  for (int d=0; d<3; d++) {                             //   Loop over dimensions
-	    Kernel::Xperiodic[d] = pX[d] * cycle[d];            //    Periodic coordinate offset
-	  }                                                     //   End loop over dimensions
-	  Kernel::M2L(Ci, Cj, mutual);                          //   M2L kernel
-	  countKernel(numM2L);                                  //   Increment M2L counter
-	  countList(Ci, Cj, mutual, false);                     //   Increment M2L list
-	  countWeight(Ci, Cj, mutual, remote);                  //   Increment M2L weight
+	pollProgress(1);                                        //  Poll progress hook
+	C_iter CjBatch[maxBatch];                               //  Batch of source cells
+	vec3 XjBatch[maxBatch];                                 //  Periodic offsets of source cells
+	int numBatch = 0;                                       //  Number of source cells in batch
+	for (int i=list.M2L.offset[icell]; i<list.M2L.offset[icell+1]; i++) {// Loop over M2L interaction list
+	  XjBatch[numBatch] = Xperiodic[list.M2L.periodicKey[i]];//   Periodic coordinate offset
+	  CjBatch[numBatch] = Cj0 + list.M2L.jcell[i];          //   Iterator of source cell
+	  if (++numBatch == maxBatch) {                         //   If batch is full
+	    evalM2L(Ci, CjBatch, XjBatch, numBatch, remote);    //    Batched M2L kernel
+	    numBatch = 0;                                       //    Start new batch
+	  }                                                     //   End if for full batch
 	}                                                       //  End loop over M2L interaction list
+	if (numBatch > 0) evalM2L(Ci, CjBatch, XjBatch, numBatch, remote);//  Batched M2L kernel for rest of list
+	for (int i=list.P2L.offset[icell]; i<list.P2L.offset[icell+1]; i++) {// Loop over P2L interaction list
+	  C_iter Cj = Cj0 + list.P2L.jcell[i];                  //   Iterator of source cell
+	  uint64_t begin = counter::start();                    //   Start cycle counter
+	  Kernel::P2L(Ci, Cj, Xperiodic[list.P2L.periodicKey[i]]);//   P2L kernel
+	  counter::stop(counter::P2L, begin, Cj->NBODY);        //   Count P2L kernel
+	  countWeight(Ci, Cj, false, remote);                   //   Increment P2L weight
+	}                                                       //  End loop over P2L interaction list
+	for (int i=list.M2P.offset[icell]; i<list.M2P.offset[icell+1]; i++) {// Loop over M2P interaction list
+	  C_iter Cj = Cj0 + list.M2P.jcell[i];                  //   Iterator of source cell
+	  uint64_t begin = counter::start();                    //   Start cycle counter
+	  Kernel::M2P(Ci, Cj, Xperiodic[list.M2P.periodicKey[i]]);//   M2P kernel
+	  counter::stop(counter::M2P, begin, Ci->NBODY);        //   Count M2P kernel
+	  countWeight(Ci, Cj, false, remote);                   //   Increment M2P weight
+	}                                                       //  End loop over M2P interaction list
       }                                                         // End loop over target cells
 
 #ifndef EXAFMM_NO_P2P
+      logger::startTimer("Traverse P2P");                       // Start timer
+      if (mutual) {                                             // If mutual interaction
+	listBasedP2PMutual(numCells, list.P2P, remote);         //  Evaluate each pair of leafs once
+	logger::stopTimer("Traverse P2P", 0);                   //  Stop timer
+	return;                                                 //  Skip one-sided P2P
+      }                                                         // End if for mutual interaction
 #ifdef _OPENMP
-#pragma omp parallel for private(list, periodicKeys) schedule(dynamic)
+#pragma omp parallel for schedule(dynamic)
 #endif
       for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
+	const int maxBatch = 64;                                //  Maximum number of source cells in one batch
 	C_iter Ci = Ci0 + icell;                                //  Iterator of target cell
-	if (Ci->NCHILD == 0) {                                  //  If target cell is leaf
-	  int nlist;                                            //   Interaction list size
-	  getList(0, icell, list, periodicKeys, nlist);         //   Get P2P interaction list
-	  for (int ilist=0; ilist<nlist; ilist++) {             //   Loop over P2P interaction list
-	    int jcell = list[ilist];                            //    Index of source cell
-	    int periodicKey = periodicKeys[ilist];              //    Periodic key
-	    C_iter Cj = Cj0 + jcell;                            //    Iterator of source cell
-	    ivec3 pX = getPeriodicIndex(periodicKey);           //    3-D periodic index of source cell
-	    for (int d=0; d<3; d++) {                           //    Loop over dimensions
-	      Kernel::Xperiodic[d] = pX[d] * cycle[d];          //     Periodic coordinate offset
-	    }                                                   //    End loop over dimensions
-	    Kernel::P2P(Ci, Cj, mutual);                        //    P2P kernel
-	    countKernel(numP2P);                                //    Increment P2P counter
-	    countList(Ci, Cj, mutual, true);                    //    Increment P2P list
-	    countWeight(Ci, Cj, mutual, remote);                //    Increment P2P weight
-	  }                                                     //   End loop over P2P interaction list
-	}                                                       //  End if for target cell leaf
+	pollProgress(1);                                        //  Poll progress hook
+	C_iter Cj[maxBatch];                                    //  Batch of source cells
+	vec3 Xj[maxBatch];                                      //  Periodic offsets of source cells
+	int numBatch = 0;                                       //  Number of source cells in batch
+	for (int i=list.P2P.offset[icell]; i<list.P2P.offset[icell+1]; i++) {// Loop over P2P interaction list
+	  Xj[numBatch] = Xperiodic[list.P2P.periodicKey[i]];    //   Periodic coordinate offset
+	  Cj[numBatch] = Cj0 + list.P2P.jcell[i];               //   Iterator of source cell
+	  if (Cj[numBatch] == Ci && list.P2P.periodicKey[i] == 13) {// If source and target are same
+	    evalP2P(Ci, false, remote);                         //    P2P kernel for single cell
+	  } else if (++numBatch == maxBatch) {                  //   Else if batch is full
+	    evalP2P(Ci, Cj, Xj, numBatch, remote);              //    Batched P2P kernel
+	    numBatch = 0;                                       //    Start new batch
+	  }                                                     //   End if for same source and target
+	}                                                       //  End loop over P2P interaction list
+	if (numBatch > 0) evalP2P(Ci, Cj, Xj, numBatch, remote);//  Batched P2P kernel for rest of list
       }                                                         // End loop over target cells
+      logger::stopTimer("Traverse P2P", 0);                     // Stop timer
 #endif
     }
 
-    //! Tree traversal of periodic cells
-    void traversePeriodic(vec3 cycle) {
-      logger::startTimer("Traverse periodic");                  // Start timer
+    //! P2P of a Verlet list of leaf pairs within the cutoff plus a skin
+    /*!
+      Bodies may have moved by up to skin/2 since the list was set, so the cells are
+      padded by the skin when deciding which pairs are entirely within the cutoff.
+    */
+    void listBasedCutoff(int numCells, const CSRList & list, vec3 cycle, real_t skin, real_t remote) {
+      setPeriodicOffsets(cycle);                                // Set periodic coordinate offset of each key
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+      for (int icell=0; icell<numCells; icell++) {              // Loop over target cells
+	const int maxBatch = 64;                                //  Maximum number of source cells in one batch
+	C_iter Ci = Ci0 + icell;                                //  Iterator of target cell
+	pollProgress(1);                                        //  Poll progress hook
+	C_iter Cj[maxBatch];                                    //  Batch of source cells
+	vec3 Xj[maxBatch];                                      //  Periodic offsets of source cells
+	int numBatch = 0;                                       //  Number of source cells in batch
+	CutoffScratch & scratch = cutoffScratch[getThreadIndex()];//  Scratch of this thread
+	for (int i=list.offset[icell]; i<list.offset[icell+1]; i++) {// Loop over Verlet list
+	  C_iter CJ = Cj0 + list.jcell[i];                      //   Iterator of source cell
+	  const vec3 & X = Xperiodic[list.periodicKey[i]];      //   Periodic coordinate offset
+	  real_t R = std::sqrt(norm(Ci->X - CJ->X - X));        //   Distance between cell centers
+	  real_t Rsum = (Ci->R + CJ->R) * std::sqrt(real_t(3)) + skin;// Radii of spheres around cubic cells
+	  if (R - Rsum >= cutoff) continue;                     //   Skip cells that are beyond the cutoff
+	  if (R + Rsum >= cutoff) {                             //   If cells straddle the cutoff
+	    uint64_t begin = counter::start();                  //    Start cycle counter
+	    P2PCutoff(Ci, CJ, X, cutoff, scratch.buffer, scratch.cells.begin());// Filter pairs by cutoff
+	    counter::stop(counter::P2P, begin, real_t(Ci->NBODY) * CJ->NBODY);// Count P2P kernel
+	    countList(Ci, CJ, false, true);                     //    Increment P2P list
+	    countWeight(Ci, CJ, false, remote);                 //    Increment P2P weight
+	    continue;                                           //    Skip batch
+	  }                                                     //   End if for straddling cells
+	  Cj[numBatch] = CJ;                                    //   Store source cell
+	  Xj[numBatch] = X;                                     //   Store periodic offset
+	  if (++numBatch == maxBatch) {                         //   If batch is full
+	    evalP2P(Ci, Cj, Xj, numBatch, remote);              //    Batched P2P kernel
+	    numBatch = 0;                                       //    Start new batch
+	  }                                                     //   End if for full batch
+	}                                                       //  End loop over Verlet list
+	if (numBatch > 0) evalP2P(Ci, Cj, Xj, numBatch, remote);//  Batched P2P kernel for rest of list
+      }                                                         // End loop over target cells
+    }
+
+    //! Number of real parts of an expansion coefficient
+    static int numParts(const real_t &) { return 1; }
+    static int numParts(const complex_t &) { return 2; }
+
+    //! Real (part 0) or imaginary (part 1) part of an expansion coefficient
+    static real_t getPart(const real_t & M, int) { return M; }
+    static real_t getPart(const complex_t & M, int part) { return part == 0 ? std::real(M) : std::imag(M); }
+
+    //! Unit expansion coefficient in the real (part 0) or imaginary (part 1) direction
+    static void setUnit(real_t & M, int) { M = 1; }
+    static void setUnit(complex_t & M, int part) { M = part == 0 ? complex_t(1) : I; }
+
+    //! Far field of periodic images of source root CJ on target root CI by M2L and M2M for each sublevel
+    void periodicImages(C_iter CI, C_iter CJ, vec3 cycle) {
       Cells pcells; pcells.resize(27);                          // Create cells
       C_iter Ci = pcells.end()-1;                               // Last cell is periodic parent cell
-      *Ci = *Cj0;                                               // Copy values from source root
+      vec3 Xshift;                                              // Periodic coordinate offset of image
+      *Ci = *CJ;                                                // Copy values from source root
       Ci->ICHILD = 0;                                           // Child cells for periodic center cell
       Ci->NCHILD = 26;                                          // Number of child cells for periodic center cell
-      C_iter C0 = Cj0;                                          // Placeholder for Cj0
       for (int level=0; level<images-1; level++) {              // Loop over sublevels of tree
 	for (int ix=-1; ix<=1; ix++) {                          //  Loop over x periodic direction
 	  for (int iy=-1; iy<=1; iy++) {                        //   Loop over y periodic direction
@@ -411,10 +883,10 @@ namespace exafmm {
 		for (int cx=-1; cx<=1; cx++) {                  //      Loop over x periodic direction (child)
 		  for (int cy=-1; cy<=1; cy++) {                //       Loop over y periodic direction (child)
 		    for (int cz=-1; cz<=1; cz++) {              //        Loop over z periodic direction (child)
-		      Kernel::Xperiodic[0] = (ix * 3 + cx) * cycle[0];//   Coordinate offset for x periodic direction
-		      Kernel::Xperiodic[1] = (iy * 3 + cy) * cycle[1];//   Coordinate offset for y periodic direction
-		      Kernel::Xperiodic[2] = (iz * 3 + cz) * cycle[2];//   Coordinate offset for z periodic direction
-		      Kernel::M2L(Ci0, Ci, false);              //         M2L kernel
+		      Xshift[0] = (ix * 3 + cx) * cycle[0];     //         Coordinate offset for x periodic direction
+		      Xshift[1] = (iy * 3 + cy) * cycle[1];     //         Coordinate offset for y periodic direction
+		      Xshift[2] = (iz * 3 + cz) * cycle[2];     //         Coordinate offset for z periodic direction
+		      Kernel::M2L(CI, Ci, Xshift, false);       //         M2L kernel
 		    }                                           //        End loop over z periodic direction (child)
 		  }                                             //       End loop over y periodic direction (child)
 		}                                               //      End loop over x periodic direction (child)
@@ -422,8 +894,7 @@ namespace exafmm {
 	    }                                                   //    End loop over z periodic direction
 	  }                                                     //   End loop over y periodic direction
 	}                                                       //  End loop over x periodic direction
-	Cj0 = pcells.begin();                                   //  Redefine Cj0 for M2M
-	C_iter Cj = Cj0;                                        //  Iterator of periodic neighbor cells
+	C_iter Cj = pcells.begin();                             //  Iterator of periodic neighbor cells
 	for (int ix=-1; ix<=1; ix++) {                          //  Loop over x periodic direction
 	  for (int iy=-1; iy<=1; iy++) {                        //   Loop over y periodic direction
 	    for (int iz=-1; iz<=1; iz++) {                      //    Loop over z periodic direction
@@ -438,21 +909,98 @@ namespace exafmm {
 	  }                                                     //   End loop over y periodic direction
 	}                                                       //  End loop over x periodic direction
 	Ci->M = 0;                                              //  Reset multipoles of periodic parent
-	Kernel::M2M(Ci,Cj0);                                    //  Evaluate periodic M2M kernels for this sublevel
+	Kernel::M2M(Ci, pcells.begin());                        //  Evaluate periodic M2M kernels for this sublevel
 	cycle *= 3;                                             //  Increase center cell size three times
-	Cj0 = C0;                                               //  Reset Cj0 back
       }                                                         // End loop over sublevels of tree
+    }
+
+    //! Precompute the far field of periodic images as a linear operator on the source root multipole
+    /*!
+      M2L and M2M are linear in the multipoles, so the far field of all image
+      sublevels is the sum of the responses to each real part of each coefficient
+      of the source root. The responses are local expansions about the center of the
+      source root, so they depend only on the cycle (and the size of the root for
+      Helmholtz), and not on the target root.
+    */
+    void setPeriodicOperator(vec3 cycle) {
+      logger::startTimer("Set periodic operator");              // Start timer
+      Cells roots(2);                                           // Copies of source root as target and source
+      C_iter CI = roots.begin();                                // Target root at center of source root
+      C_iter CJ = roots.begin() + 1;                            // Source root
+      *CI = *Cj0;                                               // Copy values from source root
+      *CJ = *Cj0;                                               // Copy values from source root
+      int nparts = numParts(CJ->M[0]);                          // Number of real parts per coefficient
+      periodicOperator.resize(Kernel::NTERM * nparts);          // Allocate one column per unit part
+      for (int n=0; n<Kernel::NTERM; n++) {                     // Loop over coefficients
+	for (int part=0; part<nparts; part++) {                 //  Loop over real parts of coefficient
+	  CJ->M = 0;                                            //   Reset source multipoles
+	  setUnit(CJ->M[n], part);                              //   Unit multipole of this part
+	  CI->L = 0;                                            //   Reset target locals
+	  periodicImages(CI, CJ, cycle);                        //   Far field of periodic images
+	  periodicOperator[n*nparts+part] = CI->L;              //   Store response as column of operator
+	}                                                       //  End loop over real parts of coefficient
+      }                                                         // End loop over coefficients
+      periodicCycle = cycle;                                    // Cycle of periodic operator
+      periodicScale = Cj0->SCALE;                               // Scale of source root
+      logger::stopTimer("Set periodic operator");               // Stop timer
+    }
+
+    //! Tree traversal of periodic cells
+    /*!
+      The periodic operator gives the far field of the images about the center of the
+      source root, and one L2L shifts it to the target root. Only this shift depends on
+      the pair of roots, so one operator serves the local root and all remote LET roots.
+    */
+    void traversePeriodic(vec3 cycle) {
+      logger::startTimer("Traverse periodic");                  // Start timer
+      if (!Kernel::linear) {                                    // If M2L and M2M are not linear in M
+	periodicImages(Ci0, Cj0, cycle);                        //  Evaluate each sublevel explicitly
+	logger::stopTimer("Traverse periodic");                 //  Stop timer
+	return;                                                 //  Skip periodic operator
+      }                                                         // End if for linear kernels
+      if (periodicOperator.empty() || norm(cycle - periodicCycle) != 0 ||// If periodic operator is not set
+	  (Kernel::equation == Helmholtz && Cj0->SCALE != periodicScale)) {// or Helmholtz source root has another size
+	setPeriodicOperator(cycle);                             //  Precompute periodic operator
+      }                                                         // End if for periodic operator
+      Cells roots(2);                                           // Source root center and target root
+      C_iter CJ = roots.begin();                                // Parent cell at center of source root
+      C_iter CI = roots.begin() + 1;                            // Child cell at target root
+      *CJ = *Cj0;                                               // Copy values from source root
+      *CI = *Ci0;                                               // Copy values from target root
+      CJ->L = 0;                                                // Reset locals at center of source root
+      CI->L = 0;                                                // Reset locals at target root
+      CI->IPARENT = 0;                                          // Parent of target root is source root center
+      const vecP & M = Cj0->M;                                  // Multipoles of source root
+      int nparts = numParts(M[0]);                              // Number of real parts per coefficient
+      for (int n=0; n<Kernel::NTERM; n++) {                     // Loop over coefficients
+	for (int part=0; part<nparts; part++) {                 //  Loop over real parts of coefficient
+	  CJ->L += periodicOperator[n*nparts+part] * getPart(M[n], part);// Add response to this part
+	}                                                       //  End loop over real parts of coefficient
+      }                                                         // End loop over coefficients
+      Kernel::L2L(CI, roots.begin());                           // Shift far field to target root
+      Ci0->L += CI->L;                                          // Add far field to locals of target root
       logger::stopTimer("Traverse periodic");                   // Stop timer
     }
 
   public:
     //! Constructor
     Traversal(int _nspawn, int _images, const char * _path) :   // Constructor
-      nspawn(_nspawn), images(_images), path(_path)             // Initialize variables
-#if EXAFMM_COUNT_KERNEL
-      , numP2P(0), numM2L(0)
-#endif
-    {}
+      nspawn(_nspawn), images(_images), path(_path), costModel(NULL), progress(NULL), numPolls(0),// Initialize variables
+      recording(false), cutoff(0) {}
+
+    //! Select far field kernels by a calibrated cost model during dual tree traversal
+    void setCostModel(const CostModel<Kernel> * _costModel) {
+      costModel = _costModel;                                   // Set cost model
+    }
+
+    //! Poll progress, e.g. of non-blocking communication, from thread 0 between kernels
+    /*!
+      _progress->poll() is called about once per target cell in list based traversal,
+      and once every 64 cell pairs in dual tree traversal. NULL stops polling.
+    */
+    void setProgress(Progress * _progress) {
+      progress = _progress;                                     // Set progress hook
+    }
 
 #if EXAFMM_COUNT_LIST
     //! Initialize size of P2P and M2L interaction lists per cell
@@ -488,87 +1036,212 @@ namespace exafmm {
       logger::initTracer();                                     // Initialize tracer
       Ci0 = icells.begin();                                     // Iterator of first target cell
       Cj0 = jcells.begin();                                     // Iterator of first source cell
-      Kernel::Xperiodic = 0;                                    // Set periodic coordinate offset to 0
       if (dual) {                                               // If dual tree traversal
-	if (images == 0) {                                      //  If non-periodic boundary condition
-	  dualTreeTraversal(Ci0, Cj0, mutual, remote);          //   Traverse the tree
-	} else {                                                //  If periodic boundary condition
-	  for (int ix=-1; ix<=1; ix++) {                        //   Loop over x periodic direction
-	    for (int iy=-1; iy<=1; iy++) {                      //    Loop over y periodic direction
-	      for (int iz=-1; iz<=1; iz++) {                    //     Loop over z periodic direction
-		Kernel::Xperiodic[0] = ix * cycle[0];           //      Coordinate shift for x periodic direction
-		Kernel::Xperiodic[1] = iy * cycle[1];           //      Coordinate shift for y periodic direction
-		Kernel::Xperiodic[2] = iz * cycle[2];           //      Coordinate shift for z periodic direction
-		dualTreeTraversal(Ci0, Cj0, false, remote);     //      Traverse the tree for this periodic image
-	      }                                                 //     End loop over z periodic direction
-	    }                                                   //    End loop over y periodic direction
-	  }                                                     //   End loop over x periodic direction
-	  traversePeriodic(cycle);                              //   Traverse tree for periodic images
-	}                                                       //  End if for periodic boundary condition
+	dualTreeTraversalImages(cycle, mutual, remote);         //  Traverse the tree
       } else {                                                  // If list based traversal
-	int numCells = icells.size();                           //  Number of cells
-	mutual = false;                                         //  Set mutual interaction flag to false
-	listOffset = new int [numCells][3]();                   //  Offset of interaction lists
-	lists = new int [(216+27)*numCells][3]();               //  All interaction lists
-	setLists(icells);                                       //  Set P2P and M2L interaction lists
-	listBasedTraversal(numCells, cycle, mutual, remote);    //  Traverse the tree
-	if (images != 0) {                                      //  If periodic boundary condition
-	  traversePeriodic(cycle);                              //   Traverse tree for periodic images
-	}                                                       //  End if for periodic boundary condition
-	delete[] listOffset;                                    //  Deallocate offset of lists
-	delete[] lists;                                         //  Deallocate lists
+	setInteractionList(icells.size(), cycle, false, traversalList);// Set P2P and M2L interaction lists
+	listBasedTraversal(icells.size(), traversalList, cycle, mutual && &icells == &jcells, remote);// Traverse the tree
       }                                                         // End if for dual tree traversal
+      if (images != 0) {                                        // If periodic boundary condition
+	traversePeriodic(cycle);                                //  Traverse tree for periodic images
+      }                                                         // End if for periodic boundary condition
+      logger::stopTimer("Traverse");                            // Stop timer
+      logger::writeTracer();                                    // Write tracer to file
+    }
+
+    //! Set P2P and M2L interaction lists of icells and jcells with list based or dual tree traversal
+    void setInteractionList(Cells & icells, Cells & jcells, vec3 cycle, bool dual, InteractionList & list) {
+      list.clear();                                             // Clear previous lists
+      if (icells.empty() || jcells.empty()) return;             // Quit if either of the cell vectors are empty
+      logger::startTimer("Set interaction list");               // Start timer
+      Ci0 = icells.begin();                                     // Iterator of first target cell
+      Cj0 = jcells.begin();                                     // Iterator of first source cell
+      setInteractionList(icells.size(), cycle, dual, list);     // Set P2P and M2L interaction lists
+      logger::stopTimer("Set interaction list");                // Stop timer
+    }
+
+    //! Evaluate P2P and M2L of an interaction list, setting it first if it is empty
+    void traverse(Cells & icells, Cells & jcells, vec3 cycle, bool dual, InteractionList & list, real_t remote=1) {
+      if (icells.empty() || jcells.empty()) return;             // Quit if either of the cell vectors are empty
+      if (list.empty()) setInteractionList(icells, jcells, cycle, dual, list);// Set interaction list once per tree
+      assert(list.M2L.offset.size() == icells.size() + 1);      // Make sure list belongs to this tree
+      logger::startTimer("Traverse");                           // Start timer
+      logger::initTracer();                                     // Initialize tracer
+      Ci0 = icells.begin();                                     // Iterator of first target cell
+      Cj0 = jcells.begin();                                     // Iterator of first source cell
+      listBasedTraversal(icells.size(), list, cycle, false, remote);// Evaluate kernels of interaction list
+      if (images != 0) {                                        // If periodic boundary condition
+	traversePeriodic(cycle);                                //  Traverse tree for periodic images
+      }                                                         // End if for periodic boundary condition
+      logger::stopTimer("Traverse");                            // Stop timer
+      logger::writeTracer();                                    // Write tracer to file
+    }
+
+    //! Evaluate P2P of the bodies within the cutoff, without far field
+    /*!
+      Dual tree traversal that skips cell pairs beyond the cutoff instead of
+      evaluating M2L, and runs P2P on pairs of leafs within it. jcells can be a
+      local essential tree set with the same cutoff. With periodic boundaries, the
+      27 nearest images are searched, so the cutoff must not exceed the cycle.
+    */
+    void traverseCutoff(Cells & icells, Cells & jcells, vec3 cycle, real_t _cutoff, real_t remote=1) {
+      if (icells.empty() || jcells.empty()) return;             // Quit if either of the cell vectors are empty
+      logger::startTimer("Traverse");                           // Start timer
+      logger::initTracer();                                     // Initialize tracer
+      Ci0 = icells.begin();                                     // Iterator of first target cell
+      Cj0 = jcells.begin();                                     // Iterator of first source cell
+      cutoff = _cutoff;                                         // Prune traversal by cutoff
+      initCutoffScratch();                                      // Scratch of each thread for the cutoff
+      dualTreeTraversalImages(cycle, false, remote);            // Traverse the tree
+      cutoff = 0;                                               // Back to FMM traversal
       logger::stopTimer("Traverse");                            // Stop timer
       logger::writeTracer();                                    // Write tracer to file
     }
 
+    //! Set Verlet list of icells and jcells, the pairs of leafs within the cutoff
+    void setCutoffList(Cells & icells, Cells & jcells, vec3 cycle, real_t _cutoff, InteractionList & list) {
+      cutoff = _cutoff;                                         // Prune traversal by cutoff
+      setInteractionList(icells, jcells, cycle, true, list);    // Record P2P pairs within the cutoff
+      cutoff = 0;                                               // Back to FMM traversal
+    }
+
+    //! Evaluate P2P of the bodies within the cutoff with a Verlet list, setting it first if it is empty
+    /*!
+      The list holds the pairs of leafs within cutoff + skin. It stays valid as long as
+      the cells keep their bodies, centers and radii, and no body has moved by more
+      than skin/2 since it was set. clear() it otherwise.
+    */
+    void traverseCutoff(Cells & icells, Cells & jcells, vec3 cycle, real_t _cutoff, real_t skin,
+			InteractionList & list, real_t remote=1) {
+      if (icells.empty() || jcells.empty()) return;             // Quit if either of the cell vectors are empty
+      if (list.empty()) setCutoffList(icells, jcells, cycle, _cutoff + skin, list);// Set Verlet list once per tree
+      assert(list.P2P.offset.size() == icells.size() + 1);      // Make sure list belongs to this tree
+      logger::startTimer("Traverse");                           // Start timer
+      Ci0 = icells.begin();                                     // Iterator of first target cell
+      Cj0 = jcells.begin();                                     // Iterator of first source cell
+      cutoff = _cutoff;                                         // Cutoff radius of P2P kernels
+      initCutoffScratch();                                      // Scratch of each thread for the cutoff
+      listBasedCutoff(icells.size(), list.P2P, cycle, skin, remote);// Evaluate P2P of Verlet list
+      cutoff = 0;                                               // Back to FMM traversal
+      logger::stopTimer("Traverse");                            // Stop timer
+    }
+
+    //! Recursive functor for blocked direct summation of a range of target blocks
+    /*!
+      Each target block sweeps over all source blocks of all periodic images through
+      the batched P2P kernel, which tiles the sources so that they stay in cache. With
+      a cutoff, block pairs that are entirely outside of it are skipped, and only
+      pairs that straddle it are filtered body by body.
+    */
     struct DirectRecursion {
-      C_iter Ci;                                                //!< Iterator of target cell
-      C_iter Cj;                                                //!< Iterator of source cell
-      DirectRecursion(C_iter _Ci, C_iter _Cj) :                 // Constructor
-	Ci(_Ci), Cj(_Cj) {}                                     // Initialize variables
+      C_iter CiBegin;                                           //!< Begin iterator of target blocks
+      C_iter CiEnd;                                             //!< End iterator of target blocks
+      C_iter CjBegin;                                           //!< Begin iterator of source blocks
+      C_iter CjEnd;                                             //!< End iterator of source blocks
+      const vec3 * Xperiodic;                                   //!< Periodic coordinate offsets of images
+      int numImages;                                            //!< Number of periodic images
+      real_t cutoff;                                            //!< Cutoff radius, 0 for no cutoff
+      CutoffScratch * scratches;                                //!< Cutoff scratch of each thread
+      DirectRecursion(C_iter _CiBegin, C_iter _CiEnd, C_iter _CjBegin, C_iter _CjEnd,// Constructor
+		      const vec3 * _Xperiodic, int _numImages, real_t _cutoff, CutoffScratch * _scratches) :
+	CiBegin(_CiBegin), CiEnd(_CiEnd), CjBegin(_CjBegin), CjEnd(_CjEnd),// Initialize variables
+	Xperiodic(_Xperiodic), numImages(_numImages), cutoff(_cutoff), scratches(_scratches) {}
+
+      //! Direct summation of one target block over all source blocks and images
+      void evalBlock(C_iter Ci) const {
+	const int maxBatch = 64;                                // Maximum number of source blocks in one batch
+	C_iter Cj[maxBatch];                                    // Batch of source blocks
+	vec3 Xj[maxBatch];                                      // Periodic offsets of source blocks
+	int numBatch = 0;                                       // Number of source blocks in batch
+	for (int p=0; p<numImages; p++) {                       // Loop over periodic images
+	  for (C_iter CJ=CjBegin; CJ!=CjEnd; CJ++) {            //  Loop over source blocks
+	    if (cutoff > 0) {                                   //   If there is a cutoff
+	      real_t R = std::sqrt(norm(Ci->X - CJ->X - Xperiodic[p]));// Distance between block centers
+	      if (R - Ci->R - CJ->R >= cutoff) continue;        //    Skip blocks that are outside of cutoff
+	      if (R + Ci->R + CJ->R >= cutoff) {                //    If blocks straddle the cutoff
+		CutoffScratch & scratch = scratches[getThreadIndex()];//   Scratch of this thread
+		P2PCutoff(Ci, CJ, Xperiodic[p], cutoff, scratch.buffer, scratch.cells.begin());// Filter pairs by cutoff
+		continue;                                       //     Skip batch
+	      }                                                 //    End if for straddling blocks
+	    }                                                   //   End if for cutoff
+	    Cj[numBatch] = CJ;                                  //   Store source block
+	    Xj[numBatch] = Xperiodic[p];                        //   Store periodic offset
+	    if (++numBatch == maxBatch) {                       //   If batch is full
+	      Kernel::P2P(Ci, Cj, Xj, numBatch);                //    Batched P2P kernel
+	      numBatch = 0;                                     //    Start new batch
+	    }                                                   //   End if for full batch
+	  }                                                     //  End loop over source blocks
+	}                                                       // End loop over periodic images
+	if (numBatch > 0) Kernel::P2P(Ci, Cj, Xj, numBatch);    // Batched P2P kernel for rest of blocks
+      }
+
       void operator() () const {                                // Overload operator
-	if (Ci->NBODY < 25) {                                   // If number of target bodies is less than threshold
-	  Kernel::P2P(Ci, Cj, false);                           //  Evaluate P2P kernel
-	} else {                                                // If number of target bodies is more than threshold
-	  Cells cells; cells.resize(1);                         //  Initialize new cell vector
-	  C_iter Ci2 = cells.begin();                           //  New cell iterator for right branch
-	  Ci2->BODY = Ci->BODY + Ci->NBODY / 2;                 //  Set begin iterator to handle latter half
-	  Ci2->NBODY = Ci->NBODY - Ci->NBODY / 2;               //  Set range to handle latter half
-	  Ci->NBODY = Ci->NBODY / 2;                            //  Set range to handle first half
+	if (CiEnd - CiBegin == 1) {                             // If only one target block in range
+	  evalBlock(CiBegin);                                   //  Direct summation of target block
+	} else {                                                // If many target blocks are in range
+	  C_iter CiMid = CiBegin + (CiEnd - CiBegin) / 2;       //  Split range of target blocks in half
 	  mk_task_group;                                        //  Initialize task group
-	  DirectRecursion leftBranch(Ci, Cj);                   //  Instantiate recursive functor
+	  DirectRecursion leftBranch(CiBegin, CiMid, CjBegin, CjEnd, Xperiodic, numImages, cutoff, scratches);// Instantiate recursive functor
 	  create_taskc(leftBranch);                             //  Create new task for left branch
-	  DirectRecursion rightBranch(Ci2, Cj);                 //  Instantiate recursive functor
+	  DirectRecursion rightBranch(CiMid, CiEnd, CjBegin, CjEnd, Xperiodic, numImages, cutoff, scratches);// Instantiate recursive functor
 	  rightBranch();                                        //  Use old task for right branch
 	  wait_tasks;                                           //  Synchronize task group
-	}                                                       // End if for NBODY threshold
+	}                                                       // End if for one target block
       }                                                         // End operator
     };
 
+    //! Split bodies into blocks of directBlock consecutive bodies with their bounding spheres
+    static void setBlocks(Bodies & bodies, Cells & blocks) {
+      blocks.resize((bodies.size() + directBlock - 1) / directBlock);// One cell per block
+      for (C_iter C=blocks.begin(); C!=blocks.end(); C++) {     // Loop over blocks
+	int ibody = (C - blocks.begin()) * directBlock;         //  Index of first body of block
+	C->BODY = bodies.begin() + ibody;                       //  Iterator of first body
+	C->NBODY = std::min(int(directBlock), int(bodies.size()) - ibody);// Number of bodies
+	vec3 Xmin = C->BODY->X, Xmax = C->BODY->X;              //  Bounds of block
+	for (B_iter B=C->BODY; B!=C->BODY+C->NBODY; B++) {      //  Loop over bodies of block
+	  Xmin = min(B->X, Xmin);                               //   Update minimum bound
+	  Xmax = max(B->X, Xmax);                               //   Update maximum bound
+	}                                                       //  End loop over bodies of block
+	C->X = (Xmin + Xmax) / 2;                               //  Center of block
+	C->R = std::sqrt(norm(Xmax - Xmin)) / 2;                //  Radius of bounding sphere
+      }                                                         // End loop over blocks
+    }
+
     //! Direct summation
-    void direct(Bodies & ibodies, Bodies & jbodies, vec3 cycle) {
-      Cells cells; cells.resize(2);                             // Define a pair of cells to pass to P2P kernel
-      C_iter Ci = cells.begin(), Cj = cells.begin()+1;          // First cell is target, second cell is source
+    /*!
+      Without a cutoff, the images are those within the periodic sublevels, as for the
+      FMM. With a cutoff, they are those that can reach the cutoff. Bodies are blocked in
+      the given order, so the cutoff prunes the most when they are sorted (e.g. by the
+      tree). Each task sums its own target bodies, so all images run concurrently.
+    */
+    void direct(Bodies & ibodies, Bodies & jbodies, vec3 cycle, real_t cutoff=0) {
+      if (ibodies.empty() || jbodies.empty()) return;           // Quit if either of the body vectors are empty
       int prange = 0;                                           // Range of periodic images
       for (int i=0; i<images; i++) {                            // Loop over periodic image sublevels
 	prange += int(std::pow(3.,i));                          //  Accumulate range of periodic images
       }                                                         // End loop over perioidc image sublevels
-      for (int ix=-prange; ix<=prange; ix++) {                  //  Loop over x periodic direction
-	for (int iy=-prange; iy<=prange; iy++) {                //   Loop over y periodic direction
-	  for (int iz=-prange; iz<=prange; iz++) {              //    Loop over z periodic direction
-	    Kernel::Xperiodic[0] = ix * cycle[0];               //     Coordinate shift for x periodic direction
-	    Kernel::Xperiodic[1] = iy * cycle[1];               //     Coordinate shift for y periodic direction
-	    Kernel::Xperiodic[2] = iz * cycle[2];               //     Coordinate shift for z periodic direction
-	    Ci->BODY = ibodies.begin();                         //     Iterator of first target body
-	    Ci->NBODY = ibodies.size();                         //     Number of target bodies
-	    Cj->BODY = jbodies.begin();                         //     Iterator of first source body
-	    Cj->NBODY = jbodies.size();                         //     Number of source bodies
-	    DirectRecursion directRecursion(Ci, Cj);            //     Instantiate recursive functor
-	    directRecursion();                                  //     Recursive call for direct summation
-	  }                                                     //    End loop over z periodic direction
-	}                                                       //   End loop over y periodic direction
-      }                                                         //  End loop over x periodic direction
+      if (cutoff > 0 && images != 0) {                          // If there is a cutoff with periodic images
+	prange = int(cutoff / min(cycle) * 0.999999) + 1;       //  Range of images within cutoff
+      }                                                         // End if for cutoff
+      std::vector<vec3> imageOffsets;                           // Periodic coordinate offsets of images
+      for (int ix=-prange; ix<=prange; ix++) {                  // Loop over x periodic direction
+	for (int iy=-prange; iy<=prange; iy++) {                //  Loop over y periodic direction
+	  for (int iz=-prange; iz<=prange; iz++) {              //   Loop over z periodic direction
+	    vec3 X;                                             //    Periodic coordinate offset
+	    X[0] = ix * cycle[0];                               //    Coordinate shift for x periodic direction
+	    X[1] = iy * cycle[1];                               //    Coordinate shift for y periodic direction
+	    X[2] = iz * cycle[2];                               //    Coordinate shift for z periodic direction
+	    imageOffsets.push_back(X);                          //    Store periodic coordinate offset
+	  }                                                     //   End loop over z periodic direction
+	}                                                       //  End loop over y periodic direction
+      }                                                         // End loop over x periodic direction
+      initCutoffScratch();                                      // Scratch of each thread for the cutoff
+      Cells iblocks, jblocks;                                   // Blocks of target and source bodies
+      setBlocks(ibodies, iblocks);                              // Split target bodies into blocks
+      setBlocks(jbodies, jblocks);                              // Split source bodies into blocks
+      DirectRecursion directRecursion(iblocks.begin(), iblocks.end(), jblocks.begin(), jblocks.end(),// Instantiate recursive functor
+				      &imageOffsets[0], imageOffsets.size(), cutoff, &cutoffScratch[0]);
+      directRecursion();                                        // Recursive call for direct summation
     }
 
     //! Normalize bodies after direct summation
@@ -594,19 +1267,7 @@ namespace exafmm {
   
     //! Print traversal statistics
     void printTraversalData() {
-#if EXAFMM_COUNT_KERNEL
-      if (logger::verbose) {                                    // If verbose flag is true
-	std::cout << "--- Traversal stats --------------" << std::endl// Print title
-		  << std::setw(logger::stringLength) << std::left //  Set format
-		  << "P2P calls"  << " : "                      //  Print title
-		  << std::setprecision(0) << std::fixed         //  Set format
-		  << numP2P << std::endl                        //  Print number of P2P calls
-		  << std::setw(logger::stringLength) << std::left //  Set format
-		  << "M2L calls"  << " : "                      //  Print title
-		  << std::setprecision(0) << std::fixed         //  Set format
-		  << numM2L << std::endl;                       //  Print number of M2L calls
-      }                                                         // End if for verbose flag
-#endif
+      counter::print<Kernel>();                                 // Print kernel counters of all threads
     }
 #if EXAFMM_COUNT_LIST
     void writeList(Cells cells, int mpirank) {
@@ -2,17 +2,73 @@
 #define tree_mpi_h
 #include <mpi.h>
 #include "logger.h"
+#include "mac.h"
+#include "node_mpi.h"
+#include "progress.h"
 #include "types.h"
 
 namespace exafmm {
   //! Handles all the communication of local essential trees
   template<typename Kernel>
-  class TreeMPI {
+  class TreeMPI : public Progress {
     typedef typename Kernel::Bodies Bodies;                     //!< Vector of bodies
     typedef typename Kernel::Cells Cells;                       //!< Vector of cells
     typedef typename Kernel::B_iter B_iter;                     //!< Iterator of body vector
     typedef typename Kernel::C_iter C_iter;                     //!< Iterator of cell vector
     typedef typename Kernel::vecP vecP;                         //!< Vector type for expansion terms
+    typedef Cell<B_iter,vecP> CellBase;                         //!< Topology and geometry of cell
+#if EXAFMM_LET_SINGLE
+    typedef float mreal_t;                                      //!< Multipoles are sent in single precision
+#else
+    typedef real_t mreal_t;                                     //!< Multipoles are sent in working precision
+#endif
+    typedef Source<Kernel::equation> SourceBase;                //!< Position and source values of body
+    static const int NMREAL = sizeof(vecP) / sizeof(real_t);    //!< Number of real values in multipole expansion
+
+    //! Cell of local essential tree as sent over the wire
+    /*!
+      Only what remote traversal reads: topology, key, scale, center and radius.
+      Weights, list counts, body iterators and local expansions stay behind.
+    */
+    struct CellLET {
+      int      IPARENT;                                         //!< Index of parent cell
+      int      ICHILD;                                          //!< Index of first child cell
+      int      NCHILD;                                          //!< Number of child cells
+      int      IBODY;                                           //!< Index of first body
+      int      NBODY;                                           //!< Number of descendant bodies
+      uint64_t ICELL;                                           //!< Cell index
+      real_t   SCALE;                                           //!< Scale for Helmholtz kernel
+      vec3     X;                                               //!< Cell center
+      real_t   R;                                               //!< Cell radius
+    };
+
+    //! Multipole expansion of cell of local essential tree as sent over the wire
+    struct MultipoleLET {
+      mreal_t  M[NMREAL];                                       //!< Real and imaginary parts of coefficients
+    };
+
+    //! Body of local essential tree as sent over the wire (position, source and initial index)
+    struct BodyLET : public SourceBase {
+      int      IBODY;                                           //!< Initial body numbering of sending rank
+    };
+
+    //! Pair of local and remote cells in pull traversal, with the periodic keys of the images that visit it
+    struct PullPair {
+      int icell;                                                //!< Index of local cell
+      int jcell;                                                //!< Index of remote cell in pulled tree
+      int mask;                                                 //!< Mask of periodic keys of source images
+      PullPair(int _icell, int _jcell, int _mask) :             //!< Constructor
+	icell(_icell), jcell(_jcell), mask(_mask) {}
+    };
+
+    //! Distributed graph of the ranks that exchange data with this rank
+    struct Graph {
+      MPI_Comm comm;                                            //!< Graph communicator
+      std::vector<int> pattern;                                 //!< Ranks with non-zero send count, in rank order
+      std::vector<int> sources;                                 //!< Ranks that send to this rank, in collective order
+      std::vector<int> destinations;                            //!< Ranks that this rank sends to, in collective order
+      Graph() : comm(MPI_COMM_NULL) {}                          //!< Constructor
+    };
 
   private:
     const int mpirank;                                          //!< Rank of MPI communicator
@@ -32,8 +88,114 @@ namespace exafmm {
     int * sendCellDispl;                                        //!< Send displacement
     int * recvCellCount;                                        //!< Receive count
     int * recvCellDispl;                                        //!< Receive displacement
+    std::vector<BodyLET> sendBodyLET;                           //!< Send buffer for packed bodies
+    std::vector<BodyLET> recvBodyLET;                           //!< Receive buffer for packed bodies
+    std::vector<CellLET> sendBase;                              //!< Send buffer for topology and geometry of cells
+    std::vector<CellLET> recvBase;                              //!< Receive buffer for topology and geometry of cells
+    std::vector<MultipoleLET> sendM;                            //!< Send buffer for multipoles of cells
+    std::vector<MultipoleLET> recvM;                            //!< Receive buffer for multipoles of cells
+    std::vector<MPI_Request> sendRequests;                      //!< Requests of non-blocking sends of LET
+    std::vector<MPI_Request> recvRequests;                      //!< Requests of non-blocking receives of LET
+    std::vector<int> recvRequestRank;                           //!< Source rank of each receive request
+    std::vector<int> recvPending;                               //!< Number of pending receives from each rank
+    std::vector<int> recvArrived;                               //!< Ranks whose receives all completed, not yet handed out
+    std::vector<int> recvIndices;                               //!< Indices of requests completed by MPI_Testsome
+    int neighborSize;                                           //!< Minimum number of ranks to use neighborhood collectives
+    NodeMPI * node;                                             //!< Two-level communication through node leaders (NULL: flat)
+    Graph bodyGraph;                                            //!< Graph of body exchange
+    Graph cellGraph;                                            //!< Graph of cell exchange
+    std::vector<int> neighborSendCount;                         //!< Send count per destination of graph
+    std::vector<int> neighborSendDispl;                         //!< Send displacement per destination of graph
+    std::vector<int> neighborRecvCount;                         //!< Receive count per source of graph
+    std::vector<int> neighborRecvDispl;                         //!< Receive displacement per source of graph
+#if MPI_VERSION >= 3
+    MPI_Win baseWin;                                            //!< Window of topology and geometry of local cells
+    MPI_Win multipoleWin;                                       //!< Window of multipoles of local cells
+    MPI_Win bodyWin;                                            //!< Window of local bodies
+#endif
+    std::vector<int> pullCellCount;                             //!< Number of exposed cells of each rank
+    std::vector<int> pullChild;                                 //!< First pulled child of each remote cell (-1: not requested, -2: requested)
+    std::vector<int> pullBody;                                  //!< First pulled body of each remote cell (-1: not requested, -2: requested)
+    double pullBytes;                                           //!< Bytes pulled from remote ranks
 
   private:
+    //! Check if exchanges go through neighborhood collectives
+    bool useNeighbor() {
+#if MPI_VERSION >= 3
+      return mpisize >= neighborSize;                           // Use graph for enough ranks
+#else
+      return false;                                             // Neighborhood collectives need MPI-3
+#endif
+    }
+
+    //! Set graph of ranks with non-zero send count, reusing it unless the pattern of any rank has changed
+    void setGraph(Graph & graph, int * sendCount) {
+#if MPI_VERSION >= 3
+      std::vector<int> pattern;                                 // Ranks with non-zero send count
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	if (sendCount[irank] > 0) pattern.push_back(irank);     //  Add rank that is sent to
+      }                                                         // End loop over ranks
+      int changed = graph.comm == MPI_COMM_NULL || pattern != graph.pattern;// Check if pattern has changed
+      MPI_Allreduce(MPI_IN_PLACE, &changed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);// Changed on any rank
+      if (!changed) return;                                     // Reuse graph
+      if (graph.comm != MPI_COMM_NULL) MPI_Comm_free(&graph.comm);// Free old graph
+      graph.pattern = pattern;                                  // Store pattern
+      int degree = pattern.size();                              // Number of destinations
+      MPI_Dist_graph_create(MPI_COMM_WORLD, 1, (int*)&mpirank, &degree, &pattern[0],// Create graph from destinations
+			    MPI_UNWEIGHTED, MPI_INFO_NULL, 0, &graph.comm);
+      int indegree, outdegree, weighted;                        // Number of sources and destinations
+      MPI_Dist_graph_neighbors_count(graph.comm, &indegree, &outdegree, &weighted);// Get number of neighbors
+      graph.sources.resize(indegree);                           // Resize sources
+      graph.destinations.resize(outdegree);                     // Resize destinations
+      MPI_Dist_graph_neighbors(graph.comm, indegree, &graph.sources[0], MPI_UNWEIGHTED,// Get neighbors in the
+			       outdegree, &graph.destinations[0], MPI_UNWEIGHTED);// order used by collectives
+#endif
+    }
+
+    //! Exchange send count for receive count between neighbors of graph
+    void neighborAlltoall(Graph & graph, int * sendCount, int * recvCount) {
+#if MPI_VERSION >= 3
+      int outdegree = graph.destinations.size();                // Number of destinations
+      int indegree = graph.sources.size();                      // Number of sources
+      neighborSendCount.resize(outdegree);                      // Resize send count per destination
+      neighborRecvCount.resize(indegree);                       // Resize receive count per source
+      for (int i=0; i<outdegree; i++) {                         // Loop over destinations
+	neighborSendCount[i] = sendCount[graph.destinations[i]];//  Send count of destination
+      }                                                         // End loop over destinations
+      MPI_Neighbor_alltoall(&neighborSendCount[0], 1, MPI_INT,  // Communicate send count to get receive count
+			    &neighborRecvCount[0], 1, MPI_INT, graph.comm);
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	recvCount[irank] = 0;                                   //  Ranks that are not sources send nothing
+      }                                                         // End loop over ranks
+      for (int i=0; i<indegree; i++) {                          // Loop over sources
+	recvCount[graph.sources[i]] = neighborRecvCount[i];     //  Receive count of source
+      }                                                         // End loop over sources
+#endif
+    }
+
+    //! Exchange data between neighbors of graph, with counts and displacements per rank
+    void neighborAlltoallv(Graph & graph, int * send, int * sendCount, int * sendDispl,
+			   int * recv, int * recvCount, int * recvDispl) {
+#if MPI_VERSION >= 3
+      int outdegree = graph.destinations.size();                // Number of destinations
+      int indegree = graph.sources.size();                      // Number of sources
+      neighborSendCount.resize(outdegree);                      // Resize send count per destination
+      neighborSendDispl.resize(outdegree);                      // Resize send displacement per destination
+      neighborRecvCount.resize(indegree);                       // Resize receive count per source
+      neighborRecvDispl.resize(indegree);                       // Resize receive displacement per source
+      for (int i=0; i<outdegree; i++) {                         // Loop over destinations
+	neighborSendCount[i] = sendCount[graph.destinations[i]];//  Send count of destination
+	neighborSendDispl[i] = sendDispl[graph.destinations[i]];//  Send displacement of destination
+      }                                                         // End loop over destinations
+      for (int i=0; i<indegree; i++) {                          // Loop over sources
+	neighborRecvCount[i] = recvCount[graph.sources[i]];     //  Receive count of source
+	neighborRecvDispl[i] = recvDispl[graph.sources[i]];     //  Receive displacement of source
+      }                                                         // End loop over sources
+      MPI_Neighbor_alltoallv(send, &neighborSendCount[0], &neighborSendDispl[0], MPI_INT,// Communicate data
+			     recv, &neighborRecvCount[0], &neighborRecvDispl[0], MPI_INT, graph.comm);
+#endif
+    }
+
     //! Exchange send count for bodies
     void alltoall(Bodies & bodies) {
       for (int i=0; i<mpisize; i++) {                           // Loop over ranks
@@ -44,8 +206,20 @@ namespace exafmm {
 	sendBodyCount[B->IRANK]++;                              //  Fill send count bucket
 	B->IRANK = mpirank;                                     //  Tag for sending back to original rank
       }                                                         // End loop over bodies
-      MPI_Alltoall(sendBodyCount, 1, MPI_INT,                   // Communicate send count to get receive count
-		   recvBodyCount, 1, MPI_INT, MPI_COMM_WORLD);
+      alltoallBodyCount();                                      // Send body count
+    }
+
+    //! Exchange send count for bodies that have been counted
+    void alltoallBodyCount() {
+      if (node != NULL) {                                       // If using two-level communication
+	node->alltoall(sendBodyCount, recvBodyCount);           //  Communicate send count to get receive count
+      } else if (useNeighbor()) {                               // If using neighborhood collectives
+	setGraph(bodyGraph, sendBodyCount);                     //  Set graph of body exchange
+	neighborAlltoall(bodyGraph, sendBodyCount, recvBodyCount);// Communicate send count to get receive count
+      } else {                                                  // If using collectives of all ranks
+	MPI_Alltoall(sendBodyCount, 1, MPI_INT,                 //  Communicate send count to get receive count
+		     recvBodyCount, 1, MPI_INT, MPI_COMM_WORLD);
+      }                                                         // End if for neighborhood collectives
       sendBodyDispl[0] = recvBodyDispl[0] = 0;                  // Initialize send/receive displacements
       for (int irank=0; irank<mpisize-1; irank++) {             // Loop over ranks
 	sendBodyDispl[irank+1] = sendBodyDispl[irank] + sendBodyCount[irank];//  Set send displacement
@@ -55,56 +229,277 @@ namespace exafmm {
 
     //! Exchange bodies
     void alltoallv(Bodies & bodies) {
-      assert( (sizeof(bodies[0]) & 3) == 0 );                   // Body structure must be 4 Byte aligned
-      int word = sizeof(bodies[0]) / 4;                         // Word size of body structure
-      recvBodies.resize(recvBodyDispl[mpisize-1]+recvBodyCount[mpisize-1]);// Resize receive buffer
-      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
-	sendBodyCount[irank] *= word;                           //  Multiply send count by word size of data
-	sendBodyDispl[irank] *= word;                           //  Multiply send displacement by word size of data
-	recvBodyCount[irank] *= word;                           //  Multiply receive count by word size of data
-	recvBodyDispl[irank] *= word;                           //  Multiply receive displacement by word size of data
-      }                                                         // End loop over ranks
-      MPI_Alltoallv((int*)&bodies[0], sendBodyCount, sendBodyDispl, MPI_INT,// Communicate bodies
-		    (int*)&recvBodies[0], recvBodyCount, recvBodyDispl, MPI_INT, MPI_COMM_WORLD);
-      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
-	sendBodyCount[irank] /= word;                           //  Divide send count by word size of data
-	sendBodyDispl[irank] /= word;                           //  Divide send displacement by word size of data
-	recvBodyCount[irank] /= word;                           //  Divide receive count by word size of data
-	recvBodyDispl[irank] /= word;                           //  Divide receive displacement by word size of data
-      }                                                         // End loop over ranks
+      alltoallv(bodies, recvBodies, bodyGraph, sendBodyCount, sendBodyDispl, recvBodyCount, recvBodyDispl);// Communicate bodies
     }
 
     //! Exchange send count for cells
     void alltoall(Cells) {
-      MPI_Alltoall(sendCellCount, 1, MPI_INT,                   // Communicate send count to get receive count
-		   recvCellCount, 1, MPI_INT, MPI_COMM_WORLD);
+      if (node != NULL) {                                       // If using two-level communication
+	node->alltoall(sendCellCount, recvCellCount);           //  Communicate send count to get receive count
+      } else if (useNeighbor()) {                               // If using neighborhood collectives
+	setGraph(cellGraph, sendCellCount);                     //  Set graph of cell exchange
+	neighborAlltoall(cellGraph, sendCellCount, recvCellCount);// Communicate send count to get receive count
+      } else {                                                  // If using collectives of all ranks
+	MPI_Alltoall(sendCellCount, 1, MPI_INT,                 //  Communicate send count to get receive count
+		     recvCellCount, 1, MPI_INT, MPI_COMM_WORLD);
+      }                                                         // End if for neighborhood collectives
       recvCellDispl[0] = 0;                                     // Initialize receive displacements
       for (int irank=0; irank<mpisize-1; irank++) {             // Loop over ranks
 	recvCellDispl[irank+1] = recvCellDispl[irank] + recvCellCount[irank];//  Set receive displacement
       }                                                         // End loop over ranks
     }
 
-    //! Exchange cells
-    void alltoallv(Cells & cells) {
-      assert( (sizeof(cells[0]) & 3) == 0 );                    // Cell structure must be 4 Byte aligned
-      int word = sizeof(cells[0]) / 4;                          // Word size of body structure
-      recvCells.resize(recvCellDispl[mpisize-1]+recvCellCount[mpisize-1]);// Resize receive buffer
+    //! Exchange data with counts and displacements per rank in units of elements
+    template<typename V>
+    void alltoallv(V & send, V & recv, Graph & graph, int * sendCount, int * sendDispl,
+		   int * recvCount, int * recvDispl) {
+      assert( (sizeof(send[0]) & 3) == 0 );                     // Data structure must be 4 Byte aligned
+      int word = sizeof(send[0]) / 4;                           // Word size of data structure
+      recv.resize(recvDispl[mpisize-1]+recvCount[mpisize-1]);   // Resize receive buffer
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	sendCount[irank] *= word;                               //  Multiply send count by word size of data
+	sendDispl[irank] *= word;                               //  Multiply send displacement by word size of data
+	recvCount[irank] *= word;                               //  Multiply receive count by word size of data
+	recvDispl[irank] *= word;                               //  Multiply receive displacement by word size of data
+      }                                                         // End loop over ranks
+      if (node != NULL) {                                       // If using two-level communication
+	node->alltoallv((int*)&send[0], sendCount, sendDispl,   //  Communicate data
+			(int*)&recv[0], recvCount, recvDispl);
+      } else if (useNeighbor()) {                               // If using neighborhood collectives
+	neighborAlltoallv(graph, (int*)&send[0], sendCount, sendDispl,// Communicate data
+			  (int*)&recv[0], recvCount, recvDispl);
+      } else {                                                  // If using collectives of all ranks
+	MPI_Alltoallv((int*)&send[0], sendCount, sendDispl, MPI_INT,// Communicate data
+		      (int*)&recv[0], recvCount, recvDispl, MPI_INT, MPI_COMM_WORLD);
+      }                                                         // End if for neighborhood collectives
       for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
-	sendCellCount[irank] *= word;                           //  Multiply send count by word size of data
-	sendCellDispl[irank] *= word;                           //  Multiply send displacement by word size of data
-	recvCellCount[irank] *= word;                           //  Multiply receive count by word size of data
-	recvCellDispl[irank] *= word;                           //  Multiply receive displacement by word size of data
+	sendCount[irank] /= word;                               //  Divide send count by word size of data
+	sendDispl[irank] /= word;                               //  Divide send displacement by word size of data
+	recvCount[irank] /= word;                               //  Divide receive count by word size of data
+	recvDispl[irank] /= word;                               //  Divide receive displacement by word size of data
       }                                                         // End loop over ranks
-      MPI_Alltoallv((int*)&cells[0], sendCellCount, sendCellDispl, MPI_INT,// Communicate cells
-		    (int*)&recvCells[0], recvCellCount, recvCellDispl, MPI_INT, MPI_COMM_WORLD);
+    }
+
+    //! Pack bodies to be sent into the LET format
+    void packBodies() {
+      int numSendBodies = sendBodies.size();                    // Number of send bodies
+      sendBodyLET.resize(numSendBodies);                        // Resize send buffer for packed bodies
+#pragma omp parallel for
+      for (int i=0; i<numSendBodies; i++) {                     // Loop over send bodies
+	static_cast<SourceBase&>(sendBodyLET[i]) = sendBodies[i];//  Copy position and source values
+	sendBodyLET[i].IBODY = sendBodies[i].IBODY;             //  Copy initial body numbering
+      }                                                         // End loop over send bodies
+    }
+
+    //! Unpack bodies received from irank
+    void unpackBodies(int irank) {
+      int begin = recvBodyDispl[irank];                         // First body of irank
+      int end = begin + recvBodyCount[irank];                   // Last body of irank
+#pragma omp parallel for
+      for (int i=begin; i<end; i++) {                           // Loop over bodies of irank
+	unpackBody(recvBodyLET[i], recvBodies.begin() + i, irank);//  Unpack body
+      }                                                         // End loop over bodies of irank
+    }
+
+    //! Unpack a body received from irank
+    void unpackBody(const BodyLET & body, B_iter B, int irank) {
+      static_cast<SourceBase&>(*B) = body;                      // Copy position and source values
+      B->IBODY = body.IBODY;                                    // Copy initial body numbering
+      B->IRANK = irank;                                         // Tag with source rank
+      B->ICELL = 0;                                             // Cell index is not sent
+      B->WEIGHT = 0;                                            // Weight is not sent
+      B->TRG = 0;                                               // Clear target values
+    }
+
+    //! Pack cells into the LET format
+    void packCells(const Cells & cells) {
+      int numSendCells = cells.size();                          // Number of send cells
+      sendBase.resize(numSendCells);                            // Resize send buffer for topology and geometry
+      sendM.resize(numSendCells);                               // Resize send buffer for multipoles
+#pragma omp parallel for
+      for (int i=0; i<numSendCells; i++) {                      // Loop over send cells
+	typename Cells::const_iterator C = cells.begin() + i;   //  Cell iterator (const, so that M is not allocated)
+	CellLET & base = sendBase[i];                           //  Packed topology and geometry
+	base.IPARENT = C->IPARENT;                              //  Copy index of parent cell
+	base.ICHILD = C->ICHILD;                                //  Copy index of first child cell
+	base.NCHILD = C->NCHILD;                                //  Copy number of child cells
+	base.IBODY = C->IBODY;                                  //  Copy index of first body
+	base.NBODY = C->NBODY;                                  //  Copy number of bodies
+	base.ICELL = C->ICELL;                                  //  Copy cell index
+	base.SCALE = C->SCALE;                                  //  Copy scale for Helmholtz kernel
+	base.X = C->X;                                          //  Copy cell center
+	base.R = C->R;                                          //  Copy cell radius
+	const real_t * M = (const real_t*)&C->M[0];             //  Real values of multipoles
+	for (int n=0; n<NMREAL; n++) {                          //  Loop over real values of multipoles
+	  sendM[i].M[n] = mreal_t(M[n]);                        //   Copy (and round) multipoles
+	}                                                       //  End loop over real values of multipoles
+      }                                                         // End loop over send cells
+    }
+
+    //! Unpack received cells in the range [begin,end)
+    void unpackCells(int begin, int end) {
+#pragma omp parallel for
+      for (int i=begin; i<end; i++) {                           // Loop over receive cells
+	unpackCell(recvBase[i], recvM[i], recvCells.begin() + i);//  Unpack cell
+      }                                                         // End loop over receive cells
+    }
+
+    //! Unpack a cell with its multipoles
+    void unpackCell(const CellLET & base, const MultipoleLET & multipole, C_iter C) {
+      C->IPARENT = base.IPARENT;                                // Copy index of parent cell
+      C->ICHILD = base.ICHILD;                                  // Copy index of first child cell
+      C->NCHILD = base.NCHILD;                                  // Copy number of child cells
+      C->IBODY = base.IBODY;                                    // Copy index of first body
+      C->NBODY = base.NBODY;                                    // Copy number of bodies
+#if EXAFMM_COUNT_LIST
+      C->numP2P = C->numM2L = 0;                                // Interaction lists are not sent
+#endif
+      C->ICELL = base.ICELL;                                    // Copy cell index
+      C->WEIGHT = 0;                                            // Weight is not sent
+      C->SCALE = base.SCALE;                                    // Copy scale for Helmholtz kernel
+      C->X = base.X;                                            // Copy cell center
+      C->R = base.R;                                            // Copy cell radius
+      real_t * M = (real_t*)&C->M[0];                           // Real values of multipoles
+      for (int n=0; n<NMREAL; n++) {                            // Loop over real values of multipoles
+	M[n] = multipole.M[n];                                  //  Copy multipoles
+      }                                                         // End loop over real values of multipoles
+      C->L.clear();                                             // Local expansions are not needed
+    }
+
+    //! Exchange cells (packed topology and multipoles are sent separately, local expansions are not sent)
+    void alltoallv(Cells & cells) {
+      packCells(cells);                                         // Pack cells into LET format
+      alltoallv(sendBase, recvBase, cellGraph, sendCellCount, sendCellDispl, recvCellCount, recvCellDispl);// Communicate topology and geometry
+      alltoallv(sendM, recvM, cellGraph, sendCellCount, sendCellDispl, recvCellCount, recvCellDispl);// Communicate multipoles
+      int numRecvCells = recvBase.size();                       // Number of receive cells
+      recvCells.resize(numRecvCells);                           // Resize receive buffer
+      unpackCells(0, numRecvCells);                             // Unpack cells from all ranks
+    }
+
+    //! Post non-blocking send and receive of data per cell for each rank
+    template<typename T>
+    void isendrecv(std::vector<T> & send, std::vector<T> & recv, int * sendCount, int * sendDispl,
+		   int * recvCount, int * recvDispl, int tag) {
+      assert( (sizeof(T) & 3) == 0 );                           // Data structure must be 4 Byte aligned
+      int word = sizeof(T) / 4;                                 // Word size of data structure
       for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
-	sendCellCount[irank] /= word;                           //  Divide send count by word size of data
-	sendCellDispl[irank] /= word;                           //  Divide send displacement by word size of data
-	recvCellCount[irank] /= word;                           //  Divide receive count by word size of data
-	recvCellDispl[irank] /= word;                           //  Divide receive displacement by word size of data
+	if (recvCount[irank] > 0) {                             //  If receiving from irank
+	  MPI_Request request;                                  //   Receive request handle
+	  MPI_Irecv((int*)&recv[recvDispl[irank]], recvCount[irank]*word, MPI_INT,// Receive data from irank
+		    irank, tag, MPI_COMM_WORLD, &request);
+	  recvRequests.push_back(request);                      //   Store receive request
+	  recvRequestRank.push_back(irank);                     //   Store source rank of request
+	  recvPending[irank]++;                                 //   Increment pending receives from irank
+	}                                                       //  End if for receiving
+	if (sendCount[irank] > 0) {                             //  If sending to irank
+	  MPI_Request request;                                  //   Send request handle
+	  MPI_Isend((int*)&send[sendDispl[irank]], sendCount[irank]*word, MPI_INT,// Send data to irank
+		    irank, tag, MPI_COMM_WORLD, &request);
+	  sendRequests.push_back(request);                      //   Store send request
+	}                                                       //  End if for sending
       }                                                         // End loop over ranks
     }
 
+#if MPI_VERSION >= 3
+    //! Expose a buffer in a window and start a passive target epoch to all ranks
+    template<typename T>
+    void createWindow(std::vector<T> & data, MPI_Win & win) {
+      MPI_Win_create(data.empty() ? NULL : &data[0], data.size() * sizeof(T), sizeof(T),// Create window over buffer
+		     MPI_INFO_NULL, MPI_COMM_WORLD, &win);
+      MPI_Win_lock_all(MPI_MODE_NOCHECK, win);                  // Start epoch to all ranks
+    }
+
+    //! End the epoch and free a window
+    void freeWindow(MPI_Win & win) {
+      MPI_Win_unlock_all(win);                                  // End epoch to all ranks
+      MPI_Win_free(&win);                                       // Free window
+    }
+
+    //! Get count elements starting at element disp of the window of irank into data[offset]
+    template<typename T>
+    void getWindow(std::vector<T> & data, int offset, int count, int irank, int disp, MPI_Win win) {
+      assert( (sizeof(T) & 3) == 0 );                           // Data structure must be 4 Byte aligned
+      int word = sizeof(T) / 4;                                 // Word size of data structure
+      MPI_Get((int*)&data[offset], count*word, MPI_INT,         // Get data from window of irank
+	      irank, disp, count*word, MPI_INT, win);
+      pullBytes += double(count) * sizeof(T);                   // Count pulled bytes
+    }
+
+    //! Request children of remote cell j, unless they have been requested or pulled
+    void requestChildren(int j, std::vector<int> & cellRequests) {
+      if (pullChild[j] == -1) {                                 // If children were never requested
+	pullChild[j] = -2;                                      //  Mark as requested
+	cellRequests.push_back(j);                              //  Add to requests
+      }                                                         // End if for new request
+    }
+
+    //! Request bodies of remote cell j, unless they have been requested or pulled
+    void requestBodies(int j, std::vector<int> & bodyRequests) {
+      if (pullBody[j] == -1) {                                  // If bodies were never requested
+	pullBody[j] = -2;                                       //  Mark as requested
+	bodyRequests.push_back(j);                              //  Add to requests
+      }                                                         // End if for new request
+    }
+
+    //! Get requested children and bodies of remote cells from irank with one flush
+    void fetchPull(Cells & jcells, std::vector<int> & cellRequests, std::vector<int> & bodyRequests, int irank) {
+      int numCells = 0, numBodies = 0;                          // Number of cells and bodies to get
+      for (size_t r=0; r<cellRequests.size(); r++) {            // Loop over requested children
+	numCells += jcells[cellRequests[r]].NCHILD;             //  Count children
+      }                                                         // End loop over requested children
+      for (size_t r=0; r<bodyRequests.size(); r++) {            // Loop over requested bodies
+	numBodies += jcells[bodyRequests[r]].NBODY;             //  Count bodies
+      }                                                         // End loop over requested bodies
+      recvBase.resize(numCells);                                // Resize buffer for topology and geometry
+      recvM.resize(numCells);                                   // Resize buffer for multipoles
+      recvBodyLET.resize(numBodies);                            // Resize buffer for packed bodies
+      int icell = 0, ibody = 0;                                 // Offsets in buffers
+      for (size_t r=0; r<cellRequests.size(); r++) {            // Loop over requested children
+	C_iter C = jcells.begin() + cellRequests[r];            //  Remote cell whose children are needed
+	getWindow(recvBase, icell, C->NCHILD, irank, C->ICHILD, baseWin);// Get topology and geometry of children
+	getWindow(recvM, icell, C->NCHILD, irank, C->ICHILD, multipoleWin);// Get multipoles of children
+	icell += C->NCHILD;                                     //  Increment cell offset
+      }                                                         // End loop over requested children
+      for (size_t r=0; r<bodyRequests.size(); r++) {            // Loop over requested bodies
+	C_iter C = jcells.begin() + bodyRequests[r];            //  Remote leaf whose bodies are needed
+	getWindow(recvBodyLET, ibody, C->NBODY, irank, C->IBODY, bodyWin);// Get bodies of leaf
+	ibody += C->NBODY;                                      //  Increment body offset
+      }                                                         // End loop over requested bodies
+      if (numCells > 0) {                                       // If children were requested
+	MPI_Win_flush(irank, baseWin);                          //  Complete gets of topology and geometry
+	MPI_Win_flush(irank, multipoleWin);                     //  Complete gets of multipoles
+      }                                                         // End if for children
+      if (numBodies > 0) MPI_Win_flush(irank, bodyWin);         // Complete gets of bodies
+      int jcell = jcells.size();                                // First new cell
+      jcells.resize(jcell + numCells);                          // Append children to pulled tree
+      pullChild.resize(jcell + numCells, -1);                   // Children of new cells are not requested
+      pullBody.resize(jcell + numCells, -1);                    // Bodies of new cells are not requested
+#pragma omp parallel for
+      for (int i=0; i<numCells; i++) {                          // Loop over new cells
+	unpackCell(recvBase[i], recvM[i], jcells.begin() + jcell + i);// Unpack cell
+      }                                                         // End loop over new cells
+      for (size_t r=0; r<cellRequests.size(); r++) {            // Loop over requested children
+	int j = cellRequests[r];                                //  Index of parent cell
+	pullChild[j] = jcell;                                   //  First child in pulled tree
+	for (int i=0; i<jcells[j].NCHILD; i++) {                //  Loop over children
+	  jcells[jcell+i].IPARENT = j;                          //   Parent in pulled tree
+	}                                                       //  End loop over children
+	jcell += jcells[j].NCHILD;                              //  Increment first child
+      }                                                         // End loop over requested children
+      int jbody = recvBodies.size();                            // First new body
+      recvBodies.resize(jbody + numBodies);                     // Append bodies
+#pragma omp parallel for
+      for (int i=0; i<numBodies; i++) {                         // Loop over new bodies
+	unpackBody(recvBodyLET[i], recvBodies.begin() + jbody + i, irank);// Unpack body
+      }                                                         // End loop over new bodies
+      for (size_t r=0; r<bodyRequests.size(); r++) {            // Loop over requested bodies
+	int j = bodyRequests[r];                                //  Index of leaf cell
+	pullBody[j] = jbody;                                    //  First body in pulled bodies
+	jbody += jcells[j].NBODY;                               //  Increment first body
+      }                                                         // End loop over requested bodies
+    }
+#endif
+
   protected:
     //! Get distance to other domain
     real_t getDistance(C_iter C, Bounds bounds, vec3 Xperiodic) {
@@ -118,13 +513,63 @@ namespace exafmm {
       return norm(dX);                                          // Return distance squared
     }
 
+    //! Get distance between local domain and other domain
+    real_t getDistance(Bounds local, Bounds bounds, vec3 Xperiodic) {
+      vec3 dX;                                                  // Distance vector
+      for (int d=0; d<3; d++) {                                 // Loop over dimensions
+	dX[d] = std::max(local.Xmin[d] + Xperiodic[d] - bounds.Xmax[d],// Calculate the gap between the domains
+			 bounds.Xmin[d] - local.Xmax[d] - Xperiodic[d]);// or a negative overlap
+	dX[d] = std::max(dX[d], real_t(0));                     //  Overlapping domains have no gap
+      }                                                         // End loop over dimensions
+      return norm(dX);                                          // Return distance squared
+    }
+
+    //! Check if cell or domain is closer than R to other domain, or to any of its periodic images
+    template<typename T>
+    bool isNear(T C, Bounds bounds, vec3 cycle, real_t R) {
+      vec3 Xperiodic = 0;                                       // Periodic coordinate offset
+      if (images == 0) {                                        // If free boundary condition
+	return R * R > getDistance(C, bounds, Xperiodic);       //  Check distance to other domain
+      }                                                         // End if for free boundary condition
+      for (int ix=-1; ix<=1; ix++) {                            // Loop over x periodic direction
+	for (int iy=-1; iy<=1; iy++) {                          //  Loop over y periodic direction
+	  for (int iz=-1; iz<=1; iz++) {                        //   Loop over z periodic direction
+	    Xperiodic[0] = ix * cycle[0];                       //    Coordinate offset for x periodic direction
+	    Xperiodic[1] = iy * cycle[1];                       //    Coordinate offset for y periodic direction
+	    Xperiodic[2] = iz * cycle[2];                       //    Coordinate offset for z periodic direction
+	    if (R * R > getDistance(C, bounds, Xperiodic)) return true;// Check distance to periodic image
+	  }                                                     //   End loop over z periodic direction
+	}                                                       //  End loop over y periodic direction
+      }                                                         // End loop over x periodic direction
+      return false;                                             // Cell is far from all images
+    }
+
+    //! Check if any LET is sent to irank
+    /*!
+      With a cutoff, ranks whose domain is farther than the cutoff from the local
+      domain need nothing, which keeps the exchange sparse.
+    */
+    bool sendLET(Cells & cells, int irank, vec3 cycle, real_t cutoff) {
+      if (irank == mpirank || cells.empty()) return false;      // Nothing to send to self or from empty tree
+      if (cutoff == 0) return true;                             // Far field needs LET on all ranks
+      Bounds local, bounds;                                     // Bounds of this rank and irank
+      for (int d=0; d<3; d++) {                                 // Loop over dimensions
+	local.Xmin[d] = allBoundsXmin[mpirank][d];              //  Local Xmin for this rank
+	local.Xmax[d] = allBoundsXmax[mpirank][d];              //  Local Xmax for this rank
+	bounds.Xmin[d] = allBoundsXmin[irank][d];               //  Local Xmin for irank
+	bounds.Xmax[d] = allBoundsXmax[irank][d];               //  Local Xmax for irank
+      }                                                         // End loop over dimensions
+      return isNear(local, bounds, cycle, cutoff);              // Check domains against cutoff
+    }
+
     //! Add cells to send buffer
     void addSendCell(C_iter C, int & irank, int & icell, int & iparent, bool copyData) {
       if (copyData) {                                           // If copying data to send cells
-	Cell<B_iter,vecP,Kernel::equation,Kernel::basis> cell(*C); // Initialize send cell
-	cell.NCHILD = cell.NBODY = 0;                           //  Reset counters
-	cell.IPARENT = iparent;                                 //  Index of parent
-	sendCells[sendCellDispl[irank]+icell] = cell;           //  Copy cell to send buffer
+	C_iter Csend = sendCells.begin() + sendCellDispl[irank] + icell;// Send cell iterator
+	static_cast<CellBase&>(*Csend) = *C;                    //  Copy topology and geometry to send buffer
+	Csend->M = C->M;                                        //  Copy multipoles to send buffer
+	Csend->NCHILD = Csend->NBODY = 0;                       //  Reset counters
+	Csend->IPARENT = iparent;                               //  Index of parent
 	C_iter Cparent = sendCells.begin() + sendCellDispl[irank] + iparent;// Get parent iterator
 	if (Cparent->NCHILD == 0) Cparent->ICHILD = icell;      //  Index of parent's first child
 	Cparent->NCHILD++;                                      //  Increment parent's child counter
@@ -141,14 +586,14 @@ namespace exafmm {
 	B_iter Bsend = sendBodies.begin() + sendBodyDispl[irank] + ibody; // Send body iterator
 	for (B_iter B=C->BODY; B!=C->BODY+C->NBODY; B++,Bsend++) {//  Loop over bodies in cell
 	  *Bsend = *B;                                          //   Copy body to send buffer
-	  Bsend->IRANK = irank;                                 //   Assign destination rank
+	  Bsend->IRANK = mpirank;                               //   Tag with source rank
 	}                                                       //  End loop over bodies in cell
       }                                                         // End if for copying data to send bodies
       ibody += C->NBODY;                                        // Increment body counter
     }
 
     //! Determine which cells to send
-    void traverseLET(C_iter C, C_iter C0, Bounds bounds, vec3 cycle,
+    void traverseLET(C_iter C, C_iter C0, Bounds bounds, vec3 cycle, real_t cutoff,
 		     int & irank, int & ibody, int & icell, int iparent, bool copyData) {
       int level = int(logf(mpisize-1) / M_LN2 / 3) + 1;         // Level of local root cell
       if (mpisize == 1) level = 0;                              // Account for serial case
@@ -161,23 +606,8 @@ namespace exafmm {
 	if (CC->NCHILD == 0) {                                  //  If cell is leaf
 	  addSendBody(CC, irank, ibody, icell-1, copyData);     //   Add bodies to send
 	} else {                                                //  If cell is not leaf
-	  vec3 Xperiodic = 0;                                   //   Periodic coordinate offset
-	  if (images == 0) {                                    //   If free boundary condition
-	    real_t R2 = getDistance(CC, bounds, Xperiodic);     //    Get distance to other domain
-	    divide[cc] |= 4 * CC->R * CC->R > R2;               //    Divide if the cell seems too close
-	  } else {                                              //   If periodic boundary condition
-	    for (int ix=-1; ix<=1; ix++) {                      //    Loop over x periodic direction
-	      for (int iy=-1; iy<=1; iy++) {                    //     Loop over y periodic direction
-		for (int iz=-1; iz<=1; iz++) {                  //      Loop over z periodic direction
-		  Xperiodic[0] = ix * cycle[0];                 //       Coordinate offset for x periodic direction
-		  Xperiodic[1] = iy * cycle[1];                 //       Coordinate offset for y periodic direction
-		  Xperiodic[2] = iz * cycle[2];                 //       Coordinate offset for z periodic direction
-		  real_t R2 = getDistance(CC, bounds, Xperiodic); //       Get distance to other domain
-		  divide[cc] |= 4 * CC->R * CC->R > R2;         //       Divide if cell seems too close
-		}                                               //      End loop over z periodic direction
-	      }                                                 //     End loop over y periodic direction
-	    }                                                   //    End loop over x periodic direction
-	  }                                                     //   Endif for periodic boundary condition
+	  real_t R = cutoff > 0 ? CC->R * std::sqrt(real_t(3)) + cutoff : 2 * CC->R;// Bodies within R of other domain are needed
+	  divide[cc] |= isNear(CC, bounds, cycle, R);           //   Divide if the cell seems too close
 	  divide[cc] |= CC->R > (max(cycle) / (1 << (level+1)));     //   Divide if cell is larger than local root cell
 	}                                                       //  Endif for leaf
       }                                                         // End loop over child cells
@@ -185,7 +615,7 @@ namespace exafmm {
       for (C_iter CC=C0+C->ICHILD; CC!=C0+C->ICHILD+C->NCHILD; CC++,cc++) { // Loop over child cells
 	if (divide[cc]) {                                       //  If cell must be divided further
 	  iparent = icells[cc];                                 //   Parent cell index
-	  traverseLET(CC, C0, bounds, cycle, irank, ibody, icell, iparent, copyData);// Recursively traverse tree to set LET
+	  traverseLET(CC, C0, bounds, cycle, cutoff, irank, ibody, icell, iparent, copyData);// Recursively traverse tree to set LET
 	}                                                       //  End if for cell division
       }                                                         // End loop over child cells
     }
@@ -193,7 +623,7 @@ namespace exafmm {
   public:
     //! Constructor
     TreeMPI(int _mpirank, int _mpisize, int _images) :
-      mpirank(_mpirank), mpisize(_mpisize), images(_images) {   // Initialize variables
+      mpirank(_mpirank), mpisize(_mpisize), images(_images), neighborSize(64), node(NULL) {// Initialize variables
       allBoundsXmin = new float [mpisize][3];                   // Allocate array for minimum of local domains
       allBoundsXmax = new float [mpisize][3];                   // Allocate array for maximum of local domains
       sendBodyCount = new int [mpisize];                        // Allocate send count
@@ -204,6 +634,10 @@ namespace exafmm {
       sendCellDispl = new int [mpisize];                        // Allocate send displacement
       recvCellCount = new int [mpisize];                        // Allocate receive count
       recvCellDispl = new int [mpisize];                        // Allocate receive displacement
+#if MPI_VERSION >= 3
+      baseWin = multipoleWin = bodyWin = MPI_WIN_NULL;          // Windows are created by exposeLET
+#endif
+      pullBytes = 0;                                            // Initialize pulled bytes
     }
     //! Destructor
     ~TreeMPI() {
@@ -217,6 +651,30 @@ namespace exafmm {
       delete[] sendCellDispl;                                   // Deallocate send displacement
       delete[] recvCellCount;                                   // Deallocate receive count
       delete[] recvCellDispl;                                   // Deallocate receive displacement
+      int finalized;                                            // Flag for MPI_Finalize
+      MPI_Finalized(&finalized);                                // Check if MPI_Finalize has been called
+      if (!finalized && bodyGraph.comm != MPI_COMM_NULL) MPI_Comm_free(&bodyGraph.comm);// Free graph of body exchange
+      if (!finalized && cellGraph.comm != MPI_COMM_NULL) MPI_Comm_free(&cellGraph.comm);// Free graph of cell exchange
+    }
+
+    //! Set minimum number of ranks to exchange through neighborhood collectives
+    /*!
+      With at least this many ranks, bodies and cells are exchanged with
+      MPI_Neighbor_alltoallv over a graph of the ranks that actually send to each
+      other, instead of MPI_Alltoallv over all ranks. Must be the same on all ranks.
+    */
+    void setNeighborSize(int _neighborSize) {
+      neighborSize = _neighborSize;                             // Set minimum number of ranks
+    }
+
+    //! Set two-level communication for the exchange of bodies and cells
+    /*!
+      Bodies and cells are then exchanged through the node shared memory windows and
+      node leaders of _node instead of MPI_Alltoallv over all ranks. NULL sets flat
+      communication again. Must be the same on all ranks.
+    */
+    void setNodeMPI(NodeMPI * _node) {
+      node = _node;                                             // Set two-level communication
     }
 
     //! Allgather bounds from all ranks
@@ -231,7 +689,12 @@ namespace exafmm {
     }
 
     //! Set local essential tree to send to each process
-    void setLET(Cells & cells, vec3 cycle) {
+    /*!
+      By default the bodies are those needed by the multipole acceptance criterion.
+      With a cutoff, they are those within the cutoff of the other domain, which is
+      all that the cutoff traversal needs.
+    */
+    void setLET(Cells & cells, vec3 cycle, real_t cutoff=0) {
       logger::startTimer("Set LET size");                       // Start timer
       C_iter C0 = cells.begin();                                // Set cells begin iterator
       Bounds bounds;                                            // Bounds of local subdomain
@@ -242,7 +705,7 @@ namespace exafmm {
 	if (irank != 0) sendCellDispl[irank] = sendCellDispl[irank-1] + sendCellCount[irank-1];// Update cell displacement
 	sendBodyCount[irank] = 0;                               //  Initialize send body count for current rank
 	sendCellCount[irank] = 0;                               //  Initialize send cell count for current rank
-	if (irank != mpirank && !cells.empty()) {               //  If not current rank and cell vector is not empty
+	if (sendLET(cells, irank, cycle, cutoff)) {             //  If sending LET to irank
 	  int ibody = 0;                                        //   Initialize send body's offset
 	  int icell = 1;                                        //   Initialize send cell's offset
 	  for (int d=0; d<3; d++) {                             //   Loop over dimensions
@@ -252,7 +715,7 @@ namespace exafmm {
 	  if (C0->NCHILD == 0) {                                //   If root cell is leaf
 	    addSendBody(C0, irank, ibody, icell-1, false);      //    Add bodies to send
 	  }                                                     //   End if for root cell leaf
-	  traverseLET(C0, C0, bounds, cycle, irank, ibody, icell, 0, false); // Traverse tree to set LET
+	  traverseLET(C0, C0, bounds, cycle, cutoff, irank, ibody, icell, 0, false);// Traverse tree to set LET
 	  sendBodyCount[irank] = ibody;                         //   Send body count for current rank
 	  sendCellCount[irank] = icell;                         //   Send cell count for current rank
 	}                                                       //  Endif for current rank
@@ -265,7 +728,7 @@ namespace exafmm {
       sendCells.resize(numSendCells);                           // Clear send buffer for cells
       MPI_Barrier(MPI_COMM_WORLD);
       for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
-	if (irank != mpirank && !cells.empty()) {               //  If not current rank and cell vector is not empty
+	if (sendLET(cells, irank, cycle, cutoff)) {             //  If sending LET to irank
 	  int ibody = 0;                                        //   Reinitialize send body's offset
 	  int icell = 0;                                        //   Reinitialize send cell's offset
 	  for (int d=0; d<3; d++) {                             //   Loop over dimensions
@@ -273,13 +736,14 @@ namespace exafmm {
 	    bounds.Xmax[d] = allBoundsXmax[irank][d];           //   Local Xmax for irank
 	  }                                                     //   End loop over dimensions
 	  C_iter Csend = sendCells.begin() + sendCellDispl[irank];//   Send cell iterator
-	  *Csend = *C0;                                         //   Copy cell to send buffer
+	  static_cast<CellBase&>(*Csend) = *C0;                 //   Copy topology and geometry to send buffer
+	  Csend->M = C0->M;                                     //   Copy multipoles to send buffer
 	  Csend->NCHILD = Csend->NBODY = 0;                     //   Reset link to children and bodies
 	  icell++;                                              //   Increment send cell counter
 	  if (C0->NCHILD == 0) {                                //   If root cell is leaf
 	    addSendBody(C0, irank, ibody, icell-1, true);       //    Add bodies to send
 	  }                                                     //   End if for root cell leaf
-	  traverseLET(C0, C0, bounds, cycle, irank, ibody, icell, 0, true); // Traverse tree to set LET
+	  traverseLET(C0, C0, bounds, cycle, cutoff, irank, ibody, icell, 0, true);// Traverse tree to set LET
 	}                                                       //  Endif for current rank
       }                                                         // End loop over ranks
       logger::stopTimer("Set LET");                             // Stop timer
@@ -327,6 +791,11 @@ namespace exafmm {
 	  Body<Kernel::equation> body;                          //   Body to contain remote root coordinates
 	  body.X = C0->X;                                       //   Copy remote root coordinates
 	  body.IBODY = recvCellDispl[irank];                    //   Copy remote root displacement in vector
+	  body.IRANK = irank;                                   //   Rank of remote root
+	  body.ICELL = 0;                                       //   Cell index is set by the global tree
+	  body.WEIGHT = 0;                                      //   Root carries no weight of its own
+	  body.SRC = 0;                                         //   Root has no source values of its own
+	  body.TRG = 0;                                         //   Clear target values
 	  bodies.push_back(body);                               //   Push this root cell to body vector
 	}                                                       //  End if for not current rank
       }                                                         // End loop over ranks
@@ -393,8 +862,13 @@ namespace exafmm {
     //! Send bodies
     Bodies commBodies() {
       logger::startTimer("Comm LET bodies");                    // Start timer
-      alltoall(sendBodies);                                     // Send body count
-      alltoallv(sendBodies);                                    // Send bodies
+      alltoallBodyCount();                                      // Send body count from setLET
+      packBodies();                                             // Pack bodies into LET format
+      alltoallv(sendBodyLET, recvBodyLET, bodyGraph, sendBodyCount, sendBodyDispl, recvBodyCount, recvBodyDispl);// Send bodies
+      recvBodies.resize(recvBodyLET.size());                    // Resize receive buffer
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	unpackBodies(irank);                                    //  Unpack bodies from irank
+      }                                                         // End loop over ranks
       logger::stopTimer("Comm LET bodies");                     // Stop timer
       return recvBodies;                                        // Return received bodies
     }
@@ -407,6 +881,257 @@ namespace exafmm {
       logger::stopTimer("Comm LET cells");                      // Stop timer
     }
 
+    //! Post non-blocking send and receive of the local essential trees
+    /*!
+      Only the counts are exchanged collectively. Bodies, topology and multipoles
+      are sent to each rank point to point, so that local work can proceed while
+      they are in flight, and waitLET() can hand out each rank as soon as its
+      local essential tree has arrived.
+    */
+    void startLET() {
+      logger::startTimer("Start LET");                          // Start timer
+      alltoallBodyCount();                                      // Send body count from setLET
+      alltoall(sendCells);                                      // Send cell count
+      packBodies();                                             // Pack bodies into LET format
+      packCells(sendCells);                                     // Pack cells into LET format
+      int numRecvBodies = recvBodyDispl[mpisize-1] + recvBodyCount[mpisize-1];// Number of receive bodies
+      int numRecvCells = recvCellDispl[mpisize-1] + recvCellCount[mpisize-1];// Number of receive cells
+      recvBodyLET.resize(numRecvBodies);                        // Resize receive buffer for packed bodies
+      recvBodies.resize(numRecvBodies);                         // Resize receive buffer for bodies
+      recvBase.resize(numRecvCells);                            // Resize receive buffer for topology and geometry
+      recvM.resize(numRecvCells);                               // Resize receive buffer for multipoles
+      recvCells.resize(numRecvCells);                           // Resize receive buffer for cells
+      sendRequests.clear();                                     // Clear send requests
+      recvRequests.clear();                                     // Clear receive requests
+      recvRequestRank.clear();                                  // Clear source ranks of receive requests
+      recvPending.assign(mpisize, 0);                           // Initialize pending receives per rank
+      recvArrived.clear();                                      // No rank has arrived yet
+      isendrecv(sendBodyLET, recvBodyLET, sendBodyCount, sendBodyDispl, recvBodyCount, recvBodyDispl, 0);// Post bodies
+      isendrecv(sendBase, recvBase, sendCellCount, sendCellDispl, recvCellCount, recvCellDispl, 1);// Post topology
+      isendrecv(sendM, recvM, sendCellCount, sendCellDispl, recvCellCount, recvCellDispl, 2);// Post multipoles
+      logger::stopTimer("Start LET");                           // Stop timer
+    }
+
+    //! Count a completed receive request, and queue its rank once all of its receives completed
+    void completeRecv(int index) {
+      int irank = recvRequestRank[index];                       // Source rank of completed receive
+      if (--recvPending[irank] == 0) recvArrived.push_back(irank);// Rank is done if all its receives completed
+    }
+
+    //! Progress the receives of startLET() without blocking
+    /*!
+      Completed receives are only recorded, so that waitLET() hands their ranks out
+      without waiting. Called by the traversal through poll() while it works on other
+      ranks, so that the messages keep moving even with MPI implementations that only
+      progress inside MPI calls.
+    */
+    void testLET() {
+      if (recvRequests.empty()) return;                         // Quit if there are no receives
+      int numRequests = recvRequests.size();                    // Number of receive requests
+      recvIndices.resize(numRequests);                          // Resize indices of completed requests
+      int numCompleted;                                         // Number of completed requests
+      MPI_Testsome(numRequests, &recvRequests[0], &numCompleted, &recvIndices[0], MPI_STATUSES_IGNORE);// Test receives
+      if (numCompleted == MPI_UNDEFINED) return;                // Quit if all receives have completed before
+      for (int i=0; i<numCompleted; i++) {                      // Loop over completed requests
+	completeRecv(recvIndices[i]);                           //  Count completed receive
+      }                                                         // End loop over completed requests
+    }
+
+    //! Progress the LET exchange from the traversal
+    void poll() {
+      testLET();                                                // Test receives without blocking
+    }
+
+    //! Wait for the local essential tree of any rank and get it
+    /*!
+      Returns the rank whose local essential tree was copied to cells, in order of
+      arrival, or -1 after all have arrived and all sends have completed. Ranks that
+      send nothing are skipped.
+    */
+    int waitLET(Cells & cells) {
+      logger::startTimer("Wait LET");                           // Start timer
+      while (recvArrived.empty()) {                             // While no LET has arrived
+	int index = MPI_UNDEFINED;                              //  Index of completed request
+	if (!recvRequests.empty()) {                            //  If there were receives
+	  MPI_Waitany(recvRequests.size(), &recvRequests[0], &index, MPI_STATUS_IGNORE);// Wait for any receive
+	}                                                       //  End if for receives
+	if (index == MPI_UNDEFINED) break;                      //  Quit if all receives have completed
+	completeRecv(index);                                    //  Count completed receive
+      }                                                         // End while loop for arrival
+      if (recvArrived.empty()) {                                // If all LETs have been handed out
+	if (!sendRequests.empty()) {                            //  If there were sends
+	  MPI_Waitall(sendRequests.size(), &sendRequests[0], MPI_STATUSES_IGNORE);// Wait for all sends
+	}                                                       //  End if for sends
+	logger::stopTimer("Wait LET");                          //  Stop timer
+	return -1;                                              //  Return no rank
+      }                                                         // End if for completion
+      int irank = recvArrived.front();                          // Rank that arrived first
+      recvArrived.erase(recvArrived.begin());                   // Hand out rank
+      unpackBodies(irank);                                      // Unpack bodies from irank
+      unpackCells(recvCellDispl[irank], recvCellDispl[irank] + recvCellCount[irank]);// Unpack cells from irank
+      logger::stopTimer("Wait LET");                            // Stop timer
+      getLET(cells, irank);                                     // Get LET from irank
+      return irank;                                             // Return rank whose LET has arrived
+    }
+
+#if MPI_VERSION >= 3
+    //! Expose the local tree and its bodies for one-sided gets by all ranks
+    /*!
+      Collective. The tree is packed into the LET format and put in windows with a
+      passive target epoch to all ranks, which stays open until closeLET(). cells must
+      not change in between, and commBodies(), commCells() and startLET() must not be
+      called, since they reuse the buffers.
+    */
+    void exposeLET(Cells & cells) {
+      logger::startTimer("Expose LET");                         // Start timer
+      int numCells = cells.size();                              // Number of local cells
+      sendBodies.clear();                                       // Clear bodies to expose
+      if (numCells > 0) {                                       // If local tree is not empty
+	C_iter C0 = cells.begin();                              //  Root cell
+	sendBodies.assign(C0->BODY, C0->BODY + C0->NBODY);      //  Bodies of local tree in cell order
+      }                                                         // End if for empty tree
+      packBodies();                                             // Pack bodies into LET format
+      packCells(cells);                                         // Pack cells into LET format
+      for (int i=0; i<numCells; i++) {                          // Loop over local cells
+	sendBase[i].IBODY = cells[i].BODY - cells[0].BODY;      //  Index of first body in exposed bodies
+      }                                                         // End loop over local cells
+      pullCellCount.resize(mpisize);                            // Resize number of exposed cells
+      MPI_Allgather(&numCells, 1, MPI_INT, &pullCellCount[0], 1, MPI_INT, MPI_COMM_WORLD);// Gather number of exposed cells
+      createWindow(sendBase, baseWin);                          // Expose topology and geometry
+      createWindow(sendM, multipoleWin);                        // Expose multipoles
+      createWindow(sendBodyLET, bodyWin);                       // Expose bodies
+      pullBytes = 0;                                            // Reset pulled bytes
+      logger::stopTimer("Expose LET");                          // Stop timer
+    }
+
+    //! Pull the cells and bodies of irank that the dual tree traversal of icells needs
+    /*!
+      Runs the dual tree traversal of icells against the exposed tree of irank without
+      kernels, deciding with getPairType() and getSplitType() as Traversal::traverse()
+      (or Traversal::traverseCutoff() if cutoff > 0) does with the same nspawn. Children
+      of a remote cell are fetched when a pair splits it, and bodies of a remote leaf when
+      a pair of leafs needs P2P, each only once. Pairs are processed level by level of the
+      remote tree, so that all gets of a level complete with one flush. jcells then holds
+      exactly what the traversal reads: cells that are never split keep their NCHILD, but
+      their children are not pulled and their ICHILD is -1. The cost model and list based
+      traversal may need other cells, so only the plain dual tree traversal is supported.
+    */
+    void pullLET(Cells & icells, Cells & jcells, int irank, vec3 cycle, int nspawn, real_t cutoff=0) {
+      logger::startTimer("Pull LET");                           // Start timer
+      jcells.clear();                                           // Clear pulled tree
+      recvBodies.clear();                                       // Clear pulled bodies
+      if (icells.empty() || pullCellCount[irank] == 0) {        // If either tree is empty
+	logger::stopTimer("Pull LET");                          //  Stop timer
+	return;                                                 //  Nothing to pull
+      }                                                         // End if for empty tree
+      vec3 Xperiodic[27];                                       // Periodic coordinate offset of each key
+      for (int key=0; key<27; key++) {                          // Loop over periodic keys
+	Xperiodic[key][0] = (key % 3 - 1) * cycle[0];           //  x periodic offset
+	Xperiodic[key][1] = ((key / 3) % 3 - 1) * cycle[1];     //  y periodic offset
+	Xperiodic[key][2] = (key / 9 - 1) * cycle[2];           //  z periodic offset
+      }                                                         // End loop over periodic keys
+      recvBase.resize(1);                                       // Buffer for topology and geometry of root
+      recvM.resize(1);                                          // Buffer for multipoles of root
+      getWindow(recvBase, 0, 1, irank, 0, baseWin);             // Get topology and geometry of root
+      getWindow(recvM, 0, 1, irank, 0, multipoleWin);           // Get multipoles of root
+      MPI_Win_flush(irank, baseWin);                            // Complete get of topology and geometry
+      MPI_Win_flush(irank, multipoleWin);                       // Complete get of multipoles
+      jcells.resize(1);                                         // Pulled tree starts with root
+      unpackCell(recvBase[0], recvM[0], jcells.begin());        // Unpack root
+      jcells[0].IPARENT = 0;                                    // Root has no parent
+      pullChild.assign(1, -1);                                  // Children of root are not requested
+      pullBody.assign(1, -1);                                   // Bodies of root are not requested
+      std::vector<PullPair> pairs, waiting;                     // Pairs of this level, pairs waiting for children
+      std::vector<int> cellRequests, bodyRequests;              // Remote cells whose children or bodies are needed
+      pairs.push_back(PullPair(0, 0, images == 0 ? 1 << 13 : (1 << 27) - 1));// Root pair for center or all 27 images
+      while (!pairs.empty()) {                                  // While pairs remain
+	waiting.clear();                                        //  Clear pairs waiting for children
+	cellRequests.clear();                                   //  Clear requested children
+	bodyRequests.clear();                                   //  Clear requested bodies
+	for (size_t p=0; p<pairs.size(); p++) {                 //  Loop over pairs (grows as Ci splits)
+	  PullPair pair = pairs[p];                             //   Copy pair, since pairs may grow
+	  C_iter Ci = icells.begin() + pair.icell;              //   Local cell
+	  C_iter Cj = jcells.begin() + pair.jcell;              //   Remote cell
+	  int splitMask = 0;                                    //   Periodic keys of images that need splitting
+	  for (int key=0; (pair.mask >> key) != 0; key++) {     //   Loop over periodic keys in mask
+	    if ((pair.mask & (1 << key)) == 0) continue;        //    Skip images that are not in mask
+	    bool inside;                                        //    Flag for all bodies within cutoff (unused)
+	    PairType type = getPairType(Ci, Cj, Xperiodic[key], cutoff, inside);// Same criterion as the traversal
+	    if (type == PairNear) {                             //    If both cells are leafs
+	      if (Cj->NBODY != 0) requestBodies(pair.jcell, bodyRequests);// P2P needs the bodies of Cj
+	    } else if (type == PairSplit) {                     //    Else if cells are split
+	      splitMask |= 1 << key;                            //     Split cells for this image
+	    }                                                   //    Far field needs only the multipoles of Cj
+	  }                                                     //   End loop over periodic keys in mask
+	  if (splitMask == 0) continue;                         //   Skip pairs that need no splitting
+	  if (getSplitType(Ci, Cj, nspawn, false) != SplitTarget) {// If Cj is split
+	    requestChildren(pair.jcell, cellRequests);          //    Children of Cj are needed
+	    waiting.push_back(PullPair(pair.icell, pair.jcell, splitMask));// Pair waits for children of Cj
+	  } else {                                              //   Else if only Ci is split
+	    for (int ci=Ci->ICHILD; ci<Ci->ICHILD+Ci->NCHILD; ci++) {// Loop over Ci's children
+	      pairs.push_back(PullPair(ci, pair.jcell, splitMask));// Pair on the same level of the remote tree
+	    }                                                   //    End loop over Ci's children
+	  }                                                     //   End if for splitting
+	}                                                       //  End loop over pairs
+	fetchPull(jcells, cellRequests, bodyRequests, irank);   //  Get children and bodies of this level
+	pairs.clear();                                          //  Clear pairs of this level
+	for (size_t p=0; p<waiting.size(); p++) {               //  Loop over pairs waiting for children
+	  C_iter Ci = icells.begin() + waiting[p].icell;        //   Local cell
+	  C_iter Cj = jcells.begin() + waiting[p].jcell;        //   Remote cell
+	  bool both = getSplitType(Ci, Cj, nspawn, false) == SplitBoth;// Both cells are split if still large
+	  int first = pullChild[waiting[p].jcell];              //   First child of Cj in pulled tree
+	  for (int cj=first; cj<first+Cj->NCHILD; cj++) {       //   Loop over Cj's children
+	    if (both) {                                         //    If both cells are split
+	      for (int ci=Ci->ICHILD; ci<Ci->ICHILD+Ci->NCHILD; ci++) {// Loop over Ci's children
+		pairs.push_back(PullPair(ci, cj, waiting[p].mask));// Pair of children
+	      }                                                 //     End loop over Ci's children
+	    } else {                                            //    Else if only Cj is split
+	      pairs.push_back(PullPair(waiting[p].icell, cj, waiting[p].mask));// Pair of Ci and child of Cj
+	    }                                                   //    End if for both cells
+	  }                                                     //   End loop over Cj's children
+	}                                                       //  End loop over pairs waiting for children
+      }                                                         // End while loop for pairs
+      for (size_t j=0; j<jcells.size(); j++) {                  // Loop over pulled cells
+	C_iter C = jcells.begin() + j;                          //  Cell iterator
+	C->ICHILD = pullChild[j];                               //  First pulled child, -1 if children were not pulled
+	C->IBODY = std::max(pullBody[j], 0);                    //  First pulled body (not read if not pulled)
+	C->BODY = recvBodies.begin() + C->IBODY;                //  Iterator of first body
+      }                                                         // End loop over pulled cells
+      logger::stopTimer("Pull LET");                            // Stop timer
+    }
+
+    //! End the epochs of exposeLET() and free the windows (collective)
+    void closeLET() {
+      logger::startTimer("Close LET");                          // Start timer
+      freeWindow(baseWin);                                      // Free window of topology and geometry
+      freeWindow(multipoleWin);                                 // Free window of multipoles
+      freeWindow(bodyWin);                                      // Free window of bodies
+      logger::stopTimer("Close LET");                           // Stop timer
+    }
+
+    //! Print bytes pulled by all ranks since exposeLET()
+    double printPullData() {
+      double global;                                            // Bytes pulled by all ranks
+      MPI_Allreduce(&pullBytes, &global, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);// Reduce pulled bytes
+      if (logger::verbose) {                                    // If verbose flag is true
+	logger::printTitle("Pull LET stats");                   //  Print title
+	std::cout << std::setw(logger::stringLength) << std::left //  Set format
+		  << "Pulled bytes"  << " : "                   //  Print title
+		  << std::setprecision(0) << std::fixed         //  Set format
+		  << global << std::endl;                       //  Print bytes pulled by all ranks
+      }                                                         // End if for verbose flag
+      return global;                                            // Return bytes pulled by all ranks
+    }
+#else
+    void exposeLET(Cells &) {
+      std::cerr << "Pulling LET needs MPI-3" << std::endl;
+      abort();
+    }
+    void pullLET(Cells &, Cells &, int, vec3, int, real_t=0) {}
+    void closeLET() {}
+    double printPullData() { return 0; }
+#endif
+
     //! Copy recvBodies to bodies
     Bodies getRecvBodies() {
       return recvBodies;                                        // Return recvBodies
@@ -455,6 +1180,30 @@ namespace exafmm {
 		     (int*)&recvBodies[0], recvBodyCount, recvBodyDispl, MPI_INT, MPI_COMM_WORLD);
       return recvBodies;                                        // Return bodies
     }
+
+    //! Print size of local essential trees sent from all ranks
+    double printLETData() {
+      double local[2] = {0, 0};                                 // Bytes and destination ranks of this rank
+      for (int irank=0; irank<mpisize; irank++) {               // Loop over ranks
+	local[0] += double(sendBodyCount[irank]) * sizeof(BodyLET);// Add bytes of packed bodies
+	local[0] += double(sendCellCount[irank]) * (sizeof(CellLET) + sizeof(MultipoleLET));// Add bytes of packed cells
+	local[1] += sendCellCount[irank] > 0;                   //  Count destination ranks
+      }                                                         // End loop over ranks
+      double global[2];                                         // Bytes and destination ranks of all ranks
+      MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);// Reduce bytes and destinations
+      if (logger::verbose) {                                    // If verbose flag is true
+	logger::printTitle("LET stats");                        //  Print title
+	std::cout << std::setw(logger::stringLength) << std::left //  Set format
+		  << "LET bytes"  << " : "                      //  Print title
+		  << std::setprecision(0) << std::fixed         //  Set format
+		  << global[0] << std::endl                     //  Print bytes sent from all ranks
+		  << std::setw(logger::stringLength) << std::left //  Set format
+		  << "LET ranks per rank" << " : "              //  Print title
+		  << std::setprecision(1) << std::fixed         //  Set format
+		  << global[1] / mpisize << std::endl;          //  Print average number of destination ranks
+      }                                                         // End if for verbose flag
+      return global[0];                                         // Return bytes sent from all ranks
+    }
   };
 }
 #endif
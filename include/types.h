@@ -1,7 +1,9 @@
 #ifndef types_h
 #define types_h
 #include <assert.h>                                             // Some compilers don't have cassert
+#include <algorithm>
 #include <complex>
+#include <cstddef>
 #include "kahan.h"
 #include "macros.h"
 #include <stdint.h>
@@ -54,6 +56,34 @@ namespace exafmm {
     vec3 Xmax;                                                  //!< Maximum value of coordinates
   };
 
+  //! Interaction list of one kernel type in compressed sparse row format
+  struct CSRList {
+    std::vector<int> offset;                                    //!< Offset of list of each target cell, size numCells+1
+    std::vector<int> jcell;                                     //!< Index of source cell
+    std::vector<int> periodicKey;                               //!< Periodic key of source cell
+  };
+
+  //! Interaction lists of a target tree and a source tree
+  /*!
+    The lists depend only on the two trees, so they can be reused for repeated
+    evaluations of the same geometry. clear() them when either tree changes.
+    M2P and P2L are set by list based traversal of adaptive trees, and by dual
+    tree traversal with a cost model.
+  */
+  struct InteractionList {
+    CSRList P2P;                                                //!< P2P interaction list (U list)
+    CSRList M2L;                                                //!< M2L interaction list (V list)
+    CSRList M2P;                                                //!< M2P interaction list (W list)
+    CSRList P2L;                                                //!< P2L interaction list (X list)
+    bool empty() const { return M2L.offset.empty(); }           //!< Check if lists have been set
+    void clear() {                                              //!< Clear lists
+      P2P.offset.clear(); P2P.jcell.clear(); P2P.periodicKey.clear();
+      M2L.offset.clear(); M2L.jcell.clear(); M2L.periodicKey.clear();
+      M2P.offset.clear(); M2P.jcell.clear(); M2P.periodicKey.clear();
+      P2L.offset.clear(); P2L.jcell.clear(); P2L.periodicKey.clear();
+    }
+  };
+
   //! Equations supported
   enum Equation {
     Empty,                                                      //!< Empty kernel
@@ -107,6 +137,185 @@ namespace exafmm {
     kvec4   TRG;                                                //!< Scalar+vector3 real values
   };
 
+  //! Pool of expansion coefficients shared by all cells
+  /*!
+    Coefficients are carved from slabs of batchSize vectors and recycled through a
+    free list per thread, so that building, copying and destroying cells does not call
+    malloc once the pool has grown to the number of live expansions. A thread whose free
+    list grows beyond two batches hands one batch to the shared list, where threads with
+    an empty free list take it from. Slabs are kept for the lifetime of the process.
+  */
+  template<typename vecP>
+  class ExpansionPool {
+  private:
+    //! Free coefficients, linked through their own storage
+    struct Node {
+      Node * next;                                              //!< Next free coefficients in batch
+      Node * nextBatch;                                         //!< First node of next shared batch
+    };
+    //! Free list of the calling thread
+    struct FreeList {
+      Node * head;                                              //!< First free coefficients
+      int    size;                                              //!< Number of free coefficients
+    };
+    static const int batchSize = 64;                            //!< Number of coefficients per slab and per batch
+    static Node * sharedBatches;                                //!< Shared batches of free coefficients
+    static volatile int lock;                                   //!< Spin lock for shared batches
+
+    //! Get free list of the calling thread
+    static FreeList & getFreeList() {
+      static __thread FreeList freeList = {NULL, 0};            // Thread local free list
+      return freeList;                                          // Return free list
+    }
+    //! Take a batch from the shared list, or carve a new slab
+    static Node * takeBatch() {
+      Node * batch = NULL;                                      // Batch of free coefficients
+      while (__sync_lock_test_and_set(&lock, 1));               // Acquire lock
+      if (sharedBatches != NULL) {                              // If there are shared batches
+	batch = sharedBatches;                                  //  Take first batch
+	sharedBatches = batch->nextBatch;                       //  Remove it from shared list
+      }                                                         // End if for shared batches
+      __sync_lock_release(&lock);                               // Release lock
+      if (batch == NULL) {                                      // If there was no shared batch
+	assert(sizeof(vecP) >= sizeof(Node));                   //  Coefficients must be large enough to hold a node
+	vecP * slab = new vecP [batchSize];                     //  Allocate new slab
+	for (int i=batchSize-1; i>=0; i--) {                    //  Loop over slab in reverse
+	  Node * node = reinterpret_cast<Node*>(slab + i);      //   Link coefficients in order of the slab
+	  node->next = batch;                                   //   Link to next coefficients
+	  batch = node;                                         //   New head of batch
+	}                                                       //  End loop over slab
+      }                                                         // End if for shared batch
+      return batch;                                             // Return batch
+    }
+
+  public:
+    //! Allocate coefficients from the free list of the calling thread
+    static vecP * allocate() {
+      FreeList & freeList = getFreeList();                      // Free list of the calling thread
+      if (freeList.head == NULL) {                              // If free list is empty
+	freeList.head = takeBatch();                            //  Refill with one batch
+	freeList.size = batchSize;                              //  Size of batch
+      }                                                         // End if for empty free list
+      Node * node = freeList.head;                              // Take first free coefficients
+      freeList.head = node->next;                               // Unlink them
+      freeList.size--;                                          // Decrement size of free list
+      return reinterpret_cast<vecP*>(node);                     // Return coefficients
+    }
+    //! Return coefficients to the free list of the calling thread
+    static void deallocate(vecP * data) {
+      FreeList & freeList = getFreeList();                      // Free list of the calling thread
+      Node * node = reinterpret_cast<Node*>(data);              // Reuse storage as list node
+      node->next = freeList.head;                               // Link to free list
+      freeList.head = node;                                     // New head of free list
+      if (++freeList.size == 2 * batchSize) {                   // If free list holds two batches
+	Node * last = node;                                     //  Last node of first batch
+	for (int i=1; i<batchSize; i++) last = last->next;      //  Walk to end of first batch
+	freeList.head = last->next;                             //  Keep second batch
+	last->next = NULL;                                      //  Terminate first batch
+	freeList.size -= batchSize;                             //  Size of kept batch
+	while (__sync_lock_test_and_set(&lock, 1));             //  Acquire lock
+	node->nextBatch = sharedBatches;                        //  Link to shared batches
+	sharedBatches = node;                                   //  Share first batch
+	__sync_lock_release(&lock);                             //  Release lock
+      }                                                         // End if for two batches
+    }
+  };
+  template<typename vecP>
+  typename ExpansionPool<vecP>::Node * ExpansionPool<vecP>::sharedBatches = NULL;
+  template<typename vecP>
+  volatile int ExpansionPool<vecP>::lock = 0;
+
+  //! Expansion coefficients stored outside of the cell structure
+  /*!
+    Behaves like vecP with value semantics, but the cell only holds a pointer to
+    coefficients in the ExpansionPool, so that traversal scans compact cells. Coefficients
+    that are not allocated are zero, so constructing and copying fresh cells does not touch
+    the pool, and clear() returns coefficients that are never used (e.g. L of remote LET
+    cells). A non-const access allocates them, which the upward pass and the LET unpacking
+    do once per cell before the traversal. A const access never allocates and reads a
+    shared zero vector instead. Moves transfer the pointer.
+  */
+  template<typename vecP>
+  class Expansion;
+  template<int N, typename T>
+  class Expansion<vec<N,T> > {
+    typedef vec<N,T> vecP;                                      //!< Vector type of coefficients
+    typedef ExpansionPool<vecP> Pool;                           //!< Pool of coefficients
+  private:
+    vecP * data;                                                //!< Pointer to coefficients, NULL for zero
+    static const vecP zero;                                     //!< Coefficients of unallocated expansions
+
+    vecP & get() {                                              // Get coefficients, allocating if necessary
+      if (data == NULL) {                                       // If coefficients are not allocated
+	data = Pool::allocate();                                //  Allocate coefficients from pool
+	*data = T(0);                                           //  Initialize coefficients
+      }                                                         // End if for allocation
+      return *data;                                             // Return coefficients
+    }
+    const vecP & get() const {                                  // Get coefficients without allocating
+      return data != NULL ? *data : zero;                       // Return zero if not allocated
+    }
+  public:
+    Expansion() : data(NULL) {}                                 // Default constructor
+    Expansion(const Expansion & e) : data(NULL) {               // Copy constructor
+      if (e.data != NULL) get() = *e.data;                      // Copy coefficients if allocated
+    }
+#if __cplusplus >= 201103L
+    Expansion(Expansion && e) noexcept : data(e.data) {         // Move constructor
+      e.data = NULL;                                            // Source no longer owns coefficients
+    }
+    Expansion & operator=(Expansion && e) noexcept {            // Move assignment
+      std::swap(data, e.data);                                  // Source deallocates old coefficients
+      return *this;
+    }
+#endif
+    ~Expansion() {                                              // Destructor
+      clear();                                                  // Return coefficients to pool
+    }
+    Expansion & operator=(const Expansion & e) {                // Copy assignment
+      if (e.data != NULL) get() = *e.data;                      // Copy coefficients if allocated
+      else if (data != NULL) *data = T(0);                      // Else zero allocated coefficients
+      return *this;
+    }
+    Expansion & operator=(const vecP & v) {                     // Vector assignment
+      get() = v;
+      return *this;
+    }
+    Expansion & operator=(const T & v) {                        // Scalar assignment
+      get() = v;
+      return *this;
+    }
+    Expansion & operator+=(const vecP & v) {                    // Vector compound assignment (add)
+      get() += v;
+      return *this;
+    }
+    Expansion & operator/=(const T & v) {                       // Scalar compound assignment (divide)
+      if (data != NULL) *data /= v;                             // Zero stays zero
+      return *this;
+    }
+    T & operator[](int i) {                                     // Indexing (lvalue)
+      return get()[i];
+    }
+    const T & operator[](int i) const {                         // Indexing (rvalue)
+      return get()[i];
+    }
+    operator vecP & () {                                        // Type-casting (lvalue)
+      return get();
+    }
+    operator const vecP & () const {                            // Type-casting (rvalue)
+      return get();
+    }
+    bool allocated() const {                                    // Check if coefficients are allocated
+      return data != NULL;
+    }
+    void clear() {                                              // Return coefficients to pool
+      if (data != NULL) Pool::deallocate(data);
+      data = NULL;
+    }
+  };
+  template<int N, typename T>
+  const vec<N,T> Expansion<vec<N,T> >::zero = T(0);
+
   //! Structure of cells
   template<typename B_iter, typename vecP, Equation equation=Empty, Basis basis=Spherical>
   struct Cell {                                                 //!< Base components of cell structure
@@ -128,26 +337,25 @@ namespace exafmm {
   template<typename B_iter, typename vecP>
   struct Cell<B_iter,vecP,Laplace,Cartesian> : public Cell<B_iter,vecP> { //!< Specialization for Laplace Spherical
     B_iter BODY;                                                //!< Iterator of first body
-    vecP   M, L;                                                //!< Multipole/local coefficients
+    Expansion<vecP> M, L;                                       //!< Multipole/local coefficients
   };
   template<typename B_iter, typename vecP>
   struct Cell<B_iter,vecP,Laplace,Spherical> : public Cell<B_iter,vecP> { //!< Specialization for Laplace Spherical
     B_iter BODY;                                                //!< Iterator of first body
-    vecP   M, L;                                                //!< Multipole/local coefficients
+    Expansion<vecP> M, L;                                       //!< Multipole/local coefficients
   };
   template<typename B_iter, typename vecP>
   struct Cell<B_iter,vecP,Helmholtz,Spherical> : public Cell<B_iter,vecP> { //!< Specialization for Helmholtz Spherical
     B_iter BODY;                                                //!< Iterator of first body
-    vecP   M, L;                                                //!< Multipole/local coefficients
+    Expansion<vecP> M, L;                                       //!< Multipole/local coefficients
   };
   template<typename B_iter, typename vecP>
   struct Cell<B_iter,vecP,BiotSavart,Spherical> : public Cell<B_iter,vecP> { //!< Specialization for Biot-Savart Spherical
     B_iter BODY;                                                //!< Iterator of first body
-    vecP   M, L;                                                //!< Multipole/local coefficients
+    Expansion<vecP> M, L;                                       //!< Multipole/local coefficients
   };
 
   struct KernelBase {
-    static vec3 Xperiodic;                                      //!< Periodic coordinate offset
     static real_t eps2;                                         //!< Epslion squared
     static complex_t wavek;                                     //!< Helmholtz wave number
   };
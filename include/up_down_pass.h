@@ -1,5 +1,6 @@
 #ifndef up_down_pass_h
 #define up_down_pass_h
+#include "counter.h"
 #include "logger.h"
 #include "thread.h"
 #include "types.h"
@@ -98,9 +99,13 @@ namespace exafmm {
 	wait_tasks;                                             //   Synchronize tasks
 	C->M = 0;                                               //  Initialize multipole expansion coefficients
 	C->L = 0;                                               //  Initialize local expansion coefficients
-	if(C->NCHILD==0) Kernel::P2M(C);                        //  P2M kernel
-	else {                                                  //  If not leaf cell
+	uint64_t begin = counter::start();                      //  Start cycle counter
+	if(C->NCHILD==0) {                                      //  If leaf cell
+	  Kernel::P2M(C);                                       //   P2M kernel
+	  counter::stop(counter::P2M, begin, C->NBODY);         //   Count P2M kernel
+	} else {                                                //  If not leaf cell
           Kernel::M2M(C, C0);                                   //   M2M kernel
+	  counter::stop(counter::M2M, begin, C->NCHILD);        //   Count M2M kernel of all children
         }                                                       //  End if for non leaf cell
 	if (useRmax) setRmax();                                 //  Redefine cell radius R based on maximum distance
 	C->R /= theta;                                          //  Divide R by theta
@@ -114,9 +119,13 @@ namespace exafmm {
       PreOrderTraversal(C_iter _C, C_iter _C0) :                // Constructor
 	C(_C), C0(_C0) {}                                       // Initialize variables
       void operator() () const {                                // Overload operator()
+	uint64_t begin = counter::start();                      //  Start cycle counter
 	Kernel::L2L(C, C0);                                     //  L2L kernel
+	counter::stop(counter::L2L, begin, 1);                  //  Count L2L kernel
 	if (C->NCHILD==0) {                                     //  If leaf cell
+	  begin = counter::start();                             //   Start cycle counter
           Kernel::L2P(C);                                       //  L2P kernel
+	  counter::stop(counter::L2P, begin, C->NBODY);         //   Count L2P kernel
         }                                                       // End if for leaf cell
 #if EXAFMM_USE_WEIGHT
 	C_iter CP = C0 + C->IPARENT;                            // Parent cell
@@ -0,0 +1,302 @@
+#ifndef wsteal_h
+#define wsteal_h
+#include <cstdio>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace exafmm {
+  //! Work stealing task runtime with one Chase-Lev deque per thread
+  /*!
+    The thread that calls init() becomes worker 0, the others are started as pthreads.
+    TaskGroup::run() pushes a copy of the functor to the bottom of the deque of the
+    calling worker. The caller goes on with its own work and pops the task back in wait()
+    unless a thief took it, so that without steals tasks run in serial order. Idle workers
+    steal from the top of the deques of workers on the same NUMA node first, and sleep
+    after repeated failed attempts. Threads outside the pool, and a pool of one worker, run
+    tasks immediately.
+  */
+  namespace wsteal {
+    //! Task in a deque, executed once by its owner or a thief
+    struct Task {
+      volatile int * pending;                                   //!< Counter of unfinished tasks of its task group
+      virtual ~Task() {}                                        //!< Destructor
+      virtual void execute() = 0;                               //!< Run the task
+    };
+
+    //! Task holding a copy of the functor
+    template<typename Func>
+    struct TaskFunc : public Task {
+      Func func;                                                //!< Functor to call
+      TaskFunc(const Func & _func) : func(_func) {}             //!< Constructor
+      void execute() { func(); }                                //!< Call the functor
+    };
+
+    //! Chase-Lev work stealing deque
+    /*!
+      The owner pushes and pops at the bottom, thieves take from the top. Only taking the
+      last task needs a compare-and-swap. A full array is replaced by one of twice the size.
+      Old arrays are kept until the deque is destroyed, because thieves may still read them.
+    */
+    class Deque {
+      typedef Task * volatile TaskPtr;                          //!< Task slot read by other threads
+      struct Array {
+	long size;                                              //!< Capacity (power of 2)
+	TaskPtr * tasks;                                        //!< Circular buffer of tasks
+	Array * prev;                                           //!< Previous array of smaller size
+	Array(long _size, Array * _prev) : size(_size), tasks(new TaskPtr [_size]), prev(_prev) {}
+	~Array() { delete[] tasks; }
+	Task * get(long i) const { return tasks[i & (size - 1)]; }
+	void put(long i, Task * task) { tasks[i & (size - 1)] = task; }
+      };
+
+    private:
+      volatile long top;                                        //!< Index of oldest task, incremented by thieves
+      volatile long bottom;                                     //!< Index of next free slot, moved by owner
+      Array * volatile array;                                   //!< Current circular buffer
+
+    public:
+      Deque() : top(0), bottom(0), array(new Array(256, NULL)) {}// Constructor
+      ~Deque() {                                                // Destructor
+	while (array) {                                         //  While arrays remain
+	  Array * prev = array->prev;                           //   Previous array
+	  delete array;                                         //   Deallocate array
+	  array = prev;                                         //   Move to previous array
+	}                                                       //  End while loop for arrays
+      }
+
+      //! Push task to the bottom (owner only)
+      void push(Task * task) {
+	long b = bottom;                                        //  Bottom index
+	long t = top;                                           //  Top index
+	Array * a = array;                                      //  Current array
+	if (b - t >= a->size - 1) {                             //  If array is full
+	  Array * grown = new Array(2 * a->size, a);            //   Allocate array of twice the size
+	  for (long i=t; i<b; i++) grown->put(i, a->get(i));    //   Copy tasks
+	  __sync_synchronize();                                 //   Publish tasks before array
+	  array = a = grown;                                    //   Switch to new array
+	}                                                       //  End if for full array
+	a->put(b, task);                                        //  Store task
+	__sync_synchronize();                                   //  Publish task before bottom
+	bottom = b + 1;                                         //  Increment bottom
+      }
+
+      //! Pop task from the bottom (owner only), NULL if empty or taken by a thief
+      Task * pop() {
+	long b = bottom - 1;                                    //  Index of last task
+	Array * a = array;                                      //  Current array
+	bottom = b;                                             //  Reserve last task
+	__sync_synchronize();                                   //  Make reservation visible before reading top
+	long t = top;                                           //  Top index
+	if (b < t) {                                            //  If deque was empty
+	  bottom = t;                                           //   Restore bottom
+	  return NULL;                                          //   Nothing to pop
+	}                                                       //  End if for empty deque
+	Task * task = a->get(b);                                //  Last task
+	if (b > t) return task;                                 //  No race if more than one task was left
+	if (!__sync_bool_compare_and_swap(&top, t, t + 1)) task = NULL;// Race with thieves for the last task
+	bottom = t + 1;                                         //  Deque is empty either way
+	return task;                                            //  Return task or NULL if lost
+      }
+
+      //! Task that pop() would return (owner only)
+      Task * peek() const {
+	long b = bottom;                                        //  Bottom index
+	return b > top ? array->get(b - 1) : NULL;              //  Last task if not empty
+      }
+
+      //! Steal task from the top (any thread), NULL if empty or lost a race
+      Task * steal() {
+	long t = top;                                           //  Top index
+	__sync_synchronize();                                   //  Read top before bottom
+	long b = bottom;                                        //  Bottom index
+	if (t >= b) return NULL;                                //  Nothing to steal
+	Array * a = array;                                      //  Current array
+	Task * task = a->get(t);                                //  Oldest task
+	if (!__sync_bool_compare_and_swap(&top, t, t + 1)) return NULL;// Lost race with owner or thief
+	return task;                                            //  Return stolen task
+      }
+
+      //! Check if deque looks empty
+      bool empty() const {
+	return bottom <= top;                                   //  Empty if bottom is not above top
+      }
+    };
+
+    //! Worker thread with its own deque
+    struct Worker {
+      Deque     deque;                                          //!< Tasks spawned by this worker
+      int       id;                                             //!< Worker index
+      int       node;                                           //!< NUMA node the worker started on
+      unsigned  seed;                                           //!< Seed for random victim selection
+      pthread_t thread;                                         //!< pthread of worker (unused for worker 0)
+      Worker(int _id) : id(_id), node(0), seed(_id * 2654435761u + 1) {}// Constructor
+    };
+
+    Worker ** workers = NULL;                                   //!< All workers
+    int numWorkers = 0;                                         //!< Number of workers
+    volatile bool stop = false;                                 //!< Flag for stopping workers
+    volatile int numSleeping = 0;                               //!< Number of sleeping workers
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;          //!< Mutex for sleeping workers
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;             //!< Condition for waking up workers
+    __thread Worker * self = NULL;                              //!< Worker of calling thread, NULL outside pool
+    const int maxFails = 1024;                                  //!< Failed steal attempts before sleeping
+
+    //! NUMA node of the CPU the calling thread runs on
+    inline int getNumaNode() {
+#if defined(__linux__) && defined(_GNU_SOURCE)
+      int cpu = sched_getcpu();                                 // CPU of calling thread
+      if (cpu < 0) return 0;                                    // Unknown CPU
+      for (int node=0; node<64; node++) {                       // Loop over NUMA nodes
+	char path[64];                                          //  Path of CPU link in sysfs
+	sprintf(path, "/sys/devices/system/node/node%d/cpu%d", node, cpu);// Link exists if CPU belongs to node
+	if (access(path, F_OK) == 0) return node;               //  Return node of CPU
+      }                                                         // End loop over NUMA nodes
+#endif
+      return 0;                                                 // Single node
+    }
+
+    //! Try to steal a task, from workers on the same NUMA node first
+    inline Task * steal(Worker * thief) {
+      int offset = rand_r(&thief->seed) % numWorkers;           // Random first victim
+      for (int pass=0; pass<2; pass++) {                        // Loop over same node and other nodes
+	for (int i=0; i<numWorkers; i++) {                      //  Loop over victims
+	  Worker * victim = workers[(offset + i) % numWorkers]; //   Victim worker
+	  if (victim == thief) continue;                        //   Skip self
+	  if ((victim->node == thief->node) != (pass == 0)) continue;// Skip victims of the other pass
+	  Task * task = victim->deque.steal();                  //   Try to steal
+	  if (task) return task;                                //   Return stolen task
+	}                                                       //  End loop over victims
+      }                                                         // End loop over passes
+      return NULL;                                              // No task found
+    }
+
+    //! Run task and notify its task group
+    inline void execute(Task * task) {
+      task->execute();                                          // Run task
+      __sync_fetch_and_sub(task->pending, 1);                   // Decrement pending tasks of task group
+      delete task;                                              // Deallocate task
+    }
+
+    //! Check if any deque has tasks
+    inline bool hasWork() {
+      for (int i=0; i<numWorkers; i++) {                        // Loop over workers
+	if (!workers[i]->deque.empty()) return true;            //  Found a task
+      }                                                         // End loop over workers
+      return false;                                             // All deques are empty
+    }
+
+    //! Wake up a sleeping worker after a push
+    inline void wakeup() {
+      __sync_synchronize();                                     // Publish push before reading numSleeping
+      if (numSleeping > 0) {                                    // If some worker sleeps
+	pthread_mutex_lock(&mutex);                             //  Lock mutex
+	pthread_cond_signal(&cond);                             //  Wake up one worker
+	pthread_mutex_unlock(&mutex);                           //  Unlock mutex
+      }                                                         // End if for sleeping workers
+    }
+
+    //! Main loop of workers other than worker 0
+    inline void * loop(void * arg) {
+      Worker * worker = static_cast<Worker*>(arg);              // Worker of this thread
+      self = worker;                                            // Set thread local worker
+      worker->node = getNumaNode();                             // NUMA node of this thread
+      int fails = 0;                                            // Number of failed steal attempts
+      while (!stop) {                                           // While runtime is active
+	Task * task = steal(worker);                            //  Try to steal a task
+	if (task) {                                             //  If a task was stolen
+	  execute(task);                                        //   Run task
+	  fails = 0;                                            //   Reset failed attempts
+	} else if (++fails < maxFails) {                        //  Else if not idle for long
+	  sched_yield();                                        //   Yield processor
+	} else {                                                //  Else go to sleep
+	  pthread_mutex_lock(&mutex);                           //   Lock mutex
+	  __sync_fetch_and_add(&numSleeping, 1);                //   Announce sleep before checking deques
+	  if (!stop && !hasWork()) pthread_cond_wait(&cond, &mutex);// Sleep unless a task was pushed
+	  __sync_fetch_and_sub(&numSleeping, 1);                //   Woke up
+	  pthread_mutex_unlock(&mutex);                         //   Unlock mutex
+	  fails = 0;                                            //   Reset failed attempts
+	}                                                       //  End if for stolen task
+      }                                                         // End while loop for active runtime
+      return NULL;
+    }
+
+    //! Stop and join all workers
+    inline void finalize() {
+      if (numWorkers == 0) return;                              // Quit if runtime is not running
+      pthread_mutex_lock(&mutex);                               // Lock mutex
+      stop = true;                                              // Set stop flag
+      pthread_cond_broadcast(&cond);                            // Wake up all workers
+      pthread_mutex_unlock(&mutex);                             // Unlock mutex
+      for (int i=1; i<numWorkers; i++) {                        // Loop over started workers
+	pthread_join(workers[i]->thread, NULL);                 //  Join worker
+      }                                                         // End loop over started workers
+      for (int i=0; i<numWorkers; i++) delete workers[i];       // Deallocate workers
+      delete[] workers;                                         // Deallocate array of workers
+      workers = NULL;                                           // Reset array of workers
+      numWorkers = 0;                                           // Reset number of workers
+      self = NULL;                                              // Calling thread leaves the pool
+    }
+
+    //! Start numThreads workers, the calling thread being worker 0
+    inline void init(int numThreads) {
+      if (numThreads < 1) numThreads = 1;                       // At least the calling thread
+      if (numThreads == numWorkers) return;                     // Keep running pool of the same size
+      finalize();                                               // Stop previous pool
+      stop = false;                                             // Reset stop flag
+      workers = new Worker * [numThreads];                      // Allocate array of workers
+      for (int i=0; i<numThreads; i++) workers[i] = new Worker(i);// Allocate workers
+      numWorkers = numThreads;                                  // Set number of workers
+      self = workers[0];                                        // Calling thread is worker 0
+      self->node = getNumaNode();                               // NUMA node of calling thread
+      for (int i=1; i<numThreads; i++) {                        // Loop over other workers
+	pthread_create(&workers[i]->thread, NULL, loop, workers[i]);// Start worker thread
+      }                                                         // End loop over other workers
+    }
+
+    //! Stop workers at exit
+    struct Finalizer {
+      ~Finalizer() { finalize(); }                              //!< Destructor
+    } finalizer;                                                //!< Instance whose destructor runs at exit
+
+    //! Group of tasks spawned by one function and waited for together
+    class TaskGroup {
+    private:
+      volatile int pending;                                     //!< Number of unfinished tasks
+
+    public:
+      TaskGroup() : pending(0) {}                               //!< Constructor
+      ~TaskGroup() { wait(); }                                  //!< Destructor
+
+      //! Spawn a copy of func as a task
+      template<typename Func>
+      void run(const Func & func) {
+	if (self == NULL || numWorkers == 1) {                  //  If calling thread is not in the pool or alone
+	  func();                                               //   Run immediately
+	  return;
+	}                                                       //  End if for calling thread
+	Task * task = new TaskFunc<Func>(func);                 //  Copy functor into task
+	task->pending = &pending;                               //  Register task group
+	__sync_fetch_and_add(&pending, 1);                      //  Increment pending tasks
+	self->deque.push(task);                                 //  Push task to own deque
+	wakeup();                                               //  Wake up a sleeping worker
+      }
+
+      //! Wait for all tasks of this group, running own and stolen tasks meanwhile
+      void wait() {
+	while (pending > 0) {                                   //  While tasks are not finished
+	  Task * task = self->deque.peek();                     //   Last task in own deque
+	  if (task && task->pending == &pending) {              //   If it belongs to this group
+	    task = self->deque.pop();                           //    Pop it
+	  } else {                                              //   Else own tasks were stolen
+	    task = steal(self);                                 //    Help other workers
+	  }                                                     //   End if for own task
+	  if (task) execute(task);                              //   Run task
+	  else sched_yield();                                   //   Yield processor while thieves finish
+	}                                                       //  End while loop for pending tasks
+      }
+    };
+  }
+}
+#endif
@@ -15,7 +15,7 @@ namespace exafmm {
     typedef std::vector<Cell<B_iter,vecP,BiotSavart,basis> > Cells;//!< Vector of cells for BiotSavart
     typedef typename Cells::iterator C_iter;                    //!< Iterator of cell vector
 
-    static void P2P(C_iter Ci, C_iter Cj, bool ) {
+    static void P2P(C_iter Ci, C_iter Cj, const vec3 & Xperiodic, bool ) {
       B_iter Bi = Ci->BODY;
       B_iter Bj = Cj->BODY;
       int ni = Ci->NBODY;
@@ -45,6 +45,13 @@ namespace exafmm {
       }
     }
 
+    //! Batched P2P of a target cell with numCells source cells shifted by periodic offsets Xj
+    static void P2P(C_iter Ci, const C_iter * Cj, const vec3 * Xj, int numCells) {
+      for (int c=0; c<numCells; c++) {                          // Loop over source cells
+	P2P(Ci, Cj[c], Xj[c], false);                           //  P2P kernel for pair of cells
+      }                                                         // End loop over source cells
+    }
+
     static void P2P(C_iter C) {
       B_iter B = C->BODY;
       int n = C->NBODY;
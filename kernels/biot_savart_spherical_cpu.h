@@ -11,11 +11,11 @@ namespace exafmm {
     static const int P = _P;                                    //!< Set order of expansion
     static const int NTERM = 3*P*(P+1)/2;                       //!< # of terms in Biot-Savart Spherical expansion
     typedef vec<NTERM,complex_t> vecP;                          //!< Vector type for expansion terms
+    static const bool linear = true;                            //!< M2M and M2L are linear in M
     using typename BiotSavartP2PCPU<vecP,Spherical>::Bodies;    //!< Vector of bodies for Biot-Savart
     using typename BiotSavartP2PCPU<vecP,Spherical>::B_iter;    //!< Iterator of body vector
     using typename BiotSavartP2PCPU<vecP,Spherical>::Cells;     //!< Vector of cells for Biot-Savart
     using typename BiotSavartP2PCPU<vecP,Spherical>::C_iter;    //!< Iterator of cell vector
-    using BiotSavartP2PCPU<vecP,Spherical>::Xperiodic;
 
     static void init() {}
     static void finalize() {}
@@ -74,7 +74,7 @@ namespace exafmm {
       }
     }
 
-    static void M2L(C_iter Ci, C_iter Cj, bool mutual) {
+    static void M2L(C_iter Ci, C_iter Cj, const vec3 & Xperiodic, bool mutual) {
       assert(mutual == false);
       complex_t Ynmi[P*P], Ynmj[P*P];
       vec3 dX = Ci->X - Cj->X - Xperiodic;
@@ -114,6 +114,66 @@ namespace exafmm {
       }
     }
 
+    //! Batched M2L of a target cell with numCells source cells shifted by periodic offsets Xj
+    static void M2L(C_iter Ci, const C_iter * Cj, const vec3 * Xj, int numCells) {
+      for (int c=0; c<numCells; c++) {                          // Loop over source cells
+	M2L(Ci, Cj[c], Xj[c], false);                           //  M2L kernel for pair of cells
+      }                                                         // End loop over source cells
+    }
+
+    static void M2P(C_iter Ci, C_iter Cj, const vec3 & Xperiodic) {
+      complex_t Ynm[P*P], YnmTheta[P*P];
+      for (B_iter B=Ci->BODY; B!=Ci->BODY+Ci->NBODY; B++) {
+	vec3 dX = B->X - Cj->X - Xperiodic;
+	vec3 spherical[3] = {0, 0, 0};
+	vec3 cartesian[3] = {0, 0, 0};
+	real_t r, theta, phi;
+	cart2sph(dX, r, theta, phi);
+	evalLocal(P, r, theta, phi, Ynm, YnmTheta);
+	for (int n=0; n<P; n++) {
+	  int nm  = n * n + n;
+	  int nms = n * (n + 1) / 2;
+	  for (int d=0; d<3; d++) {
+	    spherical[d][0] -= std::real(Cj->M[3*nms+d] * Ynm[nm]) / r * (n + 1);
+	    spherical[d][1] += std::real(Cj->M[3*nms+d] * YnmTheta[nm]);
+	  }
+	  for (int m=1; m<=n; m++) {
+	    nm  = n * n + n + m;
+	    nms = n * (n + 1) / 2 + m;
+	    for (int d=0; d<3; d++) {
+	      spherical[d][0] -= 2 * std::real(Cj->M[3*nms+d] * Ynm[nm]) / r * (n + 1);
+	      spherical[d][1] += 2 * std::real(Cj->M[3*nms+d] * YnmTheta[nm]);
+	      spherical[d][2] += 2 * std::real(Cj->M[3*nms+d] * Ynm[nm] * I) * m;
+	    }
+	  }
+	}
+	for (int d=0; d<3; d++) {
+	  sph2cart(r, theta, phi, spherical[d], cartesian[d]);
+	}
+	B->TRG[1] += cartesian[1][2] - cartesian[2][1];
+	B->TRG[2] += cartesian[2][0] - cartesian[0][2];
+	B->TRG[3] += cartesian[0][1] - cartesian[1][0];
+      }
+    }
+
+    static void P2L(C_iter Ci, C_iter Cj, const vec3 & Xperiodic) {
+      complex_t Ynm[P*P];
+      for (B_iter B=Cj->BODY; B!=Cj->BODY+Cj->NBODY; B++) {
+	vec3 dX = Ci->X - B->X - Xperiodic;
+	real_t rho, alpha, beta;
+	cart2sph(dX, rho, alpha, beta);
+	evalLocal(P, rho, alpha, beta, Ynm);
+	for (int j=0; j<P; j++) {
+	  for (int k=0; k<=j; k++) {
+	    int jks = j * (j + 1) / 2 + k;
+	    for (int d=0; d<3; d++) {
+	      Ci->L[3*jks+d] += B->SRC[d] * real_t(oddOrEven(j)) * Ynm[j*j+j-k];
+	    }
+	  }
+	}
+      }
+    }
+
     static void L2L(C_iter Ci, C_iter C0) {
       complex_t Ynm[P*P], YnmTheta[P*P];
       C_iter Cj = C0 + Ci->IPARENT;
@@ -16,11 +16,11 @@ namespace exafmm {
     static const int P = _P;                                    //!< Set order of expansion
     static const int NTERM = P*P;                               //!< # of terms in Helmholtz Spherical expansion
     typedef vec<NTERM,complex_t> vecP;                          //!< Vector type for expansion terms
+    static const bool linear = true;                            //!< M2M and M2L are linear in M
     using typename HelmholtzP2PCPU<vecP,Spherical>::Bodies;     //!< Vector of bodies for Helmholtz
     using typename HelmholtzP2PCPU<vecP,Spherical>::B_iter;     //!< Iterator of body vector
     using typename HelmholtzP2PCPU<vecP,Spherical>::Cells;      //!< Vector of cells for Helmholtz
     using typename HelmholtzP2PCPU<vecP,Spherical>::C_iter;     //!< Iterator of cell vector
-    using HelmholtzP2PCPU<vecP,Spherical>::Xperiodic;
     using HelmholtzP2PCPU<vecP,Spherical>::wavek;
 
   private:
@@ -489,7 +489,7 @@ namespace exafmm {
       }
     }
 
-    static void M2L(C_iter Ci, C_iter Cj, bool mutual) {
+    static void M2L(C_iter Ci, C_iter Cj, const vec3 & Xperiodic, bool mutual) {
       assert(mutual == false);
       real_t Ynm[P*(P+1)/2], Ynmd[P*(P+1)/2];
       complex_t phitemp[2*P], phitempn[2*P];
@@ -613,6 +613,118 @@ namespace exafmm {
       Ci->L += Lnm;
     }
 
+    //! Batched M2L of a target cell with numCells source cells shifted by periodic offsets Xj
+    static void M2L(C_iter Ci, const C_iter * Cj, const vec3 * Xj, int numCells) {
+      for (int c=0; c<numCells; c++) {                          // Loop over source cells
+	M2L(Ci, Cj[c], Xj[c], false);                           //  M2L kernel for pair of cells
+      }                                                         // End loop over source cells
+    }
+
+    static void M2P(C_iter Ci, C_iter Cj, const vec3 & Xperiodic) {
+      real_t Ynm[P*(P+1)/2], Ynmd[P*(P+1)/2];
+      complex_t ephi[P], hn[P], hnd[P];
+      real_t kscale = Cj->SCALE * abs(wavek);
+      for (B_iter B=Ci->BODY; B!=Ci->BODY+Ci->NBODY; B++) {
+	kcvec4 TRG = kcomplex_t(0,0);
+	vec3 dX = B->X - Cj->X - Xperiodic;
+	real_t r, theta, phi;
+	cart2sph(dX, r, theta, phi);
+	real_t ctheta = std::cos(theta);
+	real_t stheta = std::sin(theta);
+	real_t cphi = std::cos(phi);
+	real_t sphi = std::sin(phi);
+	ephi[1] = std::exp(I * phi);
+	for (int n=2; n<P; n++) {
+	  ephi[n] = ephi[n-1] * ephi[1];
+	}
+	real_t rx = stheta * cphi;
+	real_t thetax = ctheta * cphi;
+	real_t phix = -sphi;
+	real_t ry = stheta * sphi;
+	real_t thetay = ctheta * sphi;
+	real_t phiy = cphi;
+	real_t rz = ctheta;
+	real_t thetaz = -stheta;
+	real_t phiz = 0;
+	get_Ynmd(P, ctheta, Ynm, Ynmd);
+	complex_t z = wavek * r;
+	get_hnd(P, z, kscale, hn, hnd);
+	TRG[0] += Cj->M[0] * hn[0];
+	for (int n=0; n<P; n++) {
+	  hnd[n] *= wavek;
+	}
+	complex_t ur = Cj->M[0] * hnd[0];
+	complex_t utheta = 0;
+	complex_t uphi = 0;
+	for (int n=1; n<P; n++) {
+	  int nm = n * n + n;
+	  int nms = n * (n + 1) / 2;
+	  TRG[0] += Cj->M[nm] * hn[n] * Ynm[nms];
+	  ur += hnd[n] * Ynm[nms] * Cj->M[nm];
+	  complex_t hnuse = hn[n] / r;
+	  utheta -= Cj->M[nm] * hnuse * Ynmd[nms] * stheta;
+	  for (int m=1; m<=n; m++) {
+	    int npm = n * n + n + m;
+	    int nmm = n * n + n - m;
+	    nms = n * (n + 1) / 2 + m;
+	    complex_t ztmp1 = hn[n] * Ynm[nms] * stheta;
+	    complex_t ztmp2 = Cj->M[npm] * ephi[m];
+	    complex_t ztmp3 = Cj->M[nmm] * conj(ephi[m]);
+	    complex_t ztmpsum = ztmp2 + ztmp3;
+	    TRG[0] += ztmp1 * ztmpsum;
+	    ur += hnd[n] * Ynm[nms] * stheta * ztmpsum;
+	    utheta -= ztmpsum * hnuse * Ynmd[nms];
+	    ztmpsum = real_t(m) * I * (ztmp2 - ztmp3);
+	    uphi += hnuse * Ynm[nms] * ztmpsum;
+	  }
+	}
+	complex_t ux = ur * rx + utheta * thetax + uphi * phix;
+	complex_t uy = ur * ry + utheta * thetay + uphi * phiy;
+	complex_t uz = ur * rz + utheta * thetaz + uphi * phiz;
+	TRG[1] -= ux;
+	TRG[2] -= uy;
+	TRG[3] -= uz;
+	B->TRG += TRG * B->SRC;
+      }
+    }
+
+    static void P2L(C_iter Ci, C_iter Cj, const vec3 & Xperiodic) {
+      real_t Ynm[P*(P+1)/2];
+      complex_t ephi[P], hn[P];
+      vecP Lnm = complex_t(0,0);
+      real_t kscale = Ci->SCALE * abs(wavek);
+      for (B_iter B=Cj->BODY; B!=Cj->BODY+Cj->NBODY; B++) {
+	vec3 dX = B->X + Xperiodic - Ci->X;
+	real_t r, theta, phi;
+	cart2sph(dX, r, theta, phi);
+	real_t ctheta = std::cos(theta);
+	ephi[1] = exp(I * phi);
+	for (int n=2; n<P; n++) {
+	  ephi[n] = ephi[n-1] * ephi[1];
+	}
+	get_Ynm(P, ctheta, Ynm);
+	complex_t z = wavek * r;
+	get_hn(P, z, kscale, hn);
+	for (int n=0; n<P; n++) {
+	  hn[n] *= B->SRC;
+	}
+	for (int n=0; n<P; n++) {
+	  int nm = n * n + n;
+	  int nms = n * (n + 1) / 2;
+	  Lnm[nm] += Ynm[nms] * hn[n];
+	  for (int m=1; m<=n; m++) {
+	    nms = n * (n + 1) / 2 + m;
+	    int npm = n * n + n + m;
+	    int nmm = n * n + n - m;
+	    complex_t Ynmhn = Ynm[nms] * hn[n];
+	    Lnm[npm] += Ynmhn * conj(ephi[m]);
+	    Lnm[nmm] += Ynmhn * ephi[m];
+	  }
+	}
+      }
+      Ci->L += Lnm * I * wavek;
+    }
+
     static void L2L(C_iter Ci, C_iter C0) {
       real_t Ynm[P*(P+1)/2], Ynmd[P*(P+1)/2];
       complex_t phitemp[2*P], phitempn[2*P];
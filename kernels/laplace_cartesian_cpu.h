@@ -674,11 +674,11 @@ namespace exafmm {
     static const int P = _P;                                    //!< Set order of expansion
     static const int NTERM = P*(P+1)*(P+2)/6;                   //!< # of terms in Laplace Cartesian expansion
     typedef vec<NTERM,real_t> vecP;                             //!< Vector type for expansion terms
+    static const bool linear = mass == 0;                       //!< M2M and M2L are linear in M unless normalized by mass
     using typename LaplaceP2PCPU<vecP,Cartesian>::Bodies;       //!< Vector of bodies for Laplace
     using typename LaplaceP2PCPU<vecP,Cartesian>::B_iter;       //!< Iterator of body vector
     using typename LaplaceP2PCPU<vecP,Cartesian>::Cells;        //!< Vector of cells for Laplace
     using typename LaplaceP2PCPU<vecP,Cartesian>::C_iter;       //!< Iterator of cell vector
-    using LaplaceP2PCPU<vecP,Cartesian>::Xperiodic;
 
     static void init() {}
     static void finalize() {}
@@ -710,7 +710,7 @@ namespace exafmm {
       Mass<NTERM,mass>::divide(Ci->M);
     }
 
-    static void M2L(C_iter Ci, C_iter Cj, bool mutual) {
+    static void M2L(C_iter Ci, C_iter Cj, const vec3 & Xperiodic, bool mutual) {
       vec3 dX = Ci->X - Cj->X - Xperiodic;
       real_t invR2 = 1 / norm(dX);
       real_t invR = Mass<NTERM,mass>::sqrt(invR2,Ci->M[0],Cj->M[0]);
@@ -723,6 +723,43 @@ namespace exafmm {
       }
     }
 
+    //! Batched M2L of a target cell with numCells source cells shifted by periodic offsets Xj
+    static void M2L(C_iter Ci, const C_iter * Cj, const vec3 * Xj, int numCells) {
+      for (int c=0; c<numCells; c++) {                          // Loop over source cells
+	M2L(Ci, Cj[c], Xj[c], false);                           //  M2L kernel for pair of cells
+      }                                                         // End loop over source cells
+    }
+
+    static void M2P(C_iter Ci, C_iter Cj, const vec3 & Xperiodic) {
+      for (B_iter B=Ci->BODY; B!=Ci->BODY+Ci->NBODY; B++) {
+	vec3 dX = B->X - Cj->X - Xperiodic;
+	real_t invR2 = 1 / norm(dX);
+	real_t invR = Mass<NTERM,mass>::sqrt(invR2,1,Cj->M[0]);
+	vecP C, L = 0;
+	Coef<B_iter,NTERM,mass,P-1>::getCoef(C, dX, invR2, invR);
+	Mass<NTERM,mass>::add(L, Cj->M[0], C);
+	for (int i=1; i<NTERM; i++) L[0] += Cj->M[i] * C[i];
+	L[1] += LocalSum<vecP,P,1,0,0>::kernel(Cj->M, C);
+	L[2] += LocalSum<vecP,P,0,1,0>::kernel(Cj->M, C);
+	L[3] += LocalSum<vecP,P,0,0,1>::kernel(Cj->M, C);
+	B->TRG[0] += B->SRC * L[0];
+	B->TRG[1] += B->SRC * L[1];
+	B->TRG[2] += B->SRC * L[2];
+	B->TRG[3] += B->SRC * L[3];
+      }
+    }
+
+    static void P2L(C_iter Ci, C_iter Cj, const vec3 & Xperiodic) {
+      for (B_iter B=Cj->BODY; B!=Cj->BODY+Cj->NBODY; B++) {
+	vec3 dX = Ci->X - B->X - Xperiodic;
+	real_t invR2 = 1 / norm(dX);
+	real_t invR = Mass<NTERM,mass>::sqrt(invR2,Ci->M[0],B->SRC);
+	vecP C;
+	Coef<B_iter,NTERM,mass,P-1>::getCoef(C, dX, invR2, invR);
+	Mass<NTERM,mass>::add(Ci->L, B->SRC, C);
+      }
+    }
+
     static void L2L(C_iter Ci, C_iter Ci0) {
       C_iter Cj = Ci0 + Ci->IPARENT;
       vec3 dX = Ci->X - Cj->X;
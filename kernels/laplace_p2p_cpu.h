@@ -1,5 +1,6 @@
 #ifndef laplace_p2p_cpu_h
 #define laplace_p2p_cpu_h
+#include <algorithm>
 #include "types.h"
 #if EXAFMM_USE_SIMD
 #include "simdvec.h"
@@ -15,7 +16,7 @@ namespace exafmm {
     typedef std::vector<Cell<B_iter,vecP,Laplace,basis> > Cells;//!< Vector of cells for Laplace
     typedef typename Cells::iterator C_iter;                    //!< Iterator of cell vector
 
-    static void P2P(C_iter Ci, C_iter Cj, bool mutual) {
+    static void P2P(C_iter Ci, C_iter Cj, const vec3 & Xperiodic, bool mutual) {
       B_iter Bi = Ci->BODY;
       B_iter Bj = Cj->BODY;
       int ni = Ci->NBODY;
@@ -116,6 +117,127 @@ namespace exafmm {
       }
     }
 
+    //! Batched P2P of a target cell with numCells source cells shifted by periodic offsets Xj
+    /*!
+      Source bodies of the whole batch are gathered into a contiguous SoA tile, so that
+      each vector of targets sweeps over all of them at once. The last partial vector of
+      targets is padded with massless copies instead of falling back to a scalar loop.
+    */
+    static void P2P(C_iter Ci, const C_iter * Cj, const vec3 * Xj, int numCells) {
+      const int tileSize = 512;                                 // Number of source bodies in one tile
+      real_t xj[tileSize], yj[tileSize], zj[tileSize], mj[tileSize];// SoA tile of source bodies
+      int c = 0, j = 0;                                         // Source cell and body in cell to gather next
+      while (c < numCells) {                                    // While there are bodies left to gather
+	int nj = 0;                                             //  Number of bodies in tile
+	for ( ; c<numCells && nj<tileSize; c++, j=0) {          //  Loop over source cells
+	  B_iter Bj = Cj[c]->BODY;                              //   First body of source cell
+	  for ( ; j<Cj[c]->NBODY && nj<tileSize; j++, nj++) {   //   Loop over bodies of source cell
+	    xj[nj] = Bj[j].X[0] + Xj[c][0];                     //    Shifted x coordinate
+	    yj[nj] = Bj[j].X[1] + Xj[c][1];                     //    Shifted y coordinate
+	    zj[nj] = Bj[j].X[2] + Xj[c][2];                     //    Shifted z coordinate
+	    mj[nj] = Bj[j].SRC;                                 //    Source value
+	  }                                                     //   End loop over bodies of source cell
+	  if (j < Cj[c]->NBODY) break;                          //   Tile is full, resume at this body
+	}                                                       //  End loop over source cells
+	P2P(Ci, xj, yj, zj, mj, nj);                            //  Sweep targets over tile
+      }                                                         // End while for bodies left
+    }
+
+    //! P2P of a target cell with one SoA tile of nj source bodies
+    static void P2P(C_iter Ci, const real_t * xj, const real_t * yj, const real_t * zj, const real_t * mj, int nj) {
+      B_iter Bi = Ci->BODY;
+      int ni = Ci->NBODY;
+      int i = 0;
+#if EXAFMM_USE_SIMD
+      Source<Laplace> pad[NSIMD];
+      for ( ; i<ni; i+=NSIMD) {
+	simdvec zero = 0.0;
+	ksimdvec pot = zero;
+	ksimdvec ax = zero;
+	ksimdvec ay = zero;
+	ksimdvec az = zero;
+
+	simdvec xi, yi, zi, mi;
+	int nk = std::min(NSIMD, ni-i);
+	if (nk == NSIMD) {
+	  xi = SIMD<simdvec,B_iter,0,NSIMD>::setBody(Bi,i);
+	  yi = SIMD<simdvec,B_iter,1,NSIMD>::setBody(Bi,i);
+	  zi = SIMD<simdvec,B_iter,2,NSIMD>::setBody(Bi,i);
+	  mi = SIMD<simdvec,B_iter,3,NSIMD>::setBody(Bi,i);
+	} else {
+	  for (int k=0; k<NSIMD; k++) {
+	    pad[k].X = Bi[i+std::min(k,nk-1)].X;
+	    pad[k].SRC = k < nk ? Bi[i+k].SRC : 0;
+	  }
+	  xi = SIMD<simdvec,Source<Laplace>*,0,NSIMD>::setBody(pad,0);
+	  yi = SIMD<simdvec,Source<Laplace>*,1,NSIMD>::setBody(pad,0);
+	  zi = SIMD<simdvec,Source<Laplace>*,2,NSIMD>::setBody(pad,0);
+	  mi = SIMD<simdvec,Source<Laplace>*,3,NSIMD>::setBody(pad,0);
+	}
+
+	for (int j=0; j<nj; j++) {
+	  simdvec dx = xj[j];
+	  dx -= xi;
+	  simdvec dy = yj[j];
+	  dy -= yi;
+	  simdvec dz = zj[j];
+	  dz -= zi;
+	  simdvec m = mj[j];
+
+	  simdvec R2 = eps2;
+	  R2 += dx * dx;
+	  R2 += dy * dy;
+	  R2 += dz * dz;
+	  simdvec invR = rsqrt(R2);
+	  invR &= R2 > zero;
+
+	  m *= invR * mi;
+	  pot += m;
+	  invR = invR * invR * m;
+
+	  dx *= invR;
+	  ax += dx;
+	  dy *= invR;
+	  ay += dy;
+	  dz *= invR;
+	  az += dz;
+	}
+	for (int k=0; k<nk; k++) {
+	  Bi[i+k].TRG[0] += transpose(pot, k);
+	  Bi[i+k].TRG[1] += transpose(ax, k);
+	  Bi[i+k].TRG[2] += transpose(ay, k);
+	  Bi[i+k].TRG[3] += transpose(az, k);
+	}
+      }
+#endif
+      for ( ; i<ni; i++) {
+	kreal_t pot = 0;
+	kreal_t ax = 0;
+	kreal_t ay = 0;
+	kreal_t az = 0;
+	for (int j=0; j<nj; j++) {
+	  vec3 dX;
+	  dX[0] = Bi[i].X[0] - xj[j];
+	  dX[1] = Bi[i].X[1] - yj[j];
+	  dX[2] = Bi[i].X[2] - zj[j];
+	  real_t R2 = norm(dX) + eps2;
+	  if (R2 != 0) {
+	    real_t invR2 = 1.0 / R2;
+	    real_t invR = Bi[i].SRC * mj[j] * sqrt(invR2);
+	    dX *= invR2 * invR;
+	    pot += invR;
+	    ax += dX[0];
+	    ay += dX[1];
+	    az += dX[2];
+	  }
+	}
+	Bi[i].TRG[0] += pot;
+	Bi[i].TRG[1] -= ax;
+	Bi[i].TRG[2] -= ay;
+	Bi[i].TRG[3] -= az;
+      }
+    }
+
     static void P2P(C_iter C) {
       B_iter B = C->BODY;
       int n = C->NBODY;
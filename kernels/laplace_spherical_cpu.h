@@ -1,5 +1,6 @@
 #ifndef laplace_spherical_cpu_h
 #define laplace_spherical_cpu_h
+#include <limits>
 #include "laplace_p2p_cpu.h"
 #include "spherical.h"
 
@@ -11,14 +12,136 @@ namespace exafmm {
     static const int P = _P;                                    //!< Set order of expansion
     static const int NTERM = P*(P+1)/2;                         //!< # of terms in Laplace Spherical expansion
     typedef vec<NTERM,complex_t> vecP;                          //!< Vector type for expansion terms
+    static const bool linear = true;                            //!< M2M and M2L are linear in M
     using typename LaplaceP2PCPU<vecP,Spherical>::Bodies;       //!< Vector of bodies for Laplace
     using typename LaplaceP2PCPU<vecP,Spherical>::B_iter;       //!< Iterator of body vector
     using typename LaplaceP2PCPU<vecP,Spherical>::Cells;        //!< Vector of cells for Laplace
     using typename LaplaceP2PCPU<vecP,Spherical>::C_iter;       //!< Iterator of cell vector
-    using LaplaceP2PCPU<vecP,Spherical>::Xperiodic;
 
-    static void init() {}
-    static void finalize() {}
+  private:
+    static const int maxOffset = 3;                             //!< Maximum lattice offset of precomputed M2L operators
+    static const int numOffsets = 2 * maxOffset + 1;            //!< Number of lattice offsets per dimension
+    static const int matrixSize = P*(P+1)*(P+2)*(P+3)/6;        //!< # of nonzeros in real M2L matrix of one offset
+    static real_t * M2Loperator;                                //!< Real M2L matrices of lattice offsets of unit cells
+
+    //! Get precomputed M2L matrix of dX if Ci and Cj are equal well separated cells on a lattice
+    /*!
+      Between cells of equal size, dX / SCALE is an integer offset in [-3,3]^3 on every
+      level and for every periodic image that is a multiple of the cell size. Offsets of
+      adjacent cells are never well separated and have no matrix.
+    */
+    static const real_t * getM2LOperator(C_iter Ci, C_iter Cj, const vec3 & dX) {
+      if (M2Loperator == NULL || Ci->SCALE <= 0 || Ci->SCALE != Cj->SCALE) return NULL;// Only for cells of equal size
+      const real_t tolerance = 1000 * std::numeric_limits<real_t>::epsilon();// Round-off of cell centers
+      int index = 0;                                            // Index of lattice offset
+      bool adjacent = true;                                     // Flag for adjacent cells
+      for (int d=0; d<3; d++) {                                 // Loop over dimensions
+	real_t x = dX[d] / Ci->SCALE;                           //  Offset in units of cell size
+	int ix = int(std::floor(x + real_t(.5)));               //  Nearest lattice offset
+	if (std::abs(x - ix) > tolerance || std::abs(ix) > maxOffset) return NULL;// Not a lattice offset in range
+	adjacent &= std::abs(ix) <= 1;                          //  Adjacent if all offsets are at most one cell
+	index = index * numOffsets + ix + maxOffset;            //  Index of lattice offset
+      }                                                         // End loop over dimensions
+      if (adjacent) return NULL;                                // No matrix for adjacent cells
+      return M2Loperator + index * matrixSize;                  // M2L matrix of this offset
+    }
+
+    //! Add the product of an M2L matrix of unit cells and the multipoles of Cj to L
+    /*!
+      The multipoles are scaled by SCALE^(-n) to unit cells, and L is left in units of
+      unit cells, so that addLocal() scales it by SCALE^(-j-1) once for a whole batch.
+      Row (j,k) only has the n<P-j columns, which come first, so the rows are packed.
+      The real and imaginary rows of each (j,k) are swept together over the same multipoles.
+    */
+    static void applyM2LOperator(const real_t * T, C_iter Cj, real_t * L) {
+      real_t M[2*NTERM];                                        // Real and imaginary parts of scaled multipoles
+      real_t invScale = 1 / Cj->SCALE;                          // Inverse of cell size
+      real_t scale = 1;                                         // Initialize SCALE^(-n)
+      for (int n=0; n<P; n++) {                                 // Loop over n in Mnm
+	for (int nms=n*(n+1)/2; nms<(n+1)*(n+2)/2; nms++) {     //  Loop over m in Mnm
+	  M[2*nms+0] = std::real(Cj->M[nms]) * scale;           //   Scaled real part
+	  M[2*nms+1] = std::imag(Cj->M[nms]) * scale;           //   Scaled imaginary part
+	}                                                       //  End loop over m in Mnm
+	scale *= invScale;                                      //  Update SCALE^(-n)
+      }                                                         // End loop over n in Mnm
+      for (int j=0, jks=0; j<P; j++) {                          // Loop over j in Ljk
+	int ncol = (P - j) * (P - j + 1);                       //  # of real columns of rows of this j
+	for (int k=0; k<=j; k++, jks++) {                       //  Loop over k in Ljk
+	  real_t Lr = 0, Li = 0;                                //   Real and imaginary parts of Ljk
+	  for (int c=0; c<ncol; c++) {                          //   Loop over columns
+	    Lr += T[c] * M[c];                                  //    Real row
+	    Li += T[ncol+c] * M[c];                             //    Imaginary row
+	  }                                                     //   End loop over columns
+	  L[2*jks+0] += Lr;                                     //   Accumulate real part
+	  L[2*jks+1] += Li;                                     //   Accumulate imaginary part
+	  T += 2 * ncol;                                        //   Next pair of rows
+	}                                                       //  End loop over k in Ljk
+      }                                                         // End loop over j in Ljk
+    }
+
+    //! Scale L of unit cells by SCALE^(-j-1) and add it to the locals of C
+    static void addLocal(C_iter C, const real_t * L) {
+      real_t invScale = 1 / C->SCALE;                           // Inverse of cell size
+      real_t scale = invScale;                                  // Initialize SCALE^(-j-1)
+      for (int j=0; j<P; j++) {                                 // Loop over j in Ljk
+	for (int jks=j*(j+1)/2; jks<(j+1)*(j+2)/2; jks++) {     //  Loop over k in Ljk
+	  C->L[jks] += complex_t(L[2*jks], L[2*jks+1]) * scale; //   Scale and accumulate locals
+	}                                                       //  End loop over k in Ljk
+	scale *= invScale;                                      //  Update SCALE^(-j-1)
+      }                                                         // End loop over j in Ljk
+    }
+
+  public:
+    //! Precompute M2L matrices of all well separated lattice offsets of unit cells
+    /*!
+      M2L is linear in the real and imaginary parts of M, so each offset has a real
+      matrix from (Re M, Im M) to (Re L, Im L). Entry (jk,nm) couples M to the singular
+      harmonic Y_(j+n)^(m-k) and conj(M) to Y_(j+n)^(-m-k), as in the loops of M2L.
+    */
+    static void init() {
+      if (M2Loperator != NULL) return;                          // Already precomputed
+      M2Loperator = new real_t [numOffsets * numOffsets * numOffsets * matrixSize]();// Allocate matrices
+      complex_t Ynm[P*P];                                       // Singular harmonics of offset
+      int index = 0;                                            // Index of lattice offset
+      for (int ix=-maxOffset; ix<=maxOffset; ix++) {            // Loop over x offset
+	for (int iy=-maxOffset; iy<=maxOffset; iy++) {          //  Loop over y offset
+	  for (int iz=-maxOffset; iz<=maxOffset; iz++, index++) {//  Loop over z offset
+	    if (std::abs(ix) <= 1 && std::abs(iy) <= 1 && std::abs(iz) <= 1) continue;// Skip adjacent offsets
+	    vec3 dX;                                            //    Lattice offset
+	    dX[0] = ix;                                         //    x offset
+	    dX[1] = iy;                                         //    y offset
+	    dX[2] = iz;                                         //    z offset
+	    real_t rho, alpha, beta;                            //    Spherical coordinates of offset
+	    cart2sph(dX, rho, alpha, beta);                     //    Get spherical coordinates
+	    evalLocal(P, rho, alpha, beta, Ynm);                //    Singular harmonics of offset
+	    real_t * T = M2Loperator + index * matrixSize;      //    M2L matrix of this offset
+	    for (int j=0; j<P; j++) {                           //    Loop over j in Ljk
+	      real_t Cnm = oddOrEven(j);                        //     Sign of j
+	      int ncol = (P - j) * (P - j + 1);                 //     # of real columns of rows of this j
+	      for (int k=0; k<=j; k++, T+=2*ncol) {             //     Loop over k in Ljk
+		for (int n=0; n<P-j; n++) {                     //      Loop over n in Mnm
+		  for (int m=0; m<=n; m++) {                    //       Loop over m in Mnm
+		    int nms = n * (n + 1) / 2 + m;              //        Index of Mnm
+		    complex_t a = Ynm[(j+n)*(j+n)+j+n+m-k] * real_t(Cnm * oddOrEven((k-m)*(k<m)+m));// Coefficient of M
+		    complex_t b = m == 0 ? complex_t(0) : Ynm[(j+n)*(j+n)+j+n-m-k] * Cnm;// Coefficient of conj(M)
+		    T[2*nms+0] = std::real(a) + std::real(b);   //        Re L from Re M
+		    T[2*nms+1] = std::imag(b) - std::imag(a);   //        Re L from Im M
+		    T[ncol+2*nms+0] = std::imag(a) + std::imag(b);//      Im L from Re M
+		    T[ncol+2*nms+1] = std::real(a) - std::real(b);//      Im L from Im M
+		  }                                             //       End loop over m in Mnm
+		}                                               //      End loop over n in Mnm
+	      }                                                 //     End loop over k in Ljk
+	    }                                                   //    End loop over j in Ljk
+	  }                                                     //   End loop over z offset
+	}                                                       //  End loop over y offset
+      }                                                         // End loop over x offset
+    }
+
+    //! Free precomputed M2L matrices
+    static void finalize() {
+      delete[] M2Loperator;                                     // Deallocate matrices
+      M2Loperator = NULL;                                       // Reset pointer
+    }
 
     static void P2M(C_iter C) {
       complex_t Ynm[P*P], YnmTheta[P*P];
@@ -66,13 +189,32 @@ namespace exafmm {
       }
     }
 
-    static void M2L(C_iter Ci, C_iter Cj, bool mutual) {
+    static void M2L(C_iter Ci, C_iter Cj, const vec3 & Xperiodic, bool mutual) {
       complex_t Ynmi[P*P], Ynmj[P*P];
       vec3 dX = Ci->X - Cj->X - Xperiodic;
+      const real_t * T = getM2LOperator(Ci, Cj, dX);
+      if (T != NULL) {
+	real_t L[2*NTERM];
+	for (int i=0; i<2*NTERM; i++) L[i] = 0;
+	applyM2LOperator(T, Cj, L);
+	addLocal(Ci, L);
+	if (mutual) {
+	  for (int i=0; i<2*NTERM; i++) L[i] = 0;
+	  applyM2LOperator(getM2LOperator(Cj, Ci, -dX), Ci, L);
+	  addLocal(Cj, L);
+	}
+	return;
+      }
       real_t rho, alpha, beta;
       cart2sph(dX, rho, alpha, beta);
       evalLocal(P, rho, alpha, beta, Ynmi);
-      if (mutual) evalLocal(P, rho, alpha+M_PI, beta, Ynmj);
+      if (mutual) {
+	for (int n=0; n<P; n++) {
+	  for (int nm=n*n; nm<(n+1)*(n+1); nm++) {
+	    Ynmj[nm] = Ynmi[nm] * real_t(oddOrEven(n));
+	  }
+	}
+      }
       for (int j=0; j<P; j++) {
 	real_t Cnm = oddOrEven(j);
 	for (int k=0; k<=j; k++) {
@@ -99,6 +241,77 @@ namespace exafmm {
       }
     }
 
+    //! Batched M2L of a target cell with numCells source cells shifted by periodic offsets Xj
+    /*!
+      Sources on lattice offsets accumulate their matrix-vector products in one buffer of
+      unit cells, which is scaled and added to the locals of Ci once. Other sources fall
+      back to M2L of a pair of cells.
+    */
+    static void M2L(C_iter Ci, const C_iter * Cj, const vec3 * Xj, int numCells) {
+      real_t L[2*NTERM];                                        // Locals of unit cells
+      for (int i=0; i<2*NTERM; i++) L[i] = 0;                   // Initialize locals
+      bool found = false;                                       // Flag for any precomputed matrix
+      for (int c=0; c<numCells; c++) {                          // Loop over source cells
+	const real_t * T = getM2LOperator(Ci, Cj[c], Ci->X - Cj[c]->X - Xj[c]);// M2L matrix of offset
+	if (T == NULL) {                                        //  If offset has no matrix
+	  M2L(Ci, Cj[c], Xj[c], false);                         //   M2L kernel for pair of cells
+	} else {                                                //  Else if offset has a matrix
+	  applyM2LOperator(T, Cj[c], L);                        //   Accumulate matrix-vector product
+	  found = true;                                         //   Locals need to be added
+	}                                                       //  End if for matrix of offset
+      }                                                         // End loop over source cells
+      if (found) addLocal(Ci, L);                               // Scale and add locals of batch
+    }
+
+    static void M2P(C_iter Ci, C_iter Cj, const vec3 & Xperiodic) {
+      complex_t Ynm[P*P], YnmTheta[P*P];
+      for (B_iter B=Ci->BODY; B!=Ci->BODY+Ci->NBODY; B++) {
+        vec3 dX = B->X - Cj->X - Xperiodic;
+        vec3 spherical = 0;
+        vec3 cartesian = 0;
+        real_t r, theta, phi;
+        cart2sph(dX, r, theta, phi);
+        evalLocal(P, r, theta, phi, Ynm, YnmTheta);
+        real_t pot = 0;
+        for (int n=0; n<P; n++) {
+          int nm  = n * n + n;
+          int nms = n * (n + 1) / 2;
+          pot += std::real(Cj->M[nms] * Ynm[nm]);
+          spherical[0] -= std::real(Cj->M[nms] * Ynm[nm]) / r * (n + 1);
+          spherical[1] += std::real(Cj->M[nms] * YnmTheta[nm]);
+          for (int m=1; m<=n; m++) {
+            nm  = n * n + n + m;
+            nms = n * (n + 1) / 2 + m;
+            pot += 2 * std::real(Cj->M[nms] * Ynm[nm]);
+            spherical[0] -= 2 * std::real(Cj->M[nms] * Ynm[nm]) / r * (n + 1);
+            spherical[1] += 2 * std::real(Cj->M[nms] * YnmTheta[nm]);
+            spherical[2] += 2 * std::real(Cj->M[nms] * Ynm[nm] * I) * m;
+          }
+        }
+        sph2cart(r, theta, phi, spherical, cartesian);
+        B->TRG[0] += B->SRC * pot;
+        B->TRG[1] += B->SRC * cartesian[0];
+        B->TRG[2] += B->SRC * cartesian[1];
+        B->TRG[3] += B->SRC * cartesian[2];
+      }
+    }
+
+    static void P2L(C_iter Ci, C_iter Cj, const vec3 & Xperiodic) {
+      complex_t Ynm[P*P];
+      for (B_iter B=Cj->BODY; B!=Cj->BODY+Cj->NBODY; B++) {
+        vec3 dX = Ci->X - B->X - Xperiodic;
+        real_t rho, alpha, beta;
+        cart2sph(dX, rho, alpha, beta);
+        evalLocal(P, rho, alpha, beta, Ynm);
+        for (int j=0; j<P; j++) {
+          for (int k=0; k<=j; k++) {
+            int jks = j * (j + 1) / 2 + k;
+            Ci->L[jks] += B->SRC * real_t(oddOrEven(j)) * Ynm[j*j+j-k];
+          }
+        }
+      }
+    }
+
     static void L2L(C_iter Ci, C_iter C0) {
       complex_t Ynm[P*P], YnmTheta[P*P];
       C_iter Cj = C0 + Ci->IPARENT;
@@ -161,5 +374,8 @@ namespace exafmm {
       }
     }
   };
+
+  template<int _P>
+  real_t * LaplaceSphericalCPU<_P>::M2Loperator = NULL;
 }
 #endif
@@ -16,7 +16,6 @@
 using namespace exafmm;
 #include "laplace_cartesian_cpu.h"
 real_t KernelBase::eps2 = 0.0;
-vec3 KernelBase::Xperiodic = 0.0;
 
 int main(int argc, char ** argv) {
   Args args(argc, argv);
@@ -19,7 +19,6 @@ namespace exafmm {
   typedef typename Kernel::B_iter B_iter;                       //!< Iterator of body vector
   typedef typename Kernel::C_iter C_iter;                       //!< Iterator of cell vector
 
-  vec3 KernelBase::Xperiodic = 0;
   real_t KernelBase::eps2 = 0.0;
   static const double Celec = 332.0716;
 
@@ -36,6 +35,8 @@ namespace exafmm {
   bool isTime;
   bool pass;
   Bodies buffer;
+  Cells localCells;
+  std::vector<int> localPermutation;
   Bounds localBounds;
   Bounds globalBounds;
 
@@ -94,6 +95,11 @@ namespace exafmm {
     delete upDownPass;
   }
 
+  //! Partition by weighted splitting of the space filling curve instead of octsection
+  extern "C" void fmm_partition_curve_(int & curve) {
+    args->curve = curve;
+  }
+
   extern "C" void fmm_partition_(int & nglobal, int * icpumap, double * x, double * q,
                                  double * xold, double & cycle) {
     vec3 cycles = cycle;
@@ -122,8 +128,10 @@ namespace exafmm {
     }
     localBounds = boundBox->getBounds(bodies);
     globalBounds = baseMPI->allreduceBounds(localBounds);
-    localBounds = partition->octsection(bodies,globalBounds);
+    if (args->curve) localBounds = partition->curve(bodies,globalBounds);
+    else localBounds = partition->octsection(bodies,globalBounds);
     bodies = treeMPI->commBodies(bodies);
+    localCells.clear();
     for (int i=0; i<nglobal; i++) {
       icpumap[i] = 0;
     }
@@ -176,7 +184,8 @@ namespace exafmm {
         B++;
       }
     }
-    Cells cells = localTree->buildTree(bodies, buffer, localBounds);
+    localTree->updateTree(bodies, buffer, localCells, localPermutation, localBounds);
+    Cells & cells = localCells;
     upDownPass->upwardPass(cells);
     treeMPI->allgatherBounds(localBounds);
     treeMPI->setLET(cells, cycles);
@@ -310,41 +319,22 @@ namespace exafmm {
   extern "C" void direct_coulomb_(int & nglobal, int * icpumap, double * x, double * q, double * p, double * f, double & cycle) {
     vec3 cycles = cycle;
     logger::startTimer("Direct Coulomb");
-    int images = args->images;
-    int prange = 0;
-    for (int i=0; i<images; i++) {
-      prange += int(std::pow(3.,i));
-    }
-    real_t Xperiodic[3];
+    Bodies bodies, jbodies(nglobal);
     for (int i=0; i<nglobal; i++) {
-      if (icpumap[i] == 1) {
-        real_t pp = 0, fx = 0, fy = 0, fz = 0;
-        for (int ix=-prange; ix<=prange; ix++) {
-          for (int iy=-prange; iy<=prange; iy++) {
-            for (int iz=-prange; iz<=prange; iz++) {
-              Xperiodic[0] = ix * cycles[0];
-              Xperiodic[1] = iy * cycles[1];
-              Xperiodic[2] = iz * cycles[2];
-              for (int j=0; j<nglobal; j++) {
-                vec3 dX;
-                for (int d=0; d<3; d++) dX[d] = x[3*i+d] - x[3*j+d] - Xperiodic[d];
-                real_t R2 = norm(dX);
-                real_t invR = 1 / std::sqrt(R2);
-                if (R2 == 0) invR = 0;
-                real_t invR3 = q[j] * invR * invR * invR;
-                pp += q[j] * invR;
-                fx += dX[0] * invR3;
-                fy += dX[1] * invR3;
-                fz += dX[2] * invR3;
-              }
-            }
-          }
-        }
-        p[i] += pp * q[i] * Celec;
-        f[3*i+0] -= fx * q[i] * Celec;
-        f[3*i+1] -= fy * q[i] * Celec;
-        f[3*i+2] -= fz * q[i] * Celec;
-      }
+      for (int d=0; d<3; d++) jbodies[i].X[d] = x[3*i+d];
+      jbodies[i].SRC = q[i] == 0 ? EPS : q[i];
+      jbodies[i].TRG = 0;
+      jbodies[i].IBODY = i;
+      if (icpumap[i] == 1) bodies.push_back(jbodies[i]);
+    }
+    traversal->direct(bodies, jbodies, cycles);
+    traversal->normalize(bodies);
+    for (B_iter B=bodies.begin(); B!=bodies.end(); B++) {
+      int i = B->IBODY;
+      p[i]     += B->TRG[0] * B->SRC * Celec;
+      f[3*i+0] += B->TRG[1] * B->SRC * Celec;
+      f[3*i+1] += B->TRG[2] * B->SRC * Celec;
+      f[3*i+2] += B->TRG[3] * B->SRC * Celec;
     }
     real_t dipole[3] = {0, 0, 0};
     for (int i=0; i<nglobal; i++) {
@@ -21,7 +21,6 @@ namespace exafmm {
   typedef typename Kernel::B_iter B_iter;                       //!< Iterator of body vector
   typedef typename Kernel::C_iter C_iter;                       //!< Iterator of cell vector
 
-  vec3 KernelBase::Xperiodic = 0;
   real_t KernelBase::eps2 = 0.0;
 
   Args * args;
@@ -38,6 +37,8 @@ namespace exafmm {
   bool isTime;
   bool pass;
   Bodies buffer;
+  Cells localCells;
+  std::vector<int> localPermutation;
   Bounds localBounds;
   Bounds globalBounds;
 
@@ -100,6 +101,11 @@ namespace exafmm {
     delete upDownPass;
   }
 
+  //! Partition by weighted splitting of the space filling curve instead of octsection
+  extern "C" void FMM_Partition_Curve(bool curve) {
+    args->curve = curve;
+  }
+
   extern "C" void FMM_Partition(int & n, int * ibody, int * icell, float * x, float * q, float cycle) {
     vec3 cycles = cycle;
     logger::printTitle("Partition Profiling");
@@ -119,8 +125,10 @@ namespace exafmm {
     }
     localBounds = boundBox->getBounds(bodies);
     globalBounds = baseMPI->allreduceBounds(localBounds);
-    localBounds = partition->octsection(bodies,globalBounds);
+    if (args->curve) localBounds = partition->curve(bodies,globalBounds);
+    else localBounds = partition->octsection(bodies,globalBounds);
     bodies = treeMPI->commBodies(bodies);
+    localCells.clear();
 #if EXAFMM_CLUSTER
     Bodies clusters = clusterTree->setClusterCenter(bodies, cycles);
     Cells cells = globalTree->buildTree(clusters, buffer, localBounds);
@@ -176,7 +184,8 @@ namespace exafmm {
     Cells cells = globalTree->buildTree(clusters, buffer, localBounds);
     clusterTree->attachClusterBodies(bodies, cells, cycles);
 #else
-    Cells cells = localTree->buildTree(bodies, buffer, localBounds);
+    localTree->updateTree(bodies, buffer, localCells, localPermutation, localBounds);
+    Cells & cells = localCells;
 #endif
     upDownPass->upwardPass(cells);
     treeMPI->allgatherBounds(localBounds);
@@ -276,79 +285,28 @@ namespace exafmm {
     delete ewald;
   }
 
-  void MPI_Shift(float * var, int &nold, int mpisize, int mpirank) {
-    const int isend = (mpirank + 1          ) % mpisize;
-    const int irecv = (mpirank - 1 + mpisize) % mpisize;
-    int nnew;
-    MPI_Request sreq, rreq;
-    MPI_Isend(&nold, 1, MPI_INT, irecv, 0, MPI_COMM_WORLD, &sreq);
-    MPI_Irecv(&nnew, 1, MPI_INT, isend, 0, MPI_COMM_WORLD, &rreq);
-    MPI_Wait(&sreq, MPI_STATUS_IGNORE);
-    MPI_Wait(&rreq, MPI_STATUS_IGNORE);
-    float * buf = new float [nnew];
-    MPI_Isend(var, nold, MPI_FLOAT, irecv, 1, MPI_COMM_WORLD, &sreq);
-    MPI_Irecv(buf, nnew, MPI_FLOAT, isend, 1, MPI_COMM_WORLD, &rreq);
-    MPI_Wait(&sreq, MPI_STATUS_IGNORE);
-    MPI_Wait(&rreq, MPI_STATUS_IGNORE);
-    for (int i=0; i<nnew; i++) {
-      var[i] = buf[i];
-    }
-    nold = nnew;
-    delete[] buf;
-  }
-
   extern "C" void Direct_Coulomb(int Ni, float * x, float * q, float * p, float * f, float cycle) {
+    num_threads(args->threads);
     vec3 cycles = cycle;
-    const int Nmax = 1000000;
-    int images = args->images;
-    int prange = 0;
-    for (int i=0; i<images; i++) {
-      prange += int(std::pow(3.,i));
-    }
-    float * x2 = new float [3*Nmax];
-    float * q2 = new float [Nmax];
+    Bodies bodies(Ni), jbodies(Ni);
     for (int i=0; i<Ni; i++) {
-      x2[3*i+0] = x[3*i+0];
-      x2[3*i+1] = x[3*i+1];
-      x2[3*i+2] = x[3*i+2];
-      q2[i] = q[i];
+      for (int d=0; d<3; d++) bodies[i].X[d] = x[3*i+d];
+      bodies[i].SRC = 1;
+      bodies[i].TRG = 0;
+      jbodies[i] = bodies[i];
+      jbodies[i].SRC = q[i];
     }
-    float Xperiodic[3];
-    int Nj = Ni, Nj3 = 3 * Ni;
     if (baseMPI->mpirank == 0) std::cout << "--- MPI direct sum ---------------" << std::endl;
     for (int irank=0; irank<baseMPI->mpisize; irank++) {
       if (baseMPI->mpirank == 0) std::cout << "Direct loop          : " << irank+1 << "/" << baseMPI->mpisize << std::endl;
-      MPI_Shift(x2, Nj3, baseMPI->mpisize, baseMPI->mpirank);
-      MPI_Shift(q2, Nj,  baseMPI->mpisize, baseMPI->mpirank);
-      for (int i=0; i<Ni; i++) {
-        double pp = 0, fx = 0, fy = 0, fz = 0;
-        for (int ix=-prange; ix<=prange; ix++) {
-          for (int iy=-prange; iy<=prange; iy++) {
-            for (int iz=-prange; iz<=prange; iz++) {
-              Xperiodic[0] = ix * cycles[0];
-              Xperiodic[1] = iy * cycles[1];
-              Xperiodic[2] = iz * cycles[2];
-              for (int j=0; j<Nj; j++) {
-                double dx = x[3*i+0] - x2[3*j+0] - Xperiodic[0];
-                double dy = x[3*i+1] - x2[3*j+1] - Xperiodic[1];
-                double dz = x[3*i+2] - x2[3*j+2] - Xperiodic[2];
-                double R2 = dx * dx + dy * dy + dz * dz;
-                double invR = 1 / std::sqrt(R2);
-                if (R2 == 0) invR = 0;
-                double invR3 = q2[j] * invR * invR * invR;
-                pp += q2[j] * invR;
-                fx += dx * invR3;
-                fy += dy * invR3;
-                fz += dz * invR3;
-              }
-            }
-          }
-        }
-        p[i] += pp;
-        f[3*i+0] -= fx;
-        f[3*i+1] -= fy;
-        f[3*i+2] -= fz;
-      }
+      treeMPI->shiftBodies(jbodies);
+      traversal->direct(bodies, jbodies, cycles);
+    }
+    for (int i=0; i<Ni; i++) {
+      p[i]     += bodies[i].TRG[0];
+      f[3*i+0] += bodies[i].TRG[1];
+      f[3*i+1] += bodies[i].TRG[2];
+      f[3*i+2] += bodies[i].TRG[3];
     }
     float localDipole[3] = {0, 0, 0};
     for (int i=0; i<Ni; i++) {
@@ -369,8 +327,6 @@ namespace exafmm {
       f[3*i+1] -= coef * globalDipole[1];
       f[3*i+2] -= coef * globalDipole[2];
     }
-    delete[] x2;
-    delete[] q2;
   }
 
   extern "C" void FMM_Verify_Accuracy(int &t, double potRel, double accRel) {
@@ -18,7 +18,6 @@ namespace exafmm {
   typedef typename Kernel::B_iter B_iter;                       //!< Iterator of body vector
   typedef typename Kernel::C_iter C_iter;                       //!< Iterator of cell vector
 
-  vec3 KernelBase::Xperiodic = 0;
   real_t KernelBase::eps2 = 0.0;
 
   Args * args;
@@ -35,8 +34,17 @@ namespace exafmm {
   bool isTime;
   bool pass;
   Bodies buffer;
+  Cells localCells;
+  std::vector<int> localPermutation;
   Bounds localBounds;
   Bounds globalBounds;
+  real_t skin;
+  Bodies cutoffBodies;
+  Cells cutoffCells;
+  Bounds cutoffBounds;
+  std::vector<vec3> cutoffX0;
+  std::vector<vec3> cutoffShift;
+  std::vector<InteractionList> cutoffLists;
 
   extern "C" void FMM_Init(int images, int threads, double theta, double cutoff, bool verbose, const char * path) {
     const int ncrit = 32;
@@ -81,6 +89,7 @@ namespace exafmm {
 
     pass = true;
     isTime = false;
+    skin = 0;
   }
 
   extern "C" void FMM_Finalize() {
@@ -118,6 +127,7 @@ namespace exafmm {
       B->ICELL = res_index[i];
     }
     localBounds = boundBox->getBounds(bodies);
+    localCells.clear();
     Cells cells = localTree->buildTree(bodies, buffer, localBounds);
     upDownPass->upwardPass(cells);
     int id = 0;
@@ -152,6 +162,11 @@ namespace exafmm {
     }
   }
 
+  //! Partition by weighted splitting of the space filling curve instead of octsection
+  extern "C" void FMM_Partition_Curve(bool curve) {
+    args->curve = curve;
+  }
+
   extern "C" void FMM_Partition(int * ni, int nimax, int * res_index, double * x, double * q, double * v, double * cycle) {
     num_threads(args->threads);
     vec3 cycles;
@@ -175,8 +190,10 @@ namespace exafmm {
     }
     localBounds = boundBox->getBounds(bodies);
     globalBounds = baseMPI->allreduceBounds(localBounds);
-    localBounds = partition->octsection(bodies,globalBounds);
+    if (args->curve) localBounds = partition->curve(bodies,globalBounds);
+    else localBounds = partition->octsection(bodies,globalBounds);
     bodies = treeMPI->commBodies(bodies);
+    localCells.clear();
     Cells cells = localTree->buildTree(bodies, buffer, localBounds);
     upDownPass->upwardPass(cells);
 
@@ -227,7 +244,8 @@ namespace exafmm {
       B->IBODY = i | (iwrap << shift);
       B->ICELL = res_index[i];
     }
-    Cells cells = localTree->buildTree(bodies, buffer, localBounds);
+    localTree->updateTree(bodies, buffer, localCells, localPermutation, localBounds);
+    Cells & cells = localCells;
     upDownPass->upwardPass(cells);
     treeMPI->allgatherBounds(localBounds);
     treeMPI->setLET(cells, cycles);
@@ -264,7 +282,7 @@ namespace exafmm {
     logger::printTitle("Total runtime");
     logger::printTime("Total FMM");
     for (B_iter B=bodies.begin(); B!=bodies.end(); B++) {
-      int i = B - bodies.begin();
+      int i = B->IBODY & mask;
       p[i]     = B->TRG[0];
       f[3*i+0] = B->TRG[1];
       f[3*i+1] = B->TRG[2];
@@ -370,27 +388,6 @@ namespace exafmm {
     delete ewald;
   }
 
-  void MPI_Shift(double * var, int &nold, int mpisize, int mpirank) {
-    const int isend = (mpirank + 1          ) % mpisize;
-    const int irecv = (mpirank - 1 + mpisize) % mpisize;
-    int nnew;
-    MPI_Request sreq, rreq;
-    MPI_Isend(&nold, 1, MPI_INT, irecv, 0, MPI_COMM_WORLD, &sreq);
-    MPI_Irecv(&nnew, 1, MPI_INT, isend, 0, MPI_COMM_WORLD, &rreq);
-    MPI_Wait(&sreq, MPI_STATUS_IGNORE);
-    MPI_Wait(&rreq, MPI_STATUS_IGNORE);
-    double * buf = new double [nnew];
-    MPI_Isend(var, nold, MPI_DOUBLE, irecv, 1, MPI_COMM_WORLD, &sreq);
-    MPI_Irecv(buf, nnew, MPI_DOUBLE, isend, 1, MPI_COMM_WORLD, &rreq);
-    MPI_Wait(&sreq, MPI_STATUS_IGNORE);
-    MPI_Wait(&rreq, MPI_STATUS_IGNORE);
-    for (int i=0; i<nnew; i++) {
-      var[i] = buf[i];
-    }
-    nold = nnew;
-    delete[] buf;
-  }
-
   extern "C" void Dipole_Correction(int ni, double * x, double * q, double * p, double * f, double * cycle) {
     vec3 cycles;
     for (int d=0; d<3; d++) cycles[d] = cycle[d];
@@ -415,61 +412,77 @@ namespace exafmm {
     }
   }
 
+  //! Set skin of the Verlet lists of FMM_Cutoff, 0 to traverse the tree in every call
+  extern "C" void FMM_Cutoff_Skin(double _skin) {
+    skin = _skin;
+    cutoffX0.clear();
+  }
+
   extern "C" void FMM_Cutoff(int ni, double * x, double * q, double * p, double * f, double cutoff, double * cycle) {
+    num_threads(args->threads);
     vec3 cycles;
     for (int d=0; d<3; d++) cycles[d] = cycle[d];
-    const int Nmax = 1000000;
-    const double cutoff2 = cutoff * cutoff;
-    int prange = int(cutoff/min(cycles)*0.999999) + 1;
-    double * x2 = new double [3*Nmax];
-    double * q2 = new double [Nmax];
-    for (int i=0; i<ni; i++) {
-      x2[3*i+0] = x[3*i+0];
-      x2[3*i+1] = x[3*i+1];
-      x2[3*i+2] = x[3*i+2];
-      q2[i] = q[i];
+    int rebuild = skin == 0 || int(cutoffX0.size()) != ni;
+    for (int i=0; i<ni && !rebuild; i++) {
+      vec3 dX;
+      for (int d=0; d<3; d++) dX[d] = x[3*i+d] - cutoffX0[i][d];
+      rebuild |= 4 * norm(dX) >= skin * skin;
     }
-    float Xperiodic[3];
-    int nj = ni, nj3 = 3 * ni;
-    if (baseMPI->mpirank == 0) std::cout << "--- MPI direct sum ---------------" << std::endl;
-    for (int irank=0; irank<baseMPI->mpisize; irank++) {
-      if (baseMPI->mpirank == 0) std::cout << "Direct loop          : " << irank+1 << "/" << baseMPI->mpisize << std::endl;
-      MPI_Shift(x2, nj3, baseMPI->mpisize, baseMPI->mpirank);
-      MPI_Shift(q2, nj,  baseMPI->mpisize, baseMPI->mpirank);
+    if (baseMPI->allreduceInt(rebuild) != 0) {
+      cutoffBodies.resize(ni);
+      cutoffX0.resize(ni);
+      cutoffShift.resize(ni);
       for (int i=0; i<ni; i++) {
-        double pp = 0, fx = 0, fy = 0, fz = 0;
-        for (int ix=-prange; ix<=prange; ix++) {
-          for (int iy=-prange; iy<=prange; iy++) {
-            for (int iz=-prange; iz<=prange; iz++) {
-              Xperiodic[0] = ix * cycles[0];
-              Xperiodic[1] = iy * cycles[1];
-              Xperiodic[2] = iz * cycles[2];
-              for (int j=0; j<nj; j++) {
-                double dx = x[3*i+0] - x2[3*j+0] - Xperiodic[0];
-                double dy = x[3*i+1] - x2[3*j+1] - Xperiodic[1];
-                double dz = x[3*i+2] - x2[3*j+2] - Xperiodic[2];
-                double R2 = dx * dx + dy * dy + dz * dz;
-                if (R2 < cutoff2) {
-                  double invR = 1 / std::sqrt(R2);
-                  if (R2 == 0) invR = 0;
-                  double invR3 = q2[j] * invR * invR * invR;
-                  pp += q2[j] * invR;
-                  fx += dx * invR3;
-                  fy += dy * invR3;
-                  fz += dz * invR3;
-                }
-              }
-            }
-          }
-        }
-        p[i] += pp;
-        f[3*i+0] -= fx;
-        f[3*i+1] -= fy;
-        f[3*i+2] -= fz;
+        B_iter B = cutoffBodies.begin() + i;
+        for (int d=0; d<3; d++) B->X[d] = x[3*i+d];
+        cutoffX0[i] = B->X;
+        if (args->images != 0) wrap(B->X, cycles);
+        cutoffShift[i] = B->X - cutoffX0[i];
+        B->IBODY = i;
+      }
+      cutoffBounds = boundBox->getBounds(cutoffBodies);
+      cutoffCells = localTree->buildTree(cutoffBodies, buffer, cutoffBounds);
+      cutoffLists.assign(baseMPI->mpisize, InteractionList());
+    } else {
+      for (B_iter B=cutoffBodies.begin(); B!=cutoffBodies.end(); B++) {
+        int i = B->IBODY;
+        for (int d=0; d<3; d++) B->X[d] = x[3*i+d] + cutoffShift[i][d];
       }
     }
-    delete[] x2;
-    delete[] q2;
+    Bodies bodies = cutoffBodies;
+    for (B_iter B=cutoffBodies.begin(); B!=cutoffBodies.end(); B++) {
+      B->SRC = q[B->IBODY];
+    }
+    for (B_iter B=bodies.begin(); B!=bodies.end(); B++) {
+      B->SRC = 1;
+      B->TRG = 0;
+    }
+    Cells cells = cutoffCells;
+    for (C_iter C=cells.begin(); C!=cells.end(); C++) {
+      C->BODY = bodies.begin() + (C->BODY - cutoffBodies.begin());
+    }
+    treeMPI->allgatherBounds(cutoffBounds);
+    treeMPI->setLET(cutoffCells, cycles, cutoff + skin);
+    treeMPI->startLET();
+    traversal->setProgress(treeMPI);
+    Cells jcells;
+    int irank = baseMPI->mpirank;
+    do {
+      Cells & sources = irank == baseMPI->mpirank ? cutoffCells : jcells;
+      if (skin > 0) {
+        traversal->traverseCutoff(cells, sources, cycles, cutoff, skin, cutoffLists[irank]);
+      } else {
+        traversal->traverseCutoff(cells, sources, cycles, cutoff);
+      }
+    } while ((irank = treeMPI->waitLET(jcells)) >= 0);
+    traversal->setProgress(NULL);
+    for (B_iter B=bodies.begin(); B!=bodies.end(); B++) {
+      int i = B->IBODY;
+      p[i]     += B->TRG[0];
+      f[3*i+0] += B->TRG[1];
+      f[3*i+1] += B->TRG[2];
+      f[3*i+2] += B->TRG[3];
+    }
   }
 
   extern "C" void FMM_Verify_Accuracy(int &t, double potRel, double accRel) {
@@ -26,7 +26,6 @@ namespace exafmm {
   typedef typename Kernel::B_iter B_iter;                       //!< Iterator of body vector
   typedef typename Kernel::C_iter C_iter;                       //!< Iterator of cell vector
 
-  vec3 KernelBase::Xperiodic = 0;
   real_t KernelBase::eps2 = 0.0;
   complex_t KernelBase::wavek = complex_t(0.,0.);
 
@@ -37,6 +36,10 @@ namespace exafmm {
   Bodies vbodies;
   Cells bcells;
   Cells vcells;
+  InteractionList listB2B;
+  InteractionList listV2B;
+  InteractionList listB2V;
+  InteractionList listV2V;
 
   bool isTime;
   bool pass;
@@ -50,6 +53,15 @@ namespace exafmm {
   UpDownPass<Kernel> * upDownPass;
   Verify<Kernel> * verify;
 
+  //! Local traversal reusing the interaction list of icells and jcells until the trees are rebuilt
+  void traverseLocal(Cells & icells, Cells & jcells, InteractionList & list) {
+    if (args->mutual) {
+      traversal->traverse(icells, jcells, cycles, args->dual, args->mutual);
+    } else {
+      traversal->traverse(icells, jcells, cycles, args->dual, list);
+    }
+  }
+
   void log_initialize() {
     args->verbose &= baseMPI->mpirank == 0;
     verify->verbose = args->verbose;
@@ -149,6 +161,11 @@ namespace exafmm {
     delete upDownPass;
   }
 
+  //! Partition by weighted splitting of the space filling curve instead of bisection
+  extern "C" void FMM_Partition_Curve(bool curve) {
+    args->curve = curve;
+  }
+
   extern "C" void FMM_Partition(int & nb, double * xb, double * yb, double * zb, double * vb,
                                 int & nv, double * xv, double * yv, double * zv, double * vv) {
     logger::printTitle("Partition Profiling");
@@ -156,9 +173,11 @@ namespace exafmm {
     localBounds = boundBox->getBounds(vbodies, localBounds);
     globalBounds = baseMPI->allreduceBounds(localBounds);
     cycles = globalBounds.Xmax - globalBounds.Xmin;
-    partition->bisection(bbodies, globalBounds);
+    if (args->curve) partition->curve(bbodies, globalBounds);
+    else partition->bisection(bbodies, globalBounds);
     bbodies = treeMPI->commBodies(bbodies);
-    partition->bisection(vbodies, globalBounds);
+    if (args->curve) partition->curve(vbodies, globalBounds);
+    else partition->bisection(vbodies, globalBounds);
     vbodies = treeMPI->commBodies(vbodies);
     treeMPI->allgatherBounds(localBounds);
 
@@ -195,6 +214,10 @@ namespace exafmm {
     bcells = localTree->buildTree(bbodies, buffer, localBoundsB);
     Bounds localBoundsV = boundBox->getBounds(vbodies);
     vcells = localTree->buildTree(vbodies, buffer, localBoundsV);
+    listB2B.clear();
+    listV2B.clear();
+    listB2V.clear();
+    listV2V.clear();
   }
 
   extern "C" void FMM_B2B(double * vi, double * vb, bool verbose) {
@@ -212,7 +235,7 @@ namespace exafmm {
     treeMPI->commCells();
     traversal->initListCount(bcells);
     traversal->initWeight(bcells);
-    traversal->traverse(bcells, jcells, cycles, args->dual, args->mutual);
+    traverseLocal(bcells, jcells, listB2B);
     if (baseMPI->mpisize > 1) {
       if (args->graft) {
         treeMPI->linkLET();
@@ -257,7 +280,7 @@ namespace exafmm {
     treeMPI->commCells();
     traversal->initListCount(bcells);
     traversal->initWeight(bcells);
-    traversal->traverse(bcells, vcells, cycles, args->dual, args->mutual);
+    traverseLocal(bcells, vcells, listV2B);
     if (baseMPI->mpisize > 1) {
       if (args->graft) {
         treeMPI->linkLET();
@@ -303,7 +326,7 @@ namespace exafmm {
     treeMPI->commCells();
     traversal->initListCount(vcells);
     traversal->initWeight(vcells);
-    traversal->traverse(vcells, bcells, cycles, args->dual, args->mutual);
+    traverseLocal(vcells, bcells, listB2V);
     if (baseMPI->mpisize > 1) {
       if (args->graft) {
         treeMPI->linkLET();
@@ -345,7 +368,7 @@ namespace exafmm {
     treeMPI->commCells();
     traversal->initListCount(vcells);
     traversal->initWeight(vcells);
-    traversal->traverse(vcells, jcells, cycles, args->dual, args->mutual);
+    traverseLocal(vcells, jcells, listV2V);
     if (baseMPI->mpisize > 1) {
       if (args->graft) {
         treeMPI->linkLET();
@@ -360,6 +360,59 @@ contains
     grmse = sqrt(accNrmGlob2/3.0/nglobal)
   end subroutine verify
 
+  subroutine coulomb_direct_check(pcycle,mpirank,mpisize)
+    use mpi
+    implicit none
+    integer nglobal,i,ista,iend,mpirank,mpisize,ierr
+    real(8) pcycle,average,pl2err,fl2err,enerf,enere,grmsf,grmse
+    integer,allocatable,dimension(:) :: icpumap
+    real(8),allocatable,dimension(:) :: x,q,xold,p,p2,f,f2
+    nglobal = 100
+    allocate( x(3*nglobal),q(nglobal),xold(3*nglobal),icpumap(nglobal) )
+    allocate( p(nglobal),p2(nglobal),f(3*nglobal),f2(3*nglobal) )
+    call random_number(x)
+    call random_number(q)
+    call mpi_bcast(x,3*nglobal,mpi_real8,0,mpi_comm_world,ierr)
+    call mpi_bcast(q,nglobal,mpi_real8,0,mpi_comm_world,ierr)
+    average = sum(q) / nglobal
+    do i = 1,nglobal
+       x(3*i-2) = x(3*i-2) * pcycle - pcycle / 2
+       x(3*i-1) = x(3*i-1) * pcycle - pcycle / 2
+       x(3*i-0) = x(3*i-0) * pcycle - pcycle / 2
+       q(i) = 2 * (q(i) - average)
+       icpumap(i) = 0
+    enddo
+    xold(1:3*nglobal) = x(1:3*nglobal)
+    ista = 1
+    iend = nglobal
+    call split_range(ista,iend,mpirank,mpisize)
+    do i = ista,iend
+       icpumap(i) = 1
+    enddo
+    call fmm_partition(nglobal,icpumap,x,q,xold,pcycle)
+    p(1:nglobal) = 0
+    p2(1:nglobal) = 0
+    f(1:3*nglobal) = 0
+    f2(1:3*nglobal) = 0
+    call fmm_coulomb(nglobal,icpumap,x,q,p,f,pcycle)
+    call direct_coulomb(nglobal,icpumap,x,q,p2,f2,pcycle)
+    call verify(nglobal,icpumap,p,p2,f,f2,pl2err,fl2err,enerf,enere,grmsf,grmse)
+    if (mpirank == 0) then
+       print "(a)",'--- Coulomb FMM vs. Direct ------'
+       print "(a,f9.6)",'Rel. L2 Error (pot)  : ',pl2err
+       print "(a,f9.6)",'Rel. L2 Error (acc)  : ',fl2err
+       print "(a,f15.4)",'Energy (FMM)         : ',enerf
+       print "(a,f15.4)",'Energy (Direct)      : ',enere
+       print "(a,f15.4)",'GRMS (FMM)           : ',grmsf
+       print "(a,f15.4)",'GRMS (Direct)        : ',grmse
+       if (.not. (pl2err < 1e-3 .and. fl2err < 1e-3)) then
+          print "(a)",'Coulomb FMM and direct summation do not match'
+          call mpi_abort(mpi_comm_world,1,ierr)
+       endif
+    endif
+    deallocate( x,q,xold,icpumap,p,p2,f,f2 )
+  end subroutine coulomb_direct_check
+
   subroutine energy(nglobal,nat,nbonds,ntheta,ksize,&
        alpha,sigma,cutoff,cuton,pcycle,xold,&
        x,p,p2,f,f2,q,gscale,fgscale,rscale,rbond,cbond,aangle,cangle,&
@@ -955,6 +1008,8 @@ program main
           rbond,cbond,aangle,cangle,mass,xc,v,time)
   endif
 
+  call coulomb_direct_check(pcycle,mpirank,mpisize)
+
   deallocate( x,q,v,p,f,p2,f2,icpumap )
   deallocate( ires,numex,natex,rscale,gscale,fgscale,atype )
 